@@ -1,8 +1,12 @@
 #define BLYNK_PRINT   Serial          // must be before #include <BlynkSimpleEsp8266.h>
 
+#define NO_GLOBAL_BLYNK               // Blynk runs on CAsyncClient, see below
+
 #include <ESP8266WiFi.h>
 #include <BlynkSimpleEsp8266.h>
 #include "CTank.h"
+#include "CTelemetry.h"
+#include "CAsyncClient.h"
 
 // default colors
 #define BLYNK_GREEN     "#23C48E"
@@ -13,13 +17,26 @@
 #define BLYNK_GRAY      "#606060"
 
 
-// Blynk server connection timeout
-#define BLYNK_TIMEOUT           5000 // milliseconds
-
 // When the tank is powered, it shot a codes and try to read it. If it happen, 
 // the hotsopt is forced to load. Useful if you need to enter in hotspot mode.
 // To do it, place the turret cannon in front of a wall (the hand works just fine)
 #define HOTSPOT_REQUEST_TIMEOUT 3000 // milliseconds
+// the check runs while the WiFi associates: it ends after this window once the WiFi is connected
+#define HOTSPOT_REQUEST_MIN     500  // milliseconds
+
+// serial console commands (115200 baud)
+#define SERIAL_CMD_IR_STATS     'i'  // print the IR counters and the interrupt timing histograms
+#define SERIAL_CMD_IR_RESET     'r'  // reset them (e.g. before a test under WiFi load)
+#define SERIAL_CMD_TIMER_STATS  't'  // print the timer wheel deadline statistics
+#define SERIAL_CMD_MATCH_DUMP   'm'  // dump the match record (see TankSim/MatchReplay)
+#define SERIAL_CMD_TELEMETRY    'b'  // print the Blynk messages sent and suppressed per second (then reset the counters)
+#define SERIAL_CMD_CONTROL      'c'  // print the control loop inputs, stale inputs and latency (then reset the counters)
+#define SERIAL_CMD_MP3          'p'  // print the MP3 command queue and the DFPlayer feedback counters (then reset them)
+#define SERIAL_CMD_BATTERY      'v'  // print the battery voltage, charge, remaining runtime and low battery counters
+#define SERIAL_CMD_STORAGE      'f'  // print the file system mount time and the config writes (journal, compactions)
+#define SERIAL_CMD_STATS        's'  // dump the persistent tank statistics: shots, hits taken, hit-by matrix, uptime (CSV)
+#define SERIAL_CMD_BOOT         'u'  // print the boot stages timing and the time to drive
+#define SERIAL_CMD_NETWORK      'n'  // print the connection state, failures and time to reconnect by type, RSSI
 
 #define VIRTUAL_VOLTAGE  V0           // voltage virtual pin. This value is written by the tank to the app
                                       //    Range: [0..4200]
@@ -57,15 +74,32 @@
 #define VIRTUAL_SAVE_SLIDER   V13    // save method
 
 
-// Battery voltage threshold. If the battery voltage is below this threshold, all the functionalities are disabled
-// (motors, shoot, etc).
-#define BATTERY_VOLTAGE_THRESHOLD 3500  // mA
+// Low battery: all the functionalities are disabled (motors, shoot, etc). The threshold and its
+// hysteresis are in CBatteryMonitor.h (BATTERY_LOW_THRESHOLD, BATTERY_LOW_HYSTERESIS)
 
+// telemetry: the filtered voltage is checked every 100 ms but sent at most once per second, only if changed
+// by more than the deadband. Hit points are sent at the next flush (50 ms), ammos at most 5 times per second
+#define VOLTAGE_SAMPLE_PERIOD    100  // milliseconds
+#define VOLTAGE_SEND_INTERVAL    1000 // milliseconds
+#define VOLTAGE_DEADBAND         20   // mV
+#define AMMO_SEND_INTERVAL       200  // milliseconds
+
+// telemetry callbacks ------------------------------------------------------------------------------------------------
+void telemetrySendValue(uint8_t pin, int32_t value) {
+	Blynk.virtualWrite(pin, value);
+}
+
+void telemetrySendProperty(uint8_t pin, const char *property, const char *value) {
+	Blynk.setProperty(pin, property, value);
+}
 
 // global varibles ----------------------------------------------------------------------------------------------------
 WidgetTerminal terminal(VIRTUAL_TERMINAL); // for the terminal log
-BlynkTimer voltageTimer;
-Ticker needRepairTimer;
+CTelemetry telemetry(telemetrySendValue, telemetrySendProperty);
+CWheelTimer telemetryTimer;
+int8_t voltageChannel, voltageColorChannel, hitpointChannel, ammoChannel, repairColorChannel;
+CWheelTimer voltageTimer;    // on the tank timer wheel
+CWheelTimer needRepairTimer;
 bool couldMove;
 bool couldRepair;
 
@@ -83,19 +117,83 @@ uint16_t fxID_Start;
 uint16_t fxID_Damage;
 uint16_t fxID_Burn;
 
+// connectivity callbacks (see CConnectivity) ------------------------------------------------------------------------
+// The TCP connection to the server is made by blynkClient without blocking (Blynk's own connect()
+// would wait up to 5 s), then CConnectivity starts the login and waits for its answer. The WiFi, TCP
+// and login timeouts and the retry backoff are in CConnectivity.h
+CAsyncClient       blynkClient;
+BlynkArduinoClient blynkTransport(blynkClient);
+BlynkWifi          Blynk(blynkTransport);
+
+// Blynk keeps the pointers for the reconnections: global strings
+char blynkServer[41];
+char blynkToken[41];
+
+void serverConnect(void) {
+	strcpy(blynkServer, myTank.getBlynkServer().c_str());
+	strcpy(blynkToken, myTank.getBlynkToken().c_str());
+	if (myTank.isBlynkKnownByIP()) {
+		Serial.printf("Connecting using IP: %s\n", myTank.getBlynkIP().toString().c_str());
+		Blynk.config(blynkToken, myTank.getBlynkIP(), myTank.getBlynkPort());
+		blynkClient.begin(myTank.getBlynkIP(), myTank.getBlynkPort());
+	}
+	else {
+		Serial.printf("Connecting using server: %s\n", blynkServer);
+		Blynk.config(blynkToken, blynkServer, myTank.getBlynkPort());
+		blynkClient.begin(blynkServer, myTank.getBlynkPort());
+	}
+}
+
+bool serverConnected(void) {
+	return(Blynk.connected());
+}
+
+void serverDisconnect(void) {
+	Blynk.disconnect();
+	blynkClient.cancel();
+}
+
+// once taken over by Blynk (IDLE) the connection is the one of the WiFiClient: closed by a login rejected
+uint8_t serverLink(void) {
+	switch (blynkClient.getState()) {
+	case ASYNC_CLIENT_CONNECTING:
+		return(CONN_LINK_PENDING);
+	case ASYNC_CLIENT_READY:
+		return(CONN_LINK_UP);
+	case ASYNC_CLIENT_IDLE:
+		return(blynkClient.connected() ? CONN_LINK_UP : CONN_LINK_DOWN);
+	}
+	return(CONN_LINK_DOWN);
+}
+
+// called once, TCP ready. Blynk.connect(0) only resets its transport (nothing taken over yet) and
+// moves Blynk to CONNECTING without waiting: the next Blynk.run() takes the connection over and
+// sends the login. Blynk.run() is never called before, so its 5 s gate between two logins is only
+// armed by a login (CConnectivity keeps its retries farther apart, CONN_LOGIN_INTERVAL)
+void serverLogin(void) {
+	Blynk.connect(0);
+}
+
+void serverRun(void) {
+	Blynk.run();
+}
+
 // timer handlers -----------------------------------------------------------------------------------------------------
 void voltageTimerEvent(void){
 	uint16_t voltage = myTank.getBatteryVoltage();
-	Blynk.virtualWrite(VIRTUAL_VOLTAGE, voltage);
-	if (voltage < BATTERY_VOLTAGE_THRESHOLD) {
+	telemetry.set(voltageChannel, voltage);
+	if (myTank.isBatteryLow()) {
+		// logged once, when the battery goes low
+		if (couldMove) {
+			terminal.printf("[%07lu] LOW BATTERY %umV!!!\n", millis() / 100, voltage);
+			terminal.flush();
+		}
 		couldMove = false;
-		Blynk.setProperty(VIRTUAL_VOLTAGE, "color", BLYNK_RED);
-		terminal.printf("[%07lu] LOW BATTERY %umV!!!\n", millis() / 100, voltage);
-		terminal.flush();
+		telemetry.set(voltageColorChannel, BLYNK_RED);
 	}
 	else {
 		couldMove = true;
-		Blynk.setProperty(VIRTUAL_VOLTAGE, "color", BLYNK_GREEN);
+		telemetry.set(voltageColorChannel, BLYNK_GREEN);
 	}
 }
 
@@ -124,7 +222,17 @@ void soundFXInit(void) {
 
 }
 
-void blynkTankInit(void) {
+// pins updated by the tank while playing
+void telemetryInit(void) {
+	voltageChannel      = telemetry.addValue(VIRTUAL_VOLTAGE, VOLTAGE_SEND_INTERVAL, VOLTAGE_DEADBAND);
+	voltageColorChannel = telemetry.addProperty(VIRTUAL_VOLTAGE, "color");
+	hitpointChannel     = telemetry.addValue(VIRTUAL_HITPOINT);
+	ammoChannel         = telemetry.addValue(VIRTUAL_AMMO, AMMO_SEND_INTERVAL);
+	repairColorChannel  = telemetry.addProperty(VIRTUAL_REPAIR_BTN, "offBackColor");
+}
+
+// app widgets, written at every connection to the server (the tank may have played offline)
+void blynkAppSync(void) {
 	Blynk.virtualWrite(VIRTUAL_TURRET_CENTER, 1500 - myTank.getServoCenter());
 	Blynk.virtualWrite(VIRTUAL_TURRET_LEFT, 2000 - myTank.getServoMax_us());
 	Blynk.virtualWrite(VIRTUAL_TURRET_RIGHT, 1000 - myTank.getServoMin_us());
@@ -132,15 +240,6 @@ void blynkTankInit(void) {
 
 	Blynk.setProperty(VIRTUAL_HITPOINT, "min", 0);
 	Blynk.setProperty(VIRTUAL_HITPOINT, "max", myTank.getMaxHitpoint());
-	Blynk.virtualWrite(VIRTUAL_HITPOINT, 0);
-
-	ammos = myTank.getAmmo();
-	Blynk.virtualWrite(VIRTUAL_AMMO, ammos);
-
-	Blynk.setProperty(VIRTUAL_VOLTAGE, "color", BLYNK_GREEN);
-
-	Blynk.setProperty(VIRTUAL_REPAIR_BTN, "offBackColor", BLYNK_GRAY);
-
 	updateTurretSlider();
 
 	// log terminal initialization
@@ -148,7 +247,23 @@ void blynkTankInit(void) {
 	terminal.printf("Tank ready!\n");
 	terminal.flush();
 
-	voltageTimer.setInterval(100, voltageTimerEvent);
+	// the app may show old values
+	telemetry.invalidate();
+}
+
+void blynkTankInit(void) {
+	telemetry.set(hitpointChannel, 0);
+
+	ammos = myTank.getAmmo();
+	telemetry.set(ammoChannel, ammos);
+
+	telemetry.set(voltageColorChannel, BLYNK_GREEN);
+
+	telemetry.set(repairColorChannel, BLYNK_GRAY);
+	telemetry.flush();
+
+	myTank.getTimerWheel().attach_ms(voltageTimer, VOLTAGE_SAMPLE_PERIOD, voltageTimerEvent);
+	myTank.getTimerWheel().attach_ms(telemetryTimer, TELEMETRY_FLUSH_PERIOD, CTelemetry::flushTimer, &telemetry);
 
 	myTank.shakeTurretAnimation(1);
 	couldMove = true;
@@ -211,7 +326,7 @@ BLYNK_WRITE(VIRTUAL_JOYSTICK) {
 	// read the joystick position
 	int joyX = param[0].asInt();
 	int joyY = param[1].asInt();
-	myTank.moveTank(joyX, joyY);
+	myTank.setJoystick(joyX, joyY); // applied by the control loop (only the newest position)
 }
 
 //turret callback. Called every time the turret values (position) change
@@ -226,7 +341,7 @@ BLYNK_WRITE(VIRTUAL_TURRET) {
 
 	// read the turret slider position
 	int value = param.asInt();
-	myTank.moveTurret_us(value); // move the turret
+	myTank.setTurret_us(value); // move the turret (control loop)
 }
 
 //fire button callback. Called every time the fire button is pressed
@@ -245,7 +360,7 @@ BLYNK_WRITE(VIRTUAL_FIRE_BTN) {
 	// if the button is pressed (value == 1)
 	if (value == 1) {
 		if (myTank.shoot()) {// shoot an ammo
-			Blynk.virtualWrite(VIRTUAL_AMMO, myTank.getAmmo());
+			telemetry.set(ammoChannel, myTank.getAmmo());
 			myTank.playSound(fxID_Shoot);
 			myTank.shootAnimation();
 		}
@@ -261,11 +376,11 @@ BLYNK_WRITE(VIRTUAL_REPAIR_BTN) {
 	int value = param.asInt();
 	if (1 == value) {
 		int currentDamage = myTank.getMaxHitpoint() - myTank.repairTank();
-		Blynk.virtualWrite(VIRTUAL_HITPOINT, currentDamage);
+		telemetry.set(hitpointChannel, currentDamage);
 		if (0 == currentDamage) {
-			Blynk.setProperty(VIRTUAL_REPAIR_BTN, "offBackColor", BLYNK_GRAY);
+			telemetry.set(repairColorChannel, BLYNK_GRAY);
 			couldRepair = 0;
-			needRepairTimer.detach();
+			myTank.getTimerWheel().detach(needRepairTimer);
 			Blynk.virtualWrite(VIRTUAL_TURRET, (myTank.getServoMin_us() + myTank.getServoMax_us()) / 2);
 //			myTank.moveTurret_us((myTank.getServoMin_us() + myTank.getServoMax_us()) / 2);
 			myTank.moveTurret_us(myTank.getServoCenter(), true);
@@ -278,6 +393,7 @@ BLYNK_WRITE(VIRTUAL_REPAIR_BTN) {
 // various system callbacks (not really useful atm)
 BLYNK_CONNECTED() {
 	Serial.printf("Connected to server!\n");
+	blynkAppSync();
 }
 BLYNK_APP_CONNECTED() {
 	Serial.printf("APP Connected\n");
@@ -291,74 +407,109 @@ BLYNK_DISCONNECTED() {
 
 void setup()
 {
-	// Debug console
+	// microsecond timers for the IR pulse distance protocol. Must be the first statement
+	halTimerInit();
+
+	// Debug console. No wait for the serial monitor: the boot timing can be printed later
 	Serial.begin(115200);
-	delay(2000);
 
+	// WiFi and server connections go on in the background, main loop included: the tank plays
+	// offline until the app is connected. The boot timing is printed at the first connection
+	CFastBoot &boot = myTank.getFastBoot();
+	myTank.getConnectivity().setServer(serverConnect, serverLink, serverLogin, serverConnected, serverDisconnect, serverRun);
+	myTank.wifiBegin();
+
+	uint8_t stage = boot.startStage("init");
 	soundFXInit();
+	telemetryInit();
+	boot.endStage(stage);
 	// check if the user force to start the hotsopt by placing the turret in front of a wall
-	if (myTank.checkProximity(HOTSPOT_REQUEST_TIMEOUT)) {
+	stage = boot.startStage("proximity");
+	bool isHotspotRequested = myTank.checkProximity(HOTSPOT_REQUEST_TIMEOUT, HOTSPOT_REQUEST_MIN);
+	boot.endStage(stage);
+	if (isHotspotRequested) {
 		Serial.printf("\nProximity detected. Launching hotspot\n");
 		myTank.playSound(fxID_Error);
 		myTank.startHotspot();
-	}
-
-
-	myTank.wifiConnect();
-
-	while (!Blynk.connected()) {
-		char server[40];
-		char token[40];
-		strcpy(server, myTank.getBlynkServer().c_str());
-		strcpy(token, myTank.getBlynkToken().c_str());
-		if (myTank.isBlynkKnownByIP()) {
-			Serial.printf("Connecting using IP: %s\n", myTank.getBlynkIP().toString().c_str());
-			Blynk.config(token, myTank.getBlynkIP(), myTank.getBlynkPort());
-		}
-		else {
-			Serial.printf("Connecting using server: %s\n", myTank.getBlynkServer().c_str());
-			Blynk.config(token, server, myTank.getBlynkPort());
-		}
-		Blynk.connect(BLYNK_TIMEOUT);
-		if (!Blynk.connected()) {
-			Serial.printf("Unable to connect to %s server. Launching hotspot...\n", myTank.getBlynkServer().c_str());
-			myTank.playSound(fxID_Error);
-			myTank.startHotspot();
-		}
+		myTank.wifiBegin(); // new settings
 	}
 
 	myTank.playSound(fxID_Start);
 	blynkTankInit();
-
 }
 
 void loop()
 {
-	Blynk.run(); // Blynk server synchronization
-	voltageTimer.run();
+	myTank.runNetwork(); // WiFi and Blynk connections, Blynk server synchronization (Blynk.run)
+	myTank.runTimers(); // voltage, repair, ammo and animation timers
 
 //	myTank.printMP3Debug();
 
+	// serial console commands
+	if (Serial.available() > 0) {
+		switch (Serial.read()) {
+		case SERIAL_CMD_IR_STATS:
+			myTank.printIRStats();
+			break;
+		case SERIAL_CMD_IR_RESET:
+			myTank.resetIRStats();
+			break;
+		case SERIAL_CMD_TIMER_STATS:
+			myTank.printTimerStats();
+			break;
+		case SERIAL_CMD_MATCH_DUMP:
+			myTank.dumpMatchRecord();
+			break;
+		case SERIAL_CMD_TELEMETRY:
+			telemetry.printStats();
+			telemetry.resetStats();
+			break;
+		case SERIAL_CMD_CONTROL:
+			myTank.printControlStats();
+			myTank.resetControlStats();
+			break;
+		case SERIAL_CMD_MP3:
+			myTank.printMP3Stats();
+			myTank.resetMP3Stats();
+			break;
+		case SERIAL_CMD_BATTERY:
+			myTank.printBatteryStats();
+			break;
+		case SERIAL_CMD_STORAGE:
+			myTank.printStorageStats();
+			break;
+		case SERIAL_CMD_STATS:
+			myTank.dumpStats();
+			break;
+		case SERIAL_CMD_BOOT:
+			myTank.getFastBoot().print();
+			break;
+		case SERIAL_CMD_NETWORK:
+			myTank.getConnectivity().printStats();
+			break;
+		}
+	}
+
 	// for auto regenerating ammos
 	if (ammos != myTank.getAmmo()) {
 		ammos = myTank.getAmmo();
-		Blynk.virtualWrite(VIRTUAL_AMMO, ammos);
+		telemetry.set(ammoChannel, ammos);
 	}
 
-	// if I have received an IR valid packet...
-	int hitCode = myTank.getHitCode();
-	if (hitCode != -1) {
+	// for every IR valid packet received (more hits can be queued while Blynk is busy)...
+	int hitCode;
+	while ((hitCode = myTank.getHitCode()) != -1) {
 		if (!couldRepair) {  // prevent get hit when repairing...
 			int currentDamage = myTank.getMaxHitpoint() - myTank.gotHit();
-			Blynk.virtualWrite(VIRTUAL_HITPOINT, currentDamage);
+			telemetry.set(hitpointChannel, currentDamage);
 			// print it in the terminal log (with a timing reference) and flush the data
 			terminal.printf("[%07lu] HIT by %02Xh\n", millis() / 100, hitCode);
 			terminal.flush();
 			if (myTank.getMaxHitpoint() == currentDamage) {
 				myTank.moveTank(0, 0);
 				myTank.playSound(fxID_Burn, true);
-				Blynk.setProperty(VIRTUAL_REPAIR_BTN, "offBackColor", BLYNK_GREEN);
-				needRepairTimer.attach_ms(300, needRepairTimerEvent);
+				telemetry.set(repairColorChannel, BLYNK_GREEN);
+				myTank.getTimerWheel().attach_ms(needRepairTimer, 300, needRepairTimerEvent);
 				couldRepair = true;
 				myTank.canRespawnAmmo(false);
 			}
@@ -0,0 +1,92 @@
+#include "CAnimator.h"
+
+CAnimator::CAnimator(CTimerWheel &wheel, apply_t apply, void *owner) : m_wheel(wheel)
+{
+	m_apply = apply;
+	m_owner = owner;
+	for (uint8_t i = 0; i < ANIMATION_TRACKS; i++) {
+		m_tracks[i].animator   = this;
+		m_tracks[i].index      = i;
+		m_tracks[i].count      = 0;
+		m_tracks[i].next       = 0;
+		m_tracks[i].priority   = ANIMATION_PRIORITY_LOW;
+		m_tracks[i].generation = 0;
+		m_tracks[i].isPlaying  = false;
+	}
+}
+
+CAnimator::~CAnimator()
+{
+	for (uint8_t i = 0; i < ANIMATION_TRACKS; i++)
+		m_wheel.detach(m_tracks[i].timer);
+}
+
+bool CAnimator::play(uint8_t track, const AnimationKeyframe_t *frames, uint8_t count, uint8_t priority)
+{
+	if ((track >= ANIMATION_TRACKS) || (0 == count) || (count > ANIMATION_MAX_KEYFRAMES))
+		return(false);
+	track_t &current = m_tracks[track];
+	if (current.isPlaying && (priority < current.priority))
+		return(false);
+
+	m_wheel.detach(current.timer);
+	memcpy(current.frames, frames, count * sizeof(AnimationKeyframe_t));
+	current.count     = count;
+	current.next      = 0;
+	current.priority  = priority;
+	current.isPlaying = true;
+	current.generation++;
+	step(&current);
+	return(true);
+}
+
+void CAnimator::cancel(uint8_t track)
+{
+	if ((track >= ANIMATION_TRACKS) || !m_tracks[track].isPlaying)
+		return;
+	m_wheel.detach(m_tracks[track].timer);
+	end(m_tracks[track], true);
+}
+
+void CAnimator::cancelAll(void)
+{
+	for (uint8_t i = 0; i < ANIMATION_TRACKS; i++)
+		cancel(i);
+}
+
+bool CAnimator::isPlaying(uint8_t track)
+{
+	if (track >= ANIMATION_TRACKS)
+		return(false);
+	return(m_tracks[track].isPlaying);
+}
+
+// apply the keyframes due now, then wait for the next one
+void CAnimator::step(track_t *track)
+{
+	CAnimator *animator = track->animator;
+	for (;;) {
+		if (track->next >= track->count) {
+			animator->end(*track, false);
+			return;
+		}
+		const AnimationKeyframe_t &frame = track->frames[track->next++];
+		uint8_t generation = track->generation;
+		animator->m_apply(animator->m_owner, track->index, frame);
+		// the callback has cancelled or replaced this animation
+		if ((generation != track->generation) || !track->isPlaying)
+			return;
+		if (frame.hold_ms > 0) {
+			animator->m_wheel.once_ms(track->timer, frame.hold_ms, step, track);
+			return;
+		}
+	}
+}
+
+void CAnimator::end(track_t &track, bool cancelled)
+{
+	track.isPlaying = false;
+	track.generation++;
+	AnimationKeyframe_t frame = { ANIMATION_END, (int16_t)(cancelled ? 1 : 0), 0, 0 };
+	m_apply(m_owner, track.index, frame);
+}
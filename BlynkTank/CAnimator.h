@@ -0,0 +1,67 @@
+#pragma once
+#ifndef CANIMATOR_H
+#define CANIMATOR_H
+
+#include "HAL.h"
+#include "CTimerWheel.h"
+
+#define ANIMATION_TRACKS        2  // independent tracks (e.g. turret and motors), played at the same time
+#define ANIMATION_MAX_KEYFRAMES 16 // keyframes of an animation
+
+// a running animation is replaced only by one with the same or a higher priority
+#define ANIMATION_PRIORITY_LOW    0
+#define ANIMATION_PRIORITY_NORMAL 1
+#define ANIMATION_PRIORITY_HIGH   2
+
+// action of the last call of an animation: value1 = 1 if cancelled, 0 if completed
+#define ANIMATION_END 0xFF
+
+// keyframe: the action is applied, then the track waits hold_ms before the next keyframe
+struct AnimationKeyframe_t {
+	uint8_t  action;  // meaning defined by the owner (apply callback)
+	int16_t  value1;
+	int16_t  value2;
+	uint16_t hold_ms;
+};
+
+// Keyframe scheduler. The keyframes are played by the timer wheel, so the main loop is never
+// blocked (Blynk, IR hits and joystick keep running during the animations).
+// The keyframes are applied by the owner callback, ANIMATION_END included
+class CAnimator
+{
+public:
+	typedef void(*apply_t)(void *owner, uint8_t track, const AnimationKeyframe_t &frame);
+
+	CAnimator(CTimerWheel &wheel, apply_t apply, void *owner);
+	~CAnimator();
+
+	// the first keyframe is applied now. Returns false if the track is playing a higher priority
+	// animation. A replaced animation gets no ANIMATION_END
+	bool play(uint8_t track, const AnimationKeyframe_t *frames, uint8_t count, uint8_t priority = ANIMATION_PRIORITY_NORMAL);
+	void cancel(uint8_t track);
+	void cancelAll(void);
+	bool isPlaying(uint8_t track);
+
+private:
+	struct track_t {
+		CAnimator          *animator;
+		uint8_t             index;
+		CWheelTimer         timer;
+		AnimationKeyframe_t frames[ANIMATION_MAX_KEYFRAMES];
+		uint8_t             count;
+		uint8_t             next;
+		uint8_t             priority;
+		uint8_t             generation; // changed by play and cancel: the apply callback may start another animation
+		bool                isPlaying;
+	};
+
+	CTimerWheel &m_wheel;
+	apply_t      m_apply;
+	void        *m_owner;
+	track_t      m_tracks[ANIMATION_TRACKS];
+
+	static void step(track_t *track);
+	void end(track_t &track, bool cancelled);
+};
+
+#endif
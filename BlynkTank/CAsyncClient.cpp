@@ -0,0 +1,164 @@
+#include "CAsyncClient.h"
+
+#ifdef ARDUINO
+
+#include <include/ClientContext.h>
+
+CAsyncClient::CAsyncClient()
+{
+	m_pcb         = NULL;
+	m_port        = 0;
+	m_state       = ASYNC_CLIENT_IDLE;
+	m_isResolving = false;
+}
+
+CAsyncClient::~CAsyncClient()
+{
+	cancel();
+}
+
+void CAsyncClient::begin(const char *host, uint16_t port)
+{
+	IPAddress ip;
+	if (ip.fromString(host)) {
+		begin(ip, port);
+		return;
+	}
+	cancel();
+	m_host  = host;
+	m_port  = port;
+	m_state = ASYNC_CLIENT_CONNECTING;
+	ip_addr_t address;
+	err_t result = dns_gethostbyname(host, &address, dnsFound, this);
+	if (ERR_OK == result)
+		startTCP(IPAddress(&address));
+	else if (ERR_INPROGRESS == result)
+		m_isResolving = true;
+	else
+		m_state = ASYNC_CLIENT_FAILED;
+}
+
+void CAsyncClient::begin(IPAddress ip, uint16_t port)
+{
+	cancel();
+	m_host  = "";
+	m_port  = port;
+	m_state = ASYNC_CLIENT_CONNECTING;
+	startTCP(ip);
+}
+
+// a DNS answer still on its way is ignored (m_isResolving)
+void CAsyncClient::cancel(void)
+{
+	m_isResolving = false;
+	if (NULL != m_pcb) {
+		tcp_arg(m_pcb, NULL);
+		tcp_err(m_pcb, NULL);
+		tcp_recv(m_pcb, NULL);
+		tcp_abort(m_pcb);
+		m_pcb = NULL;
+	}
+	m_state = ASYNC_CLIENT_IDLE;
+}
+
+uint8_t CAsyncClient::getState(void)
+{
+	return(m_state);
+}
+
+// another server: no connection (0), as a failed WiFiClient::connect()
+int CAsyncClient::connect(IPAddress ip, uint16_t port)
+{
+	if ((ip != m_ip) || (port != m_port))
+		return(0);
+	return(takeOver());
+}
+
+int CAsyncClient::connect(const char *host, uint16_t port)
+{
+	IPAddress ip;
+	if (ip.fromString(host))
+		return(connect(ip, port));
+	if ((0 == m_host.length()) || (m_host != host) || (port != m_port))
+		return(0);
+	return(takeOver());
+}
+
+void CAsyncClient::startTCP(const IPAddress &ip)
+{
+	m_ip  = ip;
+	m_pcb = tcp_new();
+	if (NULL == m_pcb) {
+		m_state = ASYNC_CLIENT_FAILED;
+		return;
+	}
+	tcp_arg(m_pcb, this);
+	tcp_err(m_pcb, tcpError);
+	tcp_recv(m_pcb, tcpReceived);
+	if (ERR_OK != tcp_connect(m_pcb, ip, m_port, tcpConnected)) {
+		tcp_abort(m_pcb);
+		m_pcb   = NULL;
+		m_state = ASYNC_CLIENT_FAILED;
+	}
+}
+
+// the ready connection becomes the one of the WiFiClient (ClientContext takes the lwIP callbacks)
+int CAsyncClient::takeOver(void)
+{
+	if (ASYNC_CLIENT_READY != m_state)
+		return(0);
+	ClientContext *context = new ClientContext(m_pcb, NULL, NULL);
+	m_pcb   = NULL;
+	m_state = ASYNC_CLIENT_IDLE;
+	WiFiClient::operator=(WiFiClient(context));
+	return(1);
+}
+
+void CAsyncClient::dnsFound(const char *name, const ip_addr_t *ip, void *arg)
+{
+	CAsyncClient *client = (CAsyncClient *)arg;
+	if (!client->m_isResolving)
+		return;
+	client->m_isResolving = false;
+	if (NULL == ip)
+		client->m_state = ASYNC_CLIENT_FAILED;
+	else
+		client->startTCP(IPAddress(ip));
+}
+
+err_t CAsyncClient::tcpConnected(void *arg, tcp_pcb *pcb, err_t err)
+{
+	CAsyncClient *client = (CAsyncClient *)arg;
+	if (ERR_OK != err) {
+		// the pcb is aborted here: lwIP must be told (ERR_ABRT)
+		client->cancel();
+		client->m_state = ASYNC_CLIENT_FAILED;
+		return(ERR_ABRT);
+	}
+	client->m_state = ASYNC_CLIENT_READY;
+	return(ERR_OK);
+}
+
+// nothing is expected before the login: data is dropped, a close of the server fails the connection
+err_t CAsyncClient::tcpReceived(void *arg, tcp_pcb *pcb, pbuf *p, err_t err)
+{
+	if (NULL != p) {
+		tcp_recved(pcb, p->tot_len);
+		pbuf_free(p);
+		return(ERR_OK);
+	}
+	CAsyncClient *client = (CAsyncClient *)arg;
+	client->cancel();
+	client->m_state = ASYNC_CLIENT_FAILED;
+	return(ERR_ABRT);
+}
+
+// connection refused or reset: lwIP already freed the pcb
+void CAsyncClient::tcpError(void *arg, err_t err)
+{
+	CAsyncClient *client = (CAsyncClient *)arg;
+	client->m_pcb   = NULL;
+	client->m_state = ASYNC_CLIENT_FAILED;
+}
+
+#endif
@@ -0,0 +1,58 @@
+#pragma once
+#ifndef CASYNCCLIENT_H
+#define CASYNCCLIENT_H
+
+// TCP client for the Blynk transport, NodeMCU only. WiFiClient::connect() waits for the
+// connection (up to its timeout, 5 s): here begin() starts it (DNS, then TCP) and returns, the
+// lwIP callbacks move the state, getState() polls it. connect(), called by Blynk.run(), never
+// waits: it takes over the connection if it is ready, otherwise it fails at once. Blynk's own
+// reconnections cost nothing then: the connection is always started by begin().
+// connect() takes over only the connection to the host (or address) and port given to begin().
+#ifdef ARDUINO
+
+#include <ESP8266WiFi.h>
+#include <lwip/tcp.h>
+#include <lwip/dns.h>
+
+#define ASYNC_CLIENT_IDLE       0 // nothing started, or the connection was taken over
+#define ASYNC_CLIENT_CONNECTING 1 // DNS or TCP in progress
+#define ASYNC_CLIENT_READY      2 // connected, waiting for connect()
+#define ASYNC_CLIENT_FAILED     3 // DNS failed, connection refused or reset
+
+class CAsyncClient : public WiFiClient
+{
+public:
+	CAsyncClient();
+	~CAsyncClient();
+
+	// a host name is resolved first. Any connection in progress is cancelled
+	void    begin(const char *host, uint16_t port);
+	void    begin(IPAddress ip, uint16_t port);
+	// drops the connection in progress (or ready). The one taken over is closed by stop()
+	void    cancel(void);
+	uint8_t getState(void);
+
+	// Client: take over the ready connection to the server of begin(), no wait
+	using WiFiClient::connect;
+	int connect(IPAddress ip, uint16_t port) override;
+	int connect(const char *host, uint16_t port) override;
+
+private:
+	tcp_pcb  *m_pcb;
+	String    m_host;    // begin() with a host name, empty with an address
+	IPAddress m_ip;      // of the connection (resolved host)
+	uint16_t  m_port;
+	uint8_t   m_state;
+	bool      m_isResolving;
+
+	void startTCP(const IPAddress &ip);
+	int  takeOver(void);
+	static void dnsFound(const char *name, const ip_addr_t *ip, void *arg);
+	static err_t tcpConnected(void *arg, tcp_pcb *pcb, err_t err);
+	static err_t tcpReceived(void *arg, tcp_pcb *pcb, pbuf *p, err_t err);
+	static void  tcpError(void *arg, err_t err);
+};
+
+#endif
+
+#endif
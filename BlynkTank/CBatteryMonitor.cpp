@@ -0,0 +1,155 @@
+#include "CBatteryMonitor.h"
+
+// single cell Li-ion under load: voltage (mV) -> state of charge (per mille). The tank stops at
+// BATTERY_LOW_THRESHOLD: that's the empty battery
+static const uint16_t dischargeCurve[][2] = {
+	{ 3500,    0 },
+	{ 3600,   60 },
+	{ 3700,  200 },
+	{ 3750,  330 },
+	{ 3800,  450 },
+	{ 3900,  630 },
+	{ 4000,  780 },
+	{ 4100,  900 },
+	{ 4200, 1000 },
+};
+
+CBatteryMonitor::CBatteryMonitor()
+{
+	m_fullScale_mV = 4200;
+	m_sum          = 0;
+	m_count        = 0;
+	m_filtered     = 0;
+	m_isValid      = false;
+	m_isLow        = false;
+	m_charge       = 0;
+	m_rate         = 0;
+	resetStats();
+}
+
+void CBatteryMonitor::begin(uint16_t fullScale_mV)
+{
+	m_fullScale_mV = fullScale_mV;
+}
+
+bool CBatteryMonitor::addSample(uint16_t adc, uint32_t now_ms)
+{
+	m_stats.samples++;
+	if (!m_isValid) {
+		// the first sample starts the filter (no ramp from 0 V)
+		uint16_t voltage = (uint16_t)(((uint32_t)adc * m_fullScale_mV) >> 10);
+		m_filtered       = (uint32_t)voltage << 4;
+		m_isValid        = true;
+		m_isLow          = voltage < BATTERY_LOW_THRESHOLD;
+		m_charge         = chargeFromVoltage(voltage);
+		m_windowStart_ms = now_ms;
+		m_windowCharge   = m_charge;
+	}
+	m_sum += adc;
+	if (++m_count < BATTERY_OVERSAMPLING)
+		return(false);
+	uint16_t voltage = (uint16_t)((m_sum * m_fullScale_mV + (BATTERY_OVERSAMPLING << 9)) / (BATTERY_OVERSAMPLING << 10));
+	m_sum   = 0;
+	m_count = 0;
+	measure(voltage, now_ms);
+	return(true);
+}
+
+bool CBatteryMonitor::isValid(void)
+{
+	return(m_isValid);
+}
+
+uint16_t CBatteryMonitor::getVoltage(void)
+{
+	return((uint16_t)((m_filtered + 8) >> 4));
+}
+
+bool CBatteryMonitor::isLow(void)
+{
+	return(m_isLow);
+}
+
+uint16_t CBatteryMonitor::getCharge(void)
+{
+	return(m_charge);
+}
+
+uint16_t CBatteryMonitor::getRuntime(void)
+{
+	if (0 == m_rate)
+		return(BATTERY_RUNTIME_UNKNOWN);
+	uint32_t minutes = ((uint32_t)m_charge << 4) / m_rate;
+	return((minutes < BATTERY_RUNTIME_UNKNOWN) ? (uint16_t)minutes : BATTERY_RUNTIME_UNKNOWN - 1);
+}
+
+BatteryStats_t CBatteryMonitor::getStats(void)
+{
+	return(m_stats);
+}
+
+void CBatteryMonitor::resetStats(void)
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+	m_stats.minVoltage = 0xFFFF;
+}
+
+// voltage, charge (tenths of percent, no float printf) and runtime on the serial console
+void CBatteryMonitor::printStats(void)
+{
+	Serial.printf("battery: %u mV (measurements min %u, max %u mV), charge %u.%u%%, ", getVoltage(),
+		(m_stats.measurements > 0) ? m_stats.minVoltage : 0, m_stats.maxVoltage, m_charge / 10, m_charge % 10);
+	if (BATTERY_RUNTIME_UNKNOWN == getRuntime())
+		Serial.printf("runtime unknown");
+	else
+		Serial.printf("runtime %u min", getRuntime());
+	Serial.printf(", %s (%u times low), %u samples, %u measurements\n", m_isLow ? "LOW" : "ok", m_stats.lowTransitions,
+		m_stats.samples, m_stats.measurements);
+}
+
+// new oversampled voltage: filter, low battery hysteresis, charge and discharge rate
+void CBatteryMonitor::measure(uint16_t voltage, uint32_t now_ms)
+{
+	m_stats.measurements++;
+	if (voltage < m_stats.minVoltage)
+		m_stats.minVoltage = voltage;
+	if (voltage > m_stats.maxVoltage)
+		m_stats.maxVoltage = voltage;
+	m_filtered = (uint32_t)((int32_t)m_filtered + ((((int32_t)voltage << 4) - (int32_t)m_filtered) >> BATTERY_FILTER_SHIFT));
+
+	uint16_t filtered = getVoltage();
+	if (!m_isLow && (filtered < BATTERY_LOW_THRESHOLD)) {
+		m_isLow = true;
+		m_stats.lowTransitions++;
+	}
+	else if (m_isLow && (filtered >= BATTERY_LOW_THRESHOLD + BATTERY_LOW_HYSTERESIS))
+		m_isLow = false;
+	m_charge = chargeFromVoltage(filtered);
+
+	uint32_t elapsed = now_ms - m_windowStart_ms;
+	if (elapsed < BATTERY_RATE_WINDOW)
+		return;
+	// charge used in the window, per minute (Q4). Charging or resting: nothing used
+	uint32_t used = (m_windowCharge > m_charge) ? m_windowCharge - m_charge : 0;
+	used = (used << 4) * 60000 / elapsed;
+	if (0 == m_rate)
+		m_rate = used;
+	else
+		m_rate = (m_rate + used) / 2;
+	m_windowStart_ms = now_ms;
+	m_windowCharge   = m_charge;
+}
+
+// discharge curve, linear between the points
+uint16_t CBatteryMonitor::chargeFromVoltage(uint16_t voltage)
+{
+	const uint8_t points = sizeof(dischargeCurve) / sizeof(dischargeCurve[0]);
+	if (voltage <= dischargeCurve[0][0])
+		return(0);
+	for (uint8_t i = 1; i < points; i++) {
+		if (voltage < dischargeCurve[i][0])
+			return(dischargeCurve[i - 1][1] + (uint32_t)(voltage - dischargeCurve[i - 1][0]) *
+				(dischargeCurve[i][1] - dischargeCurve[i - 1][1]) / (dischargeCurve[i][0] - dischargeCurve[i - 1][0]));
+	}
+	return(dischargeCurve[points - 1][1]);
+}
@@ -0,0 +1,69 @@
+#pragma once
+#ifndef CBATTERYMONITOR_H
+#define CBATTERYMONITOR_H
+
+#include "HAL.h"
+
+// one ADC read every 20 ms: the ESP8266 ADC shares the RF calibration circuit, reads in a tight
+// loop drop the WiFi connection
+#define BATTERY_SAMPLE_PERIOD    20    // milliseconds (main loop timer)
+#define BATTERY_OVERSAMPLING     8     // samples per measurement (160 ms)
+#define BATTERY_FILTER_SHIFT     5     // low pass filter of the measurements: 32 measurements time constant (5 s)
+#define BATTERY_LOW_THRESHOLD    3500  // mV: below this the tank stops (motors, shots...)
+#define BATTERY_LOW_HYSTERESIS   150   // mV: the tank moves again only above threshold + hysteresis (more than the motor current sag)
+#define BATTERY_RATE_WINDOW      60000 // milliseconds: discharge rate measured over one minute
+#define BATTERY_RUNTIME_UNKNOWN  0xFFFF
+
+// counters since the last reset
+struct BatteryStats_t {
+	uint32_t samples;
+	uint32_t measurements;
+	uint32_t lowTransitions;   // low battery state entered
+	uint16_t minVoltage;       // mV, measurements (not filtered): motor current sag
+	uint16_t maxVoltage;
+};
+
+// Battery monitor, integer math only: the ADC samples are averaged in blocks (oversampling), the
+// block voltages go through a first order low pass filter, and the low battery state has a
+// hysteresis, so the voltage sag of the motor current doesn't make the tank stop and go.
+// The state of charge comes from the single cell Li-ion discharge curve, the remaining runtime
+// from the discharge rate of the last minutes. The samples come from the owner (addSample),
+// so the class runs on the host too
+class CBatteryMonitor
+{
+public:
+	CBatteryMonitor();
+
+	// battery voltage at the ADC full scale (1024), depending on the voltage divider
+	void begin(uint16_t fullScale_mV);
+	// one ADC reading (0..1023). Returns true when a new measurement is ready
+	bool addSample(uint16_t adc, uint32_t now_ms);
+
+	bool     isValid(void);        // at least one sample
+	uint16_t getVoltage(void);     // mV, filtered
+	bool     isLow(void);
+	uint16_t getCharge(void);      // state of charge, per mille
+	uint16_t getRuntime(void);     // minutes, BATTERY_RUNTIME_UNKNOWN if not discharging (or not known yet)
+
+	BatteryStats_t getStats(void);
+	void           resetStats(void);
+	void           printStats(void);
+
+private:
+	uint16_t m_fullScale_mV;
+	uint32_t m_sum;               // ADC samples of the block
+	uint8_t  m_count;
+	uint32_t m_filtered;          // mV, Q4
+	bool     m_isValid;
+	bool     m_isLow;
+	uint16_t m_charge;
+	uint32_t m_windowStart_ms;
+	uint16_t m_windowCharge;      // charge at the start of the rate window
+	uint32_t m_rate;              // per mille per minute, Q4. 0 -> unknown
+	BatteryStats_t m_stats;
+
+	void     measure(uint16_t voltage, uint32_t now_ms);
+	static uint16_t chargeFromVoltage(uint16_t voltage);
+};
+
+#endif
@@ -0,0 +1,404 @@
+#include "CConfigStore.h"
+
+static const uint8_t configMagic[] = { 'T', 'K', 'C', 'F' };
+
+// CRC32 (IEEE, reflected), 4 bits at a time: 64 bytes of table instead of 1 KB
+static const uint32_t crcTable[16] = {
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+	0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+static void writeUint16(uint8_t *buffer, uint16_t value)
+{
+	buffer[0] = value & 0x00FF;
+	buffer[1] = value >> 8;
+}
+
+static uint16_t readUint16(const uint8_t *buffer)
+{
+	return(buffer[0] | (buffer[1] << 8));
+}
+
+static void writeUint32(uint8_t *buffer, uint32_t value)
+{
+	writeUint16(buffer, value & 0xFFFF);
+	writeUint16(buffer + 2, value >> 16);
+}
+
+static uint32_t readUint32(const uint8_t *buffer)
+{
+	return(readUint16(buffer) | ((uint32_t)readUint16(buffer + 2) << 16));
+}
+
+CConfigStore::CConfigStore(const char *path, const char *journalPath, const char *textPath, const ConfigField_t *fields,
+	uint8_t fieldCount, uint16_t schemaVersion)
+{
+	m_path          = path;
+	m_journalPath   = journalPath;
+	m_textPath      = textPath;
+	m_fields        = fields;
+	m_fieldCount    = (fieldCount < CONFIG_FIELDS_MAX) ? fieldCount : CONFIG_FIELDS_MAX;
+	m_schemaVersion = schemaVersion;
+	m_generation    = 0;
+	m_isStored      = false;
+	m_journalSize   = 0;
+	resetStats();
+}
+
+uint8_t CConfigStore::load(void *record)
+{
+	uint8_t result = CONFIG_NOT_FOUND;
+	m_isStored    = false;
+	m_generation  = 0;
+	m_journalSize = 0;
+	CHalFile file = halFSOpen(m_path, "r");
+	if (file) {
+		uint8_t  buffer[CONFIG_RECORD_MAX];
+		uint16_t length = file.read(buffer, sizeof(buffer));
+		file.close();
+		result = decode(record, buffer, length);
+	}
+	// the journal makes sense only on top of its record
+	if ((CONFIG_LOADED == result) || (CONFIG_MIGRATED == result))
+		replayJournal(record);
+
+	if (NULL != m_textPath) {
+		CHalFile textFile = halFSOpen(m_textPath, "r");
+		if (textFile) {
+			uint8_t fields = importText(record, textFile);
+			textFile.close();
+			// imported once: the text file goes away when the binary record is stored
+			if ((fields > 0) && compact(record)) {
+				halFSRemove(m_textPath);
+				return(CONFIG_IMPORTED);
+			}
+		}
+	}
+
+	// stored again with the current schema version
+	if (CONFIG_MIGRATED == result)
+		compact(record);
+	else if (CONFIG_LOADED == result) {
+		storeFieldCRC(record);
+		m_isStored = true;
+	}
+	return(result);
+}
+
+bool CConfigStore::save(const void *record)
+{
+	m_stats.saves++;
+	if (m_isStored) {
+		uint8_t changed = 0;
+		for (uint8_t i = 0; i < m_fieldCount; i++) {
+			if (fieldCRC(record, m_fields[i]) != m_fieldCRC[i])
+				changed++;
+		}
+		if (0 == changed) {
+			m_stats.unchanged++;
+			return(true);
+		}
+		if (appendJournal(record))
+			return(true);
+	}
+	return(compact(record));
+}
+
+uint16_t CConfigStore::encode(const void *record, uint8_t *buffer, uint16_t size)
+{
+	if (size < CONFIG_HEADER_SIZE + 4)
+		return(0);
+	uint16_t pos = CONFIG_HEADER_SIZE;
+	buffer[pos++] = CONFIG_FIELD_GENERATION;
+	buffer[pos++] = 2;
+	writeUint16(buffer + pos, m_generation);
+	pos += 2;
+	for (uint8_t i = 0; (i < m_fieldCount) && (pos > 0); i++)
+		pos = encodeField(record, m_fields[i], buffer, pos, size);
+	if (0 == pos)
+		return(0);
+	uint16_t payload = pos - CONFIG_HEADER_SIZE;
+	memcpy(buffer, configMagic, sizeof(configMagic));
+	writeUint16(buffer + 4, m_schemaVersion);
+	writeUint16(buffer + 6, payload);
+	writeUint32(buffer + 8, crc32(buffer + CONFIG_HEADER_SIZE, payload));
+	return(pos);
+}
+
+uint8_t CConfigStore::decode(void *record, const uint8_t *buffer, uint16_t length)
+{
+	if ((length < CONFIG_HEADER_SIZE) || (0 != memcmp(buffer, configMagic, sizeof(configMagic))))
+		return(CONFIG_CORRUPTED);
+	uint16_t version = readUint16(buffer + 4);
+	uint16_t payload = readUint16(buffer + 6);
+	if (CONFIG_HEADER_SIZE + payload > length)
+		return(CONFIG_CORRUPTED);
+	const uint8_t *data = buffer + CONFIG_HEADER_SIZE;
+	if ((crc32(data, payload) != readUint32(buffer + 8)) || !checkFields(data, payload))
+		return(CONFIG_CORRUPTED);
+	applyFields(record, data, payload);
+	return((version == m_schemaVersion) ? CONFIG_LOADED : CONFIG_MIGRATED);
+}
+
+// "Tag = value" lines, read in a fixed buffer. The version line and the unknown tags are skipped
+uint8_t CConfigStore::importText(void *record, CHalFile &file)
+{
+	char    line[CONFIG_LINE_MAX];
+	uint8_t length = 0, imported = 0;
+	int     data;
+	do {
+		data = file.read();
+		if ((data >= 0) && ('\n' != data)) {
+			if (length < CONFIG_LINE_MAX - 1)
+				line[length++] = (char)data;
+			continue;
+		}
+		if ((length > 0) && ('\r' == line[length - 1]))
+			length--;
+		line[length] = '\0';
+		length = 0;
+		for (uint8_t i = 0; i < m_fieldCount; i++) {
+			const ConfigField_t &field = m_fields[i];
+			if (NULL == field.textTag)
+				continue;
+			size_t tagLength = strlen(field.textTag);
+			if (0 != strncmp(line, field.textTag, tagLength))
+				continue;
+			uint8_t *value = (uint8_t *)record + field.offset;
+			if (CONFIG_FIELD_STRING == field.type)
+				copyString((char *)value, line + tagLength, field.size);
+			else {
+				uint16_t number = (uint16_t)atoi(line + tagLength);
+				memcpy(value, &number, sizeof(number));
+			}
+			imported++;
+			break;
+		}
+	} while (data >= 0);
+	return(imported);
+}
+
+ConfigStoreStats_t CConfigStore::getStats(void)
+{
+	return(m_stats);
+}
+
+void CConfigStore::resetStats(void)
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+// write counters on the serial console
+void CConfigStore::printStats(void)
+{
+	Serial.printf("%s: %u saves, %u unchanged, %u journaled, %u compactions, %u bytes written, journal %u bytes, %u entries replayed, %u torn\n",
+		m_path, m_stats.saves, m_stats.unchanged, m_stats.journaled, m_stats.compactions, m_stats.bytesWritten,
+		m_journalSize, m_stats.replayed, m_stats.tornEntries);
+}
+
+const char *CConfigStore::resultName(uint8_t result)
+{
+	switch (result) {
+	case CONFIG_LOADED:    return("loaded");
+	case CONFIG_MIGRATED:  return("migrated");
+	case CONFIG_IMPORTED:  return("imported from text");
+	case CONFIG_NOT_FOUND: return("not found");
+	case CONFIG_CORRUPTED: return("corrupted");
+	}
+	return("unknown");
+}
+
+// crc: CRC of the previous data, to go on with the next ones
+uint32_t CConfigStore::crc32(const uint8_t *data, uint16_t length, uint32_t crc)
+{
+	crc = ~crc;
+	for (uint16_t i = 0; i < length; i++) {
+		crc = (crc >> 4) ^ crcTable[(crc ^ data[i]) & 0x0F];
+		crc = (crc >> 4) ^ crcTable[(crc ^ (data[i] >> 4)) & 0x0F];
+	}
+	return(~crc);
+}
+
+void CConfigStore::copyString(char *dest, const char *src, uint8_t size)
+{
+	strncpy(dest, src, size - 1);
+	dest[size - 1] = '\0';
+}
+
+const ConfigField_t *CConfigStore::findField(uint8_t id)
+{
+	for (uint8_t i = 0; i < m_fieldCount; i++) {
+		if (m_fields[i].id == id)
+			return(&m_fields[i]);
+	}
+	return(NULL);
+}
+
+// returns the position after the field, 0 if it does not fit
+uint16_t CConfigStore::encodeField(const void *record, const ConfigField_t &field, uint8_t *buffer, uint16_t pos, uint16_t size)
+{
+	const uint8_t *value = (const uint8_t *)record + field.offset;
+	uint8_t length = (CONFIG_FIELD_STRING == field.type) ? strnlen((const char *)value, field.size - 1) : 2;
+	if (pos + 2 + length > size)
+		return(0);
+	buffer[pos++] = field.id;
+	buffer[pos++] = length;
+	if (CONFIG_FIELD_STRING == field.type)
+		memcpy(buffer + pos, value, length);
+	else {
+		uint16_t number;
+		memcpy(&number, value, sizeof(number));
+		writeUint16(buffer + pos, number);
+	}
+	return(pos + length);
+}
+
+// the field lengths are checked before changing the record
+bool CConfigStore::checkFields(const uint8_t *data, uint16_t length)
+{
+	uint16_t pos = 0;
+	while (pos < length) {
+		if ((pos + 2 > length) || (pos + 2 + data[pos + 1] > length))
+			return(false);
+		pos += 2 + data[pos + 1];
+	}
+	return(true);
+}
+
+void CConfigStore::applyFields(void *record, const uint8_t *data, uint16_t length)
+{
+	for (uint16_t pos = 0; pos < length; pos += 2 + data[pos + 1]) {
+		uint8_t fieldLength = data[pos + 1];
+		if ((CONFIG_FIELD_GENERATION == data[pos]) && (2 == fieldLength)) {
+			m_generation = readUint16(data + pos + 2);
+			continue;
+		}
+		const ConfigField_t *field = findField(data[pos]);
+		if (NULL == field)
+			continue; // written by a newer schema
+		uint8_t *value = (uint8_t *)record + field->offset;
+		if (CONFIG_FIELD_STRING == field->type) {
+			if (fieldLength > field->size - 1)
+				fieldLength = field->size - 1;
+			memcpy(value, data + pos + 2, fieldLength);
+			value[fieldLength] = '\0';
+		}
+		else if (2 == fieldLength) {
+			uint16_t number = readUint16(data + pos + 2);
+			memcpy(value, &number, sizeof(number));
+		}
+	}
+}
+
+uint32_t CConfigStore::fieldCRC(const void *record, const ConfigField_t &field)
+{
+	const uint8_t *value = (const uint8_t *)record + field.offset;
+	if (CONFIG_FIELD_STRING == field.type)
+		return(crc32(value, strnlen((const char *)value, field.size - 1)));
+	return(crc32(value, 2));
+}
+
+void CConfigStore::storeFieldCRC(const void *record)
+{
+	for (uint8_t i = 0; i < m_fieldCount; i++)
+		m_fieldCRC[i] = fieldCRC(record, m_fields[i]);
+}
+
+// entries of the current generation, up to the first torn one
+void CConfigStore::replayJournal(void *record)
+{
+	if (NULL == m_journalPath)
+		return;
+	CHalFile file = halFSOpen(m_journalPath, "r");
+	if (!file)
+		return;
+	uint8_t  buffer[CONFIG_JOURNAL_MAX];
+	uint16_t length = file.read(buffer, sizeof(buffer));
+	file.close();
+	if ((length < 2) || (readUint16(buffer) != m_generation))
+		return;
+	uint16_t pos = 2;
+	while (pos < length) {
+		uint8_t entry = buffer[pos];
+		if ((pos + 1 + entry + 4 > length) || (crc32(buffer + pos + 1, entry) != readUint32(buffer + pos + 1 + entry)) ||
+			!checkFields(buffer + pos + 1, entry)) {
+			// the next save compacts: nothing is appended after a torn entry
+			m_stats.tornEntries++;
+			pos = CONFIG_JOURNAL_MAX;
+			break;
+		}
+		applyFields(record, buffer + pos + 1, entry);
+		m_stats.replayed++;
+		pos += 1 + entry + 4;
+	}
+	m_journalSize = pos;
+}
+
+// the changed fields at the end of the journal. False if there is no room (or no journal)
+bool CConfigStore::appendJournal(const void *record)
+{
+	if (NULL == m_journalPath)
+		return(false);
+	uint8_t  entry[CONFIG_JOURNAL_MAX];
+	uint16_t pos = 0;
+	// new journal: generation of the record first
+	if (0 == m_journalSize) {
+		writeUint16(entry, m_generation);
+		pos = 2;
+	}
+	uint16_t start = pos++;
+	for (uint8_t i = 0; (i < m_fieldCount) && (pos > 0); i++) {
+		if (fieldCRC(record, m_fields[i]) != m_fieldCRC[i])
+			pos = encodeField(record, m_fields[i], entry, pos, sizeof(entry) - 4);
+	}
+	if ((0 == pos) || (pos - start - 1 > 0xFF))
+		return(false);
+	entry[start] = pos - start - 1;
+	writeUint32(entry + pos, crc32(entry + start + 1, entry[start]));
+	pos += 4;
+	if (m_journalSize + pos > CONFIG_JOURNAL_MAX)
+		return(false);
+
+	CHalFile file = halFSOpen(m_journalPath, (0 == m_journalSize) ? "w" : "a");
+	if (!file)
+		return(false);
+	bool isWritten = file.write(entry, pos) == pos;
+	file.close();
+	if (!isWritten)
+		return(false);
+	m_journalSize += pos;
+	m_stats.journaled++;
+	m_stats.bytesWritten += pos;
+	storeFieldCRC(record);
+	return(true);
+}
+
+// whole record, next generation: the journal is no longer needed
+bool CConfigStore::compact(const void *record)
+{
+	uint8_t  buffer[CONFIG_RECORD_MAX];
+	uint16_t generation = m_generation;
+	m_generation++;
+	uint16_t length = encode(record, buffer, sizeof(buffer));
+	CHalFile file;
+	if (0 != length)
+		file = halFSOpen(m_path, "w");
+	if (!file) {
+		m_generation = generation;
+		return(false);
+	}
+	bool isWritten = file.write(buffer, length) == length;
+	file.close();
+	if (!isWritten) {
+		m_generation = generation;
+		return(false);
+	}
+	if ((NULL != m_journalPath) && halFSExists(m_journalPath))
+		halFSRemove(m_journalPath);
+	m_journalSize = 0;
+	m_isStored    = true;
+	m_stats.compactions++;
+	m_stats.bytesWritten += length;
+	storeFieldCRC(record);
+	return(true);
+}
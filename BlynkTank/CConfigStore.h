@@ -0,0 +1,108 @@
+#pragma once
+#ifndef CCONFIGSTORE_H
+#define CCONFIGSTORE_H
+
+#include "HAL.h"
+
+// Binary config record with a CRC, read and written with no heap allocation. The fields are
+// stored by ID, so a record written by another schema version is migrated field by field: the
+// known fields are loaded, the missing ones keep the value of the caller (defaults), the unknown
+// ones are skipped. The old text config files ("Tag = value" lines) can still be imported.
+// A save appends only the changed fields to a journal, compacted into the record when full,
+// and writes nothing if nothing changed.
+//   record : 'T' 'K' 'C' 'F', schema version (uint16), payload length (uint16), CRC32 of the payload (uint32)
+//   field  : ID, length, value (strings without terminator, integers little endian)
+//   journal: generation of the record (uint16), entries
+//   entry  : payload length, fields, CRC32 of the fields (uint32). A torn entry ends the journal
+// The generation of the record is its field 0: the journal left by a compaction interrupted by
+// a reset belongs to the older generation, and it is ignored
+#define CONFIG_HEADER_SIZE  12
+#define CONFIG_RECORD_MAX   512 // bytes, header included
+#define CONFIG_JOURNAL_MAX  256 // bytes: when full, the journal is compacted into the record
+#define CONFIG_FIELDS_MAX   16
+#define CONFIG_LINE_MAX     128 // longest line of a text config file
+
+// field types
+#define CONFIG_FIELD_STRING 0 // char array, size with the terminator
+#define CONFIG_FIELD_UINT16 1
+
+#define CONFIG_FIELD_GENERATION 0 // reserved field ID
+
+// load results
+#define CONFIG_LOADED       0 // same schema version
+#define CONFIG_MIGRATED     1 // another schema version: the fields not stored keep their values
+#define CONFIG_IMPORTED     2 // from the text file (then stored as binary)
+#define CONFIG_NOT_FOUND    3 // nothing changed
+#define CONFIG_CORRUPTED    4 // bad header, length or CRC: nothing changed
+
+// one field of the record structure. The IDs never change: a new field gets a new ID
+struct ConfigField_t {
+	uint8_t     id;
+	uint8_t     type;
+	uint16_t    offset;   // in the record structure (offsetof)
+	uint8_t     size;     // bytes in the record structure
+	const char *textTag;  // text config file tag (e.g. "WiFiSSID = "), NULL if not in the text file
+};
+
+// counters since the last reset
+struct ConfigStoreStats_t {
+	uint32_t saves;
+	uint32_t unchanged;      // saves with nothing to write
+	uint32_t journaled;      // saves appended to the journal
+	uint32_t compactions;    // whole record written
+	uint32_t bytesWritten;
+	uint32_t replayed;       // journal entries applied by load
+	uint32_t tornEntries;    // journal entries with a bad CRC (reset while writing)
+};
+
+class CConfigStore
+{
+public:
+	// journalPath NULL -> every save writes the whole record
+	CConfigStore(const char *path, const char *journalPath, const char *textPath, const ConfigField_t *fields,
+		uint8_t fieldCount, uint16_t schemaVersion);
+
+	// record and journal first, then the text file if present (it wins, and it is removed once stored as binary)
+	uint8_t load(void *record);
+	bool    save(const void *record);
+
+	// in memory (no file system). encode returns the record length, 0 if it does not fit
+	uint16_t encode(const void *record, uint8_t *buffer, uint16_t size);
+	uint8_t  decode(void *record, const uint8_t *buffer, uint16_t length);
+	// lines of a text config file. Returns the fields imported
+	uint8_t  importText(void *record, CHalFile &file);
+
+	ConfigStoreStats_t getStats(void);
+	void               resetStats(void);
+	void               printStats(void);
+
+	static const char *resultName(uint8_t result);
+	static uint32_t    crc32(const uint8_t *data, uint16_t length, uint32_t crc = 0);
+	// strncpy that always terminates
+	static void        copyString(char *dest, const char *src, uint8_t size);
+
+private:
+	const char          *m_path;
+	const char          *m_journalPath;
+	const char          *m_textPath;
+	const ConfigField_t *m_fields;
+	uint8_t              m_fieldCount;
+	uint16_t             m_schemaVersion;
+	uint16_t             m_generation;
+	bool                 m_isStored;          // m_fieldCRC are the stored values
+	uint32_t             m_fieldCRC[CONFIG_FIELDS_MAX];
+	uint16_t             m_journalSize;
+	ConfigStoreStats_t   m_stats;
+
+	const ConfigField_t *findField(uint8_t id);
+	uint16_t encodeField(const void *record, const ConfigField_t &field, uint8_t *buffer, uint16_t pos, uint16_t size);
+	bool     checkFields(const uint8_t *data, uint16_t length);
+	void     applyFields(void *record, const uint8_t *data, uint16_t length);
+	uint32_t fieldCRC(const void *record, const ConfigField_t &field);
+	void     storeFieldCRC(const void *record);
+	void     replayJournal(void *record);
+	bool     appendJournal(const void *record);
+	bool     compact(const void *record);
+};
+
+#endif
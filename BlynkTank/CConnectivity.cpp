@@ -0,0 +1,368 @@
+#include "CConnectivity.h"
+
+CConnectivity::CConnectivity()
+{
+	m_serverConnect       = NULL;
+	m_serverLink          = NULL;
+	m_serverLogin         = NULL;
+	m_serverConnected     = NULL;
+	m_serverDisconnect    = NULL;
+	m_serverRun           = NULL;
+	m_ssid                = "";
+	m_password            = "";
+	m_fastBoot            = NULL;
+	m_state               = CONN_IDLE;
+	m_stateSince_ms       = 0;
+	m_begin_ms            = 0;
+	m_lastRun_ms          = 0;
+	m_isFastLink          = false;
+	m_wifiStage           = BOOT_STAGES_MAX;
+	m_serverStage         = BOOT_STAGES_MAX;
+	m_backoff_ms          = 0;
+	m_isLoginSent         = false;
+	m_loginSent_ms        = 0;
+	m_consecutiveFailures = 0;
+	m_failuresSinceBegin  = 0;
+	m_hasBeenOnline       = false;
+	m_outageTypes         = 0;
+	memset(m_outageSince_ms, 0, sizeof(m_outageSince_ms));
+	m_lastRSSI_ms         = 0;
+	resetStats();
+}
+
+void CConnectivity::setServer(serverConnect_t connect, serverLink_t link, serverLogin_t login, serverConnected_t connected,
+	serverDisconnect_t disconnect, serverRun_t run)
+{
+	m_serverConnect    = connect;
+	m_serverLink       = link;
+	m_serverLogin      = login;
+	m_serverConnected  = connected;
+	m_serverDisconnect = disconnect;
+	m_serverRun        = run;
+}
+
+void CConnectivity::begin(const char *ssid, const char *password, CFastBoot *fastBoot)
+{
+	uint32_t now = halMillis();
+	if ((NULL != m_serverDisconnect) && isServerStarted())
+		m_serverDisconnect();
+	m_ssid                = ssid;
+	m_password            = password;
+	m_fastBoot            = fastBoot;
+	m_begin_ms            = now;
+	m_lastRun_ms          = now;
+	m_consecutiveFailures = 0;
+	m_failuresSinceBegin  = 0;
+	m_hasBeenOnline       = false;
+	m_outageTypes         = 0;
+	m_wifiStage           = BOOT_STAGES_MAX;
+	m_serverStage         = BOOT_STAGES_MAX;
+	if (NULL != m_fastBoot)
+		m_wifiStage = m_fastBoot->startStage("wifi");
+	beginWiFi(true, now);
+}
+
+uint8_t CConnectivity::run(void)
+{
+	if (CONN_IDLE == m_state)
+		return(m_state);
+	uint32_t start_us = halMicros();
+	uint32_t now      = halMillis();
+	if (CONN_ONLINE == m_state)
+		m_stats.online_ms  += now - m_lastRun_ms;
+	else
+		m_stats.offline_ms += now - m_lastRun_ms;
+	m_lastRun_ms = now;
+
+	switch (m_state) {
+	case CONN_WIFI_CONNECTING:
+		stepWiFi(now);
+		break;
+	case CONN_SERVER_CONNECTING:
+		stepServer(now);
+		break;
+	case CONN_SERVER_LOGIN:
+		stepLogin(now);
+		break;
+	case CONN_ONLINE:
+		stepOnline(now);
+		break;
+	case CONN_BACKOFF:
+		if (now - m_stateSince_ms < m_backoff_ms)
+			break;
+		// the WiFi may have reconnected by itself
+		if (HAL_WIFI_CONNECTED == halWiFiStatus())
+			beginServer(now);
+		else
+			beginWiFi(true, now);
+		break;
+	}
+
+	uint32_t elapsed = halMicros() - start_us;
+	if (elapsed > m_stats.runMax_us)
+		m_stats.runMax_us = elapsed;
+	return(m_state);
+}
+
+uint8_t CConnectivity::getState(void)
+{
+	return(m_state);
+}
+
+bool CConnectivity::isWiFiConnected(void)
+{
+	return(isServerStarted());
+}
+
+bool CConnectivity::isOnline(void)
+{
+	return(CONN_ONLINE == m_state);
+}
+
+bool CConnectivity::isHotspotNeeded(void)
+{
+	return(!m_hasBeenOnline && (m_failuresSinceBegin >= CONN_HOTSPOT_FAILURES));
+}
+
+ConnectivityStats_t CConnectivity::getStats(void)
+{
+	return(m_stats);
+}
+
+void CConnectivity::resetStats(void)
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+	m_stats.since_ms = halMillis();
+}
+
+// failures by type, time to reconnect by cause, link quality
+void CConnectivity::printStats(void)
+{
+	uint32_t total = m_stats.online_ms + m_stats.offline_ms;
+	Serial.printf("network: %s, %u attempts, first online in %u ms, online %u per mille\n", stateName(m_state),
+		m_stats.attempts, m_stats.firstOnline_ms, (0 == total) ? 0 : (uint32_t)((uint64_t)m_stats.online_ms * 1000 / total));
+	for (uint8_t i = 0; i < CONN_FAIL_TYPES; i++) {
+		if (0 == m_stats.failures[i])
+			continue;
+		if (0 == m_stats.reconnects[i]) {
+			Serial.printf("  %-12s %u failures, no reconnect yet\n", failureName(i), m_stats.failures[i]);
+			continue;
+		}
+		Serial.printf("  %-12s %u failures, %u reconnects in %u ms (max %u ms)\n", failureName(i), m_stats.failures[i],
+			m_stats.reconnects[i], m_stats.reconnectSum_ms[i] / m_stats.reconnects[i], m_stats.reconnectMax_ms[i]);
+	}
+	Serial.printf("  RSSI %d dBm (min %d, average %d), longest step %u us\n", m_stats.rssiLast, m_stats.rssiMin,
+		(0 == m_stats.rssiSamples) ? 0 : (int)(m_stats.rssiSum / (int32_t)m_stats.rssiSamples), m_stats.runMax_us);
+}
+
+const char *CConnectivity::stateName(uint8_t state)
+{
+	switch (state) {
+	case CONN_IDLE:              return("idle");
+	case CONN_WIFI_CONNECTING:   return("WiFi connecting");
+	case CONN_SERVER_CONNECTING: return("server connecting");
+	case CONN_SERVER_LOGIN:      return("server login");
+	case CONN_ONLINE:            return("online");
+	case CONN_BACKOFF:           return("waiting");
+	}
+	return("unknown");
+}
+
+const char *CConnectivity::failureName(uint8_t failure)
+{
+	switch (failure) {
+	case CONN_FAIL_NO_AP:       return("no AP");
+	case CONN_FAIL_AUTH:        return("WiFi auth");
+	case CONN_FAIL_WIFI:        return("WiFi");
+	case CONN_FAIL_LINK_LOST:   return("link lost");
+	case CONN_FAIL_SERVER:      return("server");
+	case CONN_FAIL_SERVER_LOST: return("server lost");
+	case CONN_FAIL_LOGIN:       return("login");
+	}
+	return("unknown");
+}
+
+void CConnectivity::setState(uint8_t state, uint32_t now)
+{
+	m_state         = state;
+	m_stateSince_ms = now;
+}
+
+// useLink: a new attempt, on the cached link if any. Otherwise the fallback to the scan
+void CConnectivity::beginWiFi(bool useLink, uint32_t now)
+{
+	halWiFiLink_t link;
+	m_isFastLink = useLink && (NULL != m_fastBoot) && (BOOT_CACHE_NONE != m_fastBoot->loadLink(m_ssid, m_password, link));
+	if (useLink)
+		m_stats.attempts++;
+	halWiFiDisconnect();
+	halWiFiBegin(m_ssid, m_password, m_isFastLink ? &link : NULL);
+	setState(CONN_WIFI_CONNECTING, now);
+}
+
+void CConnectivity::beginServer(uint32_t now)
+{
+	if (NULL == m_serverConnect) {
+		goOnline(now);
+		return;
+	}
+	if ((NULL != m_fastBoot) && (BOOT_STAGES_MAX == m_serverStage))
+		m_serverStage = m_fastBoot->startStage("server");
+	m_stats.attempts++;
+	m_serverConnect();
+	setState(CONN_SERVER_CONNECTING, now);
+}
+
+void CConnectivity::stepWiFi(uint32_t now)
+{
+	uint8_t status = halWiFiStatus();
+	if (HAL_WIFI_CONNECTED == status) {
+		if (NULL != m_fastBoot) {
+			halWiFiLink_t link;
+			halWiFiGetLink(link);
+			m_fastBoot->storeLink(m_ssid, m_password, link);
+			m_fastBoot->endStage(m_wifiStage);
+		}
+		beginServer(now);
+		return;
+	}
+	bool isFailed = (HAL_WIFI_NO_AP == status) || (HAL_WIFI_AUTH_FAILED == status) || (HAL_WIFI_FAILED == status);
+	if (m_isFastLink && (isFailed || (now - m_stateSince_ms >= BOOT_WIFI_FAST_TIMEOUT))) {
+		// access point replaced, moved to another channel or off: scan. The link is kept (an access
+		// point off comes back the same), the connection replaces it if needed
+		beginWiFi(false, now);
+		return;
+	}
+	if (HAL_WIFI_AUTH_FAILED == status)
+		fail(CONN_FAIL_AUTH, now);
+	else if (HAL_WIFI_NO_AP == status)
+		fail(CONN_FAIL_NO_AP, now);
+	else if ((HAL_WIFI_FAILED == status) || (now - m_stateSince_ms >= CONN_WIFI_TIMEOUT))
+		fail(CONN_FAIL_WIFI, now);
+}
+
+// TCP connection: a server down may not answer at all (timeout)
+void CConnectivity::stepServer(uint32_t now)
+{
+	if (HAL_WIFI_CONNECTED != halWiFiStatus()) {
+		fail(CONN_FAIL_LINK_LOST, now);
+		return;
+	}
+	uint8_t link = m_serverLink();
+	if (CONN_LINK_UP == link) {
+		m_serverLogin();
+		now = halMillis();
+		m_isLoginSent  = true;
+		m_loginSent_ms = now;
+		setState(CONN_SERVER_LOGIN, now);
+	}
+	else if ((CONN_LINK_DOWN == link) || (now - m_stateSince_ms >= CONN_SERVER_TIMEOUT))
+		fail(CONN_FAIL_SERVER, now);
+}
+
+// login sent: the server answers, or closes the connection if it rejects it
+void CConnectivity::stepLogin(uint32_t now)
+{
+	if (HAL_WIFI_CONNECTED != halWiFiStatus()) {
+		fail(CONN_FAIL_LINK_LOST, now);
+		return;
+	}
+	m_serverRun();
+	now = halMillis();
+	if (m_serverConnected())
+		goOnline(now);
+	else if ((CONN_LINK_DOWN == m_serverLink()) || (now - m_stateSince_ms >= CONN_LOGIN_TIMEOUT))
+		fail(CONN_FAIL_LOGIN, now);
+}
+
+bool CConnectivity::isServerStarted(void)
+{
+	return((CONN_SERVER_CONNECTING == m_state) || (CONN_SERVER_LOGIN == m_state) || (CONN_ONLINE == m_state));
+}
+
+void CConnectivity::stepOnline(uint32_t now)
+{
+	if (HAL_WIFI_CONNECTED != halWiFiStatus()) {
+		// no wait: the WiFi reconnects by itself, a new attempt follows if it does not
+		fail(CONN_FAIL_LINK_LOST, now);
+		m_isFastLink = false;
+		setState(CONN_WIFI_CONNECTING, now);
+		return;
+	}
+	if (NULL != m_serverRun) {
+		m_serverRun();
+		if (!m_serverConnected()) {
+			fail(CONN_FAIL_SERVER_LOST, halMillis());
+			return;
+		}
+	}
+	if (now - m_lastRSSI_ms >= CONN_RSSI_PERIOD)
+		sampleRSSI();
+}
+
+void CConnectivity::goOnline(uint32_t now)
+{
+	for (uint8_t i = 0; i < CONN_FAIL_TYPES; i++) {
+		if (0 == (m_outageTypes & (1 << i)))
+			continue;
+		uint32_t outage_ms = now - m_outageSince_ms[i];
+		m_stats.reconnects[i]++;
+		m_stats.reconnectSum_ms[i] += outage_ms;
+		if (outage_ms > m_stats.reconnectMax_ms[i])
+			m_stats.reconnectMax_ms[i] = outage_ms;
+	}
+	m_outageTypes = 0;
+	m_consecutiveFailures = 0;
+	setState(CONN_ONLINE, now);
+	sampleRSSI();
+	if (m_hasBeenOnline)
+		return;
+	m_hasBeenOnline        = true;
+	m_stats.firstOnline_ms = now - m_begin_ms;
+	if (NULL != m_fastBoot) {
+		m_fastBoot->endStage(m_serverStage);
+		m_fastBoot->print();
+	}
+}
+
+// the failures before the first connection are not outages (see firstOnline_ms)
+void CConnectivity::startOutage(uint8_t failure, uint32_t now)
+{
+	if (!m_hasBeenOnline || (0 != (m_outageTypes & (1 << failure))))
+		return;
+	m_outageTypes             |= 1 << failure;
+	m_outageSince_ms[failure]  = now;
+}
+
+void CConnectivity::fail(uint8_t failure, uint32_t now)
+{
+	m_stats.failures[failure]++;
+	startOutage(failure, now);
+	m_failuresSinceBegin++;
+	if ((NULL != m_serverDisconnect) && isServerStarted())
+		m_serverDisconnect();
+
+	// 0.5, 1, 2, 4... seconds, a random half of it
+	if (m_consecutiveFailures < 16)
+		m_consecutiveFailures++;
+	uint32_t backoff = CONN_BACKOFF_MIN << (m_consecutiveFailures - 1);
+	if (backoff > CONN_BACKOFF_MAX)
+		backoff = CONN_BACKOFF_MAX;
+	m_backoff_ms = backoff / 2 + halRandom(backoff / 2 + 1);
+	// a login right after the last one would wait on the gate of Blynk, past the login timeout
+	if (m_isLoginSent && (now - m_loginSent_ms + m_backoff_ms < CONN_LOGIN_INTERVAL))
+		m_backoff_ms = CONN_LOGIN_INTERVAL - (now - m_loginSent_ms);
+	setState(CONN_BACKOFF, now);
+}
+
+void CConnectivity::sampleRSSI(void)
+{
+	halWiFiLink_t link;
+	halWiFiGetLink(link);
+	if ((0 == m_stats.rssiSamples) || (link.rssi < m_stats.rssiMin))
+		m_stats.rssiMin = link.rssi;
+	m_stats.rssiLast = link.rssi;
+	m_stats.rssiSum += link.rssi;
+	m_stats.rssiSamples++;
+	m_lastRSSI_ms = halMillis();
+}
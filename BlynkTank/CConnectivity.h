@@ -0,0 +1,142 @@
+#pragma once
+#ifndef CCONNECTIVITY_H
+#define CCONNECTIVITY_H
+
+#include "HAL.h"
+#include "CFastBoot.h"
+
+// WiFi and Blynk server connection manager, stepped by run() from the main loop. Nothing waits:
+// every step checks the WiFi status and the server, and moves the state machine
+//   WIFI_CONNECTING -> SERVER_CONNECTING (TCP) -> SERVER_LOGIN -> ONLINE
+// A failed attempt waits an exponential backoff (with a random part: the tanks of an arena do not
+// retry together) before the next one. The login is sent once the TCP connection is up, and the
+// manager owns its deadline: a rejected login (the server closes the connection) fails at once.
+// The server run (Blynk.run) is called only while the WiFi is connected and the server is logging in
+// or online. The server callbacks must not block either (the sketch makes the TCP connection with
+// CAsyncClient). They are callbacks, so the class works on the host too.
+// An outage is timed for every failure type seen in it, from the first failure of that type to the
+// next ONLINE (a server restart: server lost, then server not reachable until it is back).
+#define CONN_WIFI_TIMEOUT     10000 // milliseconds: association and DHCP
+#define CONN_SERVER_TIMEOUT   5000  // milliseconds: TCP connection
+#define CONN_LOGIN_TIMEOUT    3000  // milliseconds: login answer
+#define CONN_LOGIN_INTERVAL   5100  // milliseconds between two logins (Blynk waits 5 s, it would not send it)
+#define CONN_BACKOFF_MIN      500   // milliseconds, doubled at every failure...
+#define CONN_BACKOFF_MAX      30000 // ...up to
+#define CONN_RSSI_PERIOD      1000  // milliseconds
+#define CONN_HOTSPOT_FAILURES 3     // never online since begin: the settings may be wrong
+
+// states
+#define CONN_IDLE              0
+#define CONN_WIFI_CONNECTING   1
+#define CONN_SERVER_CONNECTING 2
+#define CONN_ONLINE            3
+#define CONN_BACKOFF           4
+#define CONN_SERVER_LOGIN      5
+
+// TCP connection to the server (server link callback)
+#define CONN_LINK_PENDING 0
+#define CONN_LINK_UP      1
+#define CONN_LINK_DOWN    2 // refused, reset, closed by the server
+
+// failure types
+#define CONN_FAIL_NO_AP        0 // access point not found (powered off, out of range)
+#define CONN_FAIL_AUTH         1 // wrong WiFi password
+#define CONN_FAIL_WIFI         2 // association failed, or association and DHCP too long
+#define CONN_FAIL_LINK_LOST    3 // WiFi dropped while online
+#define CONN_FAIL_SERVER       4 // server not reachable (TCP)
+#define CONN_FAIL_SERVER_LOST  5 // server dropped while the WiFi is up
+#define CONN_FAIL_LOGIN        6 // login rejected (e.g. wrong auth token) or not answered
+#define CONN_FAIL_TYPES        7
+
+// counters since the last reset
+struct ConnectivityStats_t {
+	uint32_t attempts;                          // WiFi and server connections started
+	uint32_t failures[CONN_FAIL_TYPES];
+	uint32_t reconnects[CONN_FAIL_TYPES];       // outages ended, by failure type seen in them
+	uint32_t reconnectSum_ms[CONN_FAIL_TYPES];  // time to reconnect
+	uint32_t reconnectMax_ms[CONN_FAIL_TYPES];
+	uint32_t firstOnline_ms;                    // from begin, 0: not yet
+	uint32_t online_ms;
+	uint32_t offline_ms;
+	int8_t   rssiLast, rssiMin;                 // dBm
+	int32_t  rssiSum;
+	uint32_t rssiSamples;
+	uint32_t runMax_us;                         // longest step (server run included): main loop stall
+	uint32_t since_ms;                          // time of the reset
+};
+
+class CConnectivity
+{
+public:
+	typedef void(*serverConnect_t)(void);    // start the TCP connection
+	typedef uint8_t(*serverLink_t)(void);    // state of the TCP connection (CONN_LINK_...)
+	typedef void(*serverLogin_t)(void);      // TCP up: send the login, the answer comes in the server run
+	typedef bool(*serverConnected_t)(void);  // logged in
+	typedef void(*serverDisconnect_t)(void);
+	typedef void(*serverRun_t)(void);
+
+	CConnectivity();
+
+	// no server: ONLINE as soon as the WiFi is connected
+	void setServer(serverConnect_t connect, serverLink_t link, serverLogin_t login, serverConnected_t connected,
+		serverDisconnect_t disconnect, serverRun_t run);
+	// the strings must live as long as the object (not copied). fastBoot: cached link and boot stages, or NULL
+	void begin(const char *ssid, const char *password, CFastBoot *fastBoot);
+	// one step, returns the state
+	uint8_t run(void);
+	uint8_t getState(void);
+	bool    isWiFiConnected(void);
+	bool    isOnline(void);
+	// the tank never went online and keeps failing (e.g. new WiFi, wrong token): the config portal
+	// is needed. The manager keeps retrying
+	bool    isHotspotNeeded(void);
+
+	ConnectivityStats_t getStats(void);
+	void                resetStats(void);
+	void                printStats(void);
+
+	static const char *stateName(uint8_t state);
+	static const char *failureName(uint8_t failure);
+
+private:
+	serverConnect_t     m_serverConnect;
+	serverLink_t        m_serverLink;
+	serverLogin_t       m_serverLogin;
+	serverConnected_t   m_serverConnected;
+	serverDisconnect_t  m_serverDisconnect;
+	serverRun_t         m_serverRun;
+	const char         *m_ssid;
+	const char         *m_password;
+	CFastBoot          *m_fastBoot;
+	uint8_t             m_state;
+	uint32_t            m_stateSince_ms;
+	uint32_t            m_begin_ms;
+	uint32_t            m_lastRun_ms;
+	bool                m_isFastLink;      // WiFi attempt on the cached link
+	uint8_t             m_wifiStage, m_serverStage;
+	uint32_t            m_backoff_ms;
+	bool                m_isLoginSent;
+	uint32_t            m_loginSent_ms;
+	uint8_t             m_consecutiveFailures;
+	uint32_t            m_failuresSinceBegin;
+	bool                m_hasBeenOnline;
+	uint8_t             m_outageTypes;                      // bit mask of the failure types of the outage...
+	uint32_t            m_outageSince_ms[CONN_FAIL_TYPES];  // ...and the first failure of each
+	uint32_t            m_lastRSSI_ms;
+	ConnectivityStats_t m_stats;
+
+	void    setState(uint8_t state, uint32_t now);
+	void    beginWiFi(bool useLink, uint32_t now);
+	void    beginServer(uint32_t now);
+	void    stepWiFi(uint32_t now);
+	void    stepServer(uint32_t now);
+	void    stepLogin(uint32_t now);
+	bool    isServerStarted(void);
+	void    stepOnline(uint32_t now);
+	void    goOnline(uint32_t now);
+	void    startOutage(uint8_t failure, uint32_t now);
+	void    fail(uint8_t failure, uint32_t now);
+	void    sampleRSSI(void);
+};
+
+#endif
@@ -0,0 +1,234 @@
+#include "CDFPlayer.h"
+
+#define DFPLAYER_START   0x7E
+#define DFPLAYER_VERSION 0xFF
+#define DFPLAYER_LENGTH  0x06
+#define DFPLAYER_END     0xEF
+
+// kinds of command: a newer one replaces the queued one of the same kind
+#define KIND_OTHER  0
+#define KIND_PLAY   1 // a play stops the track being played: only the last one is heard
+#define KIND_VOLUME 2
+
+// 16 bit two's complement of the sum of version, length, command, feedback and parameter
+static uint16_t frameChecksum(const uint8_t *frame)
+{
+	uint16_t sum = 0;
+	for (uint8_t i = 1; i < 7; i++)
+		sum += frame[i];
+	return((uint16_t)-sum);
+}
+
+CDFPlayer::CDFPlayer()
+{
+	m_pSerial       = NULL;
+	m_head          = 0;
+	m_count         = 0;
+	m_txPos         = DFPLAYER_FRAME_SIZE;
+	m_lastSent_ms   = 0;
+	m_rxPos         = 0;
+	m_feedbackHead  = 0;
+	m_feedbackCount = 0;
+	resetStats();
+}
+
+void CDFPlayer::begin(CHalSerial *serial)
+{
+	m_pSerial = serial;
+	m_lastSent_ms = halMillis() - DFPLAYER_COMMAND_GAP;
+}
+
+bool CDFPlayer::send(uint8_t command, uint16_t parameter, bool feedback)
+{
+	if (NULL == m_pSerial)
+		return(false);
+	m_stats.queued++;
+	// the newest waiting command of the same kind is replaced, unless another command is after it
+	uint8_t commandKind = kind(command);
+	if (KIND_OTHER != commandKind) {
+		for (int8_t i = m_count - 1; i >= 0; i--) {
+			uint8_t queuedKind = kind(m_queue[(m_head + i) % DFPLAYER_QUEUE_SIZE].command);
+			if (KIND_OTHER == queuedKind)
+				break;
+			if (queuedKind == commandKind) {
+				remove(i);
+				m_stats.coalesced++;
+				break;
+			}
+		}
+	}
+	if (DFPLAYER_QUEUE_SIZE == m_count) {
+		remove(0);
+		m_stats.dropped++;
+	}
+	command_t &entry = m_queue[(m_head + m_count) % DFPLAYER_QUEUE_SIZE];
+	entry.command   = command;
+	entry.parameter = parameter;
+	entry.feedback  = feedback;
+	entry.queued_us = halMicros();
+	m_count++;
+	if (getQueueDepth() > m_stats.queueMax)
+		m_stats.queueMax = getQueueDepth();
+	return(true);
+}
+
+void CDFPlayer::run(void)
+{
+	if (NULL == m_pSerial)
+		return;
+	while (m_pSerial->available() > 0)
+		parse((uint8_t)m_pSerial->read());
+
+	if ((DFPLAYER_FRAME_SIZE == m_txPos) && (m_count > 0) && (halMillis() - m_lastSent_ms >= DFPLAYER_COMMAND_GAP))
+		startCommand();
+	if (DFPLAYER_FRAME_SIZE == m_txPos)
+		return;
+	m_pSerial->write(m_txFrame[m_txPos++]);
+	if (m_txPos < DFPLAYER_FRAME_SIZE)
+		return;
+	uint32_t latency = halMicros() - m_txQueued_us;
+	m_lastSent_ms = halMillis();
+	m_stats.sent++;
+	m_stats.latencySum_us += latency;
+	if (latency > m_stats.latencyMax_us)
+		m_stats.latencyMax_us = latency;
+}
+
+void CDFPlayer::runTimer(CDFPlayer *player)
+{
+	player->run();
+}
+
+uint8_t CDFPlayer::getQueueDepth(void)
+{
+	return(m_count + ((DFPLAYER_FRAME_SIZE == m_txPos) ? 0 : 1));
+}
+
+bool CDFPlayer::isIdle(void)
+{
+	return(0 == getQueueDepth());
+}
+
+bool CDFPlayer::readFeedback(DFPlayerFeedback_t &frame)
+{
+	if (0 == m_feedbackCount)
+		return(false);
+	frame = m_feedback[m_feedbackHead];
+	m_feedbackHead = (m_feedbackHead + 1) % DFPLAYER_FEEDBACK_SIZE;
+	m_feedbackCount--;
+	return(true);
+}
+
+const char *CDFPlayer::feedbackName(uint8_t command)
+{
+	switch (command) {
+	case DFPLAYER_FB_CARD_IN:        return("card inserted");
+	case DFPLAYER_FB_CARD_OUT:       return("card removed");
+	case DFPLAYER_FB_USB_FINISHED:   return("USB track finished");
+	case DFPLAYER_FB_TRACK_FINISHED: return("track finished");
+	case DFPLAYER_FB_ONLINE:         return("online");
+	case DFPLAYER_FB_ERROR:          return("error");
+	case DFPLAYER_FB_ACK:            return("ack");
+	case DFPLAYER_FB_STATUS:         return("status");
+	case DFPLAYER_FB_VOLUME:         return("volume");
+	}
+	return("unknown");
+}
+
+DFPlayerStats_t CDFPlayer::getStats(void)
+{
+	return(m_stats);
+}
+
+void CDFPlayer::resetStats(void)
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+// command queue and feedback counters on the serial console
+void CDFPlayer::printStats(void)
+{
+	Serial.printf("MP3 tx: %u queued, %u sent, %u coalesced, %u dropped, queue %u (max %u), latency avg %u us, max %u us\n",
+		m_stats.queued, m_stats.sent, m_stats.coalesced, m_stats.dropped, getQueueDepth(), m_stats.queueMax,
+		(m_stats.sent > 0) ? (uint32_t)(m_stats.latencySum_us / m_stats.sent) : 0, m_stats.latencyMax_us);
+	Serial.printf("MP3 rx: %u frames, %u tracks finished, %u errors (last %u), %u checksum, %u framing errors\n",
+		m_stats.frames, m_stats.finished, m_stats.errors, m_stats.lastError, m_stats.checksumErrors, m_stats.framingErrors);
+}
+
+uint8_t CDFPlayer::kind(uint8_t command)
+{
+	if ((DFPLAYER_CMD_PLAY == command) || (DFPLAYER_CMD_LOOP == command))
+		return(KIND_PLAY);
+	if (DFPLAYER_CMD_VOLUME == command)
+		return(KIND_VOLUME);
+	return(KIND_OTHER);
+}
+
+// waiting command, 0 = oldest
+void CDFPlayer::remove(uint8_t index)
+{
+	for (uint8_t i = index; i + 1 < m_count; i++)
+		m_queue[(m_head + i) % DFPLAYER_QUEUE_SIZE] = m_queue[(m_head + i + 1) % DFPLAYER_QUEUE_SIZE];
+	m_count--;
+}
+
+void CDFPlayer::startCommand(void)
+{
+	command_t &entry = m_queue[m_head];
+	m_txFrame[0] = DFPLAYER_START;
+	m_txFrame[1] = DFPLAYER_VERSION;
+	m_txFrame[2] = DFPLAYER_LENGTH;
+	m_txFrame[3] = entry.command;
+	m_txFrame[4] = entry.feedback;
+	m_txFrame[5] = entry.parameter >> 8;
+	m_txFrame[6] = entry.parameter & 0x00FF;
+	uint16_t checksum = frameChecksum(m_txFrame);
+	m_txFrame[7] = checksum >> 8;
+	m_txFrame[8] = checksum & 0x00FF;
+	m_txFrame[9] = DFPLAYER_END;
+	m_txQueued_us = entry.queued_us;
+	m_txPos = 0;
+	m_head = (m_head + 1) % DFPLAYER_QUEUE_SIZE;
+	m_count--;
+}
+
+// feedback frames: same format of the commands. Out of sync bytes are skipped up to the next start byte
+void CDFPlayer::parse(uint8_t data)
+{
+	static const uint8_t header[] = { DFPLAYER_START, DFPLAYER_VERSION, DFPLAYER_LENGTH };
+	if ((m_rxPos < sizeof(header)) && (data != header[m_rxPos])) {
+		m_stats.framingErrors++;
+		m_rxPos = 0;
+		if (DFPLAYER_START != data)
+			return;
+	}
+	m_rxFrame[m_rxPos++] = data;
+	if (m_rxPos < DFPLAYER_FRAME_SIZE)
+		return;
+	m_rxPos = 0;
+	if (DFPLAYER_END != m_rxFrame[9]) {
+		m_stats.framingErrors++;
+		return;
+	}
+	if (frameChecksum(m_rxFrame) != (uint16_t)((m_rxFrame[7] << 8) | m_rxFrame[8])) {
+		m_stats.checksumErrors++;
+		return;
+	}
+	DFPlayerFeedback_t frame;
+	frame.command   = m_rxFrame[3];
+	frame.parameter = (m_rxFrame[5] << 8) | m_rxFrame[6];
+	m_stats.frames++;
+	if ((DFPLAYER_FB_TRACK_FINISHED == frame.command) || (DFPLAYER_FB_USB_FINISHED == frame.command))
+		m_stats.finished++;
+	if (DFPLAYER_FB_ERROR == frame.command) {
+		m_stats.errors++;
+		m_stats.lastError = frame.parameter;
+	}
+	// the oldest frame is lost if nobody reads them
+	if (DFPLAYER_FEEDBACK_SIZE == m_feedbackCount) {
+		m_feedbackHead = (m_feedbackHead + 1) % DFPLAYER_FEEDBACK_SIZE;
+		m_feedbackCount--;
+	}
+	m_feedback[(m_feedbackHead + m_feedbackCount) % DFPLAYER_FEEDBACK_SIZE] = frame;
+	m_feedbackCount++;
+}
@@ -0,0 +1,108 @@
+#pragma once
+#ifndef CDFPLAYER_H
+#define CDFPLAYER_H
+
+#include "HAL.h"
+
+#define DFPLAYER_FRAME_SIZE     10
+#define DFPLAYER_QUEUE_SIZE     8
+#define DFPLAYER_FEEDBACK_SIZE  4
+#define DFPLAYER_BYTE_PERIOD    2   // milliseconds between two bytes (main loop timer). A byte takes 1 ms at 9600 baud
+#define DFPLAYER_COMMAND_GAP    20  // milliseconds between two commands: the DFPlayer drops commands sent back to back
+
+// commands (parameter meaning)
+#define DFPLAYER_CMD_PLAY       0x03 // track
+#define DFPLAYER_CMD_VOLUME     0x06 // 0..30
+#define DFPLAYER_CMD_LOOP       0x08 // track, played in loop
+#define DFPLAYER_CMD_RESET      0x0C
+#define DFPLAYER_CMD_STOP       0x16
+
+// feedback frames sent by the DFPlayer (parameter meaning)
+#define DFPLAYER_FB_CARD_IN        0x3A
+#define DFPLAYER_FB_CARD_OUT       0x3B
+#define DFPLAYER_FB_USB_FINISHED   0x3C // track
+#define DFPLAYER_FB_TRACK_FINISHED 0x3D // track (SD card)
+#define DFPLAYER_FB_ONLINE         0x3F // storage devices
+#define DFPLAYER_FB_ERROR          0x40 // error code (1 busy, 2 sleeping, 3 serial, 4 checksum, 5 track out of range, 6 track not found...)
+#define DFPLAYER_FB_ACK            0x41
+#define DFPLAYER_FB_STATUS         0x42
+#define DFPLAYER_FB_VOLUME         0x43
+
+struct DFPlayerFeedback_t {
+	uint8_t  command;
+	uint16_t parameter;
+};
+
+// counters since the last reset
+struct DFPlayerStats_t {
+	uint32_t queued;          // commands requested
+	uint32_t sent;
+	uint32_t coalesced;       // replaced by a newer command of the same kind before being sent
+	uint32_t dropped;         // queue full: the oldest waiting command is dropped
+	uint8_t  queueMax;        // max queue depth
+	uint32_t latencyMax_us;   // from the request to the last byte on the wire
+	uint64_t latencySum_us;
+	uint32_t frames;          // feedback frames received
+	uint32_t finished;        // tracks finished
+	uint32_t errors;          // error frames
+	uint16_t lastError;
+	uint32_t checksumErrors;
+	uint32_t framingErrors;   // bytes out of a frame, wrong end byte
+};
+
+// Non-blocking driver of the DFPlayer Mini MP3 module. Commands go to a queue and run() (a
+// main loop timer) writes them one byte at a time: a software serial byte is 1 ms of CPU with
+// the interrupts disturbed, a whole command was 10 ms in the middle of the fire and hit
+// handlers. A newer play (or volume) request replaces the queued one of the same kind. The
+// feedback frames of the module are parsed by run() too, and kept for readFeedback()
+class CDFPlayer
+{
+public:
+	CDFPlayer();
+
+	void begin(CHalSerial *serial);
+
+	// false if not queued (no serial port). A full queue drops the oldest waiting command
+	bool send(uint8_t command, uint16_t parameter = 0, bool feedback = false);
+	// one byte out, all the received bytes parsed
+	void run(void);
+	static void runTimer(CDFPlayer *player);
+	// waiting commands, plus the one being sent
+	uint8_t getQueueDepth(void);
+	bool    isIdle(void);
+
+	bool readFeedback(DFPlayerFeedback_t &frame);
+	static const char *feedbackName(uint8_t command);
+
+	DFPlayerStats_t getStats(void);
+	void            resetStats(void);
+	void            printStats(void);
+
+private:
+	struct command_t {
+		uint8_t  command;
+		uint16_t parameter;
+		bool     feedback;
+		uint32_t queued_us;
+	};
+
+	CHalSerial        *m_pSerial;
+	command_t          m_queue[DFPLAYER_QUEUE_SIZE];
+	uint8_t            m_head, m_count;
+	uint8_t            m_txFrame[DFPLAYER_FRAME_SIZE];
+	uint8_t            m_txPos;         // DFPLAYER_FRAME_SIZE -> nothing to send
+	uint32_t           m_txQueued_us;
+	uint32_t           m_lastSent_ms;
+	uint8_t            m_rxFrame[DFPLAYER_FRAME_SIZE];
+	uint8_t            m_rxPos;
+	DFPlayerFeedback_t m_feedback[DFPLAYER_FEEDBACK_SIZE];
+	uint8_t            m_feedbackHead, m_feedbackCount;
+	DFPlayerStats_t    m_stats;
+
+	static uint8_t kind(uint8_t command);
+	void remove(uint8_t index);
+	void startCommand(void);
+	void parse(uint8_t data);
+};
+
+#endif
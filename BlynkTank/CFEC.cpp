@@ -0,0 +1,61 @@
+#include "CFEC.h"
+
+// codeword bits: 0 -> overall parity, 1, 2, 4 -> Hamming parity bits, 3, 5, 6, 7 -> data bits (LSB first)
+static const uint8_t fecEncodeTable[16] = {
+	0x00, 0x0F, 0x33, 0x3C, 0x55, 0x5A, 0x66, 0x69, 0x96, 0x99, 0xA5, 0xAA, 0xC3, 0xCC, 0xF0, 0xFF
+};
+
+// indexed by the received codeword: data nibble (bits 0..3) + FEC_CORRECTED (bit 4) or FEC_UNCORRECTABLE (bit 5)
+static const uint8_t fecDecodeTable[256] = {
+	0x00, 0x10, 0x10, 0x20, 0x10, 0x20, 0x20, 0x11, 0x10, 0x21, 0x21, 0x11, 0x21, 0x11, 0x11, 0x01,
+	0x10, 0x20, 0x20, 0x12, 0x20, 0x14, 0x18, 0x20, 0x21, 0x19, 0x15, 0x21, 0x13, 0x21, 0x21, 0x11,
+	0x10, 0x22, 0x22, 0x12, 0x22, 0x1A, 0x16, 0x22, 0x23, 0x17, 0x1B, 0x23, 0x13, 0x23, 0x23, 0x11,
+	0x22, 0x12, 0x12, 0x02, 0x13, 0x22, 0x22, 0x12, 0x13, 0x23, 0x23, 0x12, 0x03, 0x13, 0x13, 0x23,
+	0x10, 0x24, 0x24, 0x1C, 0x24, 0x14, 0x16, 0x24, 0x25, 0x17, 0x15, 0x25, 0x1D, 0x25, 0x25, 0x11,
+	0x24, 0x14, 0x15, 0x24, 0x14, 0x04, 0x24, 0x14, 0x15, 0x25, 0x05, 0x15, 0x25, 0x14, 0x15, 0x25,
+	0x26, 0x17, 0x16, 0x26, 0x16, 0x26, 0x06, 0x16, 0x17, 0x07, 0x27, 0x17, 0x27, 0x17, 0x16, 0x27,
+	0x1E, 0x26, 0x26, 0x12, 0x26, 0x14, 0x16, 0x26, 0x27, 0x17, 0x15, 0x27, 0x13, 0x27, 0x27, 0x1F,
+	0x10, 0x28, 0x28, 0x1C, 0x28, 0x1A, 0x18, 0x28, 0x29, 0x19, 0x1B, 0x29, 0x1D, 0x29, 0x29, 0x11,
+	0x28, 0x19, 0x18, 0x28, 0x18, 0x28, 0x08, 0x18, 0x19, 0x09, 0x29, 0x19, 0x29, 0x19, 0x18, 0x29,
+	0x2A, 0x1A, 0x1B, 0x2A, 0x1A, 0x0A, 0x2A, 0x1A, 0x1B, 0x2B, 0x0B, 0x1B, 0x2B, 0x1A, 0x1B, 0x2B,
+	0x1E, 0x2A, 0x2A, 0x12, 0x2A, 0x1A, 0x18, 0x2A, 0x2B, 0x19, 0x1B, 0x2B, 0x13, 0x2B, 0x2B, 0x1F,
+	0x2C, 0x1C, 0x1C, 0x0C, 0x1D, 0x2C, 0x2C, 0x1C, 0x1D, 0x2D, 0x2D, 0x1C, 0x0D, 0x1D, 0x1D, 0x2D,
+	0x1E, 0x2C, 0x2C, 0x1C, 0x2C, 0x14, 0x18, 0x2C, 0x2D, 0x19, 0x15, 0x2D, 0x1D, 0x2D, 0x2D, 0x1F,
+	0x1E, 0x2E, 0x2E, 0x1C, 0x2E, 0x1A, 0x16, 0x2E, 0x2F, 0x17, 0x1B, 0x2F, 0x1D, 0x2F, 0x2F, 0x1F,
+	0x0E, 0x1E, 0x1E, 0x2E, 0x1E, 0x2E, 0x2E, 0x1F, 0x1E, 0x2F, 0x2F, 0x1F, 0x2F, 0x1F, 0x1F, 0x0F
+};
+
+// spread the 8 bits of value in the even bits of the result
+static inline uint16_t fecSpread(uint16_t value) {
+	value = (value | (value << 4)) & 0x0F0F;
+	value = (value | (value << 2)) & 0x3333;
+	value = (value | (value << 1)) & 0x5555;
+	return(value);
+}
+
+// inverse of fecSpread: collect the even bits of value
+static inline uint8_t fecCompact(uint16_t value) {
+	value = value & 0x5555;
+	value = (value | (value >> 1)) & 0x3333;
+	value = (value | (value >> 2)) & 0x0F0F;
+	value = (value | (value >> 4)) & 0x00FF;
+	return(value);
+}
+
+uint16_t CFEC::encode(uint8_t data)
+{
+	uint16_t low  = fecEncodeTable[data & 0x0F];
+	uint16_t high = fecEncodeTable[data >> 4];
+	return(fecSpread(low) | (fecSpread(high) << 1));
+}
+
+// returns FEC_OK, FEC_CORRECTED or FEC_UNCORRECTABLE (data not valid)
+uint8_t CFEC::decode(uint16_t codeword, uint8_t &data)
+{
+	uint8_t low  = fecDecodeTable[fecCompact(codeword)];
+	uint8_t high = fecDecodeTable[fecCompact(codeword >> 1)];
+	data = (low & 0x0F) | (high << 4);
+	uint8_t flags = (low | high) >> 4;
+	// uncorrectable (bit 1) wins over corrected (bit 0)
+	return((flags & 0x02) | (flags & ~(flags >> 1) & 0x01));
+}
@@ -0,0 +1,25 @@
+#pragma once
+#ifndef CFEC_H
+#define CFEC_H
+
+#include "HAL.h"
+
+// decode results
+#define FEC_OK            0 // no errors
+#define FEC_CORRECTED     1 // single bit errors corrected
+#define FEC_UNCORRECTABLE 2 // double bit error detected, data not valid
+
+// Forward error correction of the IR hit payloads: extended Hamming (8,4) code (corrects
+// one wrong bit, detects two wrong bits per codeword). A byte is split in two nibbles,
+// every nibble is a codeword and the two codewords are bit interleaved in 16 bits:
+// the two bits of a pulse distance symbol belong to different codewords, so a misread
+// symbol is always corrected.
+// Encode and decode are table lookups and shifts only (constant time, no branches on the data).
+class CFEC
+{
+public:
+	static uint16_t encode(uint8_t data);
+	static uint8_t  decode(uint16_t codeword, uint8_t &data);
+};
+
+#endif
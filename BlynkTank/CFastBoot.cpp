@@ -0,0 +1,160 @@
+#include "CFastBoot.h"
+#include "CConfigStore.h"
+
+CFastBoot::CFastBoot()
+{
+	m_stageCount  = 0;
+	m_cacheSource = BOOT_CACHE_NONE;
+	m_cacheWrites = 0;
+}
+
+uint8_t CFastBoot::startStage(const char *name)
+{
+	if (m_stageCount >= BOOT_STAGES_MAX)
+		return(BOOT_STAGES_MAX);
+	BootStage_t &stage = m_stages[m_stageCount];
+	stage.name      = name;
+	stage.start_us  = halMicros();
+	stage.end_us    = stage.start_us;
+	stage.isRunning = true;
+	return(m_stageCount++);
+}
+
+void CFastBoot::endStage(uint8_t stage)
+{
+	if ((stage >= m_stageCount) || !m_stages[stage].isRunning)
+		return;
+	m_stages[stage].end_us    = halMicros();
+	m_stages[stage].isRunning = false;
+}
+
+uint8_t CFastBoot::getStageCount(void)
+{
+	return(m_stageCount);
+}
+
+BootStage_t CFastBoot::getStage(uint8_t stage)
+{
+	return(m_stages[stage]);
+}
+
+// microseconds since the power on: the stages before setup() (global constructors) are included
+void CFastBoot::print(void)
+{
+	uint32_t ready_us = 0;
+	for (uint8_t i = 0; i < m_stageCount; i++) {
+		const BootStage_t &stage = m_stages[i];
+		if (stage.isRunning) {
+			Serial.printf("boot: %-10s at %5u ms, running\n", stage.name, stage.start_us / 1000);
+			continue;
+		}
+		Serial.printf("boot: %-10s at %5u ms, %5u ms\n", stage.name, stage.start_us / 1000, (stage.end_us - stage.start_us) / 1000);
+		if (stage.end_us > ready_us)
+			ready_us = stage.end_us;
+	}
+	Serial.printf("boot: time to drive %u ms, WiFi link from %s, %u cache writes\n", ready_us / 1000,
+		sourceName(m_cacheSource), m_cacheWrites);
+}
+
+uint8_t CFastBoot::loadLink(const char *ssid, const char *password, halWiFiLink_t &link)
+{
+	WiFiCache_t cache;
+	uint32_t    crc = networkCRC(ssid, password);
+	m_cacheSource = BOOT_CACHE_NONE;
+	if (halRTCRead(BOOT_RTC_OFFSET, &cache, sizeof(cache)) && isValid(cache) && (crc == cache.networkCRC))
+		m_cacheSource = BOOT_CACHE_RTC;
+	else {
+		CHalFile file = halFSOpen(BOOT_WIFI_CACHE_FILE, "r");
+		if (file) {
+			bool isRead = file.read((uint8_t *)&cache, sizeof(cache)) == sizeof(cache);
+			file.close();
+			if (isRead && isValid(cache) && (crc == cache.networkCRC)) {
+				m_cacheSource = BOOT_CACHE_FLASH;
+				// the next reset finds it in the RTC memory
+				halRTCWrite(BOOT_RTC_OFFSET, &cache, sizeof(cache));
+			}
+		}
+	}
+	if (BOOT_CACHE_NONE == m_cacheSource)
+		return(BOOT_CACHE_NONE);
+
+	memcpy(link.bssid, cache.bssid, sizeof(link.bssid));
+	link.channel = cache.channel;
+	link.rssi    = 0;
+	link.ip      = cache.ip;
+	link.gateway = cache.gateway;
+	link.mask    = cache.mask;
+	link.dns     = cache.dns;
+	return(m_cacheSource);
+}
+
+void CFastBoot::storeLink(const char *ssid, const char *password, const halWiFiLink_t &link)
+{
+	WiFiCache_t cache, stored;
+	memset(&cache, 0, sizeof(cache));
+	cache.networkCRC = networkCRC(ssid, password);
+	cache.ip         = link.ip;
+	cache.gateway    = link.gateway;
+	cache.mask       = link.mask;
+	cache.dns        = link.dns;
+	memcpy(cache.bssid, link.bssid, sizeof(cache.bssid));
+	cache.channel    = link.channel;
+	seal(cache);
+
+	if (!halRTCRead(BOOT_RTC_OFFSET, &stored, sizeof(stored)) || (0 != memcmp(&stored, &cache, sizeof(cache))))
+		halRTCWrite(BOOT_RTC_OFFSET, &cache, sizeof(cache));
+
+	// the flash is written only when the access point (or its address) changed
+	bool isSame = false;
+	CHalFile file = halFSOpen(BOOT_WIFI_CACHE_FILE, "r");
+	if (file) {
+		isSame = (file.read((uint8_t *)&stored, sizeof(stored)) == sizeof(stored)) && (0 == memcmp(&stored, &cache, sizeof(cache)));
+		file.close();
+	}
+	if (isSame)
+		return;
+	file = halFSOpen(BOOT_WIFI_CACHE_FILE, "w");
+	if (!file)
+		return;
+	file.write((const uint8_t *)&cache, sizeof(cache));
+	file.close();
+	m_cacheWrites++;
+}
+
+uint8_t CFastBoot::getCacheSource(void)
+{
+	return(m_cacheSource);
+}
+
+uint32_t CFastBoot::getCacheWrites(void)
+{
+	return(m_cacheWrites);
+}
+
+uint32_t CFastBoot::networkCRC(const char *ssid, const char *password)
+{
+	uint32_t crc = CConfigStore::crc32((const uint8_t *)ssid, strlen(ssid));
+	return(CConfigStore::crc32((const uint8_t *)password, strlen(password), crc));
+}
+
+// the random content of the RTC memory at power on fails the CRC
+bool CFastBoot::isValid(const WiFiCache_t &cache)
+{
+	return(CConfigStore::crc32((const uint8_t *)&cache, offsetof(WiFiCache_t, crc)) == cache.crc);
+}
+
+void CFastBoot::seal(WiFiCache_t &cache)
+{
+	cache.crc = CConfigStore::crc32((const uint8_t *)&cache, offsetof(WiFiCache_t, crc));
+}
+
+const char *CFastBoot::sourceName(uint8_t source)
+{
+	switch (source) {
+	case BOOT_CACHE_RTC:
+		return("RTC memory");
+	case BOOT_CACHE_FLASH:
+		return("flash");
+	}
+	return("scan");
+}
@@ -0,0 +1,76 @@
+#pragma once
+#ifndef CFASTBOOT_H
+#define CFASTBOOT_H
+
+#include "HAL.h"
+
+// Fast boot. The link of the last WiFi connection (BSSID and channel of the access point, IP
+// address) is cached in the RTC memory, kept across the resets, and in a file for the power
+// cycles (battery swap). The next boot goes straight to that access point with a static address:
+// no scan of the channels, no DHCP. A cache of another network (SSID or password changed) is not
+// used, a stale one costs BOOT_WIFI_FAST_TIMEOUT (then the scan, and the new link replaces it).
+// The boot stages are timed: every stage has its own start, so the overlapped ones are shown as such.
+//   cache: CRC32 of SSID and password, IP, gateway, mask, DNS (uint32), BSSID (6 bytes), channel,
+//          reserved, CRC32 of the fields before. Same layout in RTC memory and in the file
+#define BOOT_WIFI_CACHE_FILE   "/wifi.bin"
+#define BOOT_RTC_OFFSET        HAL_RTC_RESERVED // bytes
+#define BOOT_WIFI_FAST_TIMEOUT 1000 // milliseconds: then scan and DHCP
+#define BOOT_STAGES_MAX        8
+
+// where the link comes from (loadLink)
+#define BOOT_CACHE_NONE  0
+#define BOOT_CACHE_RTC   1
+#define BOOT_CACHE_FLASH 2
+
+struct WiFiCache_t {
+	uint32_t networkCRC;
+	uint32_t ip;
+	uint32_t gateway;
+	uint32_t mask;
+	uint32_t dns;
+	uint8_t  bssid[6];
+	uint8_t  channel;
+	uint8_t  reserved;
+	uint32_t crc;
+};
+
+struct BootStage_t {
+	const char *name;
+	uint32_t    start_us;
+	uint32_t    end_us;
+	bool        isRunning;
+};
+
+class CFastBoot
+{
+public:
+	CFastBoot();
+
+	// BOOT_STAGES_MAX if there is no room (endStage ignores it)
+	uint8_t startStage(const char *name);
+	void    endStage(uint8_t stage);
+	uint8_t getStageCount(void);
+	BootStage_t getStage(uint8_t stage);
+	// start and duration of the stages, then the time to drive (end of the last stage)
+	void    print(void);
+
+	// RTC first, then the file
+	uint8_t loadLink(const char *ssid, const char *password, halWiFiLink_t &link);
+	// writes only what changed: nothing if the tank reconnected to the same access point
+	void    storeLink(const char *ssid, const char *password, const halWiFiLink_t &link);
+	uint8_t getCacheSource(void);
+	uint32_t getCacheWrites(void); // file writes
+
+private:
+	BootStage_t m_stages[BOOT_STAGES_MAX];
+	uint8_t     m_stageCount;
+	uint8_t     m_cacheSource;
+	uint32_t    m_cacheWrites;
+
+	static uint32_t networkCRC(const char *ssid, const char *password);
+	static bool     isValid(const WiFiCache_t &cache);
+	static void     seal(WiFiCache_t &cache);
+	static const char *sourceName(uint8_t source);
+};
+
+#endif
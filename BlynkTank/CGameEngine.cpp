@@ -0,0 +1,204 @@
+#include "CGameEngine.h"
+
+CGameEngine::CGameEngine()
+{
+	GameRules_t rules;
+	defaultRules(rules);
+	reset(rules, 0);
+}
+
+void CGameEngine::defaultRules(GameRules_t &rules)
+{
+	rules.maxHitPoints     = DEFAULT_MAX_HITPOINT;
+	rules.maxAmmo          = DEFAULT_MAX_AMMO;
+	rules.ammoDamage       = DEFAULT_AMMO_DAMAGE;
+	rules.repairValue      = DEFAULT_REPAIR_VALUE;
+	rules.reloadTime_ms    = DEFAULT_AMMO_RECHARGE_TIME;
+	rules.ammoSpawnTime_ms = DEFAULT_AMMO_SPAWN_TIME;
+}
+
+void CGameEngine::reset(const GameRules_t &rules, uint32_t now_ms)
+{
+	m_rules = rules;
+	m_state.time_ms        = now_ms;
+	m_state.hitPoints      = m_rules.maxHitPoints;
+	m_state.ammo           = m_rules.maxAmmo;
+	m_state.isReloading    = false;
+	m_state.canRespawnAmmo = true;
+	m_state.reloadSteps    = 0;
+	m_state.spawnSteps     = 0;
+}
+
+void CGameEngine::restore(const GameRules_t &rules, const GameState_t &state)
+{
+	m_rules = rules;
+	m_state = state;
+}
+
+GameDelta_t CGameEngine::post(const GameEvent_t &event)
+{
+	return(post(event.time_ms, event.type, event.value));
+}
+
+GameDelta_t CGameEngine::post(uint32_t now_ms, uint8_t type, uint8_t value)
+{
+	m_delta.changed   = 0;
+	m_delta.hitPoints = 0;
+	m_delta.ammo      = 0;
+	stepTo(now_ms);
+	apply(type, value);
+	return(m_delta);
+}
+
+GameDelta_t CGameEngine::advance(uint32_t now_ms)
+{
+	m_delta.changed   = 0;
+	m_delta.hitPoints = 0;
+	m_delta.ammo      = 0;
+	stepTo(now_ms);
+	return(m_delta);
+}
+
+bool CGameEngine::canFire(void)
+{
+	return(!m_state.isReloading && (m_state.ammo > 0));
+}
+
+const GameState_t &CGameEngine::getState(void)
+{
+	return(m_state);
+}
+
+const GameRules_t &CGameEngine::getRules(void)
+{
+	return(m_rules);
+}
+
+// FNV-1a of the state fields
+uint32_t CGameEngine::getChecksum(void)
+{
+	uint8_t data[] = {
+		(uint8_t)m_state.time_ms, (uint8_t)(m_state.time_ms >> 8), (uint8_t)(m_state.time_ms >> 16), (uint8_t)(m_state.time_ms >> 24),
+		m_state.hitPoints, m_state.ammo, (uint8_t)m_state.isReloading, (uint8_t)m_state.canRespawnAmmo,
+		(uint8_t)m_state.reloadSteps, (uint8_t)(m_state.reloadSteps >> 8),
+		(uint8_t)m_state.spawnSteps, (uint8_t)(m_state.spawnSteps >> 8) };
+	uint32_t hash = 2166136261UL;
+	for (uint8_t i = 0; i < sizeof(data); i++) {
+		hash ^= data[i];
+		hash *= 16777619UL;
+	}
+	return(hash);
+}
+
+void CGameEngine::stepTo(uint32_t now_ms)
+{
+	while ((int32_t)(now_ms - m_state.time_ms) >= GAME_STEP_MS)
+		step();
+}
+
+void CGameEngine::step(void)
+{
+	m_state.time_ms += GAME_STEP_MS;
+	if (m_state.isReloading && (0 == --m_state.reloadSteps)) {
+		m_state.isReloading = false;
+		m_delta.changed |= GAME_CHANGED_RELOADING;
+	}
+	if ((m_state.spawnSteps > 0) && (0 == --m_state.spawnSteps)) {
+		setAmmo(m_state.ammo + 1);
+		// spawning until the ammos are full
+		if (m_state.ammo < m_rules.maxAmmo)
+			m_state.spawnSteps = toSteps(m_rules.ammoSpawnTime_ms);
+	}
+}
+
+void CGameEngine::apply(uint8_t type, uint8_t value)
+{
+	switch (type) {
+	case GAME_EVENT_RESET: {
+		uint8_t hitPoints = m_state.hitPoints;
+		uint8_t ammo = m_state.ammo;
+		bool    isReloading = m_state.isReloading;
+		reset(m_rules, m_state.time_ms);
+		m_state.hitPoints = hitPoints;
+		m_state.ammo = ammo;
+		setHitPoints(m_rules.maxHitPoints);
+		setAmmo(m_rules.maxAmmo);
+		if (isReloading)
+			m_delta.changed |= GAME_CHANGED_RELOADING;
+		break;
+	}
+	case GAME_EVENT_FIRE:
+		if (!canFire())
+			break;
+		setAmmo(m_state.ammo - 1);
+		m_state.isReloading = true;
+		m_state.reloadSteps = toSteps(m_rules.reloadTime_ms);
+		// the spawn period restarts at every shot
+		if (m_state.canRespawnAmmo)
+			m_state.spawnSteps = toSteps(m_rules.ammoSpawnTime_ms);
+		m_delta.changed |= GAME_CHANGED_FIRED | GAME_CHANGED_RELOADING;
+		break;
+	case GAME_EVENT_HIT:
+		if (0 == m_state.hitPoints)
+			break;
+		setHitPoints(m_state.hitPoints - value);
+		if (0 == m_state.hitPoints)
+			m_delta.changed |= GAME_CHANGED_DESTROYED;
+		break;
+	case GAME_EVENT_REPAIR:
+		if (m_state.hitPoints == m_rules.maxHitPoints)
+			break;
+		setHitPoints(m_state.hitPoints + m_rules.repairValue);
+		if (m_state.hitPoints == m_rules.maxHitPoints)
+			m_delta.changed |= GAME_CHANGED_REPAIRED;
+		break;
+	case GAME_EVENT_AMMO:
+		setAmmo(m_state.ammo + value);
+		if (m_state.ammo == m_rules.maxAmmo)
+			m_state.spawnSteps = 0;
+		break;
+	case GAME_EVENT_RESPAWN:
+		if (m_state.canRespawnAmmo != (0 != value))
+			m_delta.changed |= GAME_CHANGED_RESPAWN;
+		m_state.canRespawnAmmo = (0 != value);
+		if (!m_state.canRespawnAmmo)
+			m_state.spawnSteps = 0;
+		else if ((m_state.ammo < m_rules.maxAmmo) && (0 == m_state.spawnSteps))
+			m_state.spawnSteps = toSteps(m_rules.ammoSpawnTime_ms);
+		break;
+	}
+}
+
+// clamped to 0..max
+void CGameEngine::setHitPoints(int16_t hitPoints)
+{
+	if (hitPoints < 0)
+		hitPoints = 0;
+	if (hitPoints > m_rules.maxHitPoints)
+		hitPoints = m_rules.maxHitPoints;
+	if (hitPoints == m_state.hitPoints)
+		return;
+	m_delta.hitPoints += hitPoints - m_state.hitPoints;
+	m_delta.changed |= GAME_CHANGED_HITPOINTS;
+	m_state.hitPoints = (uint8_t)hitPoints;
+}
+
+void CGameEngine::setAmmo(int16_t ammo)
+{
+	if (ammo < 0)
+		ammo = 0;
+	if (ammo > m_rules.maxAmmo)
+		ammo = m_rules.maxAmmo;
+	if (ammo == m_state.ammo)
+		return;
+	m_delta.ammo += ammo - m_state.ammo;
+	m_delta.changed |= GAME_CHANGED_AMMO;
+	m_state.ammo = (uint8_t)ammo;
+}
+
+// at least one step
+uint16_t CGameEngine::toSteps(uint16_t milliseconds)
+{
+	uint16_t steps = (milliseconds + GAME_STEP_MS - 1) / GAME_STEP_MS;
+	return((steps > 0) ? steps : 1);
+}
@@ -0,0 +1,105 @@
+#pragma once
+#ifndef CGAMEENGINE_H
+#define CGAMEENGINE_H
+
+#include <stdint.h>
+
+// game rules defaults
+#define DEFAULT_MAX_HITPOINT       200
+#define DEFAULT_AMMO_RECHARGE_TIME 1500 // milliseconds
+#define DEFAULT_AMMO_DAMAGE        40
+#define DEFAULT_MAX_AMMO           20
+#define DEFAULT_REPAIR_VALUE       5
+#define DEFAULT_AMMO_SPAWN_TIME    7000  // milliseconds
+
+// the game timers (reload, ammo spawn) advance in fixed steps: the same events give the same
+// states on the tank and on the host, whatever the main loop timing
+#define GAME_STEP_MS 10
+
+// events (value meaning)
+#define GAME_EVENT_RESET   0 // back to full hit points and ammos
+#define GAME_EVENT_FIRE    1 // fire button: accepted only if loaded (see canFire)
+#define GAME_EVENT_HIT     2 // damage
+#define GAME_EVENT_REPAIR  3 // one repair step (rules repair value)
+#define GAME_EVENT_AMMO    4 // ammos picked up
+#define GAME_EVENT_RESPAWN 5 // 1 -> ammo respawn enabled, 0 -> disabled
+
+// delta flags: what an event (or the time) has changed
+#define GAME_CHANGED_HITPOINTS 0x01
+#define GAME_CHANGED_AMMO      0x02
+#define GAME_CHANGED_RELOADING 0x04
+#define GAME_CHANGED_FIRED     0x08 // a fire event has been accepted
+#define GAME_CHANGED_DESTROYED 0x10 // hit points down to 0
+#define GAME_CHANGED_REPAIRED  0x20 // hit points back to the max
+#define GAME_CHANGED_RESPAWN   0x40
+
+struct GameRules_t {
+	uint8_t  maxHitPoints;
+	uint8_t  maxAmmo;
+	uint8_t  ammoDamage;
+	uint8_t  repairValue;
+	uint16_t reloadTime_ms;
+	uint16_t ammoSpawnTime_ms;
+};
+
+struct GameEvent_t {
+	uint32_t time_ms;
+	uint8_t  type;
+	uint8_t  value;
+};
+
+struct GameState_t {
+	uint32_t time_ms;        // time of the last step
+	uint8_t  hitPoints;
+	uint8_t  ammo;
+	bool     isReloading;
+	bool     canRespawnAmmo;
+	uint16_t reloadSteps;    // steps to the end of the reload
+	uint16_t spawnSteps;     // steps to the next ammo, 0 -> not spawning
+};
+
+struct GameDelta_t {
+	uint8_t changed;         // GAME_CHANGED_xxx flags
+	int16_t hitPoints;       // differences
+	int16_t ammo;
+};
+
+// Game state of a tank (hit points, ammos, reload, ammo respawn, repair). Pure logic, no
+// hardware and no clock: the time comes with the events, so it runs the same way on the tank,
+// in the simulators and in the match replays
+class CGameEngine
+{
+public:
+	CGameEngine();
+
+	static void defaultRules(GameRules_t &rules);
+	void reset(const GameRules_t &rules, uint32_t now_ms);
+	// state saved by a snapshot (match replays)
+	void restore(const GameRules_t &rules, const GameState_t &state);
+
+	// steps the timers up to the event time, then applies the event. Older events are applied now
+	GameDelta_t post(const GameEvent_t &event);
+	GameDelta_t post(uint32_t now_ms, uint8_t type, uint8_t value = 0);
+	// steps the timers up to now
+	GameDelta_t advance(uint32_t now_ms);
+
+	bool               canFire(void);
+	const GameState_t &getState(void);
+	const GameRules_t &getRules(void);
+	// fingerprint of the state (regression tests and replays)
+	uint32_t           getChecksum(void);
+
+private:
+	GameRules_t m_rules;
+	GameState_t m_state;
+	GameDelta_t m_delta;
+
+	void     step(void);
+	void     stepTo(uint32_t now_ms);
+	void     apply(uint8_t type, uint8_t value);
+	void     setHitPoints(int16_t hitPoints);
+	void     setAmmo(int16_t ammo);
+	uint16_t toSteps(uint16_t milliseconds);
+};
+
+#endif
@@ -1,150 +1,412 @@
-#include <Arduino.h>
-#include "Ticker.h"
+#include "HAL.h"
 #include "CIR.h"
 
+// The ESP8266 interrupt handlers have no argument: every receiving transceiver gets a
+// slot and a trampoline that dispatches the interrupt to its own instance.
+HAL_THREAD_LOCAL CIR * volatile rxInstances[MAX_IR_RECEIVERS];
 
-uint16_t txBuffer;
-uint8_t  bitTXed;
-Ticker   txTicker;
-
-uint8_t  rxIntPin;
-int16_t  rxBuffer;
-uint8_t  bitRXed;
-Ticker   rxTicker;
-
-void beginReceivingData(void);
-
-void receiveData(void) {
-	uint16_t buffer;
-	buffer = !digitalRead(rxIntPin);
-	rxBuffer += buffer << bitRXed;
-	bitRXed++;
-	if (10 == bitRXed) {
-		rxTicker.detach();
-		buffer = rxBuffer & 0xFF;
-		uint8_t evenParity = 0;
-		for (int i = 0; i < 8; i++) {
-			if ((buffer & (1 << i)) != 0)
-				evenParity++;
-		}
-		evenParity = evenParity % 2;
-		if (((rxBuffer >> 8) & 0x01) != evenParity) {
-			rxBuffer = NO_VALID_DATA;
-			attachInterrupt(digitalPinToInterrupt(rxIntPin), beginReceivingData, FALLING);
-			return;
-		}
-		if (((rxBuffer >> 9) & 0x01) != 0x01) {
-			attachInterrupt(digitalPinToInterrupt(rxIntPin), beginReceivingData, FALLING);
-			rxBuffer = NO_VALID_DATA;
-			return;
-		}
-		rxBuffer = buffer;
-	}
+// receiver interrupt: only timestamp the edge, the frames are decoded later by CIR::decode() (main loop).
+// Everything is inlined in the IRAM trampoline (micros() is in IRAM too): a flash cache miss
+// during the WiFi activity can't delay the timestamp
+inline __attribute__((always_inline)) void CIR::receiveEdge(void) {
+	uint32_t startCycles = halCycleCount();
+	IREdge_t edge;
+	edge.time_us   = halMicros();
+	edge.level     = halDigitalReadISR(m_rxPin);
+	edge.isrCycles = halCycleCount() - startCycles;
+	m_rxEdges.push(edge);
 }
 
-
-void beginReceivingData(void) {
-	if (NO_VALID_DATA == rxBuffer) {
-		detachInterrupt(digitalPinToInterrupt(rxIntPin));
-		delayMicroseconds(500);
-		bitRXed = 0;
-		rxBuffer = 0;
-		rxTicker.attach_ms(BIT_TIME, receiveData);
-	}
+// the slot is released (NULL) after the interrupt is detached: a late interrupt is ignored
+#define RX_TRAMPOLINE(slot) void ICACHE_RAM_ATTR receiveEdge##slot(void) { \
+	CIR *instance = rxInstances[slot];                                      \
+	if (NULL != instance)                                                   \
+		instance->receiveEdge();                                            \
 }
+RX_TRAMPOLINE(0)
+RX_TRAMPOLINE(1)
+RX_TRAMPOLINE(2)
+RX_TRAMPOLINE(3)
+#if MAX_IR_RECEIVERS > 4
+RX_TRAMPOLINE(4)
+RX_TRAMPOLINE(5)
+RX_TRAMPOLINE(6)
+RX_TRAMPOLINE(7)
+RX_TRAMPOLINE(8)
+RX_TRAMPOLINE(9)
+RX_TRAMPOLINE(10)
+RX_TRAMPOLINE(11)
+#endif
 
+void (* const rxTrampolines[MAX_IR_RECEIVERS])(void) = {
+	receiveEdge0, receiveEdge1, receiveEdge2, receiveEdge3,
+#if MAX_IR_RECEIVERS > 4
+	receiveEdge4, receiveEdge5, receiveEdge6, receiveEdge7,
+	receiveEdge8, receiveEdge9, receiveEdge10, receiveEdge11
+#endif
+};
 
-void sendData(uint8_t txPin) {
-	if (txBuffer & 0x01)
-		analogWrite(txPin, (PWMRANGE / DUTY_CYCLE_DIVIDER));
-	else
-		analogWrite(txPin, 0);
 
-	txBuffer = txBuffer >> 1;
-	bitTXed++;
-	if (12 == bitTXed) {
-		txTicker.detach();
-	}
+// log2 histogram bin (see IR_HISTOGRAM_BINS)
+static uint8_t histogramBin(uint32_t value)
+{
+	if (0 == value)
+		return(0);
+	uint8_t bin = 32 - __builtin_clz(value);
+	return((bin < IR_HISTOGRAM_BINS) ? bin : IR_HISTOGRAM_BINS - 1);
+}
+
+// carrier sense timer callback
+void senseCarrier(CIR *transceiver) {
+	transceiver->senseChannel();
 }
 
 
 CIR::CIR(uint8_t rxPin, uint8_t txPin)
 {
-	pinMode(txPin, OUTPUT);
-	analogWrite(txPin, 0);
-	analogWriteFreq(CARRIER_FREQUENCY);
-	pinMode(rxPin, INPUT_PULLUP);
-	attachInterrupt(digitalPinToInterrupt(rxPin), beginReceivingData, FALLING);
-	rxIntPin = rxPin;
 	m_rxPin = rxPin;
 	m_txPin = txPin;
-	m_receivedData = NO_VALID_DATA;
-	rxBuffer = NO_VALID_DATA;
+	m_rxSlot = IR_NO_PIN;
 	m_isTransmittingCarrier = false;
+	m_isDecodingFrame = false;
+	m_frameProtocol = IR_PROTOCOL_LEGACY;
+	m_txProtocol = IR_PROTOCOL_LEGACY;
+	m_isAutoProtocol = false;
+	m_frameTXProtocol = IR_PROTOCOL_LEGACY;
+	m_txBuffer = 0;
+	m_txSymbols = 0;
+	m_frameSymbols = 0;
+	m_isCarrierSense = false;
+	m_csmaDeadline_us = CSMA_DEADLINE_US;
+	m_isTxPending = false;
+	m_isTxDeferred = false;
+	m_txRequest_us = 0;
+	m_backoffWindow = CSMA_MIN_WINDOW;
+	m_txGroupCount = 0;
+	m_lastEdge_us = halMicros() - CSMA_IFS_US;
+	resetStats();
+
+	if (IR_NO_PIN != txPin) {
+		// the carrier generator doesn't touch the PWM frequency (motors)
+		halPinMode(txPin, OUTPUT);
+		halDigitalWrite(txPin, LOW);
+		halCarrierBegin(CARRIER_FREQUENCY);
+	}
+
+	if (IR_NO_PIN != rxPin) {
+		// look for a free interrupt trampoline
+		for (uint8_t i = 0; i < MAX_IR_RECEIVERS; i++) {
+			if (NULL == rxInstances[i]) {
+				m_rxSlot = i;
+				rxInstances[i] = this;
+				break;
+			}
+		}
+		if (IR_NO_PIN == m_rxSlot)
+			m_rxPin = IR_NO_PIN; // too many receivers
+		else {
+			halPinMode(rxPin, INPUT_PULLUP);
+			startReceiver();
+		}
+	}
 }
 
 CIR::~CIR()
 {
-	detachInterrupt(digitalPinToInterrupt(m_rxPin));
+	if (IR_NO_PIN != m_rxSlot) {
+		stopReceiver();
+		rxInstances[m_rxSlot] = NULL;
+	}
 
-	if (isSendingData())
-		txTicker.detach();
-	if (rxTicker.active())
-		rxTicker.detach();
+	// a frame already handed to the carrier train ends by itself
+	m_txTicker.detach();
+	m_isTxPending = false;
+}
+
+void CIR::startReceiver(void)
+{
+	if (IR_NO_PIN != m_rxSlot)
+		halAttachInterrupt(m_rxPin, rxTrampolines[m_rxSlot], CHANGE);
+}
+
+void CIR::stopReceiver(void)
+{
+	if (IR_NO_PIN != m_rxSlot)
+		halDetachInterrupt(m_rxPin);
 }
 
 bool CIR::sendByte(uint8_t data)
+{
+	if (!prepareFrame(data, m_txProtocol))
+		return(false);
+	CIR *group[] = { this };
+	requestFrames(group, 1);
+	return(true);
+}
+
+// 16 bits frame, pulse distance protocol only (e.g. FEC coded hits)
+bool CIR::sendWord(uint16_t data)
+{
+	if (IR_PROTOCOL_LEGACY == m_txProtocol)
+		return(false);
+	if (!prepareFrame(data, IR_PROTOCOL_PD_WORD))
+		return(false);
+	CIR *group[] = { this };
+	requestFrames(group, 1);
+	return(true);
+}
+
+// the whole frame goes to the carrier train: its edges are timed by the hardware, a busy loop()
+// doesn't stretch the marks and the spaces. The first mark (start bit) starts now
+void CIR::startFrame(void)
+{
+	uint32_t durations[HAL_CARRIER_TRAIN_MAX];
+	uint8_t  count = 0;
+	uint32_t data = m_txBuffer;
+	if (IR_PROTOCOL_LEGACY != m_frameTXProtocol) {
+		// the next mark starts a symbol time after the start of this one, the frame gap at the end
+		durations[count++] = PD_MARK_US;
+		for (uint8_t i = 0; i < m_txSymbols; i++) {
+			durations[count++] = PD_SYMBOL_US + (data & 0x03) * PD_SYMBOL_STEP_US - PD_MARK_US;
+			durations[count++] = PD_MARK_US;
+			data = data >> 2;
+		}
+		durations[count++] = PD_FRAME_GAP_US;
+	}
+	else {
+		// runs of equal bits, the start bit (carrier on) first. The stop bit is the last mark
+		bool level = true;
+		durations[count++] = 0;
+		for (uint8_t i = 0; i < FRAME_BITS; i++) {
+			bool bit = data & 0x01;
+			if (bit != level) {
+				durations[count++] = 0;
+				level = bit;
+			}
+			durations[count - 1] += BIT_TIME_US;
+			data = data >> 1;
+		}
+	}
+	if (!halCarrierTrain(m_txPin, durations, count))
+		m_stats.txDropped++;
+}
+
+// the frames of the group are prepared: send them now or, with carrier sense enabled, as
+// soon as the channel is free. This transceiver is the leader: its timer runs the backoff
+void CIR::requestFrames(CIR *transceivers[], uint8_t count)
+{
+	m_txGroupCount = count;
+	for (uint8_t i = 0; i < count; i++) {
+		m_txGroup[i] = transceivers[i];
+		transceivers[i]->m_isTxPending = true;
+	}
+	m_txRequest_us  = halMicros();
+	m_isTxDeferred  = false;
+	m_backoffWindow = CSMA_MIN_WINDOW;
+	if (m_isCarrierSense)
+		senseChannel();
+	else
+		startFrames();
+}
+
+// start the frames of the group back to back
+void CIR::startFrames(void)
+{
+	uint32_t latency = halMicros() - m_txRequest_us;
+	m_stats.txFrames++;
+	if (m_isTxDeferred)
+		m_stats.txDeferred++;
+	m_stats.txLatency_us += latency;
+	if (latency > m_stats.txLatencyMax_us)
+		m_stats.txLatencyMax_us = latency;
+
+	for (uint8_t i = 0; i < m_txGroupCount; i++)
+		m_txGroup[i]->m_isTxPending = false;
+	for (uint8_t i = 0; i < m_txGroupCount; i++)
+		m_txGroup[i]->startFrame();
+}
+
+// carrier sense timer callback (and first check of the send request). The timers run in the
+// system task, never in the middle of loop(): the frame decoder can be used here
+void CIR::senseChannel(void)
+{
+	bool isBusy = false;
+	for (uint8_t i = 0; i < m_txGroupCount; i++)
+		isBusy = isBusy || m_txGroup[i]->isChannelBusy();
+	if (!isBusy) {
+		startFrames();
+		return;
+	}
+
+	m_stats.txBackoffs++;
+	m_isTxDeferred = true;
+	if ((halMicros() - m_txRequest_us) >= m_csmaDeadline_us) {
+		// too late: the shot is lost. The backoff timer is stopped too: a one shot stays active
+		// until detach(), the transceiver would be sending forever
+		m_stats.txDropped++;
+		for (uint8_t i = 0; i < m_txGroupCount; i++)
+			m_txGroup[i]->m_isTxPending = false;
+		m_txTicker.detach();
+		return;
+	}
+	// random backoff, the window doubles at every retry. A busy loop() delays the callback: the
+	// slot gets longer, the delay counts against the deadline (see CSMA_SLOT_US)
+	uint32_t slots = 1 + halRandom(m_backoffWindow);
+	if (m_backoffWindow < CSMA_MAX_WINDOW)
+		m_backoffWindow = m_backoffWindow * 2;
+	m_txTicker.once_us(slots * CSMA_SLOT_US, senseCarrier, this);
+}
+
+// listen before talk: the deadline (microseconds) is the max delay of a frame, after it the
+// frame is dropped
+void CIR::setCarrierSense(bool enable, uint32_t deadline_us)
+{
+	m_isCarrierSense  = enable;
+	m_csmaDeadline_us = deadline_us;
+}
+
+// a frame is being received or the last edge is too recent (the channel may be in the
+// middle of a frame gap). A transmit only transceiver can't sense the channel
+bool CIR::isChannelBusy(void)
+{
+	if (IR_NO_PIN == m_rxPin)
+		return(false);
+	if (isReceivingData() || detectCarrier())
+		return(true);
+	return((halMicros() - m_lastEdge_us) < CSMA_IFS_US);
+}
+
+// fire all the transceivers at once (e.g. the two barrels of the Turret_X).
+// Nothing is sent if any of them is busy
+bool CIR::sendByteAll(CIR *transceivers[], uint8_t count, uint8_t data)
+{
+	return(sendAll(transceivers, count, data, false));
+}
+
+bool CIR::sendWordAll(CIR *transceivers[], uint8_t count, uint16_t data)
+{
+	return(sendAll(transceivers, count, data, true));
+}
+
+bool CIR::sendAll(CIR *transceivers[], uint8_t count, uint16_t data, bool word)
+{
+	if ((0 == count) || (count > MAX_IR_GROUP))
+		return(false);
+	// all the barrels use the same protocol: the lowest one
+	uint8_t protocol = IR_PROTOCOL_PD;
+	for (uint8_t i = 0; i < count; i++) {
+		if ((IR_NO_PIN == transceivers[i]->m_txPin) || transceivers[i]->isSendingData())
+			return(false);
+		if (transceivers[i]->m_txProtocol < protocol)
+			protocol = transceivers[i]->m_txProtocol;
+	}
+	if (word) {
+		if (IR_PROTOCOL_LEGACY == protocol)
+			return(false);
+		protocol = IR_PROTOCOL_PD_WORD;
+	}
+	for (uint8_t i = 0; i < count; i++)
+		transceivers[i]->prepareFrame(data, protocol);
+	transceivers[0]->requestFrames(transceivers, count);
+	return(true);
+}
+
+void CIR::setProtocol(uint8_t protocol)
+{
+	m_isAutoProtocol = (IR_PROTOCOL_AUTO == protocol);
+	if (m_isAutoProtocol)
+		m_txProtocol = (m_stats.legacyFrames > 0) ? IR_PROTOCOL_LEGACY : IR_PROTOCOL_PD;
+	else
+		m_txProtocol = protocol;
+}
+
+// protocol used by the transmitter
+uint8_t CIR::getProtocol(void)
+{
+	return(m_txProtocol);
+}
+
+bool CIR::prepareFrame(uint16_t data, uint8_t protocol)
 {
 	uint16_t parity; // even
+	if (IR_NO_PIN == m_txPin)
+		return(false);
 	// already sending data
 	if (isSendingData())
-		return false;
+		return(false);
 
 	if (m_isTransmittingCarrier)
 		transmitCarrier(false);
 
+	m_frameTXProtocol = protocol;
+	if (IR_PROTOCOL_PD_WORD == protocol) {
+		// version nibble + data (no check symbol: the data is FEC coded)
+		m_txBuffer = IR_PROTOCOL_PD_WORD | ((uint32_t)data << 4);
+		m_txSymbols = PD_WORD_SYMBOLS;
+		return(true);
+	}
+	data = data & 0xFF;
+	if (IR_PROTOCOL_PD == protocol) {
+		// version nibble + data + check symbol
+		m_txBuffer = IR_PROTOCOL_PD | (data << 4);
+		uint8_t check = 0;
+		for (uint8_t i = 0; i < PD_BYTE_SYMBOLS - 1; i++)
+			check += (m_txBuffer >> (i * 2)) & 0x03;
+		m_txBuffer |= (uint32_t)(check & 0x03) << ((PD_BYTE_SYMBOLS - 1) * 2);
+		m_txSymbols = PD_BYTE_SYMBOLS;
+		return(true);
+	}
+
 	parity = 0;
 	for (uint8_t i = 0; i < 8; i++) {
 		parity += (data >> i) & 0x01;
 	}
 	parity = parity % 2;
-	bitTXed = 0;
-	txBuffer = data;
+	m_txBuffer = data;
 	// Start bit + data + parity (even) + stop bit (1)
-	txBuffer = 1 + (txBuffer << 1) + (parity << 9) + 0x0400;
-	txTicker.attach_ms(BIT_TIME, sendData, m_txPin);
+	m_txBuffer = 1 + (m_txBuffer << 1) + (parity << 9) + 0x0400;
 	return(true);
+}
 
+// sending a frame or waiting for a free channel
+bool CIR::isSendingData(void)
+{
+	return (halCarrierTrainActive(m_txPin) || m_isTxPending);
+}
 
-
+bool CIR::hasTransmitter(void)
+{
+	return(IR_NO_PIN != m_txPin);
 }
 
-bool CIR::isSendingData(void)
+bool CIR::hasReceiver(void)
 {
-	return (txTicker.active());
+	return(IR_NO_PIN != m_rxPin);
 }
 
 bool CIR::transmitCarrier(bool enable)
 {
-	if (isSendingData() || isReceivingData())
+	if ((IR_NO_PIN == m_txPin) || isSendingData() || isReceivingData())
 		return(false);
 
 	if (enable) {
-		detachInterrupt(digitalPinToInterrupt(m_rxPin));
-		analogWrite(m_txPin, (PWMRANGE / DUTY_CYCLE_DIVIDER));
+		stopReceiver();
+		halCarrierWrite(m_txPin, true);
 		m_isTransmittingCarrier = true;
 	}
 	else {
-		analogWrite(m_txPin, 0);
+		halCarrierWrite(m_txPin, false);
 		m_isTransmittingCarrier = false;
-		attachInterrupt(digitalPinToInterrupt(m_rxPin), beginReceivingData, FALLING);
+		startReceiver();
 	}
 	return(true);
 }
 
 bool CIR::detectCarrier(void)
 {
-	uint8_t value = digitalRead(m_rxPin);
+	if (IR_NO_PIN == m_rxPin)
+		return(false);
+	uint8_t value = halDigitalRead(m_rxPin);
 	if (value != 0)
 		return(false);
 	return(true);
@@ -153,26 +415,248 @@ bool CIR::detectCarrier(void)
 
 bool CIR::available(void)
 {
-//	if (NO_VALID_DATA == m_receivedData)
-	if ((NO_VALID_DATA == rxBuffer) || isReceivingData())
+	decode();
+	return(!m_receivedData.isEmpty());
+}
+
+// oldest received byte (call it until NO_VALID_DATA to get all the queued bytes).
+// The 16 bits frames are skipped: use receiveFrame() to get them
+int16_t CIR::receiveByte(void)
+{
+	IRFrame_t frame;
+	while (receiveFrame(frame)) {
+		if (IR_PROTOCOL_PD_WORD != frame.protocol)
+			return(frame.data);
+	}
+	return (NO_VALID_DATA);
+}
+
+// oldest received frame, of any protocol
+bool CIR::receiveFrame(IRFrame_t &frame)
+{
+	decode();
+	return(m_receivedData.pop(frame));
+}
+
+bool CIR::isReceivingData(void)
+{
+	decode();
+	return (m_isDecodingFrame);
+}
+
+IRStats_t CIR::getStats(void)
+{
+	decode();
+	m_stats.edgeOverflows  = m_rxEdges.getDrops();
+	m_stats.frameOverflows = m_receivedData.getDrops();
+	return(m_stats);
+}
+
+void CIR::resetStats(void)
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+	m_rxEdges.resetDrops();
+	m_receivedData.resetDrops();
+}
+
+// decode all the edges timestamped by the interrupt
+void CIR::decode(void)
+{
+	IREdge_t edge;
+	while (m_rxEdges.pop(edge)) {
+		m_stats.isrCount++;
+		if (edge.isrCycles > m_stats.isrMaxCycles)
+			m_stats.isrMaxCycles = edge.isrCycles;
+		m_stats.isrCyclesHistogram[histogramBin(edge.isrCycles)]++;
+		decodeEdge(edge.time_us, edge.level, edge.isrCycles);
+	}
+
+	// no more edges: the frame is over when all the bits are elapsed
+	if (m_isDecodingFrame) {
+		uint32_t now = halMicros();
+		if (IR_PROTOCOL_PD == m_frameProtocol) {
+			if ((now - m_lastMark_us) > PD_TIMEOUT_US) {
+				m_isDecodingFrame = false;
+				// unknown version: the frame length is unknown too
+				if (0xFF == m_frameSymbols)
+					m_stats.versionErrors++;
+				else
+					m_stats.framingErrors++;
+			}
+		}
+		else if ((now - m_frameStart_us) >= (uint32_t)FRAME_BITS * BIT_TIME_US) {
+			sampleFrameBits(now);
+			endFrame();
+		}
+	}
+}
+
+void CIR::decodeEdge(uint32_t time_us, uint8_t level, uint16_t isrCycles)
+{
+	m_lastEdge_us = time_us;
+	if (m_isDecodingFrame) {
+		m_frameISRCycles += isrCycles;
+		if (IR_PROTOCOL_PD == m_frameProtocol) {
+			if (decodePulseDistance(time_us, level))
+				return;
+			// broken frame: this edge may be the start of a new one
+		}
+		// a short first mark is the start of a pulse distance frame
+		else if ((HIGH == level) && (1 == m_frameBit) && ((time_us - m_frameStart_us) < PD_MAX_MARK_US)) {
+			m_frameProtocol = IR_PROTOCOL_PD;
+			m_lastMark_us   = m_frameStart_us;
+			m_frameBit      = 0;
+			m_frameData     = 0;
+			m_frameSymbols  = PD_BYTE_SYMBOLS; // until the version nibble is decoded
+			return;
+		}
+		else {
+			// the carrier starts are on the bit time grid
+			if (LOW == level) {
+				uint32_t offset = (time_us - m_frameStart_us) % BIT_TIME_US;
+				recordEdgeJitter((offset < BIT_TIME_US / 2) ? offset : BIT_TIME_US - offset);
+			}
+			// the bits elapsed before this edge have the previous level
+			sampleFrameBits(time_us);
+			m_frameLevel = level;
+			if (m_frameBit < FRAME_BITS)
+				return;
+			endFrame();
+		}
+	}
+
+	// a falling edge (carrier detected) is a start bit (or the first mark of a pulse distance frame)
+	if (LOW == level) {
+		m_isDecodingFrame = true;
+		m_frameProtocol   = IR_PROTOCOL_LEGACY;
+		m_frameStart_us   = time_us;
+		m_frameLevel      = level;
+		m_frameBit        = 1;
+		m_frameData       = 0x01;
+		m_frameISRCycles  = isrCycles;
+	}
+}
+
+// pulse distance frame: only the mark starts (falling edges) are used, their delay is the same
+// for all the marks while the TSOP output pulse width changes with the signal strength.
+// Returns false if the frame is broken
+bool CIR::decodePulseDistance(uint32_t time_us, uint8_t level)
+{
+	if (LOW != level)
+		return(true);
+
+	uint32_t distance = time_us - m_lastMark_us;
+	m_lastMark_us = time_us;
+	if (distance < PD_SYMBOL_US - PD_SYMBOL_STEP_US / 2) {
+		m_isDecodingFrame = false;
+		m_stats.framingErrors++;
 		return(false);
+	}
+	uint32_t symbol = (distance - (PD_SYMBOL_US - PD_SYMBOL_STEP_US / 2)) / PD_SYMBOL_STEP_US;
+	if (symbol > 0x03) {
+		m_isDecodingFrame = false;
+		m_stats.framingErrors++;
+		return(false);
+	}
+	int32_t error = (int32_t)(distance - (PD_SYMBOL_US + symbol * PD_SYMBOL_STEP_US));
+	recordEdgeJitter((error < 0) ? -error : error);
+	if (m_frameBit < 16)
+		m_frameData |= symbol << (m_frameBit * 2);
+	m_frameBit++;
+	// the version nibble tells the frame length
+	if (2 == m_frameBit) {
+		if (IR_PROTOCOL_PD_WORD == m_frameData)
+			m_frameSymbols = PD_WORD_SYMBOLS;
+		else if (IR_PROTOCOL_PD != m_frameData)
+			m_frameSymbols = 0xFF; // newer protocol: wait for the end of the frame
+	}
+	if (m_frameSymbols == m_frameBit)
+		endFrame();
 	return(true);
 }
 
-int16_t CIR::receiveByte(void)
+void CIR::recordEdgeJitter(uint32_t jitter_us)
 {
-	if (isReceivingData())
-		return (NO_VALID_DATA);
+	m_stats.edgeJitterHistogram[histogramBin(jitter_us)]++;
+	if (jitter_us > m_stats.edgeJitterMax_us)
+		m_stats.edgeJitterMax_us = jitter_us;
+}
 
-	int16_t temp = rxBuffer;
-	if (NO_VALID_DATA != rxBuffer) {
-		rxBuffer = NO_VALID_DATA;
-		attachInterrupt(digitalPinToInterrupt(m_rxPin), beginReceivingData, FALLING);
+// sample (in the middle of the bit time) all the bits elapsed before time_us
+void CIR::sampleFrameBits(uint32_t time_us)
+{
+	uint32_t elapsed = time_us - m_frameStart_us;
+	while ((m_frameBit < FRAME_BITS) && (elapsed > (uint32_t)m_frameBit * BIT_TIME_US + BIT_TIME_US / 2)) {
+		// rx pin low -> carrier detected -> bit 1
+		if (LOW == m_frameLevel)
+			m_frameData |= 1 << m_frameBit;
+		m_frameBit++;
 	}
-	return(temp);
 }
 
-bool CIR::isReceivingData(void)
+void CIR::endFrame(void)
+{
+	m_isDecodingFrame = false;
+	m_stats.lastFrameISRCycles = m_frameISRCycles;
+	m_stats.frameISRCycles += m_frameISRCycles;
+
+	if (IR_PROTOCOL_PD == m_frameProtocol)
+		endPulseDistanceFrame();
+	else
+		endLegacyFrame();
+}
+
+void CIR::endPulseDistanceFrame(void)
+{
+	IRFrame_t frame;
+	frame.protocol = m_frameData & 0x0F;
+	// a newer protocol version: the payload can't be decoded
+	if ((IR_PROTOCOL_PD != frame.protocol) && (IR_PROTOCOL_PD_WORD != frame.protocol)) {
+		m_stats.versionErrors++;
+		return;
+	}
+	if (IR_PROTOCOL_PD_WORD == frame.protocol)
+		frame.data = (m_frameData >> 4) & 0xFFFF;
+	else {
+		uint8_t check = 0;
+		for (uint8_t i = 0; i < PD_BYTE_SYMBOLS - 1; i++)
+			check += (m_frameData >> (i * 2)) & 0x03;
+		if ((check & 0x03) != (m_frameData >> ((PD_BYTE_SYMBOLS - 1) * 2))) {
+			m_stats.parityErrors++;
+			return;
+		}
+		frame.data = (m_frameData >> 4) & 0xFF;
+	}
+	m_stats.framesReceived++;
+	m_receivedData.push(frame);
+}
+
+void CIR::endLegacyFrame(void)
 {
-	return (rxTicker.active());
+	uint8_t data = (m_frameData >> 1) & 0xFF;
+	uint8_t evenParity = 0;
+	for (int i = 0; i < 8; i++) {
+		if ((data & (1 << i)) != 0)
+			evenParity++;
+	}
+	evenParity = evenParity % 2;
+	if (((m_frameData >> 9) & 0x01) != evenParity) {
+		m_stats.parityErrors++;
+		return;
+	}
+	if (((m_frameData >> 10) & 0x01) != 0x01) {
+		m_stats.framingErrors++;
+		return;
+	}
+	m_stats.framesReceived++;
+	m_stats.legacyFrames++;
+	// an older firmware is shooting: it can decode only the legacy frames
+	if (m_isAutoProtocol)
+		m_txProtocol = IR_PROTOCOL_LEGACY;
+
+	// queue full -> the frame is dropped (counted as frame overflow)
+	IRFrame_t frame;
+	frame.data     = data;
+	frame.protocol = IR_PROTOCOL_LEGACY;
+	m_receivedData.push(frame);
 }
@@ -2,10 +2,113 @@
 #ifndef CIR_H
 #define CIR_H
 
-#define CARRIER_FREQUENCY 38000 // hz
+#include "CSPSCQueue.h"
+
+#define CARRIER_FREQUENCY 38000 // hz, own generator (halCarrierBegin): the motor PWM frequency is free
 #define BIT_TIME          1     // ms
+#define BIT_TIME_US       (BIT_TIME * 1000)
 #define NO_VALID_DATA     -1    // no data in the receive buffer
-#define DUTY_CYCLE_DIVIDER 2    // PWM duty cycle divider
+#define IR_NO_PIN         0xFF  // rx or tx pin not used (transmit only or receive only transceiver)
+
+// protocol versions. The receiver decodes all of them, the transmitter uses the one set by setProtocol()
+#define IR_PROTOCOL_LEGACY  0    // 1 ms bits, 11 ms frame. Used by the older firmwares
+#define IR_PROTOCOL_PD      1    // pulse distance, 2 bits per pulse, 8 bits payload, 4.9..7.3 ms frame
+#define IR_PROTOCOL_PD_WORD 2    // pulse distance, 16 bits payload (FEC coded hits), 6.3..12.3 ms frame
+#define IR_PROTOCOL_AUTO    0xFF // pulse distance until a legacy frame is received (an older firmware is in the arena)
+
+// pulse distance frame: one mark (carrier burst) of PD_MARK_US per symbol, plus the first one. The distance
+// between the starts of two marks is a 2 bits symbol: PD_SYMBOL_US + symbol * PD_SYMBOL_STEP_US.
+// Symbols (LSB first):
+//   IR_PROTOCOL_PD      -> protocol version nibble (2), data (4), check (1) = sum of the other symbols
+//   IR_PROTOCOL_PD_WORD -> protocol version nibble (2), data (8). The data must be FEC coded (CFEC)
+// TSOP38238 limits: bursts and gaps of at least 10 carrier cycles (263 us), no long bursts
+#define PD_MARK_US          300
+#define PD_SYMBOL_US        600
+#define PD_SYMBOL_STEP_US   200
+#define PD_BYTE_SYMBOLS     7
+#define PD_WORD_SYMBOLS     10
+#define PD_FRAME_GAP_US     2000 // carrier off after the frame, before the next one
+// the first mark of a frame tells the protocol: a short one is a pulse distance mark, a long one a legacy start bit
+#define PD_MAX_MARK_US      650
+// no mark for this time -> the pulse distance frame is broken
+#define PD_TIMEOUT_US       (PD_SYMBOL_US + 4 * PD_SYMBOL_STEP_US)
+
+// max number of receiving transceivers (one interrupt trampoline each). The host simulators
+// run several tanks on the same board
+#ifdef ARDUINO
+#define MAX_IR_RECEIVERS  4
+#else
+#define MAX_IR_RECEIVERS  12
+#endif
+
+// max transceivers firing together (sendByteAll, sendWordAll)
+#define MAX_IR_GROUP      4
+
+// carrier sense multiple access (setCarrierSense): before transmitting, the channel must be
+// free (no carrier, no frame being decoded) for CSMA_IFS_US, longer than any gap inside a frame.
+// If it's busy the transmitter waits a random number of slots, the random window doubles at
+// every busy retry. The frame is dropped if the channel is not free before the deadline.
+// The backoff runs on a software timer (system task): a slot ends late by up to the longest loop()
+// pass. The slots are not aligned among the tanks, so the late sense is just a longer wait: the
+// channel is sensed and the frame started in the same callback (IRChannelSim "busy 8 CSMA")
+#define CSMA_IFS_US          1500
+#define CSMA_SLOT_US         500
+#define CSMA_MIN_WINDOW      4    // slots
+#define CSMA_MAX_WINDOW      64   // slots
+#define CSMA_DEADLINE_US     50000
+
+// frame: start bit (1) + 8 data bits + parity bit (even) + stop bit (1)
+#define FRAME_BITS        11
+
+// receiver edge queue, filled by the interrupt and emptied by the decoder (power of 2).
+// A frame has up to 12 edges: 128 edges are about 10 frames received while the main loop is busy
+#define RX_EDGE_QUEUE_SIZE  128
+
+// received frames queue, filled by the decoder and emptied by receiveByte (power of 2)
+#define RX_FRAME_QUEUE_SIZE 16
+
+// receiver timing histograms: bin 0 -> value 0, bin n -> values 2^(n-1)..2^n - 1, last bin -> all the bigger ones
+#define IR_HISTOGRAM_BINS   16
+
+// received frame
+struct IRFrame_t {
+	uint16_t data;
+	uint8_t  protocol;
+};
+
+// edge timestamped by the receiver interrupt
+struct IREdge_t {
+	uint32_t time_us;
+	uint16_t isrCycles;  // interrupt duration
+	uint8_t  level;      // rx pin level after the edge
+};
+
+// receiver and transmitter statistics. Interrupt times are in CPU cycles (HAL_CPU_MHZ cycles per microsecond)
+struct IRStats_t {
+	uint32_t framesReceived;     // valid frames decoded
+	uint32_t parityErrors;       // frames discarded, wrong parity bit or check symbol
+	uint32_t framingErrors;      // frames discarded, wrong stop bit or broken pulse distance frame
+	uint32_t versionErrors;      // pulse distance frames discarded, unknown protocol version
+	uint32_t legacyFrames;       // valid frames decoded with the legacy protocol
+	uint32_t edgeOverflows;      // edges lost, edge queue full
+	uint32_t frameOverflows;     // valid frames lost, frame queue full
+	uint32_t isrCount;           // receiver interrupts (one per edge)
+	uint32_t isrMaxCycles;       // longest receiver interrupt
+	uint32_t lastFrameISRCycles; // receiver interrupt time spent for the last frame
+	uint64_t frameISRCycles;     // receiver interrupt time spent for all the decoded frames
+	uint32_t txFrames;           // frames (or group of frames, sendByteAll) transmitted
+	uint32_t txDeferred;         // frames transmitted after a busy channel
+	uint32_t txBackoffs;         // busy channel sensed
+	uint32_t txDropped;          // frames dropped: channel busy until the deadline, or no free carrier train
+	uint32_t txLatencyMax_us;    // longest send request -> start of the transmission
+	uint64_t txLatency_us;       // send request -> start of the transmission, all the frames
+	uint32_t isrCyclesHistogram[IR_HISTOGRAM_BINS];   // receiver interrupt duration (CPU cycles)
+	// the real time of an edge is unknown to the receiver: the interrupt entry latency is seen as
+	// the distance of the carrier starts from their nominal time (previous start + symbol or bit time).
+	// The jitter of the transmitter and of the TSOP is included
+	uint32_t edgeJitterHistogram[IR_HISTOGRAM_BINS];  // microseconds
+	uint32_t edgeJitterMax_us;
+};
 
 class CIR
 {
@@ -15,20 +118,90 @@ public:
 
 	bool sendByte(uint8_t data);
 	bool isSendingData(void);
+	static bool sendByteAll(CIR *transceivers[], uint8_t count, uint8_t data);
+	bool sendWord(uint16_t data);
+	static bool sendWordAll(CIR *transceivers[], uint8_t count, uint16_t data);
+
+	void    setProtocol(uint8_t protocol);
+	uint8_t getProtocol(void);
+
+	void setCarrierSense(bool enable, uint32_t deadline_us = CSMA_DEADLINE_US);
+	bool isChannelBusy(void);
+
+	bool hasTransmitter(void);
+	bool hasReceiver(void);
 
 	bool transmitCarrier(bool enable);
 	bool detectCarrier(void);
 
 	bool    available(void);
 	int16_t receiveByte(void);
+	bool    receiveFrame(IRFrame_t &frame);
 	bool    isReceivingData(void);
 
+	IRStats_t getStats(void);
+	void      resetStats(void);
+
+	// called by the interrupt trampolines and by the tx timer
+	inline __attribute__((always_inline)) void receiveEdge(void);
+	void senseChannel(void);
+
 private:
 	uint8_t m_txPin;
 	uint8_t m_rxPin;
-	int16_t m_receivedData;
+	uint8_t m_rxSlot;   // interrupt trampoline used
 	bool    m_isTransmittingCarrier;
+
+	// transmitter
+	uint8_t   m_txProtocol;
+	bool      m_isAutoProtocol;
+	uint8_t   m_frameTXProtocol; // protocol of the frame being sent
+	uint32_t  m_txBuffer;
+	uint8_t   m_txSymbols;       // pulse distance: symbols of the frame being sent
+	CHalTimer m_txTicker;        // carrier sense backoff (the frames are sent by halCarrierTrain)
+
+	// carrier sense: the first transceiver of the group senses the channel and starts all the frames
+	bool      m_isCarrierSense;
+	uint32_t  m_csmaDeadline_us;
+	bool      m_isTxPending;     // frame prepared, waiting for a free channel
+	bool      m_isTxDeferred;
+	uint32_t  m_txRequest_us;
+	uint8_t   m_backoffWindow;
+	CIR      *m_txGroup[MAX_IR_GROUP];
+	uint8_t   m_txGroupCount;
+
+	// receiver: edges timestamped by the interrupt, frames decoded by decode()
+	CSPSCQueue<IREdge_t, RX_EDGE_QUEUE_SIZE> m_rxEdges;
+	CSPSCQueue<IRFrame_t, RX_FRAME_QUEUE_SIZE> m_receivedData;
+
+	// frame decoder (runs outside the interrupt context)
+	bool      m_isDecodingFrame;
+	uint8_t   m_frameProtocol;
+	uint32_t  m_frameStart_us;
+	uint32_t  m_lastMark_us;
+	uint32_t  m_lastEdge_us;
+	uint8_t   m_frameLevel;
+	uint8_t   m_frameBit;        // bits (legacy) or symbols (pulse distance) decoded
+	uint8_t   m_frameSymbols;    // pulse distance: symbols of the frame (known after the version nibble)
+	uint32_t  m_frameData;
+	uint32_t  m_frameISRCycles;
+	IRStats_t m_stats;
+
+	static bool sendAll(CIR *transceivers[], uint8_t count, uint16_t data, bool word);
+	bool prepareFrame(uint16_t data, uint8_t protocol);
+	void startFrame(void);
+	void requestFrames(CIR *transceivers[], uint8_t count);
+	void startFrames(void);
+	void startReceiver(void);
+	void stopReceiver(void);
+	void decode(void);
+	void decodeEdge(uint32_t time_us, uint8_t level, uint16_t isrCycles);
+	bool decodePulseDistance(uint32_t time_us, uint8_t level);
+	void sampleFrameBits(uint32_t time_us);
+	void recordEdgeJitter(uint32_t jitter_us);
+	void endFrame(void);
+	void endLegacyFrame(void);
+	void endPulseDistanceFrame(void);
 };
 
 #endif
-
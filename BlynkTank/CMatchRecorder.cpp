@@ -0,0 +1,359 @@
+#include "CMatchRecorder.h"
+
+// payload length of the record types
+static const uint8_t payloadLength[MATCH_REC_TYPES] = { 23, 3, 4, 4, 3, 2, 1, 2, 2 };
+
+static uint8_t put16(uint8_t *data, uint16_t value)
+{
+	data[0] = (uint8_t)value;
+	data[1] = (uint8_t)(value >> 8);
+	return(2);
+}
+
+static uint8_t put32(uint8_t *data, uint32_t value)
+{
+	put16(data, (uint16_t)value);
+	put16(data + 2, (uint16_t)(value >> 16));
+	return(4);
+}
+
+static uint16_t get16(const uint8_t *data)
+{
+	return(data[0] | (data[1] << 8));
+}
+
+static uint32_t get32(const uint8_t *data)
+{
+	return(get16(data) | ((uint32_t)get16(data + 2) << 16));
+}
+
+CMatchRecorder::CMatchRecorder()
+{
+	m_game         = NULL;
+	m_isEnabled    = false;
+	m_bufferLength = 0;
+	m_segment      = 0;
+	m_sequence     = 0;
+	m_segmentSize  = 0;
+	m_lastTime_ms  = 0;
+	m_gameEvents   = 0;
+	m_lastBattery  = 0;
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+bool CMatchRecorder::begin(CGameEngine *game, bool enable)
+{
+	m_game = game;
+	m_isEnabled = enable;
+	if (!m_isEnabled)
+		return(true);
+
+	// a new segment over the oldest one
+	uint32_t sequence0 = readSequence(0);
+	uint32_t sequence1 = readSequence(1);
+	if (sequence0 > sequence1) {
+		m_segment  = 0;
+		m_sequence = sequence0;
+	}
+	else {
+		m_segment  = 1;
+		m_sequence = sequence1;
+	}
+	startSegment();
+	return(0 == m_stats.writeErrors);
+}
+
+void CMatchRecorder::enable(bool enable)
+{
+	if (enable && !m_isEnabled && (NULL != m_game)) {
+		m_isEnabled = true;
+		if (0 == m_sequence)
+			startSegment();
+		else
+			snapshot(halMillis());
+		return;
+	}
+	if (!enable)
+		flush();
+	m_isEnabled = enable;
+}
+
+void CMatchRecorder::snapshot(uint32_t now_ms)
+{
+	if (!m_isEnabled || (NULL == m_game))
+		return;
+	const GameRules_t &rules = m_game->getRules();
+	const GameState_t &state = m_game->getState();
+	uint8_t payload[MATCH_RECORD_MAX];
+	uint8_t length = put32(payload, now_ms);
+	payload[length++] = rules.maxHitPoints;
+	payload[length++] = rules.maxAmmo;
+	payload[length++] = rules.ammoDamage;
+	payload[length++] = rules.repairValue;
+	length += put16(payload + length, rules.reloadTime_ms);
+	length += put16(payload + length, rules.ammoSpawnTime_ms);
+	length += put32(payload + length, state.time_ms);
+	payload[length++] = state.hitPoints;
+	payload[length++] = state.ammo;
+	payload[length++] = (state.isReloading ? 0x01 : 0x00) | (state.canRespawnAmmo ? 0x02 : 0x00);
+	length += put16(payload + length, state.reloadSteps);
+	length += put16(payload + length, state.spawnSteps);
+	append(MATCH_REC_SNAPSHOT, now_ms, payload, length);
+	m_gameEvents = 0;
+}
+
+// the state checksum is recorded right after the event, every MATCH_CHECK_EVENTS events
+void CMatchRecorder::recordGameEvent(uint32_t now_ms, uint8_t type, uint8_t value, uint8_t changed)
+{
+	if (!m_isEnabled)
+		return;
+	uint8_t payload[4] = { type, value, changed };
+	append(MATCH_REC_GAME, now_ms, payload, 3);
+	if ((++m_gameEvents < MATCH_CHECK_EVENTS) || (NULL == m_game))
+		return;
+	m_gameEvents = 0;
+	put32(payload, m_game->getChecksum());
+	append(MATCH_REC_CHECK, now_ms, payload, 4);
+}
+
+void CMatchRecorder::recordJoystick(uint32_t now_ms, int16_t x, int16_t y)
+{
+	uint8_t payload[4];
+	put16(payload, x);
+	put16(payload + 2, y);
+	append(MATCH_REC_JOYSTICK, now_ms, payload, 4);
+}
+
+void CMatchRecorder::recordTurret_us(uint32_t now_ms, int16_t us, bool absolute)
+{
+	uint8_t payload[3];
+	put16(payload, us);
+	payload[2] = absolute ? 1 : 0;
+	append(MATCH_REC_TURRET_US, now_ms, payload, 3);
+}
+
+void CMatchRecorder::recordTurretDegree(uint32_t now_ms, int16_t angle)
+{
+	uint8_t payload[2];
+	put16(payload, angle);
+	append(MATCH_REC_TURRET_DEG, now_ms, payload, 2);
+}
+
+void CMatchRecorder::recordTrigger(uint32_t now_ms, uint8_t result)
+{
+	append(MATCH_REC_TRIGGER, now_ms, &result, 1);
+}
+
+void CMatchRecorder::recordHitCode(uint32_t now_ms, uint8_t id, uint8_t damage)
+{
+	uint8_t payload[2] = { id, damage };
+	append(MATCH_REC_HIT_CODE, now_ms, payload, 2);
+}
+
+void CMatchRecorder::recordBattery(uint32_t now_ms, uint16_t voltage)
+{
+	if (abs((int)voltage - (int)m_lastBattery) < MATCH_BATTERY_DEADBAND)
+		return;
+	m_lastBattery = voltage;
+	uint8_t payload[2];
+	put16(payload, voltage);
+	append(MATCH_REC_BATTERY, now_ms, payload, 2);
+}
+
+void CMatchRecorder::append(uint8_t type, uint32_t now_ms, const uint8_t *payload, uint8_t length)
+{
+	if (!m_isEnabled)
+		return;
+	if (m_bufferLength + MATCH_RECORD_MAX > MATCH_BUFFER_SIZE)
+		flush();
+	uint8_t *record = m_buffer + m_bufferLength;
+	uint8_t  size = 0;
+	record[size++] = type;
+	// varint: 7 bits per byte, least significant first
+	uint32_t elapsed = (MATCH_REC_SNAPSHOT == type) ? 0 : now_ms - m_lastTime_ms;
+	while (elapsed >= 0x80) {
+		record[size++] = (uint8_t)(elapsed | 0x80);
+		elapsed >>= 7;
+	}
+	record[size++] = (uint8_t)elapsed;
+	memcpy(record + size, payload, length);
+	m_bufferLength += size + length;
+	m_lastTime_ms = now_ms;
+	m_stats.records++;
+}
+
+void CMatchRecorder::flush(void)
+{
+	if (!m_isEnabled || (0 == m_bufferLength))
+		return;
+	uint32_t startTime = halMicros();
+	CHalFile file = halFSOpen(fileName(m_segment), "a");
+	if (!file || (file.write(m_buffer, m_bufferLength) != m_bufferLength))
+		m_stats.writeErrors++;
+	if (file)
+		file.close();
+	m_segmentSize  += m_bufferLength;
+	m_stats.bytes  += m_bufferLength;
+	m_bufferLength  = 0;
+	m_stats.flushes++;
+	if (m_segmentSize >= MATCH_SEGMENT_SIZE) {
+		m_segment ^= 1;
+		startSegment();
+	}
+	uint32_t elapsed = halMicros() - startTime;
+	if (elapsed > m_stats.flushMax_us)
+		m_stats.flushMax_us = elapsed;
+}
+
+void CMatchRecorder::flushTimer(CMatchRecorder *recorder)
+{
+	recorder->flush();
+}
+
+// truncate the segment file, header and snapshot
+void CMatchRecorder::startSegment(void)
+{
+	uint8_t header[MATCH_HEADER_SIZE] = { 'A', 'U', 'G', 'R', MATCH_RECORD_VERSION };
+	put32(header + 5, ++m_sequence);
+	CHalFile file = halFSOpen(fileName(m_segment), "w");
+	if (!file || (file.write(header, MATCH_HEADER_SIZE) != MATCH_HEADER_SIZE))
+		m_stats.writeErrors++;
+	if (file)
+		file.close();
+	m_segmentSize = MATCH_HEADER_SIZE;
+	m_stats.segments++;
+	snapshot(halMillis());
+}
+
+void CMatchRecorder::dump(void)
+{
+	flush();
+	Serial.printf("MATCH BEGIN\n");
+	for (uint8_t i = 0; i < 2; i++) {
+		CHalFile file = halFSOpen(getSegmentFile(i), "r");
+		if (!file)
+			continue;
+		Serial.printf("MATCH SEGMENT\n");
+		uint8_t data[32];
+		size_t  length;
+		while ((length = file.read(data, sizeof(data))) > 0) {
+			Serial.printf("MATCH ");
+			for (size_t j = 0; j < length; j++)
+				Serial.printf("%02X", data[j]);
+			Serial.printf("\n");
+		}
+		file.close();
+	}
+	Serial.printf("MATCH END\n");
+}
+
+const char *CMatchRecorder::getSegmentFile(uint8_t index)
+{
+	return(fileName((0 == index) ? m_segment ^ 1 : m_segment));
+}
+
+MatchRecorderStats_t CMatchRecorder::getStats(void)
+{
+	return(m_stats);
+}
+
+const char *CMatchRecorder::fileName(uint8_t segment)
+{
+	return((0 == segment) ? MATCH_RECORD_FILE_0 : MATCH_RECORD_FILE_1);
+}
+
+// 0 -> no valid segment
+uint32_t CMatchRecorder::readSequence(uint8_t segment)
+{
+	CHalFile file = halFSOpen(fileName(segment), "r");
+	if (!file)
+		return(0);
+	uint8_t  header[MATCH_HEADER_SIZE];
+	uint32_t sequence = 0;
+	if (file.read(header, MATCH_HEADER_SIZE) == MATCH_HEADER_SIZE)
+		decodeHeader(header, MATCH_HEADER_SIZE, sequence);
+	file.close();
+	return(sequence);
+}
+
+bool CMatchRecorder::decodeHeader(const uint8_t *data, size_t size, uint32_t &sequence)
+{
+	if ((size < MATCH_HEADER_SIZE) || (0 != memcmp(data, "AUGR", 4)) || (MATCH_RECORD_VERSION != data[4]))
+		return(false);
+	sequence = get32(data + 5);
+	return(true);
+}
+
+bool CMatchRecorder::decode(const uint8_t *data, size_t size, size_t &pos, uint32_t &time_ms, MatchRecord_t &record)
+{
+	if ((pos >= size) || (data[pos] >= MATCH_REC_TYPES))
+		return(false);
+	size_t next = pos;
+	record.type = data[next++];
+	uint32_t elapsed = 0;
+	for (uint8_t shift = 0; ; shift += 7) {
+		if ((next >= size) || (shift > 28))
+			return(false);
+		elapsed |= (uint32_t)(data[next] & 0x7F) << shift;
+		if (0 == (data[next++] & 0x80))
+			break;
+	}
+	if (next + payloadLength[record.type] > size)
+		return(false);
+
+	const uint8_t *payload = data + next;
+	record.time_ms = time_ms + elapsed;
+	record.value1  = 0;
+	record.value2  = 0;
+	record.changed = 0;
+	switch (record.type) {
+	case MATCH_REC_SNAPSHOT:
+		record.time_ms                = get32(payload);
+		record.rules.maxHitPoints     = payload[4];
+		record.rules.maxAmmo          = payload[5];
+		record.rules.ammoDamage       = payload[6];
+		record.rules.repairValue      = payload[7];
+		record.rules.reloadTime_ms    = get16(payload + 8);
+		record.rules.ammoSpawnTime_ms = get16(payload + 10);
+		record.state.time_ms          = get32(payload + 12);
+		record.state.hitPoints        = payload[16];
+		record.state.ammo             = payload[17];
+		record.state.isReloading      = (0 != (payload[18] & 0x01));
+		record.state.canRespawnAmmo   = (0 != (payload[18] & 0x02));
+		record.state.reloadSteps      = get16(payload + 19);
+		record.state.spawnSteps       = get16(payload + 21);
+		break;
+	case MATCH_REC_GAME:
+		record.value1  = payload[0];
+		record.value2  = payload[1];
+		record.changed = payload[2];
+		break;
+	case MATCH_REC_CHECK:
+		record.checksum = get32(payload);
+		break;
+	case MATCH_REC_JOYSTICK:
+		record.value1 = (int16_t)get16(payload);
+		record.value2 = (int16_t)get16(payload + 2);
+		break;
+	case MATCH_REC_TURRET_US:
+		record.value1 = (int16_t)get16(payload);
+		record.value2 = payload[2];
+		break;
+	case MATCH_REC_TURRET_DEG:
+		record.value1 = (int16_t)get16(payload);
+		break;
+	case MATCH_REC_TRIGGER:
+		record.value1 = payload[0];
+		break;
+	case MATCH_REC_HIT_CODE:
+		record.value1 = payload[0];
+		record.value2 = payload[1];
+		break;
+	case MATCH_REC_BATTERY:
+		record.value1 = (int16_t)get16(payload);
+		break;
+	}
+	time_ms = record.time_ms;
+	pos = next + payloadLength[record.type];
+	return(true);
+}
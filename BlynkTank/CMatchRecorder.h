@@ -0,0 +1,118 @@
+#pragma once
+#ifndef CMATCHRECORDER_H
+#define CMATCHRECORDER_H
+
+#include "HAL.h"
+#include "CGameEngine.h"
+
+// Match recorder: every input of the tank and every game engine event is stored as a compact
+// binary record in a bounded ring of two flash segments (the oldest one is overwritten).
+// The records are buffered in RAM and written by flush() (main loop timer, or the record that
+// fills the buffer). A segment starts with a snapshot of the game engine, so it can be replayed alone.
+//   segment: 'A' 'U' 'G' 'R', version, sequence number (uint32), records
+//   record : type, milliseconds from the previous record (varint), payload (little endian)
+#define MATCH_RECORD_FILE_0  "/match0.rec"
+#define MATCH_RECORD_FILE_1  "/match1.rec"
+#define MATCH_RECORD_VERSION 1
+#define MATCH_SEGMENT_SIZE   16384 // bytes. About 2 minutes of intense play
+#define MATCH_BUFFER_SIZE    256   // RAM buffer
+#define MATCH_FLUSH_PERIOD   2000  // milliseconds
+#define MATCH_CHECK_EVENTS   16    // a state checksum every 16 game events
+#define MATCH_HEADER_SIZE    9
+#define MATCH_RECORD_MAX     32    // longest record
+
+// record types (payload)
+#define MATCH_REC_SNAPSHOT   0 // time (uint32), rules, state
+#define MATCH_REC_GAME       1 // game event type, value, changed flags of the delta
+#define MATCH_REC_CHECK      2 // game state checksum (uint32)
+#define MATCH_REC_JOYSTICK   3 // x, y (int16)
+#define MATCH_REC_TURRET_US  4 // servo position (int16), absolute (uint8)
+#define MATCH_REC_TURRET_DEG 5 // angle (int16)
+#define MATCH_REC_TRIGGER    6 // fire button result (MATCH_TRIGGER_xxx)
+#define MATCH_REC_HIT_CODE   7 // tank ID, damage
+#define MATCH_REC_BATTERY    8 // millivolts (uint16)
+#define MATCH_REC_TYPES      9
+
+#define MATCH_TRIGGER_FIRED   0
+#define MATCH_TRIGGER_REFUSED 1 // reloading or no ammos
+#define MATCH_TRIGGER_IR_BUSY 2
+
+// battery samples closer than this to the last recorded one are skipped
+#define MATCH_BATTERY_DEADBAND 20 // millivolts
+
+// decoded record
+struct MatchRecord_t {
+	uint32_t    time_ms;
+	uint8_t     type;
+	int16_t     value1;  // joystick x, turret, game event type, trigger, tank ID, battery
+	int16_t     value2;  // joystick y, absolute turret, game event value, damage
+	uint8_t     changed; // game event delta flags
+	uint32_t    checksum;
+	GameRules_t rules;   // snapshot
+	GameState_t state;
+};
+
+struct MatchRecorderStats_t {
+	uint32_t records;
+	uint32_t bytes;       // written to flash
+	uint32_t flushes;
+	uint32_t segments;    // segment switches
+	uint32_t flushMax_us;
+	uint32_t writeErrors;
+};
+
+class CMatchRecorder
+{
+public:
+	CMatchRecorder();
+
+	// continues the ring after the newest segment on flash. The game engine is read by the
+	// snapshots and the checksums
+	bool begin(CGameEngine *game, bool enable = true);
+	void enable(bool enable);
+
+	void snapshot(uint32_t now_ms);
+	void recordGameEvent(uint32_t now_ms, uint8_t type, uint8_t value, uint8_t changed);
+	void recordJoystick(uint32_t now_ms, int16_t x, int16_t y);
+	void recordTurret_us(uint32_t now_ms, int16_t us, bool absolute);
+	void recordTurretDegree(uint32_t now_ms, int16_t angle);
+	void recordTrigger(uint32_t now_ms, uint8_t result);
+	void recordHitCode(uint32_t now_ms, uint8_t id, uint8_t damage);
+	void recordBattery(uint32_t now_ms, uint16_t voltage);
+
+	// write the buffered records to flash (main loop)
+	void flush(void);
+	static void flushTimer(CMatchRecorder *recorder);
+	// both segments, oldest first, as hex lines on the serial console (see TankSim/MatchReplay)
+	void dump(void);
+	// file of a segment, 0 -> oldest
+	const char *getSegmentFile(uint8_t index);
+
+	MatchRecorderStats_t getStats(void);
+
+	// record decoder. pos is moved to the next record, time_ms is the time of the previous record
+	// (set by the snapshots). Returns false at the end of the data or on a corrupted record
+	static bool decode(const uint8_t *data, size_t size, size_t &pos, uint32_t &time_ms, MatchRecord_t &record);
+	// segment header: returns the sequence number, false if not valid
+	static bool decodeHeader(const uint8_t *data, size_t size, uint32_t &sequence);
+
+private:
+	CGameEngine         *m_game;
+	bool                 m_isEnabled;
+	uint8_t              m_buffer[MATCH_BUFFER_SIZE];
+	uint16_t             m_bufferLength;
+	uint8_t              m_segment;        // file being written
+	uint32_t             m_sequence;
+	uint32_t             m_segmentSize;
+	uint32_t             m_lastTime_ms;
+	uint8_t              m_gameEvents;     // since the last checksum
+	uint16_t             m_lastBattery;
+	MatchRecorderStats_t m_stats;
+
+	void        startSegment(void);
+	void        append(uint8_t type, uint32_t now_ms, const uint8_t *payload, uint8_t length);
+	const char *fileName(uint8_t segment);
+	uint32_t    readSequence(uint8_t segment);
+};
+
+#endif
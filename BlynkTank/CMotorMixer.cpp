@@ -0,0 +1,221 @@
+#include "CMotorMixer.h"
+
+static int32_t clamp(int32_t value, int32_t min, int32_t max)
+{
+	if (value < min)
+		return(min);
+	if (value > max)
+		return(max);
+	return(value);
+}
+
+// integer square root (bit by bit)
+static uint32_t isqrt(uint32_t value)
+{
+	uint32_t root = 0;
+	uint32_t bit = 1UL << 30;
+	while (bit > value)
+		bit >>= 2;
+	while (bit != 0) {
+		if (value >= root + bit) {
+			value -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else
+			root >>= 1;
+		bit >>= 2;
+	}
+	return(root);
+}
+
+CMotorMixer::CMotorMixer()
+{
+	MotorMixerConfig_t config;
+	defaultConfig(config);
+	configure(config);
+	stop();
+}
+
+void CMotorMixer::defaultConfig(MotorMixerConfig_t &config)
+{
+	config.deadband  = DEFAULT_MIXER_DEADBAND;
+	config.expo      = DEFAULT_MIXER_EXPO;
+	config.minDuty   = DEFAULT_MIXER_MIN_DUTY;
+	config.trimLeft  = MIXER_TRIM_UNITY;
+	config.trimRight = MIXER_TRIM_UNITY;
+	config.slew      = DEFAULT_MIXER_SLEW;
+	config.jerk      = DEFAULT_MIXER_JERK;
+}
+
+// the expo curve goes to the table: y = (1 - e) x + e x^3 (normalized)
+void CMotorMixer::configure(const MotorMixerConfig_t &config)
+{
+	m_config = config;
+	if (m_config.deadband >= MIXER_MAX_DUTY)
+		m_config.deadband = MIXER_MAX_DUTY - 1;
+	if (m_config.expo > 256)
+		m_config.expo = 256;
+	if (m_config.minDuty > MIXER_MAX_DUTY)
+		m_config.minDuty = MIXER_MAX_DUTY;
+	m_left.trim  = m_config.trimLeft;
+	m_right.trim = m_config.trimRight;
+	for (uint8_t i = 0; i < MIXER_CURVE_POINTS; i++) {
+		int32_t x = clamp(i * 32, 0, MIXER_MAX_DUTY);
+		int32_t cube = x * x / MIXER_MAX_DUTY * x / MIXER_MAX_DUTY;
+		m_curve[i] = (uint16_t)(((256 - m_config.expo) * x + m_config.expo * cube) >> 8);
+	}
+}
+
+void CMotorMixer::setCurve(const uint16_t curve[MIXER_CURVE_POINTS])
+{
+	for (uint8_t i = 0; i < MIXER_CURVE_POINTS; i++)
+		m_curve[i] = (uint16_t)clamp(curve[i], 0, MIXER_MAX_DUTY);
+}
+
+const MotorMixerConfig_t &CMotorMixer::getConfig(void)
+{
+	return(m_config);
+}
+
+void CMotorMixer::mix(int joystickX, int joystickY, int16_t &left, int16_t &right)
+{
+	int32_t x = shape(joystickX);
+	int32_t y = shape(joystickY);
+	left  = trim(-x + y, m_left.trim);
+	right = trim(x + y, m_right.trim);
+}
+
+void CMotorMixer::setTarget(int joystickX, int joystickY)
+{
+	mix(joystickX, joystickY, m_left.target, m_right.target);
+}
+
+void CMotorMixer::stop(void)
+{
+	m_left.target    = m_right.target   = 0;
+	m_left.position  = m_right.position = 0;
+	m_left.rate      = m_right.rate     = 0;
+	m_left.duty      = m_right.duty     = 0;
+}
+
+bool CMotorMixer::step(void)
+{
+	bool isChanged = stepMotor(m_left);
+	return(stepMotor(m_right) || isChanged);
+}
+
+bool CMotorMixer::isSettled(void)
+{
+	return((m_left.position == m_left.target) && (m_right.position == m_right.target));
+}
+
+uint16_t CMotorMixer::getRampTime_ms(int fromX, int fromY, int toX, int toY)
+{
+	motor_t motors[2];
+	mix(fromX, fromY, motors[0].position, motors[1].position);
+	mix(toX, toY, motors[0].target, motors[1].target);
+	uint16_t steps = 0;
+	// straight drive without trims: the two ramps are the same
+	uint8_t count = ((motors[0].position == motors[1].position) && (motors[0].target == motors[1].target)) ? 1 : 2;
+	for (uint8_t i = 0; i < count; i++) {
+		motor_t &motor = motors[i];
+		motor.rate = 0;
+		motor.trim = (0 == i) ? m_left.trim : m_right.trim;
+		motor.duty = toDuty(motor.position);
+		uint16_t motorSteps = 0;
+		while (((motor.position != motor.target) || (0 != motor.rate)) && (motorSteps < MIXER_MAX_RAMP_STEPS)) {
+			stepMotor(motor);
+			motorSteps++;
+		}
+		if (motorSteps > steps)
+			steps = motorSteps;
+	}
+	return((steps + 1) * MIXER_STEP_MS);
+}
+
+int16_t CMotorMixer::getLeftTarget(void)
+{
+	return(m_left.target);
+}
+
+int16_t CMotorMixer::getRightTarget(void)
+{
+	return(m_right.target);
+}
+
+int16_t CMotorMixer::getLeftDuty(void)
+{
+	return(m_left.duty);
+}
+
+int16_t CMotorMixer::getRightDuty(void)
+{
+	return(m_right.duty);
+}
+
+// deadband remap and response curve of a joystick axis
+int16_t CMotorMixer::shape(int value)
+{
+	int32_t magnitude = clamp((value < 0) ? -value : value, 0, MIXER_MAX_DUTY);
+	if (magnitude <= m_config.deadband)
+		return(0);
+	// table scale: 0..1024
+	magnitude = (magnitude - m_config.deadband) * 1024 / (MIXER_MAX_DUTY - m_config.deadband);
+	uint8_t index = (uint8_t)(magnitude >> 5);
+	if (index >= MIXER_CURVE_POINTS - 1)
+		magnitude = m_curve[MIXER_CURVE_POINTS - 1];
+	else {
+		int32_t low = m_curve[index];
+		magnitude = low + (((m_curve[index + 1] - low) * (magnitude & 31)) >> 5);
+	}
+	return((int16_t)((value < 0) ? -magnitude : magnitude));
+}
+
+int16_t CMotorMixer::trim(int value, uint16_t gain)
+{
+	return((int16_t)clamp((value * (int32_t)gain) / MIXER_TRIM_UNITY, -MIXER_MAX_DUTY, MIXER_MAX_DUTY));
+}
+
+// slew (acceleration) limit, and jerk limit with braking: the rate is kept low enough to stop
+// on the target decreasing it by the jerk limit at every step
+bool CMotorMixer::stepMotor(motor_t &motor)
+{
+	int32_t error = motor.target - motor.position;
+	if ((0 == m_config.slew) || ((0 == error) && (0 == motor.rate)))
+		motor.position = motor.target;
+	else {
+		int32_t wanted = clamp(error, -m_config.slew, m_config.slew);
+		int32_t rate = wanted;
+		if (m_config.jerk > 0) {
+			int32_t braking = (int32_t)isqrt(2UL * m_config.jerk * (uint32_t)((error < 0) ? -error : error));
+			wanted = clamp(wanted, -braking, braking);
+			rate = clamp(wanted, motor.rate - m_config.jerk, motor.rate + m_config.jerk);
+		}
+		int32_t position = motor.position + rate;
+		// target passed (or reached): it's the end of the ramp
+		if (((error >= 0) && (position >= motor.target) && (rate >= 0)) || ((error <= 0) && (position <= motor.target) && (rate <= 0))) {
+			position = motor.target;
+			rate = 0;
+		}
+		// direction reversal: one step stopped, the motor current decays before the H bridge turns
+		if (((motor.position > 0) && (position < 0)) || ((motor.position < 0) && (position > 0)))
+			position = 0;
+		motor.position = (int16_t)clamp(position, -MIXER_MAX_DUTY, MIXER_MAX_DUTY);
+		motor.rate = (int16_t)rate;
+	}
+	int16_t duty = toDuty(motor.position);
+	if (duty == motor.duty)
+		return(false);
+	motor.duty = duty;
+	return(true);
+}
+
+// minimum duty remap: the smallest output still moves the tank
+int16_t CMotorMixer::toDuty(int16_t position)
+{
+	if (0 == position)
+		return(0);
+	int32_t magnitude = (position < 0) ? -position : position;
+	magnitude = m_config.minDuty + magnitude * (MIXER_MAX_DUTY - m_config.minDuty) / MIXER_MAX_DUTY;
+	return((int16_t)((position < 0) ? -magnitude : magnitude));
+}
@@ -0,0 +1,83 @@
+#pragma once
+#ifndef CMOTORMIXER_H
+#define CMOTORMIXER_H
+
+#include <stdint.h>
+
+#define MIXER_MAX_DUTY       1023 // PWM full scale (joystick full scale too)
+#define MIXER_CURVE_POINTS   33   // response curve table: 0..1024, one point every 32
+#define MIXER_STEP_MS        10   // the slew limits are per step: step() must be called at this rate
+#define MIXER_TRIM_UNITY     256  // trim gains are Q8
+#define MIXER_MAX_RAMP_STEPS 1000 // getRampTime_ms limit
+
+// drive defaults
+#define DEFAULT_MIXER_DEADBAND 300 // joystick values below this are 0, the rest is stretched to the full scale
+#define DEFAULT_MIXER_EXPO     128 // 0 -> linear, 256 -> cubic (fine control around the center)
+#define DEFAULT_MIXER_MIN_DUTY 300 // below this duty the N20 motors stall: the outputs start here
+#define DEFAULT_MIXER_SLEW     70  // max duty change per step (0 -> full scale in 150 ms)
+#define DEFAULT_MIXER_JERK     20  // max slew change per step, 0 -> disabled
+
+struct MotorMixerConfig_t {
+	uint16_t deadband;
+	uint16_t expo;
+	uint16_t minDuty;
+	uint16_t trimLeft;   // Q8 gains (MIXER_TRIM_UNITY = 1.0): a tank pulling to one side is straightened
+	uint16_t trimRight;
+	uint16_t slew;       // 0 -> the outputs jump to the target (old behaviour)
+	uint16_t jerk;
+};
+
+// Drive pipeline of the two motors, all integer math: joystick deadband remap, response curve
+// (expo or custom table, interpolated), differential mix, per-motor trim, then acceleration and
+// jerk limits on the way to the target, and the minimum duty remap of the outputs. A direction
+// reversal becomes a ramp through zero instead of a full scale current step (boost converter
+// brown-outs). No hardware and no clock: step() is called at a fixed rate by the owner
+class CMotorMixer
+{
+public:
+	CMotorMixer();
+
+	static void defaultConfig(MotorMixerConfig_t &config);
+	void configure(const MotorMixerConfig_t &config);
+	// custom response curve (0..MIXER_MAX_DUTY values, monotonic), replaced by the next configure()
+	void setCurve(const uint16_t curve[MIXER_CURVE_POINTS]);
+	const MotorMixerConfig_t &getConfig(void);
+
+	// joystick x, y (-1023..1023) to the signed motor targets, without the slew limits
+	void mix(int joystickX, int joystickY, int16_t &left, int16_t &right);
+	void setTarget(int joystickX, int joystickY);
+	// the motors stop at once (no ramp)
+	void stop(void);
+	// one step toward the targets. Returns true if the outputs changed
+	bool step(void);
+	bool isSettled(void);
+	// time the slower motor takes from a stop at the first joystick x, y to the second one, with the
+	// current limits. One step more: step() is called by a timer of any phase
+	uint16_t getRampTime_ms(int fromX, int fromY, int toX, int toY);
+
+	// signed duty cycles: the sign is the direction
+	int16_t getLeftTarget(void);
+	int16_t getRightTarget(void);
+	int16_t getLeftDuty(void);
+	int16_t getRightDuty(void);
+
+private:
+	struct motor_t {
+		int16_t target;    // mixed value, before the minimum duty remap
+		int16_t position;  // slew limited value
+		int16_t rate;      // position change of the last step
+		uint16_t trim;
+		int16_t duty;      // output
+	};
+
+	MotorMixerConfig_t m_config;
+	uint16_t           m_curve[MIXER_CURVE_POINTS];
+	motor_t            m_left, m_right;
+
+	int16_t shape(int value);
+	int16_t trim(int value, uint16_t gain);
+	bool    stepMotor(motor_t &motor);
+	int16_t toDuty(int16_t position);
+};
+
+#endif
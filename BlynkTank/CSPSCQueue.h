@@ -0,0 +1,81 @@
+#pragma once
+#ifndef CSPSCQUEUE_H
+#define CSPSCQUEUE_H
+
+#include "HAL.h"
+
+// Bounded lock-free queue with a single producer and a single consumer (for example an
+// interrupt handler and the main loop). Only the producer writes m_head and m_drops, only
+// the consumer writes m_tail and m_dropsReset. One slot is always left empty: SIZE - 1 items
+// can be stored.
+// SIZE must be a power of 2 and not greater than 256.
+template<typename T, uint16_t SIZE>
+class CSPSCQueue
+{
+	static_assert(((SIZE & (SIZE - 1)) == 0) && (SIZE >= 2) && (SIZE <= 256), "CSPSCQueue size must be a power of 2 (2..256)");
+
+public:
+	CSPSCQueue() {
+		m_head  = 0;
+		m_tail  = 0;
+		m_drops = 0;
+		m_dropsReset = 0;
+	}
+
+	// producer side. If the queue is full the item is dropped and counted
+	inline __attribute__((always_inline)) bool push(const T &item) {
+		uint8_t head = m_head;
+		uint8_t next = (head + 1) & (SIZE - 1);
+		if (next == m_tail) {
+			m_drops++;
+			return(false);
+		}
+		m_items[head] = item;
+		halMemoryBarrier(); // the item must be stored before publishing it
+		m_head = next;
+		return(true);
+	}
+
+	// consumer side
+	inline __attribute__((always_inline)) bool pop(T &item) {
+		uint8_t tail = m_tail;
+		if (tail == m_head)
+			return(false);
+		halMemoryBarrier(); // read the item after its publication
+		item = m_items[tail];
+		halMemoryBarrier(); // the item must be read before releasing the slot
+		m_tail = (tail + 1) & (SIZE - 1);
+		return(true);
+	}
+
+	bool isEmpty(void) {
+		return(m_head == m_tail);
+	}
+
+	uint8_t count(void) {
+		return((m_head - m_tail) & (SIZE - 1));
+	}
+
+	uint8_t capacity(void) {
+		return(SIZE - 1);
+	}
+
+	// items dropped because the queue was full (consumer side)
+	uint32_t getDrops(void) {
+		return(m_drops - m_dropsReset);
+	}
+
+	// the producer counter is never written here: a drop counted meanwhile is not lost
+	void resetDrops(void) {
+		m_dropsReset = m_drops;
+	}
+
+private:
+	T                 m_items[SIZE];
+	volatile uint8_t  m_head;
+	volatile uint8_t  m_tail;
+	volatile uint32_t m_drops;
+	uint32_t          m_dropsReset;
+};
+
+#endif
@@ -0,0 +1,296 @@
+#include "CStatsJournal.h"
+#include "CConfigStore.h"
+
+static void writeUint32(uint8_t *buffer, uint32_t value)
+{
+	for (uint8_t i = 0; i < 4; i++)
+		buffer[i] = (value >> (8 * i)) & 0xFF;
+}
+
+static uint32_t readUint32(const uint8_t *buffer)
+{
+	return(buffer[0] | (buffer[1] << 8) | ((uint32_t)buffer[2] << 16) | ((uint32_t)buffer[3] << 24));
+}
+
+CStatsJournal::CStatsJournal()
+{
+	memset(&m_totals, 0, sizeof(m_totals));
+	memset(&m_session, 0, sizeof(m_session));
+	memset(&m_pending, 0, sizeof(m_pending));
+	m_lastFlush_ms      = 0;
+	m_journalRecords    = 0;
+	m_watermarkSession  = 0;
+	m_watermarkSequence = 0;
+	m_tornRecords       = 0;
+}
+
+void CStatsJournal::begin(void)
+{
+	uint8_t       buffer[STATS_RECORD_SIZE];
+	StatsRecord_t record;
+	uint16_t      lastSession = 0;
+	memset(&m_totals, 0, sizeof(m_totals));
+	m_journalRecords    = 0;
+	m_watermarkSession  = 0;
+	m_watermarkSequence = 0;
+	m_tornRecords       = 0;
+
+	CHalFile file = halFSOpen(STATS_HISTORY_FILE, "r");
+	if (file) {
+		while (file.read(buffer, STATS_RECORD_SIZE) == STATS_RECORD_SIZE) {
+			if (!decode(record, buffer)) {
+				m_tornRecords++;
+				continue;
+			}
+			add(m_totals, record);
+			m_watermarkSession  = record.session;
+			m_watermarkSequence = record.sequence;
+			if (record.session > lastSession)
+				lastSession = record.session;
+		}
+		file.close();
+	}
+
+	bool isTorn = false;
+	file = halFSOpen(STATS_JOURNAL_FILE, "r");
+	if (file) {
+		size_t length;
+		while ((length = file.read(buffer, STATS_RECORD_SIZE)) > 0) {
+			if ((STATS_RECORD_SIZE != length) || !decode(record, buffer)) {
+				m_tornRecords++;
+				isTorn = true;
+				continue;
+			}
+			if (isInHistory(record))
+				continue;
+			add(m_totals, record);
+			m_journalRecords++;
+			if (record.session > lastSession)
+				lastSession = record.session;
+		}
+		file.close();
+	}
+	// nothing is appended after a torn record: the good ones go to the history
+	if (isTorn)
+		compact();
+
+	memset(&m_session, 0, sizeof(m_session));
+	memset(&m_pending, 0, sizeof(m_pending));
+	m_session.session = lastSession + 1;
+	m_pending.session = m_session.session;
+	m_lastFlush_ms    = halMillis();
+}
+
+void CStatsJournal::countShot(void)
+{
+	m_pending.shots++;
+}
+
+void CStatsJournal::countHit(int hitCode)
+{
+	m_pending.hitsTaken++;
+	// the older firmwares send one byte IDs: not folded on the 4 bits ones
+	if ((hitCode >= 0) && (hitCode < STATS_TANK_IDS))
+		m_pending.hitBy[hitCode]++;
+}
+
+void CStatsJournal::countDeath(void)
+{
+	m_pending.deaths++;
+}
+
+bool CStatsJournal::flush(void)
+{
+	uint32_t elapsed = (halMillis() - m_lastFlush_ms) / 1000;
+	m_pending.uptime_s += elapsed;
+	m_lastFlush_ms     += elapsed * 1000;
+	if (!isPending())
+		return(false);
+
+	uint8_t buffer[STATS_RECORD_SIZE];
+	m_pending.sequence = m_session.sequence + 1;
+	encode(m_pending, buffer);
+	CHalFile file = halFSOpen(STATS_JOURNAL_FILE, "a");
+	if (!file)
+		return(false);
+	bool isWritten = file.write(buffer, STATS_RECORD_SIZE) == STATS_RECORD_SIZE;
+	file.close();
+	// not written: the counters are kept for the next flush
+	if (!isWritten)
+		return(false);
+
+	add(m_totals, m_pending);
+	add(m_session, m_pending);
+	m_session.sequence = m_pending.sequence;
+	memset(&m_pending, 0, sizeof(m_pending));
+	m_pending.session = m_session.session;
+	if (++m_journalRecords >= STATS_JOURNAL_MAX)
+		compact();
+	return(true);
+}
+
+void CStatsJournal::flushTimer(CStatsJournal *journal)
+{
+	journal->flush();
+}
+
+// the journal records of a session become one history record
+bool CStatsJournal::compact(void)
+{
+	CHalFile journal = halFSOpen(STATS_JOURNAL_FILE, "r");
+	if (!journal)
+		return(true);
+	CHalFile history = halFSOpen(STATS_HISTORY_FILE, "a");
+	if (!history) {
+		journal.close();
+		return(false);
+	}
+	// a torn history record is padded: the next records stay aligned (the padding fails the CRC)
+	uint8_t buffer[STATS_RECORD_SIZE];
+	size_t  torn = history.size() % STATS_RECORD_SIZE;
+	if (0 != torn) {
+		memset(buffer, 0xFF, sizeof(buffer));
+		history.write(buffer, STATS_RECORD_SIZE - torn);
+	}
+
+	StatsRecord_t record, merged;
+	bool hasMerged = false, isWritten = true;
+	while (journal.read(buffer, STATS_RECORD_SIZE) == STATS_RECORD_SIZE) {
+		if (!decode(record, buffer) || isInHistory(record))
+			continue;
+		if (hasMerged && (record.session == merged.session)) {
+			add(merged, record);
+			merged.sequence = record.sequence;
+			continue;
+		}
+		if (hasMerged) {
+			encode(merged, buffer);
+			isWritten = isWritten && (history.write(buffer, STATS_RECORD_SIZE) == STATS_RECORD_SIZE);
+		}
+		merged    = record;
+		hasMerged = true;
+	}
+	if (hasMerged) {
+		encode(merged, buffer);
+		isWritten = isWritten && (history.write(buffer, STATS_RECORD_SIZE) == STATS_RECORD_SIZE);
+	}
+	journal.close();
+	history.close();
+	if (!isWritten)
+		return(false);
+
+	if (hasMerged) {
+		m_watermarkSession  = merged.session;
+		m_watermarkSequence = merged.sequence;
+	}
+	halFSRemove(STATS_JOURNAL_FILE);
+	m_journalRecords = 0;
+	return(true);
+}
+
+StatsRecord_t CStatsJournal::getTotals(void)
+{
+	StatsRecord_t totals = m_totals;
+	add(totals, m_pending);
+	return(totals);
+}
+
+StatsRecord_t CStatsJournal::getSession(void)
+{
+	StatsRecord_t session = m_session;
+	add(session, m_pending);
+	return(session);
+}
+
+// one line per record (H history, J journal, P not flushed yet, T totals), to be pasted in a spreadsheet
+void CStatsJournal::dump(void)
+{
+	uint8_t       buffer[STATS_RECORD_SIZE];
+	StatsRecord_t record;
+	Serial.printf("stats,kind,session,sequence,uptime_s,shots,hits,deaths");
+	for (uint8_t i = 0; i < STATS_TANK_IDS; i++)
+		Serial.printf(",by%X", i);
+	Serial.printf("\n");
+
+	CHalFile file = halFSOpen(STATS_HISTORY_FILE, "r");
+	if (file) {
+		while (file.read(buffer, STATS_RECORD_SIZE) == STATS_RECORD_SIZE) {
+			if (decode(record, buffer))
+				printRecord('H', record);
+		}
+		file.close();
+	}
+	file = halFSOpen(STATS_JOURNAL_FILE, "r");
+	if (file) {
+		while (file.read(buffer, STATS_RECORD_SIZE) == STATS_RECORD_SIZE) {
+			if (decode(record, buffer) && !isInHistory(record))
+				printRecord('J', record);
+		}
+		file.close();
+	}
+	printRecord('P', m_pending);
+	printRecord('T', getTotals());
+	Serial.printf("stats: session %u, %u journal records, %u torn records\n", m_session.session, m_journalRecords, m_tornRecords);
+}
+
+void CStatsJournal::add(StatsRecord_t &total, const StatsRecord_t &record)
+{
+	total.uptime_s  += record.uptime_s;
+	total.shots     += record.shots;
+	total.hitsTaken += record.hitsTaken;
+	total.deaths    += record.deaths;
+	for (uint8_t i = 0; i < STATS_TANK_IDS; i++)
+		total.hitBy[i] += record.hitBy[i];
+}
+
+void CStatsJournal::encode(const StatsRecord_t &record, uint8_t *buffer)
+{
+	buffer[0] = record.session & 0xFF;
+	buffer[1] = record.session >> 8;
+	buffer[2] = record.sequence & 0xFF;
+	buffer[3] = record.sequence >> 8;
+	writeUint32(buffer + 4, record.uptime_s);
+	writeUint32(buffer + 8, record.shots);
+	writeUint32(buffer + 12, record.hitsTaken);
+	writeUint32(buffer + 16, record.deaths);
+	for (uint8_t i = 0; i < STATS_TANK_IDS; i++)
+		writeUint32(buffer + 20 + 4 * i, record.hitBy[i]);
+	writeUint32(buffer + STATS_RECORD_SIZE - 4, CConfigStore::crc32(buffer, STATS_RECORD_SIZE - 4));
+}
+
+bool CStatsJournal::decode(StatsRecord_t &record, const uint8_t *buffer)
+{
+	if (CConfigStore::crc32(buffer, STATS_RECORD_SIZE - 4) != readUint32(buffer + STATS_RECORD_SIZE - 4))
+		return(false);
+	record.session   = buffer[0] | (buffer[1] << 8);
+	record.sequence  = buffer[2] | (buffer[3] << 8);
+	record.uptime_s  = readUint32(buffer + 4);
+	record.shots     = readUint32(buffer + 8);
+	record.hitsTaken = readUint32(buffer + 12);
+	record.deaths    = readUint32(buffer + 16);
+	for (uint8_t i = 0; i < STATS_TANK_IDS; i++)
+		record.hitBy[i] = readUint32(buffer + 20 + 4 * i);
+	return(true);
+}
+
+void CStatsJournal::printRecord(char kind, const StatsRecord_t &record)
+{
+	Serial.printf("stats,%c,%u,%u,%u,%u,%u,%u", kind, record.session, record.sequence, record.uptime_s, record.shots,
+		record.hitsTaken, record.deaths);
+	for (uint8_t i = 0; i < STATS_TANK_IDS; i++)
+		Serial.printf(",%u", record.hitBy[i]);
+	Serial.printf("\n");
+}
+
+bool CStatsJournal::isInHistory(const StatsRecord_t &record)
+{
+	return((record.session < m_watermarkSession) ||
+		((record.session == m_watermarkSession) && (record.sequence <= m_watermarkSequence)));
+}
+
+// counters to be written, or enough uptime
+bool CStatsJournal::isPending(void)
+{
+	return((m_pending.shots > 0) || (m_pending.hitsTaken > 0) || (m_pending.deaths > 0) ||
+		(m_pending.uptime_s >= STATS_UPTIME_PERIOD));
+}
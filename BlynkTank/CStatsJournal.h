@@ -0,0 +1,71 @@
+#pragma once
+#ifndef CSTATSJOURNAL_H
+#define CSTATSJOURNAL_H
+
+#include "HAL.h"
+
+// Tank statistics kept across the reboots. The counters are incremented in RAM (nothing on the
+// firing path) and flush() appends the increments to the journal as a fixed size record with a
+// CRC. When the journal is full, compact() appends one record per play session to the history
+// and removes the journal. History and journal are append only: a record torn by a reset fails
+// its CRC and is skipped; the journal records already in the history (the last session and
+// sequence of the history) are skipped too, if the journal removal was interrupted.
+//   record: session, sequence (uint16), uptime seconds, shots, hits taken, deaths, hits by tank ID (uint32),
+//           CRC32 of the record (uint32). Little endian
+#define STATS_JOURNAL_FILE  "/stats.jnl"
+#define STATS_HISTORY_FILE  "/stats.bin"  // about 90 bytes per play session
+#define STATS_TANK_IDS      16            // IDs of the hit codes (4 bits)
+#define STATS_RECORD_SIZE   (4 + 4 * (4 + STATS_TANK_IDS) + 4)
+#define STATS_FLUSH_PERIOD  60000  // milliseconds: a record if a counter changed...
+#define STATS_UPTIME_PERIOD 600    // seconds: ...or for the uptime only
+#define STATS_JOURNAL_MAX   32     // records: the journal is compacted into the history
+
+struct StatsRecord_t {
+	uint16_t session;    // boot number
+	uint16_t sequence;   // record of the session
+	uint32_t uptime_s;
+	uint32_t shots;
+	uint32_t hitsTaken;
+	uint32_t deaths;
+	uint32_t hitBy[STATS_TANK_IDS];
+};
+
+class CStatsJournal
+{
+public:
+	CStatsJournal();
+
+	// totals from the history and the journal, next session
+	void begin(void);
+	void countShot(void);
+	void countHit(int hitCode); // -1 or an ID >= STATS_TANK_IDS: unknown shooter
+	void countDeath(void);
+
+	// appends the increments (if any) to the journal. Returns true if a record was written
+	bool flush(void);
+	static void flushTimer(CStatsJournal *journal);
+	bool compact(void);
+
+	StatsRecord_t getTotals(void);   // all the sessions, this one included
+	StatsRecord_t getSession(void);  // this session
+	// CSV on the serial console: history, journal, not flushed yet, totals
+	void dump(void);
+
+private:
+	StatsRecord_t m_totals;     // flushed
+	StatsRecord_t m_session;    // flushed, this session
+	StatsRecord_t m_pending;    // not flushed yet
+	uint32_t      m_lastFlush_ms;
+	uint16_t      m_journalRecords;
+	uint16_t      m_watermarkSession, m_watermarkSequence; // last journal record in the history
+	uint32_t      m_tornRecords;
+
+	static void add(StatsRecord_t &total, const StatsRecord_t &record);
+	static void encode(const StatsRecord_t &record, uint8_t *buffer);
+	static bool decode(StatsRecord_t &record, const uint8_t *buffer);
+	static void printRecord(char kind, const StatsRecord_t &record);
+	bool isInHistory(const StatsRecord_t &record);
+	bool isPending(void);
+};
+
+#endif
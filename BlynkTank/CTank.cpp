@@ -1,5 +1,4 @@
 #include "CTank.h"
-#include "FS.h"
 
 ADC_MODE(ADC_TOUT) // NodeMCU ADC initialization: external pin reading values enabled
 
@@ -11,6 +10,17 @@ ADC_MODE(ADC_TOUT) // NodeMCU ADC initialization: external pin reading values en
 
 #define IR_TX_PIN       D5 // IR tx pin
 #define IR_RX_PIN       D6 // IR rx pin
+// optional second IR transceiver: second barrel of the Turret_X (tx only) and/or rear hit
+// sensor (rx only). There are no free pins on the motor shield: the MP3 pins can be used
+#define IR_AUX_TX_PIN   IR_NO_PIN // second barrel IR tx pin
+#define IR_AUX_RX_PIN   IR_NO_PIN // rear hit sensor IR rx pin
+// IR protocol of the shots. Auto: fast pulse distance frames until a tank with an older
+// firmware (legacy frames only) is detected in the arena
+#define IR_PROTOCOL     IR_PROTOCOL_AUTO
+// listen before shooting: a shot fired over another tank's frame corrupts both of them.
+// A shot is dropped if the channel stays busy for IR_CSMA_DEADLINE microseconds
+#define IR_CARRIER_SENSE  true
+#define IR_CSMA_DEADLINE  CSMA_DEADLINE_US
 //#define TURRET_PIN      D8 // servo turret pin
 #define TURRET_PIN      D0 // servo turret pin
 
@@ -18,12 +28,27 @@ ADC_MODE(ADC_TOUT) // NodeMCU ADC initialization: external pin reading values en
 #define MP3_RX_PIN      D7 // MP3 rx pin
 
 #define TURRET_CENTER 98              // the turret center position (degree)
-#define PWM_DEADBAND  300             // PWM motor threshold (below this value the motor is stopped)
-#define ADC_BATTERY_COEFFICENT 1000.0 // ADC correction factor... depending on the voltage divider
-#define BATTERY_VOLTAGE (4.2 / 1024.0) * ADC_BATTERY_COEFFICENT // mv
+#define MOTOR_PWM_FREQUENCY 1000     // hz. The L293D fast decay stalls the motors at high frequencies (see the TankSim motor power benchmark)
+#define ADC_BATTERY_COEFFICENT 1000 // ADC correction factor (per mille)... depending on the voltage divider
+#define BATTERY_FULL_SCALE_MV (4200 * ADC_BATTERY_COEFFICENT / 1000) // mV at the ADC full scale (1024)
 //#define MY_ID 0x53                    // one byte tank ID (this code is transmitted when the fire button is pressed)
 #define MY_ID 0x0F                    // one byte tank ID (this code is transmitted when the fire button is pressed)
                                       // only first 4 bit -> 16 different codes max
+// with the pulse distance protocol the hit payload carries the ammo damage too:
+// tank ID (bits 0..3) + damage (bits 4..7, HIT_DAMAGE_UNIT steps)
+#define HIT_DAMAGE_UNIT 10
+// FEC coded hits (16 bits frames, CFEC). Off: the longer frame loses more shots than the 8 bits
+// one protects, the plain pulse distance frame has a check symbol (IRChannelSim, see README)
+#define IR_HIT_FEC      false
+// every input and game event recorded to flash (see CMatchRecorder)
+#define MATCH_RECORDER_ENABLED true
+
+// animations: tracks and keyframe actions
+#define ANIMATION_TRACK_TURRET  0
+#define ANIMATION_TRACK_MOTORS  1
+#define ANIMATION_TURRET_DEGREE 0 // value1 = angle
+#define ANIMATION_TURRET_US     1 // value1 = absolute position
+#define ANIMATION_MOTORS        2 // value1, value2 = joystick x, y
 
 // the code sent to check the proximity (if the turret is near a wall)
 // used to load the hotspot
@@ -45,26 +70,23 @@ ADC_MODE(ADC_TOUT) // NodeMCU ADC initialization: external pin reading values en
 #define DEFAULT_SERVO_MAX_US 2000
 
 #define SERVO_RANGE 500
+#define SERVO_DEGREE_MIN_US 544  // Servo library: pulse width of 0 degrees...
+#define SERVO_DEGREE_MAX_US 2400 // ...and of 180 degrees
 
 // how much time the tank must sense the IR carrier for starting the hotspot
 #define HOTSPOT_TIMEOUT	   2000  // milliseconds
 
-// how many seconds should try to connect to the wifi network
-#define WIFI_TIMEOUT       10    // seconds
-
-#define DEFAULT_MAX_HITPOINT       200
-#define DEFAULT_AMMO_RECHARGE_TIME 1500 // milliseconds
-#define DEFAULT_AMMO_DAMAGE        40
-#define DEFAULT_MAX_AMMO           20
-#define DEFAULT_REPAIR_VALUE       5
-#define DEFAULT_AMMO_SPAWN_TIME    7000  // milliseconds
-
-
-#define NETWORK_CONFIG_FILE "/network.cfg"
-#define TANK_CONFIG_FILE    "/tank.cfg"
+#define NETWORK_CONFIG_FILE    "/network.bin"
+#define NETWORK_CONFIG_JOURNAL "/network.jnl"
+#define TANK_CONFIG_FILE       "/tank.bin"
+#define TANK_CONFIG_JOURNAL    "/tank.jnl"
+// SPIFFS migration: the config files are copied in RAM, then the flash is formatted as LittleFS
+#define FS_MIGRATION_FILE_MAX  1024 // bytes
+// text config files of the older firmwares: imported once, then removed
+#define NETWORK_CONFIG_TEXT "/network.cfg"
+#define TANK_CONFIG_TEXT    "/tank.cfg"
 
 // tags for network configuration file
-#define VERSION_TAG      "Version = "
 #define WIFI_SSID_TAG    "WiFiSSID = "
 #define WIFI_PSWD_TAG    "WiFiPassword = "
 #define HS_SSID_TAG      "HotspotSSID = "
@@ -78,8 +100,35 @@ ADC_MODE(ADC_TOUT) // NodeMCU ADC initialization: external pin reading values en
 #define SERVO_MIN_US_TAG "ServoMin_us = "
 #define SERVO_MAX_US_TAG "ServoMax_us = "
 
+// config records: the IDs of the fields never change (see CConfigStore)
+static const ConfigField_t networkFields[] = {
+	{ 1, CONFIG_FIELD_STRING, offsetof(NetworkConfig_t, wifiSSID),    sizeof(NetworkConfig_t::wifiSSID),    WIFI_SSID_TAG },
+	{ 2, CONFIG_FIELD_STRING, offsetof(NetworkConfig_t, wifiPSW),     sizeof(NetworkConfig_t::wifiPSW),     WIFI_PSWD_TAG },
+	{ 3, CONFIG_FIELD_STRING, offsetof(NetworkConfig_t, hotspotSSID), sizeof(NetworkConfig_t::hotspotSSID), HS_SSID_TAG },
+	{ 4, CONFIG_FIELD_STRING, offsetof(NetworkConfig_t, hotspotPSW),  sizeof(NetworkConfig_t::hotspotPSW),  HS_PSWD_TAG },
+	{ 5, CONFIG_FIELD_STRING, offsetof(NetworkConfig_t, blynkServer), sizeof(NetworkConfig_t::blynkServer), BLYNK_SERVER_TAG },
+	{ 6, CONFIG_FIELD_STRING, offsetof(NetworkConfig_t, blynkPort),   sizeof(NetworkConfig_t::blynkPort),   BLYNK_PORT_TAG },
+	{ 7, CONFIG_FIELD_STRING, offsetof(NetworkConfig_t, blynkToken),  sizeof(NetworkConfig_t::blynkToken),  BLYNK_TOKEN_TAG },
+};
+
+static const ConfigField_t tankFields[] = {
+	{ 1, CONFIG_FIELD_UINT16, offsetof(TankConfig_t, servoMin_us), sizeof(uint16_t), SERVO_MIN_US_TAG },
+	{ 2, CONFIG_FIELD_UINT16, offsetof(TankConfig_t, servoMax_us), sizeof(uint16_t), SERVO_MAX_US_TAG },
+	{ 3, CONFIG_FIELD_UINT16, offsetof(TankConfig_t, servoCenter), sizeof(uint16_t), SERVO_CENTER_TAG },
+};
 
+static CConfigStore networkStore(NETWORK_CONFIG_FILE, NETWORK_CONFIG_JOURNAL, NETWORK_CONFIG_TEXT, networkFields,
+	sizeof(networkFields) / sizeof(networkFields[0]), NETWORK_CFG_SCHEMA_VERSION);
+static CConfigStore tankStore(TANK_CONFIG_FILE, TANK_CONFIG_JOURNAL, TANK_CONFIG_TEXT, tankFields,
+	sizeof(tankFields) / sizeof(tankFields[0]), TANK_CFG_SCHEMA_VERSION);
 
+// files carried over from the SPIFFS of the older firmwares (the match records are lost)
+static const char *migratedFiles[] = { NETWORK_CONFIG_FILE, NETWORK_CONFIG_JOURNAL, NETWORK_CONFIG_TEXT,
+	TANK_CONFIG_FILE, TANK_CONFIG_JOURNAL, TANK_CONFIG_TEXT };
+
+
+
+#ifdef ARDUINO
 // WifiManager callbacks and variables ------------------------------------------------------------------------
 bool shouldSaveConfig;
 
@@ -96,61 +145,37 @@ void saveConfigCallback() {
 	shouldSaveConfig = true;
 }
 // ------------------------------------------------------------------------------------------------------------
+#endif
 
-// ammoReloadTimer callback. Used to simulate the ammo reload time 
-void ammoReload(CTank* tank) {
-	tank->ammoReloadDone();
-//	Serial.println("Recharged");
+// animator callback. Used to move the turret and the motors without blocking the main loop
+void animationFrame(void *tank, uint8_t track, const AnimationKeyframe_t &frame) {
+	((CTank *)tank)->applyAnimationFrame(track, frame);
 }
 
-// Spawn ammo callback. Used to spawn ammos when the tank is not firing
-void spawnAmmo(CTank* tank) {
-	tank->newAmmos(1);
+// control loop callback. Used to apply the latched app inputs at a fixed rate
+void controlTimer(CTank *tank) {
+	tank->controlStep();
 }
 
-
-// Humming coding... very work in progress maybe Reed Solomon codes is better
-uint8_t hamming7_4Encode(uint8_t data) {
-	uint8_t dataEncoded;
-
-	// only 4 bit data;
-	data = data & 0x0F;
-
-	uint8_t p1 = ((data >> 3) & 0x01) ^ ((data >> 2) & 0x01) ^ ((data >> 1) & 0x01);
-	uint8_t p2 = ((data >> 2) & 0x01) ^ ((data >> 1) & 0x01) ^ ((data >> 0) & 0x01);
-	uint8_t p3 = ((data >> 3) & 0x01) ^ ((data >> 2) & 0x01) ^ ((data >> 0) & 0x01);
-
-	dataEncoded = p3 + (p2 << 1) + (p1 << 2) + data << 3;
-	
-	return(dataEncoded);
+// motor callback. Used to ramp the motors toward the target at a fixed rate
+void motorTimer(CTank *tank) {
+	tank->stepMotors();
 }
 
-uint8_t hamming7_4Decode(uint8_t data) {
-	
-	uint8_t s1 = ((data >> 6) & 0x01) ^ ((data >> 5) & 0x01) ^ ((data >> 4) & 0x01) ^ ((data >> 2) & 0x01);
-	uint8_t s2 = ((data >> 5) & 0x01) ^ ((data >> 4) & 0x01) ^ ((data >> 3) & 0x01) ^ ((data >> 1) & 0x01);
-	uint8_t s3 = ((data >> 6) & 0x01) ^ ((data >> 5) & 0x01) ^ ((data >> 3) & 0x01) ^ ((data >> 0) & 0x01);
-
-	uint8_t s = (s1 << 2) + (s2 << 1) + s3;
-	if (0 != s) {
-		uint8_t mask = 1 << (s - 1);
-		if ((data & mask) != 0)
-			data = data & (!mask);
-		else
-			data = data | mask;
-	}
-	return(data >> 3);
-
-
-
+// turret callback. Used to move the servo on the motion profile, one point per servo pulse
+void turretTimer(CTank *tank) {
+	tank->stepTurret();
 }
 
+// MP3 callback. Used to send the queued DFPlayer commands without blocking
+void MP3Timer(CTank *tank) {
+	tank->stepMP3();
+}
 
-
-
-
-
-
+// battery callback. Used to read the ADC spread in time (WiFi friendly)
+void batteryTimer(CTank *tank) {
+	tank->sampleBattery();
+}
 
 
 
@@ -158,63 +183,106 @@ CTank::CTank():CTank(false)
 {
 }
 
-CTank::CTank(bool formatFS)
+CTank::CTank(bool formatFS) : m_animator(m_timerWheel, animationFrame, this)
 {
-	// IR transceiver object
+	m_joystickX = 0;
+	m_joystickY = 0;
+	m_joystickSetpoint.isPending = false;
+	m_turretSetpoint.isPending   = false;
+	m_isHotspotHinted = false;
+	resetControlStats();
+	m_timerWheel.attach_ms(m_controlTimer, CONTROL_PERIOD_MS, controlTimer, this);
+
+	// IR transceiver objects
 	m_pIRcom  = new CIR(IR_RX_PIN, IR_TX_PIN);
-	m_pMP3com = new SoftwareSerial(MP3_RX_PIN, MP3_TX_PIN);
+	m_pIRaux  = NULL;
+	if ((IR_NO_PIN != IR_AUX_RX_PIN) || (IR_NO_PIN != IR_AUX_TX_PIN))
+		m_pIRaux = new CIR(IR_AUX_RX_PIN, IR_AUX_TX_PIN);
+	m_pIRcom->setProtocol(IR_PROTOCOL);
+	m_pIRcom->setCarrierSense(IR_CARRIER_SENSE, IR_CSMA_DEADLINE);
+	if (NULL != m_pIRaux) {
+		m_pIRaux->setProtocol(IR_PROTOCOL);
+		m_pIRaux->setCarrierSense(IR_CARRIER_SENSE, IR_CSMA_DEADLINE);
+	}
+	m_pMP3com = new CHalSerial(MP3_RX_PIN, MP3_TX_PIN);
 	m_pMP3com->begin(9600);
+	m_MP3Player.begin(m_pMP3com);
+	m_timerWheel.attach_ms(m_MP3Timer, DFPLAYER_BYTE_PERIOD, MP3Timer, this);
 
 	// servo turret initialization
 	m_turret.attach(TURRET_PIN);
+	m_turretPlanner.setLimits(SERVO_DEGREE_MIN_US, SERVO_DEGREE_MAX_US);
+	m_timerWheel.attach_ms(m_turretTimer, TURRET_STEP_MS, turretTimer, this);
 
 	// motor pin initialization
-	pinMode(L_MOTOR_PWM_PIN, OUTPUT);
-	pinMode(R_MOTOR_PWM_PIN, OUTPUT);
-	pinMode(L_MOTOR_DIR_PIN, OUTPUT);
-	pinMode(R_MOTOR_DIR_PIN, OUTPUT);
+	halAnalogWriteFreq(MOTOR_PWM_FREQUENCY);
+	halPinMode(L_MOTOR_PWM_PIN, OUTPUT);
+	halPinMode(R_MOTOR_PWM_PIN, OUTPUT);
+	halPinMode(L_MOTOR_DIR_PIN, OUTPUT);
+	halPinMode(R_MOTOR_DIR_PIN, OUTPUT);
+	m_timerWheel.attach_ms(m_motorTimer, MIXER_STEP_MS, motorTimer, this);
 
 	// ADC initialization (for battery voltage reading)
-	pinMode(A0, INPUT);
+	halPinMode(A0, INPUT);
+	m_battery.begin(BATTERY_FULL_SCALE_MV);
+	m_timerWheel.attach_ms(m_batteryTimer, BATTERY_SAMPLE_PERIOD, batteryTimer, this);
 
+	uint8_t stage = m_fastBoot.startStage("storage");
 	initFS(formatFS);
-	if (!readNetworkConfigFile())
-		setNetworkConfigDefaults();
-
-	if (!readTankConfigFile())
-		setTankConfigDefaults();
-
-	m_maxHitPoints     = DEFAULT_MAX_HITPOINT;
-	m_hitPoints        = DEFAULT_MAX_HITPOINT;
-	m_maxAmmo          = DEFAULT_MAX_AMMO;
-	m_ammo             = DEFAULT_MAX_AMMO;
-	m_ammoDamage       = DEFAULT_AMMO_DAMAGE;
-	m_ammoRechargeTime = DEFAULT_AMMO_RECHARGE_TIME;
-	m_repairValue      = DEFAULT_REPAIR_VALUE;
-	m_isReloading      = false;
-	m_ammoSpawnTime    = DEFAULT_AMMO_SPAWN_TIME;
-	m_canRespawnAmmo   = true;
+	// the fields not stored keep the defaults
+	setNetworkConfigDefaults();
+	readNetworkConfigFile();
+	setTankConfigDefaults();
+	readTankConfigFile();
+	// the motion profiles start from the center (the servo position is unknown)
+	m_turretPlanner.reset(m_servoCenter);
+
+	m_lastHitDamage = DEFAULT_AMMO_DAMAGE;
+	resetGame();
+
+	m_recorder.begin(&m_game, MATCH_RECORDER_ENABLED);
+	m_timerWheel.attach_ms(m_recordTimer, MATCH_FLUSH_PERIOD, CMatchRecorder::flushTimer, &m_recorder);
+
+	m_lastHitCode = -1;
+	m_statsJournal.begin();
+	m_timerWheel.attach_ms(m_statsTimer, STATS_FLUSH_PERIOD, CStatsJournal::flushTimer, &m_statsJournal);
+	m_fastBoot.endStage(stage);
 }
 
 CTank::~CTank()
 {
+	m_recorder.flush();
+	m_statsJournal.flush();
 	delete m_pIRcom;
+	delete m_pIRaux;
 	delete m_pMP3com;
 }
 
+// user command: it always wins over a running animation (no input latency)
 void CTank::moveTank(int joystickX, int joystickY) {
-	int lMotorPWM, rMotorPWM;
-	int lMotorDir, rMotorDir;
+	m_joystickX = joystickX;
+	m_joystickY = joystickY;
+	m_recorder.recordJoystick(halMillis(), joystickX, joystickY);
+	// a direct command makes the latched input stale
+	if (m_joystickSetpoint.isPending) {
+		m_joystickSetpoint.isPending = false;
+		m_controlStats.stale++;
+	}
+	m_animator.cancel(ANIMATION_TRACK_MOTORS);
+	writeMotors(joystickX, joystickY);
+}
 
-	// deadband threshold filtering
-	if (abs(joystickY) <= PWM_DEADBAND)
-		joystickY = 0;
-	if (abs(joystickX) <= PWM_DEADBAND)
-		joystickX = 0;
+// the motors reach the new target through the mixer ramp (see stepMotors)
+void CTank::writeMotors(int joystickX, int joystickY) {
+	m_mixer.setTarget(joystickX, joystickY);
+}
 
-	// calculate motor PWM output (signed)
-	lMotorPWM = -joystickX + joystickY;
-	rMotorPWM = joystickX + joystickY;
+void CTank::stepMotors(void) {
+	if (!m_mixer.step())
+		return;
+	int lMotorPWM = m_mixer.getLeftDuty();
+	int rMotorPWM = m_mixer.getRightDuty();
+	int lMotorDir, rMotorDir;
 
 	// calculate motor PWM module and direction... left motor
 	if (lMotorPWM < 0) {
@@ -232,78 +300,149 @@ void CTank::moveTank(int joystickX, int joystickY) {
 	else
 		rMotorDir = HIGH;
 
-	// PWM cap (PWM duty cycle must be 1023 (100%) or lesser)
-	if (lMotorPWM > 1023) lMotorPWM = 1023;
-	if (rMotorPWM > 1023) rMotorPWM = 1023;
-
 	// write data to the motors pin
-	analogWrite(L_MOTOR_PWM_PIN, lMotorPWM);
-	analogWrite(R_MOTOR_PWM_PIN, rMotorPWM);
-	digitalWrite(L_MOTOR_DIR_PIN, lMotorDir);
-	digitalWrite(R_MOTOR_DIR_PIN, rMotorDir);
+	halAnalogWrite(L_MOTOR_PWM_PIN, lMotorPWM);
+	halAnalogWrite(R_MOTOR_PWM_PIN, rMotorPWM);
+	halDigitalWrite(L_MOTOR_DIR_PIN, lMotorDir);
+	halDigitalWrite(R_MOTOR_DIR_PIN, rMotorDir);
+}
 
+CMotorMixer &CTank::getMotorMixer(void)
+{
+	return(m_mixer);
 }
 
 void CTank::moveTurretDegree(int angle)
+{
+	m_recorder.recordTurretDegree(halMillis(), angle);
+	if (m_turretSetpoint.isPending) {
+		m_turretSetpoint.isPending = false;
+		m_controlStats.stale++;
+	}
+	m_animator.cancel(ANIMATION_TRACK_TURRET);
+	writeTurretDegree(angle);
+}
+
+void CTank::writeTurretDegree(int angle)
 {
 	// filter the value [0..180]. May be not necessary
 	if (angle < 0) angle = 0;
 	if (angle > 180) angle = 180;
 	// the servo is mounted upside-down -> reverse the value
 	angle = 180 - angle;
-	// write the value
-	m_turret.write(angle);
+	// the planner moves the servo there (same conversion of the Servo library)
+	m_turretPlanner.setTarget(SERVO_DEGREE_MIN_US + (angle * (SERVO_DEGREE_MAX_US - SERVO_DEGREE_MIN_US)) / 180);
 }
 
 void CTank::moveTurret_us(int us, bool absolute)
 {
+	m_recorder.recordTurret_us(halMillis(), us, absolute);
+	if (m_turretSetpoint.isPending) {
+		m_turretSetpoint.isPending = false;
+		m_controlStats.stale++;
+	}
+	m_animator.cancel(ANIMATION_TRACK_TURRET);
+	writeTurret_us(us, absolute);
+}
+
+void CTank::writeTurret_us(int us, bool absolute)
+{
+	// the slider moves the turret inside the calibrated range, the calibration sliders (absolute)
+	// inside the servo range
 	if (!absolute) {
 		us = m_servoMax_us - (us - m_servoMin_us);
+		if (us < m_servoMin_us)
+			us = m_servoMin_us;
+		if (us > m_servoMax_us)
+			us = m_servoMax_us;
 	}
 	if (us < 1000 - SERVO_RANGE)
 		us = 1000 - SERVO_RANGE;
 	if (us > 2000 + SERVO_RANGE)
 		us = 2000 + SERVO_RANGE;
-	m_turret.writeMicroseconds(us);
+	m_turretPlanner.setTarget(us);
+}
+
+void CTank::stepTurret(void)
+{
+	if (m_turretPlanner.step())
+		m_turret.writeMicroseconds(m_turretPlanner.getPosition_us());
+}
+
+CTurretPlanner &CTank::getTurretPlanner(void)
+{
+	return(m_turretPlanner);
+}
+
+uint16_t CTank::getTurretPosition_us(void)
+{
+	return(m_turretPlanner.getPosition_us());
 }
 
 bool CTank::shoot(void)
 {
 	if (NULL == m_pIRcom) // check if the IR object is created 
 		return(false);
-	if (m_isReloading) // check if is recharging ammos
+	if (!m_game.canFire()) { // reloading or no ammos
+		m_recorder.recordTrigger(halMillis(), MATCH_TRIGGER_REFUSED);
 		return(false);
-	if (m_pIRcom->isSendingData()) // check if is already sending IR data
-		return(false);
-	if (0 == m_ammo) // no ammos
+	}
+	if (m_pIRcom->isSendingData()) { // check if is already sending IR data
+		m_recorder.recordTrigger(halMillis(), MATCH_TRIGGER_IR_BUSY);
 		return(false);
+	}
 
-	// fire sending my ID
-
-	m_pIRcom->sendByte(MY_ID);
-	m_isReloading = true;
-	if (m_canRespawnAmmo) {
-		m_reloadTimer.once_ms(m_ammoRechargeTime, ammoReload, this);
-		if (m_spawnAmmoTimer.active())
-			m_spawnAmmoTimer.detach();
-		m_spawnAmmoTimer.attach_ms(m_ammoSpawnTime, spawnAmmo, this);
+	// hit payload. The older firmwares understand only the legacy protocol and the ID
+	uint8_t damage = m_game.getRules().ammoDamage / HIT_DAMAGE_UNIT;
+	if (damage > 0x0F)
+		damage = 0x0F;
+	uint8_t hitPayload = MY_ID | (damage << 4);
+	bool    isLegacy = (IR_PROTOCOL_LEGACY == m_pIRcom->getProtocol());
+
+	// fire (from both barrels if there is a second one)
+	if ((NULL != m_pIRaux) && m_pIRaux->hasTransmitter()) {
+		CIR *barrels[] = { m_pIRcom, m_pIRaux };
+		bool isSent;
+		isLegacy = isLegacy || (IR_PROTOCOL_LEGACY == m_pIRaux->getProtocol());
+		if (isLegacy)
+			isSent = CIR::sendByteAll(barrels, 2, MY_ID);
+		else if (IR_HIT_FEC)
+			isSent = CIR::sendWordAll(barrels, 2, CFEC::encode(hitPayload));
+		else
+			isSent = CIR::sendByteAll(barrels, 2, hitPayload);
+		if (!isSent) {
+			m_recorder.recordTrigger(halMillis(), MATCH_TRIGGER_IR_BUSY);
+			return(false);
+		}
 	}
-	if (m_ammo > 0)
-		m_ammo--;
+	else if (isLegacy)
+		m_pIRcom->sendByte(MY_ID);
+	else if (IR_HIT_FEC)
+		m_pIRcom->sendWord(CFEC::encode(hitPayload));
+	else
+		m_pIRcom->sendByte(hitPayload);
+	m_recorder.recordTrigger(halMillis(), MATCH_TRIGGER_FIRED);
+	m_statsJournal.countShot();
+	postGameEvent(GAME_EVENT_FIRE);
 	return(true);
 }
 
-bool CTank::checkProximity(uint16_t timeout)
+bool CTank::checkProximity(uint16_t timeout, uint16_t minWindow)
 {
 	unsigned long startTime;
 	uint8_t data = 0x00;
 	if (NULL == m_pIRcom) // check if the IR object is created 
 		return(false);
-	startTime = millis();
-	while (((millis() - startTime) < timeout) && (data != HOTSPOT_REQUEST_CODE)){
+	startTime = halMillis();
+	while (((halMillis() - startTime) < timeout) && (data != HOTSPOT_REQUEST_CODE)){
+		// nothing in front of the turret and the WiFi is ready: no reason to wait. The connections
+		// go on meanwhile (the hotspot request is checked here)
+		m_connectivity.run();
+		if (m_connectivity.isWiFiConnected() && ((halMillis() - startTime) >= minWindow))
+			break;
 		if (!m_pIRcom->isSendingData()) // check if is already sending IR data
 			m_pIRcom->sendByte(HOTSPOT_REQUEST_CODE);
-		delay(10);
+		halDelay(10);
 		if (m_pIRcom->available())
 			data = m_pIRcom->receiveByte();
 	}
@@ -313,31 +452,50 @@ bool CTank::checkProximity(uint16_t timeout)
 	return false;
 }
 
+// the animations return immediately: the keyframes are played by the animator timers
 void CTank::shakeTurretAnimation(uint8_t times, bool startFromLeft)
 {
-	for (uint8_t i = 0; i < times; i++) {
-		if (startFromLeft) {
-			moveTurretDegree(60);
-			delay(300);
-			moveTurretDegree(120);
-		} else {
-			moveTurretDegree(120);
-			delay(300);
-			moveTurretDegree(60);
-		}
-		delay(300);
+	AnimationKeyframe_t frames[ANIMATION_MAX_KEYFRAMES];
+	uint8_t count = 0;
+	int16_t first = startFromLeft ? 60 : 120;
+	for (uint8_t i = 0; (i < times) && (count < ANIMATION_MAX_KEYFRAMES - 2); i++) {
+		frames[count++] = { ANIMATION_TURRET_DEGREE, first, 0, 300 };
+		frames[count++] = { ANIMATION_TURRET_DEGREE, (int16_t)(180 - first), 0, 300 };
 	}
-	moveTurret_us(m_servoCenter, true);
+	frames[count++] = { ANIMATION_TURRET_US, (int16_t)m_servoCenter, 0, 0 };
+	m_animator.play(ANIMATION_TRACK_TURRET, frames, count, ANIMATION_PRIORITY_HIGH);
 }
 
+// recoil. The user can drive during the animation: the motors go back to the joystick command.
+// Every keyframe lasts the mixer ramp to its target (slew and jerk limits): full scale kicks
 void CTank::shootAnimation(void)
 {
-	moveTank(0, -1023);
-	delay(50);
-	moveTank(0, 1023);
-	delay(50);
-	moveTank(0, 0);
-	delay(50);
+	const AnimationKeyframe_t frames[] = {
+		{ ANIMATION_MOTORS, 0, -1023, m_mixer.getRampTime_ms(m_joystickX, m_joystickY, 0, -1023) },
+		{ ANIMATION_MOTORS, 0,  1023, m_mixer.getRampTime_ms(0, -1023, 0, 1023) },
+		{ ANIMATION_MOTORS, 0,     0, m_mixer.getRampTime_ms(0, 1023, 0, 0) },
+	};
+	m_animator.play(ANIMATION_TRACK_MOTORS, frames, sizeof(frames) / sizeof(frames[0]));
+}
+
+void CTank::applyAnimationFrame(uint8_t track, const AnimationKeyframe_t &frame)
+{
+	switch (frame.action) {
+	case ANIMATION_TURRET_DEGREE:
+		writeTurretDegree(frame.value1);
+		break;
+	case ANIMATION_TURRET_US:
+		writeTurret_us(frame.value1, true);
+		break;
+	case ANIMATION_MOTORS:
+		writeMotors(frame.value1, frame.value2);
+		break;
+	case ANIMATION_END:
+		// a completed recoil gives back the motors to the user (a cancelled one: the user is driving)
+		if ((ANIMATION_TRACK_MOTORS == track) && (0 == frame.value1))
+			writeMotors(m_joystickX, m_joystickY);
+		break;
+	}
 }
 
 /*
@@ -393,56 +551,56 @@ void CTank::checkConfigPortalRequest(bool force)
 		Serial.println("Starting tank");
 }
 */
-bool CTank::wifiConnect(bool autoStartHotspot)
+// the link cached by the last connection, if any, saves the scan of the channels and the DHCP
+void CTank::wifiBegin(void)
 {
-	WiFi.begin(m_wifiSSID.c_str(), m_wifiPSW.c_str());  // Connect to the network
-	Serial.printf("Connecting to %s", m_wifiSSID.c_str());
+	m_isHotspotHinted = false;
+	m_connectivity.begin(m_network.wifiSSID, m_network.wifiPSW, &m_fastBoot);
+}
 
-	int i = 0;
-	while ((WiFi.status() != WL_CONNECTED) && (i <= WIFI_TIMEOUT)) {
-		delay(1000);
-		Serial.print('.');
-		i++;
+// never online since the begin and still failing: the settings may be wrong. The config portal
+// blocks, so it is started only by the proximity gesture at boot: here the user is told once
+// (turret shake) and the connection goes on retrying (the access point may just be off)
+uint8_t CTank::runNetwork(void)
+{
+	uint8_t state = m_connectivity.run();
+	if (m_connectivity.isHotspotNeeded() && !m_isHotspotHinted) {
+		Serial.printf("Unable to connect to %s. For the hotspot, restart with a hand in front of the turret\n", m_network.wifiSSID);
+		shakeTurretAnimation(3);
+		m_isHotspotHinted = true;
 	}
-	Serial.println('\n');
+	return(state);
+}
 
-	if (i <= WIFI_TIMEOUT) {
-		// connection established
-		Serial.println("Connection established!");
-		Serial.print("IP address: ");
-		Serial.println(WiFi.localIP());
-	}
-	else {
-		// unable to connect -> launch WiFi manager
-		Serial.printf("Unable to connect to %s\n", m_wifiSSID.c_str());
-		if (autoStartHotspot) {
-			Serial.printf("Launching hotspot...\n");
-			startHotspot();
-		}
-		else
-			return(false);
-	}
-	return(true);
+CConnectivity &CTank::getConnectivity(void)
+{
+	return(m_connectivity);
+}
 
+CFastBoot &CTank::getFastBoot(void)
+{
+	return(m_fastBoot);
 }
 
+#ifdef ARDUINO
 IPAddress CTank::getBlynkIP(void)
 {
 	if (!isBlynkKnownByIP())
 		return IPAddress(0,0,0,0);
 	IPAddress ip;
-	ip.fromString(m_blynkServer);
+	ip.fromString(m_network.blynkServer);
 	return(ip);
 }
+#endif
 
 String CTank::getBlynkServer(void)
 {
-	return(m_blynkServer);
+	return(m_network.blynkServer);
 }
 
 uint16_t CTank::getBlynkPort(void)
 {
-	long port = atol(m_blynkPort.c_str());
+	long port = atol(m_network.blynkPort);
 	if (port < 0)
 		port = 0;
 	else if (port > 65535)
@@ -452,27 +610,248 @@ uint16_t CTank::getBlynkPort(void)
 
 String CTank::getBlynkToken(void)
 {
-	return(m_blynkToken);
+	return(m_network.blynkToken);
 }
 
 bool CTank::isBlynkKnownByIP(void)
 {
+#ifdef ARDUINO
 	IPAddress ip;
-	return (ip.fromString(m_blynkServer));
+	return (ip.fromString(m_network.blynkServer));
+#else
+	return(false);
+#endif
 }
 
+// filtered battery voltage (mV). The ADC is sampled by the battery timer
 uint16_t CTank::getBatteryVoltage(void)
 {
-	uint16_t voltage = analogRead(A0);            // read battery voltage [0..1023]
-	voltage = (float)voltage * BATTERY_VOLTAGE;   // convert it in mV
-	return (voltage);
+	if (!m_battery.isValid())
+		sampleBattery();
+	return(m_battery.getVoltage());
+}
+
+// low battery state, with hysteresis (see CBatteryMonitor)
+bool CTank::isBatteryLow(void)
+{
+	if (!m_battery.isValid())
+		sampleBattery();
+	return(m_battery.isLow());
+}
+
+// state of charge, per mille
+uint16_t CTank::getBatteryCharge(void)
+{
+	return(m_battery.getCharge());
+}
+
+// minutes, BATTERY_RUNTIME_UNKNOWN if not known yet
+uint16_t CTank::getBatteryRuntime(void)
+{
+	return(m_battery.getRuntime());
+}
+
+void CTank::sampleBattery(void)
+{
+	if (m_battery.addSample(halAnalogRead(A0), halMillis()))
+		m_recorder.recordBattery(halMillis(), m_battery.getVoltage());
+}
+
+void CTank::printBatteryStats(void)
+{
+	m_battery.printStats();
 }
 
+// oldest hit code received, -1 if there are no more hits queued
 int CTank::getHitCode(void)
 {
-	if (m_pIRcom->available())
-		return(m_pIRcom->receiveByte());
-	return(-1);
+	int hitCode = receiveHit(m_pIRcom);
+	if ((NO_VALID_DATA == hitCode) && (NULL != m_pIRaux))
+		hitCode = receiveHit(m_pIRaux);
+	if (NO_VALID_DATA != hitCode) {
+		m_recorder.recordHitCode(halMillis(), hitCode, m_lastHitDamage);
+		m_lastHitCode = hitCode;
+	}
+	return(hitCode);
+}
+
+// next hit received by a transceiver. The FEC coded hits are corrected (one wrong bit
+// per nibble), the uncorrectable ones are discarded. Both the pulse distance formats are
+// accepted, whatever IR_HIT_FEC is
+int CTank::receiveHit(CIR *pIR)
+{
+	IRFrame_t frame;
+	while (pIR->receiveFrame(frame)) {
+		if (IR_PROTOCOL_LEGACY == frame.protocol) {
+			// only the ID: the damage is the same of my ammos
+			m_lastHitDamage = m_game.getRules().ammoDamage;
+			return(frame.data);
+		}
+		uint8_t payload = frame.data;
+		if ((IR_PROTOCOL_PD_WORD == frame.protocol) && (FEC_UNCORRECTABLE == CFEC::decode(frame.data, payload)))
+			continue;
+		m_lastHitDamage = (payload >> 4) * HIT_DAMAGE_UNIT;
+		return(payload & 0x0F);
+	}
+	return(NO_VALID_DATA);
+}
+
+IRStats_t CTank::getIRStats(void)
+{
+	return(m_pIRcom->getStats());
+}
+
+// histogram bin (see IR_HISTOGRAM_BINS): upper limit (exclusive) and count
+static void printHistogramBin(uint8_t bin, uint32_t count)
+{
+	if (IR_HISTOGRAM_BINS - 1 == bin)
+		Serial.printf(" >=%u:%u", 1u << (bin - 1), count);
+	else
+		Serial.printf(" <%u:%u", 1u << bin, count);
+}
+
+// IR counters and timing histograms on the serial console
+void CTank::printIRStats(void)
+{
+	printIRStats("IR", m_pIRcom);
+	if (NULL != m_pIRaux)
+		printIRStats("IR aux", m_pIRaux);
+}
+
+void CTank::resetIRStats(void)
+{
+	m_pIRcom->resetStats();
+	if (NULL != m_pIRaux)
+		m_pIRaux->resetStats();
+}
+
+// app inputs: only the newest one is applied by the next control step (a burst of queued
+// Blynk updates moves the tank once, to the last position)
+void CTank::setJoystick(int joystickX, int joystickY)
+{
+	latch(m_joystickSetpoint, joystickX, joystickY, false);
+}
+
+void CTank::setTurret_us(int us, bool absolute)
+{
+	latch(m_turretSetpoint, us, 0, absolute);
+}
+
+void CTank::latch(setpoint_t &setpoint, int value1, int value2, bool absolute)
+{
+	if (setpoint.isPending)
+		m_controlStats.stale++;
+	setpoint.value1     = value1;
+	setpoint.value2     = value2;
+	setpoint.absolute   = absolute;
+	setpoint.isPending  = true;
+	setpoint.latched_us = halMicros();
+	m_controlStats.samples++;
+}
+
+void CTank::controlStep(void)
+{
+	if (m_joystickSetpoint.isPending) {
+		recordActuation(m_joystickSetpoint);
+		moveTank(m_joystickSetpoint.value1, m_joystickSetpoint.value2);
+	}
+	if (m_turretSetpoint.isPending) {
+		recordActuation(m_turretSetpoint);
+		moveTurret_us(m_turretSetpoint.value1, m_turretSetpoint.absolute);
+	}
+}
+
+void CTank::recordActuation(setpoint_t &setpoint)
+{
+	setpoint.isPending = false;
+	uint32_t latency = halMicros() - setpoint.latched_us;
+	m_controlStats.applied++;
+	m_controlStats.latencySum_us += latency;
+	if (latency > m_controlStats.latencyMax_us)
+		m_controlStats.latencyMax_us = latency;
+	uint8_t bin = (0 == latency) ? 0 : 32 - __builtin_clz(latency);
+	m_controlStats.latencyHistogram[(bin < CONTROL_HISTOGRAM_BINS) ? bin : CONTROL_HISTOGRAM_BINS - 1]++;
+}
+
+ControlStats_t CTank::getControlStats(void)
+{
+	return(m_controlStats);
+}
+
+void CTank::resetControlStats(void)
+{
+	memset(&m_controlStats, 0, sizeof(m_controlStats));
+}
+
+// control loop counters and input to actuation latency on the serial console
+void CTank::printControlStats(void)
+{
+	Serial.printf("control: %u ms period, %u inputs, %u applied, %u stale, latency avg %u us, max %u us\n  latency (us)      :",
+		CONTROL_PERIOD_MS, m_controlStats.samples, m_controlStats.applied, m_controlStats.stale,
+		(m_controlStats.applied > 0) ? (uint32_t)(m_controlStats.latencySum_us / m_controlStats.applied) : 0,
+		m_controlStats.latencyMax_us);
+	for (uint8_t i = 0; i < CONTROL_HISTOGRAM_BINS; i++) {
+		if (m_controlStats.latencyHistogram[i] > 0)
+			printHistogramBin(i, m_controlStats.latencyHistogram[i]);
+	}
+	Serial.printf("\n");
+}
+
+// timers of the tank and of the sketch, game timers (reload, ammo respawn). To be called by the main loop
+uint32_t CTank::runTimers(void)
+{
+	m_game.advance(halMillis());
+	return(m_timerWheel.run());
+}
+
+CTimerWheel &CTank::getTimerWheel(void)
+{
+	return(m_timerWheel);
+}
+
+// timer wheel deadlines on the serial console
+void CTank::printTimerStats(void)
+{
+	TimerWheelStats_t stats = m_timerWheel.getStats();
+	Serial.printf("timers: %u pending, %u dispatched, %u cascaded, late avg %u ms, max %u ms\n", m_timerWheel.getPending(),
+		stats.dispatched, stats.cascaded, (stats.dispatched > 0) ? (uint32_t)(stats.lateSum_ms / stats.dispatched) : 0,
+		stats.lateMax_ms);
+	Serial.printf("  callback max %u us, run max %u us\n  lateness (ms)     :", stats.callbackMax_us, stats.runMax_us);
+	// empty bins skipped
+	for (uint8_t i = 0; i < TIMER_WHEEL_HISTOGRAM_BINS; i++) {
+		if (0 == stats.lateHistogram[i])
+			continue;
+		if (0 == i)
+			Serial.printf(" 0:%u", stats.lateHistogram[i]);
+		else if (TIMER_WHEEL_HISTOGRAM_BINS - 1 == i)
+			Serial.printf(" >=%u:%u", 1u << (i - 1), stats.lateHistogram[i]);
+		else
+			Serial.printf(" <%u:%u", 1u << i, stats.lateHistogram[i]);
+	}
+	Serial.printf("\n");
+}
+
+void CTank::printIRStats(const char *name, CIR *pIR)
+{
+	IRStats_t stats = pIR->getStats();
+	Serial.printf("%s rx: %u frames, %u parity, %u framing, %u version, %u edge overflows, %u frame overflows\n", name,
+		stats.framesReceived, stats.parityErrors, stats.framingErrors, stats.versionErrors, stats.edgeOverflows, stats.frameOverflows);
+	Serial.printf("%s tx: %u frames, %u deferred, %u dropped, latency avg %u us, max %u us\n", name, stats.txFrames,
+		stats.txDeferred, stats.txDropped, (stats.txFrames > 0) ? (uint32_t)(stats.txLatency_us / stats.txFrames) : 0,
+		stats.txLatencyMax_us);
+	Serial.printf("%s interrupts: %u, max %u cycles (%u MHz)\n", name, stats.isrCount, stats.isrMaxCycles, HAL_CPU_MHZ);
+	// empty bins skipped
+	Serial.printf("  duration (cycles) :");
+	for (uint8_t i = 0; i < IR_HISTOGRAM_BINS; i++) {
+		if (stats.isrCyclesHistogram[i] > 0)
+			printHistogramBin(i, stats.isrCyclesHistogram[i]);
+	}
+	Serial.printf("\n  edge jitter (us)  :");
+	for (uint8_t i = 0; i < IR_HISTOGRAM_BINS; i++) {
+		if (stats.edgeJitterHistogram[i] > 0)
+			printHistogramBin(i, stats.edgeJitterHistogram[i]);
+	}
+	Serial.printf(", max %u us\n", stats.edgeJitterMax_us);
 }
 
 uint16_t CTank::getServoMin_us(void)
@@ -507,201 +886,170 @@ void CTank::setServoCenter(uint16_t newValue)
 
 uint8_t CTank::getMaxHitpoint(void)
 {
-	return(m_maxHitPoints);
+	return(m_game.getRules().maxHitPoints);
 }
 
 uint8_t CTank::getHitpoint(void)
 {
-	return(m_hitPoints);
+	return(m_game.getState().hitPoints);
 }
 
 uint8_t CTank::getAmmo(void)
 {
-	return(m_ammo);
+	return(m_game.getState().ammo);
 }
 
 uint8_t CTank::getMaxAmmo(void)
 {
-	return(m_maxAmmo);
+	return(m_game.getRules().maxAmmo);
 }
 
+// the hit goes to the stats with the shooter of the last hit code received
 uint8_t CTank::gotHitByDamage(uint8_t damage)
 {
-	if (((int)m_hitPoints - damage) < 0)
-		m_hitPoints = 0;
-	else
-		m_hitPoints -= damage;
-	return(m_hitPoints);
+	uint8_t hitPoints = m_game.getState().hitPoints;
+	postGameEvent(GAME_EVENT_HIT, damage);
+	m_statsJournal.countHit(m_lastHitCode);
+	m_lastHitCode = -1;
+	if ((hitPoints > 0) && (0 == m_game.getState().hitPoints))
+		m_statsJournal.countDeath();
+	return(m_game.getState().hitPoints);
 }
 
+// damage of the last hit received
 uint8_t CTank::gotHit(void)
 {
-	return(gotHitByDamage(m_ammoDamage));
+	return(gotHitByDamage(m_lastHitDamage));
 }
 
 uint8_t CTank::repairTank(void)
 {
-	if ((m_hitPoints + m_repairValue) > m_maxHitPoints)
-		m_hitPoints = m_maxHitPoints;
-	else
-		m_hitPoints += m_repairValue;
-	return(m_hitPoints);
+	postGameEvent(GAME_EVENT_REPAIR);
+	return(m_game.getState().hitPoints);
 }
 
 uint8_t CTank::newAmmos(uint8_t ammos)
 {
-	if ((m_ammo + ammos) > m_maxAmmo)
-		m_ammo = m_maxAmmo;
-	else
-		m_ammo += ammos;
-	return(m_ammo);
+	postGameEvent(GAME_EVENT_AMMO, ammos);
+	return(m_game.getState().ammo);
 }
 
-bool CTank::initFS(bool formatFS)
+// one time SPIFFS -> LittleFS migration: the flash area is the same, the config files are kept in
+// RAM while the flash is formatted
+static bool migrateLegacyFS(void)
 {
-	// try to initialize the SPI file system
-	if (!SPIFFS.begin()) {
-		Serial.println("\nSPIFFS initialization failed.");
+	const uint8_t count = sizeof(migratedFiles) / sizeof(migratedFiles[0]);
+	uint8_t *data[count];
+	size_t   size[count];
+	if (!halFSLegacyBegin())
 		return(false);
+	for (uint8_t i = 0; i < count; i++) {
+		data[i] = NULL;
+		size[i] = 0;
+		CHalFile file = halFSLegacyOpen(migratedFiles[i]);
+		if (!file)
+			continue;
+		size[i] = (file.size() < FS_MIGRATION_FILE_MAX) ? file.size() : FS_MIGRATION_FILE_MAX;
+		data[i] = (uint8_t *)malloc(size[i] + 1);
+		if (NULL != data[i])
+			size[i] = file.read(data[i], size[i]);
+		file.close();
 	}
-
-	if (!SPIFFS.exists(NETWORK_CONFIG_FILE) || formatFS) {
-		// no config file present -> format the SPI file system
-		if (!SPIFFS.format()) {
-			Serial.println("SPIFFS Format error.");
-			return(false);
-		}
-		// create the config file
-		if (!writeNetworkConfigFile(true)) {
-			Serial.printf("Unable to create %s file.\n", NETWORK_CONFIG_FILE);
-			return(false);
+	halFSLegacyEnd();
+
+	bool isFormatted = halFSFormat() && halFSBegin();
+	for (uint8_t i = 0; i < count; i++) {
+		if (isFormatted && (NULL != data[i])) {
+			CHalFile file = halFSOpen(migratedFiles[i], "w");
+			if (file) {
+				file.write(data[i], size[i]);
+				file.close();
+			}
 		}
+		free(data[i]);
 	}
-	return(true);
+	return(isFormatted);
+}
+
+// LittleFS, migrated from the SPIFFS of the older firmwares if needed. It is formatted only if
+// asked or if the flash has no file system: a missing file is not a reason to format (the
+// settings have defaults)
+bool CTank::initFS(bool formatFS)
+{
+	uint32_t start = halMicros();
+	m_isFSMigrated = false;
+	m_isFSMounted  = !formatFS && halFSBegin();
+	if (!m_isFSMounted && !formatFS) {
+		m_isFSMigrated = migrateLegacyFS();
+		m_isFSMounted  = m_isFSMigrated;
+		if (m_isFSMigrated)
+			Serial.println("SPIFFS migrated to LittleFS.");
+	}
+	if (!m_isFSMounted) {
+		Serial.println("Formatting the file system.");
+		m_isFSMounted = halFSFormat() && halFSBegin();
+	}
+	m_mount_us = halMicros() - start;
+	if (!m_isFSMounted)
+		Serial.println("\nFile system initialization failed.");
+	return(m_isFSMounted);
 }
 
 bool CTank::writeNetworkConfigFile(bool useDefault)
 {
-	File configFile = SPIFFS.open(NETWORK_CONFIG_FILE, "w");
-	if (!configFile) {
+	NetworkConfig_t defaults;
+	if (useDefault)
+		setNetworkConfigDefaults(defaults);
+	if (!networkStore.save(useDefault ? &defaults : &m_network)) {
 		Serial.printf("Unable to create %s file.\n", NETWORK_CONFIG_FILE);
 		return(false);
 	}
-
-	configFile.printf("%s%s\n", VERSION_TAG, NETWORK_CFG_FILE_VERSION);
-	if (useDefault) {
-		configFile.printf("%s%s\n", WIFI_SSID_TAG, DEFAULT_SSID);
-		configFile.printf("%s%s\n", WIFI_PSWD_TAG, DEFAULT_PSWD);
-		configFile.printf("%s%s\n", HS_SSID_TAG, DEFAULT_HOTSPOT_SSID);
-		configFile.printf("%s%s\n", HS_PSWD_TAG, DEFAULT_HOTSPOT_PSWD);
-		configFile.printf("%s%s\n", BLYNK_SERVER_TAG, DEFAULT_BLYNK_SERVER);
-		configFile.printf("%s%s\n", BLYNK_PORT_TAG, DEFAULT_BLYNK_PORT);
-		configFile.printf("%s%s\n", BLYNK_TOKEN_TAG, DEFAULT_BLYNK_TOKEN);
-	}
-	else {
-		configFile.printf("%s%s\n", WIFI_SSID_TAG, m_wifiSSID.c_str());
-		configFile.printf("%s%s\n", WIFI_PSWD_TAG, m_wifiPSW.c_str());
-		configFile.printf("%s%s\n", HS_SSID_TAG, m_hotspotSSID.c_str());
-		configFile.printf("%s%s\n", HS_PSWD_TAG, m_hotspotPSW.c_str());
-		configFile.printf("%s%s\n", BLYNK_SERVER_TAG, m_blynkServer.c_str());
-		configFile.printf("%s%s\n", BLYNK_PORT_TAG, m_blynkPort.c_str());
-		configFile.printf("%s%s\n", BLYNK_TOKEN_TAG, m_blynkToken.c_str());
-	}
-	configFile.close();
-
 	return(true);
 }
 
+// binary record, migrated or imported from the old text file if needed: no heap allocation
 bool CTank::readNetworkConfigFile(void)
 {
-	File configFile = SPIFFS.open(NETWORK_CONFIG_FILE, "r");
-	if (!configFile) {
-		Serial.printf("Unable to open %s file.\n", NETWORK_CONFIG_FILE);
-		return(false);
-	}
-
-	// read configiguration data
-	while (configFile.available()) {
-		String data = configFile.readStringUntil('\n');
-		if (data.startsWith(VERSION_TAG)) {
-			data.replace(VERSION_TAG, "");
-			if (data != NETWORK_CFG_FILE_VERSION) {
-				Serial.println("Wrong firmware version, loading defaults.");
-				// different firmware version -> generate a new default one
-				configFile.close();
-				writeNetworkConfigFile(true);
-
-				setNetworkConfigDefaults();
-				return(true);
-			}
-		}
-		else if (data.startsWith(WIFI_SSID_TAG)) {
-			data.replace(WIFI_SSID_TAG, "");
-			m_wifiSSID = data;
-		}
-		else if (data.startsWith(WIFI_PSWD_TAG)) {
-			data.replace(WIFI_PSWD_TAG, "");
-			m_wifiPSW = data;
-		}
-		else if (data.startsWith(HS_SSID_TAG)) {
-			data.replace(HS_SSID_TAG, "");
-			m_hotspotSSID = data;
-		}
-		else if (data.startsWith(HS_PSWD_TAG)) {
-			data.replace(HS_PSWD_TAG, "");
-			m_hotspotPSW = data;
-		}
-		else if (data.startsWith(BLYNK_SERVER_TAG)) {
-			data.replace(BLYNK_SERVER_TAG, "");
-			m_blynkServer = data;
-		}
-		else if (data.startsWith(BLYNK_PORT_TAG)) {
-			data.replace(BLYNK_PORT_TAG, "");
-			m_blynkPort = data;
-		}
-		else if (data.startsWith(BLYNK_TOKEN_TAG)) {
-			data.replace(BLYNK_TOKEN_TAG, "");
-			m_blynkToken = data;
-		}
-	}
-	configFile.close();
-
-	return(true);
+	uint8_t result = networkStore.load(&m_network);
+	if (CONFIG_LOADED != result)
+		Serial.printf("%s: %s\n", NETWORK_CONFIG_FILE, CConfigStore::resultName(result));
+	return((CONFIG_NOT_FOUND != result) && (CONFIG_CORRUPTED != result));
 }
 
 void CTank::startHotspot(void)
 {
 	shakeTurretAnimation(3);
+#ifdef ARDUINO
 	WiFiManager wifiManager;
 	// wifimanager configuration
 	shouldSaveConfig = false;
 	wifiManager.setAPCallback(configModeCallback);
 	wifiManager.setSaveConfigCallback(saveConfigCallback);
-	WiFiManagerParameter customHotspotSSID("HS SSID", "Hotspot SSID", m_hotspotSSID.c_str(), 40);
+	WiFiManagerParameter customHotspotSSID("HS SSID", "Hotspot SSID", m_network.hotspotSSID, 40);
 	wifiManager.addParameter(&customHotspotSSID);
-	WiFiManagerParameter customHotspotPSW("HS PSWD", "Hotspot password", m_hotspotPSW.c_str(), 40);
+	WiFiManagerParameter customHotspotPSW("HS PSWD", "Hotspot password", m_network.hotspotPSW, 40);
 	wifiManager.addParameter(&customHotspotPSW);
-	WiFiManagerParameter customBlynkServer("Server", "Blynk Server", m_blynkServer.c_str(), 40);
+	WiFiManagerParameter customBlynkServer("Server", "Blynk Server", m_network.blynkServer, 40);
 	wifiManager.addParameter(&customBlynkServer);
-	WiFiManagerParameter customBlynkPort("Port", "Blynk Port", m_blynkPort.c_str(), 5);
+	WiFiManagerParameter customBlynkPort("Port", "Blynk Port", m_network.blynkPort, 5);
 	wifiManager.addParameter(&customBlynkPort);
-	WiFiManagerParameter customBlynkToken("Token", "Blynk Token", m_blynkToken.c_str(), 40);
+	WiFiManagerParameter customBlynkToken("Token", "Blynk Token", m_network.blynkToken, 40);
 	wifiManager.addParameter(&customBlynkToken);
 
 #if ENABLE_HOTSPOT_PSW == 0
-	wifiManager.startConfigPortal(m_hotspotSSID.c_str());
+	wifiManager.startConfigPortal(m_network.hotspotSSID);
 #else
-	wifiManager.startConfigPortal(m_hotspotSSID.c_str(), m_hotspotPSW.c_str());
+	wifiManager.startConfigPortal(m_network.hotspotSSID, m_network.hotspotPSW);
 #endif
 
 	if (shouldSaveConfig) {
-		m_wifiSSID    = WiFi.SSID();
-		m_wifiPSW     = WiFi.psk();
-		m_hotspotSSID = customHotspotSSID.getValue();
-		m_hotspotPSW  = customHotspotPSW.getValue();
-		m_blynkServer = customBlynkServer.getValue();
-		m_blynkPort   = customBlynkPort.getValue();
-		m_blynkToken  = customBlynkToken.getValue();
+		CConfigStore::copyString(m_network.wifiSSID,    WiFi.SSID().c_str(), sizeof(m_network.wifiSSID));
+		CConfigStore::copyString(m_network.wifiPSW,     WiFi.psk().c_str(), sizeof(m_network.wifiPSW));
+		CConfigStore::copyString(m_network.hotspotSSID, customHotspotSSID.getValue(), sizeof(m_network.hotspotSSID));
+		CConfigStore::copyString(m_network.hotspotPSW,  customHotspotPSW.getValue(), sizeof(m_network.hotspotPSW));
+		CConfigStore::copyString(m_network.blynkServer, customBlynkServer.getValue(), sizeof(m_network.blynkServer));
+		CConfigStore::copyString(m_network.blynkPort,   customBlynkPort.getValue(), sizeof(m_network.blynkPort));
+		CConfigStore::copyString(m_network.blynkToken,  customBlynkToken.getValue(), sizeof(m_network.blynkToken));
 
 		if (!writeNetworkConfigFile()) {
 			Serial.println("Unable to writing config file");
@@ -709,54 +1057,69 @@ void CTank::startHotspot(void)
 			Serial.println("Config file written.");
 		}
 	}
+#endif
 }
 
-void CTank::ammoReloadDone(void)
+
+void CTank::canRespawnAmmo(bool respawn)
 {
-	m_isReloading = false;
+	postGameEvent(GAME_EVENT_RESPAWN, respawn ? 1 : 0);
 }
 
-void CTank::canRespawnAmmo(bool respawn)
+// the engine is stepped to now before the event, so the recorded delta is only the event one
+// (the match replays do the same)
+uint8_t CTank::postGameEvent(uint8_t type, uint8_t value)
 {
-	m_canRespawnAmmo = respawn;
-	if (respawn) {
-		if ((m_ammo < m_maxAmmo) && (!m_spawnAmmoTimer.active()))
-			m_spawnAmmoTimer.attach_ms(m_ammoSpawnTime, spawnAmmo, this);
-	}
-	else
-	{
-		if (m_spawnAmmoTimer.active())
-			m_spawnAmmoTimer.detach();
-	}
+	uint32_t now = halMillis();
+	m_game.advance(now);
+	GameDelta_t delta = m_game.post(now, type, value);
+	m_recorder.recordGameEvent(now, type, value, delta.changed);
+	return(delta.changed);
 }
 
-void CTank::MP3SendCommand(uint8_t command, uint16_t parameter, bool feedback) {
-	m_pMP3com->flush();
-	m_MP3Packet[0] = 0x7E;     // start
-	m_MP3Packet[1] = 0xFF;     // version
-	m_MP3Packet[2] = 0x06;     // data lenght
-	m_MP3Packet[3] = command;  // command code
-	m_MP3Packet[4] = feedback; // feedback/response
-	m_MP3Packet[5] = parameter >> 8;
-	m_MP3Packet[6] = parameter & 0x00FF;
-	m_MP3Packet[9] = 0xEF;     // end
+// full hit points and ammos, game rules defaults
+void CTank::resetGame(void)
+{
+	GameRules_t rules;
+	CGameEngine::defaultRules(rules);
+	m_game.reset(rules, halMillis());
+	m_recorder.snapshot(halMillis());
+}
 
-	int16_t checksum = 0;
-	for (int i = 1; i < 7; i++)
-		checksum += m_MP3Packet[i];
-	checksum = -checksum;
-	m_MP3Packet[7] = checksum >> 8;
-	m_MP3Packet[8] = checksum & 0x00FF;
+CGameEngine &CTank::getGameEngine(void)
+{
+	return(m_game);
+}
+
+CMatchRecorder &CTank::getMatchRecorder(void)
+{
+	return(m_recorder);
+}
 
-	m_pMP3com->write(m_MP3Packet, 10);
+// match record on the serial console, to be replayed by TankSim/MatchReplay
+void CTank::dumpMatchRecord(void)
+{
+	m_recorder.dump();
 }
 
+CStatsJournal &CTank::getStatsJournal(void)
+{
+	return(m_statsJournal);
+}
+
+// statistics of all the sessions on the serial console (CSV)
+void CTank::dumpStats(void)
+{
+	m_statsJournal.dump();
+}
+
+// the sounds are queued: the MP3 timer sends them one byte at a time (see CDFPlayer)
 void CTank::playSound(uint16_t soundID, bool loop)
 {
 	if (loop) 
-		MP3SendCommand(0x08, soundID);
+		m_MP3Player.send(DFPLAYER_CMD_LOOP, soundID);
 	else
-		MP3SendCommand(0x03, soundID);
+		m_MP3Player.send(DFPLAYER_CMD_PLAY, soundID);
 
 }
 
@@ -764,83 +1127,78 @@ void CTank::setVolume(uint8_t volume)
 {
 	if (volume > 30)
 		volume = 30;
-	MP3SendCommand(0x06, volume);
+	m_MP3Player.send(DFPLAYER_CMD_VOLUME, volume);
 }
 
+// decoded feedback frames of the DFPlayer
 void CTank::printMP3Debug(void)
 {
-	if (m_pMP3com->available()) {
-		Serial.print("MP3 Data: ");
-		while (m_pMP3com->available()) {
-			Serial.print(m_pMP3com->read(), HEX);
-		}
-		Serial.println();
-	}
+	DFPlayerFeedback_t frame;
+	while (m_MP3Player.readFeedback(frame))
+		Serial.printf("MP3 Data: %s (%02X) %u\n", CDFPlayer::feedbackName(frame.command), frame.command, frame.parameter);
 }
 
-bool CTank::writeTankConfigFile(bool useDefault)
+// a software serial byte disturbs the interrupts for 1 ms: not while an IR frame is on the air
+void CTank::stepMP3(void)
 {
-	File configFile = SPIFFS.open(TANK_CONFIG_FILE, "w");
-	if (!configFile) {
-		Serial.printf("Unable to create %s file.\n", TANK_CONFIG_FILE);
-		return(false);
-	}
+	if (m_pIRcom->isSendingData() || m_pIRcom->isReceivingData())
+		return;
+	m_MP3Player.run();
+}
 
-	configFile.printf("%s%s\n", VERSION_TAG, TANK_CFG_FILE_VERSION);
-	if (useDefault) {
-		configFile.printf("%s%u\n", SERVO_MIN_US_TAG, DEFAULT_SERVO_MIN_US);
-		configFile.printf("%s%u\n", SERVO_MAX_US_TAG, DEFAULT_SERVO_MAX_US);
-		configFile.printf("%s%u\n", SERVO_CENTER_TAG, DEFAULT_SERVO_CENTER);
-	}
-	else {
-		configFile.printf("%s%u\n", SERVO_MIN_US_TAG, m_servoMin_us);
-		configFile.printf("%s%u\n", SERVO_MAX_US_TAG, m_servoMax_us);
-		configFile.printf("%s%u\n", SERVO_CENTER_TAG, m_servoCenter);
-	}
-	configFile.close();
+CDFPlayer &CTank::getMP3Player(void)
+{
+	return(m_MP3Player);
+}
 
-	return(true);
+void CTank::printMP3Stats(void)
+{
+	m_MP3Player.printStats();
 }
 
-bool CTank::readTankConfigFile(void)
+void CTank::resetMP3Stats(void)
+{
+	m_MP3Player.resetStats();
+}
+
+// written at once: the save gesture reports the outcome. Only the changed fields are written,
+// nothing if nothing changed (see CConfigStore)
+bool CTank::writeTankConfigFile(bool useDefault)
 {
-	File configFile = SPIFFS.open(TANK_CONFIG_FILE, "r");
-	if (!configFile) {
-		Serial.printf("Unable to open %s file.\n", TANK_CONFIG_FILE);
+	if (!m_isFSMounted)
 		return(false);
-	}
+	TankConfig_t config;
+	config.servoMin_us = useDefault ? DEFAULT_SERVO_MIN_US : m_servoMin_us;
+	config.servoMax_us = useDefault ? DEFAULT_SERVO_MAX_US : m_servoMax_us;
+	config.servoCenter = useDefault ? DEFAULT_SERVO_CENTER : m_servoCenter;
+	if (tankStore.save(&config))
+		return(true);
+	Serial.printf("Unable to create %s file.\n", TANK_CONFIG_FILE);
+	return(false);
+}
 
-	// read configiguration data
-	while (configFile.available()) {
-		String data = configFile.readStringUntil('\n');
-		if (data.startsWith(VERSION_TAG)) {
-			data.replace(VERSION_TAG, "");
-			if (data != TANK_CFG_FILE_VERSION) {
-				Serial.println("Wrong firmware version, loading defaults.");
-				// different firmware version -> generate a new default one
-				configFile.close();
-				writeTankConfigFile(true);
-				
-				setTankConfigDefaults();
-				return(true);
-			}
-		}
-		else if (data.startsWith(SERVO_MIN_US_TAG)) {
-			data.replace(SERVO_MIN_US_TAG, "");
-			m_servoMin_us = atoi(data.c_str());
-		}
-		else if (data.startsWith(SERVO_MAX_US_TAG)) {
-			data.replace(SERVO_MAX_US_TAG, "");
-			m_servoMax_us = atoi(data.c_str());
-		}
-		else if (data.startsWith(SERVO_CENTER_TAG)) {
-			data.replace(SERVO_CENTER_TAG, "");
-			m_servoCenter = atoi(data.c_str());
-		}
-	}
-	configFile.close();
+// mount time and config writes on the serial console
+void CTank::printStorageStats(void)
+{
+	Serial.printf("LittleFS: %s in %u us%s\n", m_isFSMounted ? "mounted" : "NOT mounted", m_mount_us,
+		m_isFSMigrated ? ", migrated from SPIFFS" : "");
+	networkStore.printStats();
+	tankStore.printStats();
+}
 
-	return(true);
+bool CTank::readTankConfigFile(void)
+{
+	TankConfig_t config;
+	config.servoMin_us = m_servoMin_us;
+	config.servoMax_us = m_servoMax_us;
+	config.servoCenter = m_servoCenter;
+	uint8_t result = tankStore.load(&config);
+	if (CONFIG_LOADED != result)
+		Serial.printf("%s: %s\n", TANK_CONFIG_FILE, CConfigStore::resultName(result));
+	m_servoMin_us = config.servoMin_us;
+	m_servoMax_us = config.servoMax_us;
+	m_servoCenter = config.servoCenter;
+	return((CONFIG_NOT_FOUND != result) && (CONFIG_CORRUPTED != result));
 }
 
 void CTank::setTankConfigDefaults(void)
@@ -852,11 +1210,16 @@ void CTank::setTankConfigDefaults(void)
 
 void CTank::setNetworkConfigDefaults(void)
 {
-	m_wifiSSID    = DEFAULT_SSID;
-	m_wifiPSW     = DEFAULT_PSWD;
-	m_hotspotSSID = DEFAULT_HOTSPOT_SSID;
-	m_hotspotPSW  = DEFAULT_HOTSPOT_PSWD;
-	m_blynkServer = DEFAULT_BLYNK_SERVER;
-	m_blynkPort   = DEFAULT_BLYNK_PORT;
-	m_blynkToken  = DEFAULT_BLYNK_TOKEN;
+	setNetworkConfigDefaults(m_network);
+}
+
+void CTank::setNetworkConfigDefaults(NetworkConfig_t &config)
+{
+	CConfigStore::copyString(config.wifiSSID,    DEFAULT_SSID,         sizeof(config.wifiSSID));
+	CConfigStore::copyString(config.wifiPSW,     DEFAULT_PSWD,         sizeof(config.wifiPSW));
+	CConfigStore::copyString(config.hotspotSSID, DEFAULT_HOTSPOT_SSID, sizeof(config.hotspotSSID));
+	CConfigStore::copyString(config.hotspotPSW,  DEFAULT_HOTSPOT_PSWD, sizeof(config.hotspotPSW));
+	CConfigStore::copyString(config.blynkServer, DEFAULT_BLYNK_SERVER, sizeof(config.blynkServer));
+	CConfigStore::copyString(config.blynkPort,   DEFAULT_BLYNK_PORT,   sizeof(config.blynkPort));
+	CConfigStore::copyString(config.blynkToken,  DEFAULT_BLYNK_TOKEN,  sizeof(config.blynkToken));
 }
@@ -2,22 +2,65 @@
 #ifndef CTANK_H
 #define CTANK_H
 
+#ifdef ARDUINO
 #include <ESP8266WiFi.h>
 #include <WiFiManager.h>
-#include <Arduino.h>
-#include <Servo.h>
-#include <Ticker.h>
-#include <SoftwareSerial.h>
+#endif
+#include "HAL.h"
 #include "CIR.h"
+#include "CFEC.h"
+#include "CTimerWheel.h"
+#include "CAnimator.h"
+#include "CGameEngine.h"
+#include "CMotorMixer.h"
+#include "CTurretPlanner.h"
+#include "CDFPlayer.h"
+#include "CBatteryMonitor.h"
+#include "CConfigStore.h"
+#include "CMatchRecorder.h"
+#include "CStatsJournal.h"
+#include "CConnectivity.h"
 
 #//define FIRMWARE_VERSION    "1.0.0" // firmware version
-#define NETWORK_CFG_FILE_VERSION "1.0.0" // network config file version
-#define TANK_CFG_FILE_VERSION    "1.0.0" // tank config file version
+#define NETWORK_CFG_SCHEMA_VERSION 1 // network config record schema (see CConfigStore)
+#define TANK_CFG_SCHEMA_VERSION    1 // tank config record schema
+
+// network configuration, stored as a binary record
+struct NetworkConfig_t {
+	char wifiSSID[33];     // 32 characters (802.11)
+	char wifiPSW[65];      // 63 characters (WPA2) or 64 hex digits
+	char hotspotSSID[41];  // WiFiManager parameters: 40 characters
+	char hotspotPSW[41];
+	char blynkServer[41];
+	char blynkPort[6];
+	char blynkToken[41];
+};
+
+// tank configuration, stored as a binary record
+struct TankConfig_t {
+	uint16_t servoMin_us;
+	uint16_t servoMax_us;
+	uint16_t servoCenter;
+};
 
 //  enable hotspot password
 #define ENABLE_HOTSPOT_PSW 0 // 0 -> password disabled
                              // 1 -> password enabled
 
+// control loop: the app inputs (joystick, turret slider) are latched and only the newest one
+// is applied, at a fixed rate
+#define CONTROL_PERIOD_MS      20
+#define CONTROL_HISTOGRAM_BINS IR_HISTOGRAM_BINS // log2 microseconds
+
+struct ControlStats_t {
+	uint32_t samples;        // inputs latched
+	uint32_t applied;        // inputs actuated
+	uint32_t stale;          // inputs replaced by a newer one (or by a direct command) before the actuation
+	uint32_t latencyMax_us;  // from the input to the actuation
+	uint64_t latencySum_us;
+	uint32_t latencyHistogram[CONTROL_HISTOGRAM_BINS];
+};
+
 
 class CTank
 {
@@ -28,19 +71,48 @@ public:
 	void moveTank(int joystickX, int joystickY);
 	void moveTurretDegree(int angle);
 	void moveTurret_us(int us, bool absolute = false);
+	// latched inputs, applied by the control loop
+	void setJoystick(int joystickX, int joystickY);
+	void setTurret_us(int us, bool absolute = false);
+	void controlStep(void);
+	void stepMotors(void); // motor timer: one step of the slew limited drive
+	CMotorMixer &getMotorMixer(void);
+	void stepTurret(void); // turret timer: one step of the servo motion profile
+	CTurretPlanner &getTurretPlanner(void);
+	uint16_t getTurretPosition_us(void); // pulse width now on the servo (the turret may be still moving)
+	ControlStats_t getControlStats(void);
+	void printControlStats(void);
+	void resetControlStats(void);
 	bool shoot(void);
-	bool checkProximity(uint16_t timeout);
+	// hotspot request. With the WiFi association started, it ends after minWindow once connected
+	bool checkProximity(uint16_t timeout, uint16_t minWindow = 0);
 	void shakeTurretAnimation(uint8_t times, bool startFromLeft = true);
 	void shootAnimation(void);
 	void startHotspot(void);
-	bool wifiConnect(bool autoStartHotspot = true);
+	void wifiBegin(void);     // WiFi and server connections go on in runNetwork
+	uint8_t runNetwork(void); // main loop: one step of the connection manager (CONN_ state)
+	CConnectivity &getConnectivity(void);
+	CFastBoot &getFastBoot(void);
+#ifdef ARDUINO
 	IPAddress getBlynkIP(void);
+#endif
 	String    getBlynkServer(void);
 	uint16_t  getBlynkPort(void);
 	String    getBlynkToken(void);
 	bool      isBlynkKnownByIP(void);
 	uint16_t  getBatteryVoltage(void);
+	bool      isBatteryLow(void);
+	uint16_t  getBatteryCharge(void);
+	uint16_t  getBatteryRuntime(void);
+	void      sampleBattery(void); // battery timer: one ADC sample
+	void      printBatteryStats(void);
 	int       getHitCode(void);
+	IRStats_t getIRStats(void);
+	void      printIRStats(void);
+	void      resetIRStats(void);
+	CTimerWheel &getTimerWheel(void);
+	uint32_t  runTimers(void);
+	void      printTimerStats(void);
 	uint16_t  getServoMin_us(void);
 	uint16_t  getServoMax_us(void);
 	uint16_t  getServoCenter(void);
@@ -57,42 +129,72 @@ public:
 	uint8_t   repairTank(void);
 	uint8_t   newAmmos(uint8_t ammos = 1);
 
-	void ammoReloadDone(void);
 	void canRespawnAmmo(bool respawn);
-	bool writeTankConfigFile(bool useDefaults = false);
+	void resetGame(void);
+	CGameEngine &getGameEngine(void);
+	CMatchRecorder &getMatchRecorder(void);
+	void dumpMatchRecord(void);
+	CStatsJournal &getStatsJournal(void);
+	void dumpStats(void);
+	bool writeTankConfigFile(bool useDefaults = false); // false: not written
+	void printStorageStats(void);
 
 	void playSound(uint16_t soundID, bool loop = false);
 	void setVolume(uint8_t volume);
 	void printMP3Debug(void);
+	void stepMP3(void); // MP3 timer: one byte of the queued commands
+	CDFPlayer &getMP3Player(void);
+	void printMP3Stats(void);
+	void resetMP3Stats(void);
+
+	// called by the animator
+	void applyAnimationFrame(uint8_t track, const AnimationKeyframe_t &frame);
 
 	//	void checkConfigPortalRequest(bool force = false);
 
 private:
-	SoftwareSerial *m_pMP3com;
-	Servo    m_turret;
-	CIR     *m_pIRcom;
-	String   m_wifiSSID,
-		     m_wifiPSW,
-		     m_hotspotSSID,
-		     m_hotspotPSW,
-		     m_blynkServer,
-		     m_blynkPort,
-		     m_blynkToken;
+	CHalSerial *m_pMP3com;
+	CHalServo   m_turret;
+	CIR        *m_pIRcom;
+	CIR        *m_pIRaux;
+	CTimerWheel m_timerWheel; // before the animator, that uses it
+	CAnimator   m_animator;
+	int         m_joystickX, m_joystickY; // last motors command of the user
+	CMotorMixer m_mixer;
+	CWheelTimer m_motorTimer;
+	CTurretPlanner m_turretPlanner;
+	CWheelTimer    m_turretTimer;
+
+	struct setpoint_t {
+		int      value1, value2;
+		bool     absolute;
+		bool     isPending;
+		uint32_t latched_us;
+	};
+	setpoint_t     m_joystickSetpoint, m_turretSetpoint;
+	CWheelTimer    m_controlTimer;
+	ControlStats_t m_controlStats;
+	NetworkConfig_t m_network;
 	uint16_t m_servoMin_us, m_servoMax_us, m_servoCenter;
 
-	uint8_t  m_maxHitPoints, m_hitPoints;
-	uint8_t  m_ammoDamage, m_maxAmmo, m_ammo;
-	uint16_t m_ammoRechargeTime, m_ammoSpawnTime;
-	uint8_t  m_repairValue;
-
-	uint8_t m_MP3Packet[10];
-
-
-	Ticker   m_reloadTimer;
-	Ticker   m_spawnAmmoTimer;
-
-	bool m_isReloading;
-	bool m_canRespawnAmmo;
+	CGameEngine m_game;   // hit points, ammos, reload and respawn
+	CMatchRecorder m_recorder;
+	CWheelTimer    m_recordTimer;
+	uint8_t  m_lastHitDamage;
+	int      m_lastHitCode;     // shooter of the last hit received (stats), -1 unknown
+	CStatsJournal m_statsJournal;
+	CWheelTimer   m_statsTimer;
+
+	CDFPlayer   m_MP3Player;
+	CWheelTimer m_MP3Timer;
+	CBatteryMonitor m_battery;
+	CWheelTimer     m_batteryTimer;
+	bool            m_isFSMounted;
+	bool            m_isFSMigrated;
+	uint32_t        m_mount_us;
+	CFastBoot       m_fastBoot;
+	CConnectivity   m_connectivity;
+	bool            m_isHotspotHinted; // the user was told to request the hotspot
 
 	bool initFS(bool formatFS = false);
 	bool writeNetworkConfigFile(bool useDefaults = false);
@@ -100,8 +202,17 @@ private:
 	bool readTankConfigFile(void);
 	void setTankConfigDefaults(void);
 	void setNetworkConfigDefaults(void);
+	static void setNetworkConfigDefaults(NetworkConfig_t &config);
 	
-	void MP3SendCommand(uint8_t command, uint16_t parameter, bool feedback = false);
+	int  receiveHit(CIR *pIR);
+	void writeMotors(int joystickX, int joystickY);
+	void writeTurretDegree(int angle);
+	void writeTurret_us(int us, bool absolute);
+	void printIRStats(const char *name, CIR *pIR);
+	uint8_t postGameEvent(uint8_t type, uint8_t value = 0);
+	void latch(setpoint_t &setpoint, int value1, int value2, bool absolute);
+	void recordActuation(setpoint_t &setpoint);
+
 };
 
 #endif // !CTANK
@@ -0,0 +1,149 @@
+#include "CTelemetry.h"
+
+CTelemetry::CTelemetry(sendValue_t sendValue, sendProperty_t sendProperty)
+{
+	m_sendValue    = sendValue;
+	m_sendProperty = sendProperty;
+	m_count        = 0;
+	resetStats();
+}
+
+int8_t CTelemetry::addValue(uint8_t pin, uint16_t minInterval_ms, uint32_t deadband)
+{
+	return(add(pin, NULL, minInterval_ms, deadband));
+}
+
+int8_t CTelemetry::addProperty(uint8_t pin, const char *property, uint16_t minInterval_ms)
+{
+	return(add(pin, property, minInterval_ms, 0));
+}
+
+int8_t CTelemetry::add(uint8_t pin, const char *property, uint16_t minInterval_ms, uint32_t deadband)
+{
+	if (m_count >= TELEMETRY_MAX_CHANNELS)
+		return(TELEMETRY_NO_CHANNEL);
+	channel_t &channel = m_channels[m_count];
+	channel.pin            = pin;
+	channel.property       = property;
+	channel.minInterval_ms = minInterval_ms;
+	channel.deadband       = deadband;
+	channel.value          = 0;
+	channel.sentValue      = 0;
+	channel.text           = NULL;
+	channel.sentText       = NULL;
+	channel.lastSent_ms    = 0;
+	channel.isSent         = false;
+	channel.isDirty        = false;
+	return(m_count++);
+}
+
+void CTelemetry::set(int8_t channel, int32_t value)
+{
+	if ((channel < 0) || (channel >= m_count))
+		return;
+	channel_t &current = m_channels[channel];
+	uint32_t difference = (value > current.sentValue) ? (uint32_t)(value - current.sentValue) : (uint32_t)(current.sentValue - value);
+	if (current.isSent && (difference <= current.deadband)) {
+		// back inside the deadband: a pending update is not needed anymore
+		if (current.isDirty)
+			m_stats.coalesced++;
+		else
+			m_stats.unchanged++;
+		current.isDirty = false;
+		return;
+	}
+	if (current.isDirty)
+		m_stats.coalesced++;
+	current.value   = value;
+	current.isDirty = true;
+}
+
+void CTelemetry::set(int8_t channel, const char *value)
+{
+	if ((channel < 0) || (channel >= m_count) || (NULL == value))
+		return;
+	channel_t &current = m_channels[channel];
+	if (current.isSent && ((current.sentText == value) || (0 == strcmp(current.sentText, value)))) {
+		if (current.isDirty)
+			m_stats.coalesced++;
+		else
+			m_stats.unchanged++;
+		current.isDirty = false;
+		return;
+	}
+	if (current.isDirty)
+		m_stats.coalesced++;
+	current.text    = value;
+	current.isDirty = true;
+}
+
+uint8_t CTelemetry::flush(void)
+{
+	uint32_t now = halMillis();
+	uint8_t  sent = 0;
+	for (uint8_t i = 0; i < m_count; i++) {
+		channel_t &channel = m_channels[i];
+		if (!channel.isDirty)
+			continue;
+		if (channel.isSent && (now - channel.lastSent_ms < channel.minInterval_ms))
+			continue;
+		if (NULL == channel.property) {
+			m_sendValue(channel.pin, channel.value);
+			channel.sentValue = channel.value;
+		}
+		else {
+			m_sendProperty(channel.pin, channel.property, channel.text);
+			channel.sentText = channel.text;
+		}
+		channel.lastSent_ms = now;
+		channel.isSent      = true;
+		channel.isDirty     = false;
+		sent++;
+	}
+	m_stats.sent += sent;
+	m_stats.flushes++;
+	return(sent);
+}
+
+void CTelemetry::flushTimer(CTelemetry *telemetry)
+{
+	telemetry->flush();
+}
+
+// the last values are sent again at the next flush
+void CTelemetry::invalidate(void)
+{
+	for (uint8_t i = 0; i < m_count; i++) {
+		channel_t &channel = m_channels[i];
+		if (channel.isSent)
+			channel.isDirty = true;
+		channel.isSent = false;
+		channel.value  = channel.sentValue;
+		channel.text   = channel.sentText;
+	}
+}
+
+TelemetryStats_t CTelemetry::getStats(void)
+{
+	return(m_stats);
+}
+
+void CTelemetry::resetStats(void)
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+	m_stats.since_ms = halMillis();
+}
+
+// messages per second sent and suppressed on the serial console (tenths, no float printf)
+void CTelemetry::printStats(void)
+{
+	uint32_t elapsed = halMillis() - m_stats.since_ms;
+	if (0 == elapsed)
+		elapsed = 1;
+	uint32_t suppressed = m_stats.unchanged + m_stats.coalesced;
+	uint32_t sentRate = (uint32_t)((uint64_t)m_stats.sent * 10000 / elapsed);
+	uint32_t suppressedRate = (uint32_t)((uint64_t)suppressed * 10000 / elapsed);
+	Serial.printf("telemetry: %u sent (%u.%u/s), %u suppressed (%u.%u/s): %u unchanged, %u coalesced, %u flushes in %u s\n",
+		m_stats.sent, sentRate / 10, sentRate % 10, suppressed, suppressedRate / 10, suppressedRate % 10, m_stats.unchanged,
+		m_stats.coalesced, m_stats.flushes, elapsed / 1000);
+}
@@ -0,0 +1,75 @@
+#pragma once
+#ifndef CTELEMETRY_H
+#define CTELEMETRY_H
+
+#include "HAL.h"
+
+#define TELEMETRY_MAX_CHANNELS  12
+#define TELEMETRY_FLUSH_PERIOD  50   // milliseconds between two flushes (main loop timer)
+#define TELEMETRY_NO_CHANNEL    -1
+
+// counters since the last reset
+struct TelemetryStats_t {
+	uint32_t sent;        // messages sent to the server
+	uint32_t unchanged;   // updates with the value already sent (or inside the deadband)
+	uint32_t coalesced;   // updates replaced by a newer one before being sent
+	uint32_t flushes;
+	uint32_t since_ms;    // time of the reset
+};
+
+// Telemetry publisher for the Blynk virtual pins. Every channel is a pin value or a pin property
+// (e.g. the widget color): an update marks the channel dirty only if it differs from the value
+// already sent by more than the channel deadband, and flush() sends the dirty channels no more
+// often than the channel rate limit. Only the last value of a channel is sent (coalescing).
+// The messages are sent by the callbacks (Blynk.virtualWrite and Blynk.setProperty), so the
+// class works on the host too
+class CTelemetry
+{
+public:
+	typedef void(*sendValue_t)(uint8_t pin, int32_t value);
+	typedef void(*sendProperty_t)(uint8_t pin, const char *property, const char *value);
+
+	CTelemetry(sendValue_t sendValue, sendProperty_t sendProperty);
+
+	// channel ids, TELEMETRY_NO_CHANNEL if there are too many channels
+	int8_t addValue(uint8_t pin, uint16_t minInterval_ms = 0, uint32_t deadband = 0);
+	int8_t addProperty(uint8_t pin, const char *property, uint16_t minInterval_ms = 0);
+
+	void set(int8_t channel, int32_t value);
+	void set(int8_t channel, const char *value); // the string must be a constant (not copied)
+
+	// send the dirty channels whose rate limit is elapsed. Returns the messages sent
+	uint8_t flush(void);
+	static void flushTimer(CTelemetry *telemetry);
+	// the server lost the values (reconnection): everything is sent again
+	void invalidate(void);
+
+	TelemetryStats_t getStats(void);
+	void             resetStats(void);
+	void             printStats(void);
+
+private:
+	struct channel_t {
+		uint8_t     pin;
+		const char *property;      // NULL -> pin value
+		uint16_t    minInterval_ms;
+		uint32_t    deadband;
+		int32_t     value;         // last update
+		int32_t     sentValue;
+		const char *text;          // property value
+		const char *sentText;
+		uint32_t    lastSent_ms;
+		bool        isSent;        // sentValue/sentText valid
+		bool        isDirty;
+	};
+
+	sendValue_t      m_sendValue;
+	sendProperty_t   m_sendProperty;
+	channel_t        m_channels[TELEMETRY_MAX_CHANNELS];
+	uint8_t          m_count;
+	TelemetryStats_t m_stats;
+
+	int8_t add(uint8_t pin, const char *property, uint16_t minInterval_ms, uint32_t deadband);
+};
+
+#endif
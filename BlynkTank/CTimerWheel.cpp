@@ -0,0 +1,216 @@
+#include "CTimerWheel.h"
+
+CWheelTimer::CWheelTimer()
+{
+	m_next     = NULL;
+	m_prev     = NULL;
+	m_list     = NULL;
+	m_wheel    = NULL;
+	m_expires  = 0;
+	m_period   = 0;
+	m_callback = NULL;
+	m_arg      = NULL;
+}
+
+CWheelTimer::~CWheelTimer()
+{
+	if (active())
+		m_wheel->detach(*this);
+}
+
+bool CWheelTimer::active(void)
+{
+	return(NULL != m_list);
+}
+
+
+CTimerWheel::CTimerWheel()
+{
+	memset(m_level0, 0, sizeof(m_level0));
+	memset(m_levels, 0, sizeof(m_levels));
+	m_expired = NULL;
+	m_now     = halMillis(); // next tick to process
+	m_pending = 0;
+	resetStats();
+}
+
+CTimerWheel::~CTimerWheel()
+{
+	for (uint16_t i = 0; i < TIMER_WHEEL_L0_SIZE; i++) {
+		while (NULL != m_level0[i])
+			unlink(*m_level0[i]);
+	}
+	for (uint8_t level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+		for (uint8_t i = 0; i < TIMER_WHEEL_LN_SIZE; i++) {
+			while (NULL != m_levels[level][i])
+				unlink(*m_levels[level][i]);
+		}
+	}
+	while (NULL != m_expired)
+		unlink(*m_expired);
+}
+
+void CTimerWheel::start(CWheelTimer &timer, uint32_t delay_ms, uint32_t period_ms, CWheelTimer::callback_t callback, void *arg)
+{
+	if (timer.active())
+		unlink(timer);
+	else
+		m_pending++;
+	timer.m_wheel    = this;
+	timer.m_expires  = halMillis() + delay_ms;
+	timer.m_period   = period_ms;
+	timer.m_callback = callback;
+	timer.m_arg      = arg;
+	insert(timer);
+}
+
+void CTimerWheel::detach(CWheelTimer &timer)
+{
+	if (!timer.active())
+		return;
+	unlink(timer);
+	m_pending--;
+}
+
+// slot of the deadline: the level is chosen by the distance from now
+void CTimerWheel::insert(CWheelTimer &timer)
+{
+	uint32_t expires = timer.m_expires;
+	int32_t  delta   = (int32_t)(expires - m_now);
+	// already expired (or expiring in the tick being dispatched): next tick
+	if (delta < 0) {
+		expires = m_now;
+		delta   = 0;
+	}
+	if ((uint32_t)delta > TIMER_WHEEL_MAX_MS) {
+		expires = m_now + TIMER_WHEEL_MAX_MS;
+		delta   = TIMER_WHEEL_MAX_MS;
+	}
+
+	if (delta < TIMER_WHEEL_L0_SIZE) {
+		link(timer, &m_level0[expires & (TIMER_WHEEL_L0_SIZE - 1)]);
+		return;
+	}
+	for (uint8_t level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+		uint8_t shift = TIMER_WHEEL_L0_BITS + level * TIMER_WHEEL_LN_BITS;
+		if ((level == TIMER_WHEEL_LEVELS - 2) || ((uint32_t)delta < (1UL << (shift + TIMER_WHEEL_LN_BITS)))) {
+			link(timer, &m_levels[level][(expires >> shift) & (TIMER_WHEEL_LN_SIZE - 1)]);
+			return;
+		}
+	}
+}
+
+void CTimerWheel::link(CWheelTimer &timer, CWheelTimer **list)
+{
+	timer.m_list = list;
+	timer.m_prev = NULL;
+	timer.m_next = *list;
+	if (NULL != *list)
+		(*list)->m_prev = &timer;
+	*list = &timer;
+}
+
+void CTimerWheel::unlink(CWheelTimer &timer)
+{
+	if (NULL != timer.m_prev)
+		timer.m_prev->m_next = timer.m_next;
+	else
+		*timer.m_list = timer.m_next;
+	if (NULL != timer.m_next)
+		timer.m_next->m_prev = timer.m_prev;
+	timer.m_next = NULL;
+	timer.m_prev = NULL;
+	timer.m_list = NULL;
+}
+
+// move the timers of an upper level slot to the lower levels. Returns true if the index is 0
+// (the upper level has wrapped too)
+bool CTimerWheel::cascade(uint8_t level, uint8_t index)
+{
+	CWheelTimer **list = &m_levels[level][index];
+	while (NULL != *list) {
+		CWheelTimer &timer = **list;
+		unlink(timer);
+		insert(timer);
+		m_stats.cascaded++;
+	}
+	return(0 == index);
+}
+
+uint32_t CTimerWheel::run(void)
+{
+	uint32_t startTime = halMicros();
+	uint32_t now = halMillis();
+	uint32_t count = 0;
+
+	while ((int32_t)(now - m_now) >= 0) {
+		uint32_t tick = m_now;
+		uint32_t index = tick & (TIMER_WHEEL_L0_SIZE - 1);
+		// a level 0 turn is over: bring down the timers of the next 256 ms
+		if (0 == index) {
+			for (uint8_t level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+				uint8_t shift = TIMER_WHEEL_L0_BITS + level * TIMER_WHEEL_LN_BITS;
+				if (!cascade(level, (tick >> shift) & (TIMER_WHEEL_LN_SIZE - 1)))
+					break;
+			}
+		}
+		// the timers started by the callbacks go to the next ticks
+		m_now++;
+		if (NULL == m_level0[index])
+			continue;
+		m_expired = m_level0[index];
+		m_level0[index] = NULL;
+		for (CWheelTimer *timer = m_expired; NULL != timer; timer = timer->m_next)
+			timer->m_list = &m_expired;
+		while (NULL != m_expired) {
+			dispatch(*m_expired, now);
+			count++;
+		}
+	}
+
+	uint32_t elapsed = halMicros() - startTime;
+	if (elapsed > m_stats.runMax_us)
+		m_stats.runMax_us = elapsed;
+	return(count);
+}
+
+void CTimerWheel::dispatch(CWheelTimer &timer, uint32_t now_ms)
+{
+	unlink(timer);
+	uint32_t late = now_ms - timer.m_expires;
+	m_stats.dispatched++;
+	m_stats.lateSum_ms += late;
+	if (late > m_stats.lateMax_ms)
+		m_stats.lateMax_ms = late;
+	uint8_t bin = (0 == late) ? 0 : 32 - __builtin_clz(late);
+	m_stats.lateHistogram[(bin < TIMER_WHEEL_HISTOGRAM_BINS) ? bin : TIMER_WHEEL_HISTOGRAM_BINS - 1]++;
+
+	// periodic timer: next deadline on the period grid (missed periods are skipped)
+	if (timer.m_period > 0) {
+		timer.m_expires += timer.m_period * (late / timer.m_period + 1);
+		insert(timer);
+	}
+	else
+		m_pending--;
+
+	uint32_t startTime = halMicros();
+	timer.m_callback(timer.m_arg);
+	uint32_t elapsed = halMicros() - startTime;
+	if (elapsed > m_stats.callbackMax_us)
+		m_stats.callbackMax_us = elapsed;
+}
+
+uint32_t CTimerWheel::getPending(void)
+{
+	return(m_pending);
+}
+
+TimerWheelStats_t CTimerWheel::getStats(void)
+{
+	return(m_stats);
+}
+
+void CTimerWheel::resetStats(void)
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+}
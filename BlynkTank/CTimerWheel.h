@@ -0,0 +1,114 @@
+#pragma once
+#ifndef CTIMERWHEEL_H
+#define CTIMERWHEEL_H
+
+#include "HAL.h"
+
+// Hierarchical timer wheel (1 ms tick). Level 0 has a slot per millisecond for the next 256 ms,
+// every upper level has 64 slots, each one as long as the whole lower level. A timer is stored
+// in the slot of its deadline: start and stop are O(1) (intrusive lists, no allocation), the
+// timers of the upper levels are moved down (cascade) when their slot is reached.
+//   level 0 -> 256 x 1 ms       (256 ms)
+//   level 1 ->  64 x 256 ms     (16.4 s)
+//   level 2 ->  64 x 16.4 s     (17.5 min)
+//   level 3 ->  64 x 17.5 min   (18.6 hours, longer delays are cut to it)
+// The callbacks are dispatched by run(), called from loop(): unlike the Ticker callbacks they can
+// use Blynk, the servo and all the main loop data.
+#define TIMER_WHEEL_L0_BITS  8
+#define TIMER_WHEEL_LN_BITS  6
+#define TIMER_WHEEL_LEVELS   4
+#define TIMER_WHEEL_L0_SIZE  (1 << TIMER_WHEEL_L0_BITS)
+#define TIMER_WHEEL_LN_SIZE  (1 << TIMER_WHEEL_LN_BITS)
+#define TIMER_WHEEL_MAX_MS   ((1UL << (TIMER_WHEEL_L0_BITS + (TIMER_WHEEL_LEVELS - 1) * TIMER_WHEEL_LN_BITS)) - 1)
+
+// lateness histogram: bin 0 -> on time, bin n -> 2^(n-1)..2^n - 1 ms late, last bin -> all the bigger ones
+#define TIMER_WHEEL_HISTOGRAM_BINS 10
+
+// deadline statistics
+struct TimerWheelStats_t {
+	uint32_t dispatched;      // callbacks run
+	uint32_t cascaded;        // timers moved to a lower level
+	uint32_t lateMax_ms;      // worst dispatch delay after the deadline
+	uint64_t lateSum_ms;
+	uint32_t callbackMax_us;  // longest callback
+	uint32_t runMax_us;       // longest run() call
+	uint32_t lateHistogram[TIMER_WHEEL_HISTOGRAM_BINS];
+};
+
+class CTimerWheel;
+
+// timer handle, owned by the user (e.g. a class member). Never destroy or move an active timer
+class CWheelTimer
+{
+public:
+	CWheelTimer();
+	~CWheelTimer();
+	bool active(void);
+
+private:
+	friend class CTimerWheel;
+	typedef void(*callback_t)(void *arg);
+
+	CWheelTimer  *m_next;
+	CWheelTimer  *m_prev;
+	CWheelTimer **m_list;    // head of the slot list, NULL -> not active
+	CTimerWheel  *m_wheel;
+	uint32_t      m_expires; // tick of the deadline
+	uint32_t      m_period;  // 0 -> one shot
+	callback_t    m_callback;
+	void         *m_arg;
+};
+
+class CTimerWheel
+{
+public:
+	typedef void(*callback_t)(void);
+
+	CTimerWheel();
+	~CTimerWheel();
+
+	// same interface of the Ticker library, the timer handle first
+	void once_ms(CWheelTimer &timer, uint32_t milliseconds, callback_t callback) {
+		start(timer, milliseconds, 0, reinterpret_cast<CWheelTimer::callback_t>(callback), NULL);
+	}
+
+	void attach_ms(CWheelTimer &timer, uint32_t milliseconds, callback_t callback) {
+		start(timer, milliseconds, milliseconds, reinterpret_cast<CWheelTimer::callback_t>(callback), NULL);
+	}
+
+	template<typename TArg>
+	void once_ms(CWheelTimer &timer, uint32_t milliseconds, void(*callback)(TArg *), TArg *arg) {
+		start(timer, milliseconds, 0, reinterpret_cast<CWheelTimer::callback_t>(callback), (void *)arg);
+	}
+
+	template<typename TArg>
+	void attach_ms(CWheelTimer &timer, uint32_t milliseconds, void(*callback)(TArg *), TArg *arg) {
+		start(timer, milliseconds, milliseconds, reinterpret_cast<CWheelTimer::callback_t>(callback), (void *)arg);
+	}
+
+	void detach(CWheelTimer &timer);
+
+	// dispatch the expired timers (main loop). Returns the callbacks run
+	uint32_t run(void);
+
+	uint32_t          getPending(void);
+	TimerWheelStats_t getStats(void);
+	void              resetStats(void);
+
+private:
+	CWheelTimer      *m_level0[TIMER_WHEEL_L0_SIZE];
+	CWheelTimer      *m_levels[TIMER_WHEEL_LEVELS - 1][TIMER_WHEEL_LN_SIZE];
+	CWheelTimer      *m_expired;  // timers being dispatched (a callback can stop them)
+	uint32_t          m_now;      // next tick to process
+	uint32_t          m_pending;
+	TimerWheelStats_t m_stats;
+
+	void start(CWheelTimer &timer, uint32_t delay_ms, uint32_t period_ms, CWheelTimer::callback_t callback, void *arg);
+	void insert(CWheelTimer &timer);
+	void link(CWheelTimer &timer, CWheelTimer **list);
+	void unlink(CWheelTimer &timer);
+	bool cascade(uint8_t level, uint8_t index);
+	void dispatch(CWheelTimer &timer, uint32_t now_ms);
+};
+
+#endif
@@ -0,0 +1,176 @@
+#include "CTurretPlanner.h"
+
+#define PLANNER_SHIFT 4 // 1/16 us
+
+static int32_t clamp(int32_t value, int32_t min, int32_t max)
+{
+	if (value < min)
+		return(min);
+	if (value > max)
+		return(max);
+	return(value);
+}
+
+// integer square root (bit by bit)
+static uint32_t isqrt(uint32_t value)
+{
+	uint32_t root = 0;
+	uint32_t bit = 1UL << 30;
+	while (bit > value)
+		bit >>= 2;
+	while (bit != 0) {
+		if (value >= root + bit) {
+			value -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else
+			root >>= 1;
+		bit >>= 2;
+	}
+	return(root);
+}
+
+CTurretPlanner::CTurretPlanner()
+{
+	TurretProfile_t profile;
+	m_position = 0;
+	defaultProfile(profile);
+	configure(profile);
+	setLimits(544, 2400); // Servo library range
+	reset(1500);
+}
+
+void CTurretPlanner::defaultProfile(TurretProfile_t &profile)
+{
+	profile.type        = DEFAULT_TURRET_PROFILE;
+	profile.maxVelocity = DEFAULT_TURRET_VELOCITY;
+	profile.maxAccel    = DEFAULT_TURRET_ACCEL;
+	profile.maxJerk     = DEFAULT_TURRET_JERK;
+}
+
+// the limits per step (at least 1/16 us) and the jerk time
+void CTurretPlanner::configure(const TurretProfile_t &profile)
+{
+	m_profile = profile;
+	m_maxVelocity = (int32_t)(((uint64_t)profile.maxVelocity << PLANNER_SHIFT) * TURRET_STEP_MS / 1000);
+	m_maxAccel    = (int32_t)(((uint64_t)profile.maxAccel << PLANNER_SHIFT) * TURRET_STEP_MS * TURRET_STEP_MS / 1000000);
+	if (m_maxVelocity < 1)
+		m_maxVelocity = 1;
+	if (m_maxAccel < 1)
+		m_maxAccel = 1;
+	m_smoothing = 1;
+	if ((TURRET_PROFILE_SCURVE == profile.type) && (profile.maxJerk > 0)) {
+		// jerk time = max acceleration / max jerk
+		uint32_t steps = (uint32_t)(((uint64_t)profile.maxAccel * 1000 + (uint64_t)profile.maxJerk * TURRET_STEP_MS - 1) /
+			((uint64_t)profile.maxJerk * TURRET_STEP_MS));
+		m_smoothing = (uint8_t)clamp(steps, 1, TURRET_SCURVE_MAX_STEPS);
+	}
+	fillHistory(m_position);
+}
+
+const TurretProfile_t &CTurretPlanner::getProfile(void)
+{
+	return(m_profile);
+}
+
+void CTurretPlanner::setLimits(uint16_t min_us, uint16_t max_us)
+{
+	m_min_us = min_us;
+	m_max_us = max_us;
+}
+
+void CTurretPlanner::reset(uint16_t position_us)
+{
+	position_us = (uint16_t)clamp(position_us, m_min_us, m_max_us);
+	m_target    = (int32_t)position_us << PLANNER_SHIFT;
+	m_position  = m_target;
+	m_velocity  = 0;
+	m_output_us = position_us;
+	fillHistory(m_position);
+}
+
+void CTurretPlanner::setTarget(uint16_t target_us)
+{
+	m_target = clamp(target_us, m_min_us, m_max_us) << PLANNER_SHIFT;
+}
+
+bool CTurretPlanner::step(void)
+{
+	if (isSettled())
+		return(false);
+	int32_t error = m_target - m_position;
+	if (TURRET_PROFILE_NONE == m_profile.type) {
+		m_position = m_target;
+		m_velocity = 0;
+	}
+	else if (0 != error) {
+		// the fastest speed that still stops on the target: v^2 / 2a + v / 2 = d (in steps)
+		uint32_t distance = (error < 0) ? -error : error;
+		int32_t  stopping = (int32_t)isqrt(2 * (uint32_t)m_maxAccel * distance + (uint32_t)m_maxAccel * m_maxAccel / 4) - m_maxAccel / 2;
+		int32_t  wanted = clamp(stopping, 1, m_maxVelocity);
+		if ((uint32_t)wanted > distance)
+			wanted = distance;
+		if (error < 0)
+			wanted = -wanted;
+		m_velocity = clamp(wanted, m_velocity - m_maxAccel, m_velocity + m_maxAccel);
+		m_position += m_velocity;
+		// target passed (or reached): end of the profile
+		if (((error > 0) && (m_position >= m_target)) || ((error < 0) && (m_position <= m_target))) {
+			m_position = m_target;
+			m_velocity = 0;
+		}
+	}
+	else
+		m_velocity = 0;
+
+	// S-curve: moving average of the trapezoid
+	int32_t smoothed = m_position;
+	if (m_smoothing > 1) {
+		m_sum += m_position - m_history[m_head];
+		m_history[m_head] = m_position;
+		if (++m_head >= m_smoothing)
+			m_head = 0;
+		smoothed = m_sum / m_smoothing;
+		// rounding: the last average is the target
+		if ((m_position == m_target) && (m_sum == m_target * m_smoothing))
+			smoothed = m_target;
+	}
+	m_smoothedVelocity = smoothed - m_smoothed;
+	m_smoothed = smoothed;
+
+	uint16_t output = (uint16_t)((m_smoothed + (1 << (PLANNER_SHIFT - 1))) >> PLANNER_SHIFT);
+	if (output == m_output_us)
+		return(false);
+	m_output_us = output;
+	return(true);
+}
+
+bool CTurretPlanner::isSettled(void)
+{
+	return((m_smoothed == m_target) && (m_position == m_target) && (0 == m_velocity));
+}
+
+uint16_t CTurretPlanner::getTarget_us(void)
+{
+	return((uint16_t)(m_target >> PLANNER_SHIFT));
+}
+
+uint16_t CTurretPlanner::getPosition_us(void)
+{
+	return(m_output_us);
+}
+
+int32_t CTurretPlanner::getVelocity(void)
+{
+	return(m_smoothedVelocity * 1000 / TURRET_STEP_MS / (1 << PLANNER_SHIFT));
+}
+
+void CTurretPlanner::fillHistory(int32_t position)
+{
+	for (uint8_t i = 0; i < TURRET_SCURVE_MAX_STEPS; i++)
+		m_history[i] = position;
+	m_sum              = position * m_smoothing;
+	m_head             = 0;
+	m_smoothed         = position;
+	m_smoothedVelocity = 0;
+}
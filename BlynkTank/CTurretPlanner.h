@@ -0,0 +1,71 @@
+#pragma once
+#ifndef CTURRETPLANNER_H
+#define CTURRETPLANNER_H
+
+#include <stdint.h>
+
+#define TURRET_STEP_MS 20 // one profile point per servo pulse (50 Hz): step() must be called at this rate
+
+// profiles
+#define TURRET_PROFILE_NONE      0 // the servo jumps to the target (old behaviour)
+#define TURRET_PROFILE_TRAPEZOID 1 // acceleration limited
+#define TURRET_PROFILE_SCURVE    2 // acceleration and jerk limited
+#define TURRET_SCURVE_MAX_STEPS  8 // jerk phase of the S-curve, steps
+
+// profile defaults: a 90 degrees slider jump (1000 us) takes 0.3 s
+#define DEFAULT_TURRET_PROFILE   TURRET_PROFILE_SCURVE
+#define DEFAULT_TURRET_VELOCITY  5000    // us/s
+#define DEFAULT_TURRET_ACCEL     62500   // us/s^2
+#define DEFAULT_TURRET_JERK      1250000 // us/s^3
+
+struct TurretProfile_t {
+	uint8_t  type;
+	uint32_t maxVelocity;  // servo pulse microseconds per second
+	uint32_t maxAccel;     // per second squared
+	uint32_t maxJerk;      // per second cubed (S-curve only)
+};
+
+// Motion planner of the turret servo: the pulse width goes to the target on a velocity profile
+// (trapezoid or S-curve) instead of jumping, so the servo never sees a full scale step (current
+// spike, overshoot). The trapezoid works out the braking distance at every step, so the target
+// can change while moving; the S-curve is the trapezoid averaged over the jerk time (a moving
+// average of a trapezoid velocity is an S-curve, and it still ends on the target).
+// Integer math, 1/16 us resolution. No hardware and no clock: step() is called at a fixed rate
+// by the owner, that writes the pulse width to the servo
+class CTurretPlanner
+{
+public:
+	CTurretPlanner();
+
+	static void defaultProfile(TurretProfile_t &profile);
+	void configure(const TurretProfile_t &profile); // stopped turret
+	const TurretProfile_t &getProfile(void);
+	// targets are clamped to the limits
+	void setLimits(uint16_t min_us, uint16_t max_us);
+
+	// the turret is there now (e.g. at the start), stopped
+	void reset(uint16_t position_us);
+	void setTarget(uint16_t target_us);
+	// one step toward the target. Returns true if the pulse width changed
+	bool step(void);
+	bool isSettled(void);
+
+	uint16_t getTarget_us(void);
+	uint16_t getPosition_us(void);  // pulse width written to the servo
+	int32_t  getVelocity(void);     // us/s
+
+private:
+	TurretProfile_t m_profile;
+	int32_t  m_maxVelocity, m_maxAccel; // per step, 1/16 us
+	uint16_t m_min_us, m_max_us;
+	int32_t  m_target, m_position, m_velocity; // trapezoid, 1/16 us
+	int32_t  m_history[TURRET_SCURVE_MAX_STEPS]; // trapezoid positions of the jerk time
+	int32_t  m_sum;
+	uint8_t  m_smoothing, m_head;
+	int32_t  m_smoothed, m_smoothedVelocity;
+	uint16_t m_output_us;
+
+	void fillHistory(int32_t position);
+};
+
+#endif
@@ -0,0 +1,61 @@
+#pragma once
+#ifndef HAL_H
+#define HAL_H
+
+// Hardware abstraction layer. CTank and CIR talk to the hardware only through these calls,
+// so the same code runs on the NodeMCU and, with the Linux backend, on a host PC.
+//   GPIO   -> halPinMode, halDigitalWrite, halDigitalRead, halDigitalReadISR, halAttachInterrupt, halDetachInterrupt
+//   PWM    -> halAnalogWrite, halAnalogWriteFreq
+//   IR     -> halCarrierBegin, halCarrierWrite (carrier generator, independent of the PWM frequency),
+//             halCarrierTrain, halCarrierTrainActive (frame edges timed by the hardware)
+//   ADC    -> halAnalogRead
+//   time   -> halMillis, halMicros, halDelay, halDelayMicroseconds, halCycleCount
+//   random -> halRandom
+//   sync   -> halMemoryBarrier, HAL_THREAD_LOCAL
+//   timers -> CHalTimer  (same interface of the Ticker library, plus once_us), halTimerInit
+//   servo  -> CHalServo  (same interface of the Servo library)
+//   serial -> CHalSerial (same interface of the SoftwareSerial library)
+//   FS     -> halFSBegin, halFSFormat, halFSExists, halFSRemove, halFSOpen (CHalFile)
+//   WiFi   -> halWiFiBegin, halWiFiStatus, halWiFiGetLink, halWiFiDisconnect (station)
+//   RTC    -> halRTCRead, halRTCWrite (memory kept across the resets, lost at power off)
+//
+// The NodeMCU backend is made of inline wrappers (no overhead) plus the carrier train, the Linux backend
+// simulates the pins and runs all the timers on a virtual clock (see HAL_Linux.h).
+
+#include <stdint.h>
+
+// WiFi station status (halWiFiStatus)
+#define HAL_WIFI_IDLE        0 // not started
+#define HAL_WIFI_CONNECTING  1
+#define HAL_WIFI_CONNECTED   2 // IP address assigned
+#define HAL_WIFI_NO_AP       3 // access point not found
+#define HAL_WIFI_AUTH_FAILED 4 // wrong password
+#define HAL_WIFI_FAILED      5
+
+// link of the station to its access point. IP addresses as stored by IPAddress (first byte = lowest byte)
+struct halWiFiLink_t {
+	uint8_t  bssid[6];
+	uint8_t  channel;
+	int8_t   rssi;     // dBm
+	uint32_t ip;
+	uint32_t gateway;
+	uint32_t mask;
+	uint32_t dns;
+};
+
+// carrier train: durations_us[0] carrier on, durations_us[1] off, [2] on... the carrier is off at the
+// end. The edges are timed by a hardware timer, loop() and the system task don't delay them.
+// halCarrierTrain fails if the pin is already sending one
+#define HAL_CARRIER_TRAIN_MAX 24 // durations of a train
+
+// RTC memory: 512 bytes, the first 128 are used by the OTA update (eboot command)
+#define HAL_RTC_SIZE     512
+#define HAL_RTC_RESERVED 128
+
+#ifdef ARDUINO
+#include "HAL_ESP8266.h"
+#else
+#include "HAL_Linux.h"
+#endif
+
+#endif
@@ -0,0 +1,113 @@
+// NodeMCU backend of the hardware abstraction layer, the parts that are not inline. Not compiled on the host.
+#ifdef ARDUINO
+
+#include "HAL.h"
+#include <core_version.h>
+#include <core_esp8266_waveform.h>
+
+// IR carrier train ---------------------------------------------------------------------------------------------------
+// The edges are made by a callback of the core waveform generator, called in its timer1 interrupt
+// (the one of analogWrite and Servo): a busy loop() or system task doesn't move them. The interrupt
+// only switches the source of the pin between the sigma-delta generator and the GPIO (low).
+// The callback returns the time to its next call: microseconds up to core 2.7, CPU cycles since 3.0
+#if defined(ARDUINO_ESP8266_MAJOR) && (ARDUINO_ESP8266_MAJOR >= 3)
+#define HAL_TRAIN_WAIT(cycles) (cycles)
+#else
+#define HAL_TRAIN_WAIT(cycles) ((cycles) / HAL_CPU_MHZ)
+#endif
+#define HAL_TRAIN_IDLE_US  10000 // callback period without trains
+#define HAL_TRAIN_EARLY_US 2     // an edge closer than this is made now
+
+struct halTrain_t {
+	uint32_t durations[HAL_CARRIER_TRAIN_MAX]; // CPU cycles
+	uint32_t edge;                             // cycle count of the next edge
+	uint8_t  count;
+	uint8_t  next;
+	uint8_t  pin;
+	volatile bool isActive;                    // set last by halCarrierTrain, cleared by the interrupt
+};
+
+static halTrain_t halTrains[HAL_CARRIER_TRAINS];
+static bool       halTrainHooked;
+
+// next edge of a train: carrier on at the even durations, off at the odd ones and at the end
+static inline __attribute__((always_inline)) void trainStep(halTrain_t &train)
+{
+	bool isOn = (train.next < train.count) && (0 == (train.next & 1));
+	if (isOn)
+		GPC(train.pin) |= (1 << GPCS);
+	else
+		GPC(train.pin) &= ~(1 << GPCS);
+	if (train.next >= train.count) {
+		train.isActive = false;
+		return;
+	}
+	train.edge += train.durations[train.next++];
+}
+
+static uint32_t ICACHE_RAM_ATTR trainTick(void)
+{
+	uint32_t wait = HAL_TRAIN_IDLE_US * HAL_CPU_MHZ;
+	for (uint8_t i = 0; i < HAL_CARRIER_TRAINS; i++) {
+		halTrain_t &train = halTrains[i];
+		if (!train.isActive)
+			continue;
+		int32_t left = (int32_t)(train.edge - ESP.getCycleCount());
+		if (left <= HAL_TRAIN_EARLY_US * HAL_CPU_MHZ) {
+			trainStep(train);
+			if (!train.isActive)
+				continue;
+			left = (int32_t)(train.edge - ESP.getCycleCount());
+		}
+		if ((left > 0) && ((uint32_t)left < wait))
+			wait = left;
+	}
+	return(HAL_TRAIN_WAIT(wait));
+}
+
+bool halCarrierTrain(uint8_t pin, const uint32_t *durations_us, uint8_t count)
+{
+	if ((pin >= 16) || (0 == count) || (count > HAL_CARRIER_TRAIN_MAX) || halCarrierTrainActive(pin))
+		return(false);
+	halTrain_t *train = NULL;
+	for (uint8_t i = 0; i < HAL_CARRIER_TRAINS; i++) {
+		if (!halTrains[i].isActive) {
+			train = &halTrains[i];
+			break;
+		}
+	}
+	if (NULL == train)
+		return(false);
+
+	for (uint8_t i = 0; i < count; i++)
+		train->durations[i] = durations_us[i] * HAL_CPU_MHZ;
+	train->count = count;
+	train->next  = 0;
+	train->pin   = pin;
+	// the pin goes to the generator as halCarrierWrite does, then the interrupt only flips the source
+	sigmaDeltaAttachPin(pin, HAL_CARRIER_CHANNEL);
+	if (!halTrainHooked) {
+		setTimer1Callback(trainTick);
+		halTrainHooked = true;
+	}
+
+	uint32_t savedLevel = xt_rsil(15);
+	train->edge = ESP.getCycleCount();
+	trainStep(*train); // first mark now
+	train->isActive = true;
+	// the pending interrupt may be up to HAL_TRAIN_IDLE_US away: an early one, the callback returns the right wait
+	timer1_write(microsecondsToClockCycles(HAL_TRAIN_EARLY_US));
+	xt_wsr_ps(savedLevel);
+	return(true);
+}
+
+bool halCarrierTrainActive(uint8_t pin)
+{
+	for (uint8_t i = 0; i < HAL_CARRIER_TRAINS; i++) {
+		if (halTrains[i].isActive && (pin == halTrains[i].pin))
+			return(true);
+	}
+	return(false);
+}
+
+#endif
@@ -0,0 +1,293 @@
+#pragma once
+#ifndef HAL_ESP8266_H
+#define HAL_ESP8266_H
+
+// NodeMCU backend of the hardware abstraction layer: thin inline wrappers around the
+// ESP8266 Arduino core and libraries. The carrier train is in HAL_ESP8266.cpp.
+
+#include <Arduino.h>
+#include <Ticker.h>
+#include <Servo.h>
+#include <SoftwareSerial.h>
+#include <FS.h>
+#include <LittleFS.h> // ESP8266 core 2.6.0 or newer
+#include <ESP8266WiFi.h>
+#include <sigma_delta.h>
+
+extern "C" {
+#include <user_interface.h>
+}
+
+// one board, one thread (see HAL_Linux.h)
+#define HAL_THREAD_LOCAL
+
+typedef Servo          CHalServo;
+typedef SoftwareSerial CHalSerial;
+typedef File           CHalFile;
+
+// Ticker with a microsecond one shot timer (the Ticker library has only the milliseconds one).
+// The microsecond timer is an ETSTimer of its own: since core 2.6 the Ticker one is embedded and
+// Ticker::detach() does not free it. One timer at a time: starting one stops the other. As the
+// Ticker, active() stays true after a one shot fired, until detach().
+// The microsecond timers work only after halTimerInit()
+class CHalTimer : public Ticker
+{
+public:
+	CHalTimer() {
+		memset(&m_usTimer, 0, sizeof(m_usTimer));
+		m_isArmed = false;
+	}
+
+	~CHalTimer() {
+		os_timer_disarm(&m_usTimer);
+	}
+
+	template<typename TArg>
+	void once_us(uint32_t microseconds, void(*callback)(TArg), TArg arg) {
+		static_assert(sizeof(TArg) <= sizeof(uint32_t), "once_us() callback argument size must be <= 4 bytes");
+		Ticker::detach();
+		os_timer_disarm(&m_usTimer);
+		os_timer_setfn(&m_usTimer, reinterpret_cast<ETSTimerFunc*>(callback), reinterpret_cast<void*>(arg));
+		ets_timer_arm_new(&m_usTimer, microseconds, false, false); // last parameter false -> microseconds
+		m_isArmed = true;
+	}
+
+	template<typename... TArgs>
+	void attach_ms(TArgs... args) {
+		disarm();
+		Ticker::attach_ms(args...);
+	}
+
+	template<typename... TArgs>
+	void once_ms(TArgs... args) {
+		disarm();
+		Ticker::once_ms(args...);
+	}
+
+	void detach(void) {
+		disarm();
+		Ticker::detach();
+	}
+
+	bool active(void) {
+		return(m_isArmed || Ticker::active());
+	}
+
+private:
+	ETSTimer m_usTimer;
+	bool     m_isArmed;
+
+	void disarm(void) {
+		os_timer_disarm(&m_usTimer);
+		m_isArmed = false;
+	}
+};
+
+// GPIO ---------------------------------------------------------------------------------------------------------------
+inline void halPinMode(uint8_t pin, uint8_t mode) {
+	pinMode(pin, mode);
+}
+
+inline void halDigitalWrite(uint8_t pin, uint8_t value) {
+	digitalWrite(pin, value);
+}
+
+inline int halDigitalRead(uint8_t pin) {
+	return(digitalRead(pin));
+}
+
+// pin level from an interrupt handler: GPIO input register, no call (nothing to fetch from flash).
+// GPIO16 has no interrupts: only the GPIO0..15 are allowed
+inline __attribute__((always_inline)) int halDigitalReadISR(uint8_t pin) {
+	return(GPIP(pin));
+}
+
+inline void halAttachInterrupt(uint8_t pin, void (*isr)(void), int mode) {
+	attachInterrupt(digitalPinToInterrupt(pin), isr, mode);
+}
+
+inline void halDetachInterrupt(uint8_t pin) {
+	detachInterrupt(digitalPinToInterrupt(pin));
+}
+
+// PWM ----------------------------------------------------------------------------------------------------------------
+inline void halAnalogWrite(uint8_t pin, int value) {
+	analogWrite(pin, value);
+}
+
+inline void halAnalogWriteFreq(uint32_t frequency) {
+	analogWriteFreq(frequency);
+}
+
+// IR carrier ---------------------------------------------------------------------------------------------------------
+// The carrier comes from the sigma-delta modulator, a 50% duty cycle square wave routed to the IR
+// diode pins through the GPIO matrix: no CPU time. The analogWrite frequency is global (motors), and
+// the core waveform generator (startWaveform, core 2.6 and newer) makes its edges in software: two
+// timer1 interrupts per carrier period, 76000 per second, shared with analogWrite and Servo. Only the
+// frame edges come from there (halCarrierTrain). Returns the nearest frequency the generator can make
+#define HAL_CARRIER_CHANNEL 0
+
+inline uint32_t halCarrierBegin(uint32_t frequency) {
+	uint32_t actual = sigmaDeltaSetup(HAL_CARRIER_CHANNEL, frequency);
+	sigmaDeltaWrite(HAL_CARRIER_CHANNEL, 128);
+	return(actual);
+}
+
+// the pin must be an output set low: detached from the generator it goes back to its GPIO level
+inline void halCarrierWrite(uint8_t pin, bool isOn) {
+	if (isOn)
+		sigmaDeltaAttachPin(pin, HAL_CARRIER_CHANNEL);
+	else
+		sigmaDeltaDetachPin(pin);
+}
+
+// carrier trains (HAL.h) in HAL_ESP8266.cpp: GPIO0..15, up to HAL_CARRIER_TRAINS at the same time
+#define HAL_CARRIER_TRAINS 4 // the transceivers of a group (MAX_IR_GROUP) start theirs back to back
+
+bool halCarrierTrain(uint8_t pin, const uint32_t *durations_us, uint8_t count);
+bool halCarrierTrainActive(uint8_t pin);
+
+// ADC ----------------------------------------------------------------------------------------------------------------
+inline int halAnalogRead(uint8_t pin) {
+	return(analogRead(pin));
+}
+
+// time ---------------------------------------------------------------------------------------------------------------
+inline uint32_t halMillis(void) {
+	return(millis());
+}
+
+inline uint32_t halMicros(void) {
+	return(micros());
+}
+
+inline void halDelay(uint32_t ms) {
+	delay(ms);
+}
+
+inline void halDelayMicroseconds(uint32_t us) {
+	delayMicroseconds(us);
+}
+
+// switch the SDK timers to microsecond resolution (CHalTimer::once_us). The milliseconds
+// timers keep working. Call it as the first statement of setup(), before arming any timer
+inline void halTimerInit(void) {
+	system_timer_reinit();
+}
+
+// CPU cycle counter, HAL_CPU_MHZ cycles per microsecond
+#define HAL_CPU_MHZ (F_CPU / 1000000L)
+
+inline uint32_t halCycleCount(void) {
+	return(ESP.getCycleCount());
+}
+
+// random number in [0, max). Hardware random number generator: every tank has its own sequence
+inline uint32_t halRandom(uint32_t max) {
+	return(RANDOM_REG32 % max);
+}
+
+// compiler memory barrier. The ESP8266 has one core: interrupts see the memory in program order
+inline void halMemoryBarrier(void) {
+	__asm__ __volatile__("" ::: "memory");
+}
+
+// file system --------------------------------------------------------------------------------------------------------
+// LittleFS: faster mount, wear leveling, power loss safe. No automatic format: a flash of the
+// older firmwares (SPIFFS) must be migrated first
+inline bool halFSBegin(void) {
+	LittleFSConfig config;
+	config.setAutoFormat(false);
+	LittleFS.setConfig(config);
+	return(LittleFS.begin());
+}
+
+inline bool halFSFormat(void) {
+	return(LittleFS.format());
+}
+
+inline bool halFSExists(const char *path) {
+	return(LittleFS.exists(path));
+}
+
+inline bool halFSRemove(const char *path) {
+	return(LittleFS.remove(path));
+}
+
+inline CHalFile halFSOpen(const char *path, const char *mode) {
+	return(LittleFS.open(path, mode));
+}
+
+// SPIFFS of the older firmwares, read only (migration). Same flash area of LittleFS: one mounted at a time
+inline bool halFSLegacyBegin(void) {
+	SPIFFSConfig config;
+	config.setAutoFormat(false);
+	SPIFFS.setConfig(config);
+	return(SPIFFS.begin());
+}
+
+inline CHalFile halFSLegacyOpen(const char *path) {
+	return(SPIFFS.open(path, "r"));
+}
+
+inline void halFSLegacyEnd(void) {
+	SPIFFS.end();
+}
+
+// WiFi station -------------------------------------------------------------------------------------------------------
+// link NULL: scan of all the channels, then DHCP. Otherwise straight to the access point of the link
+// (BSSID and channel) with its IP address, no DHCP. The credentials are not written to flash at every begin
+inline void halWiFiBegin(const char *ssid, const char *password, const halWiFiLink_t *link) {
+	WiFi.persistent(false);
+	WiFi.mode(WIFI_STA);
+	if (NULL == link) {
+		WiFi.config(0u, 0u, 0u);
+		WiFi.begin(ssid, password);
+	}
+	else {
+		WiFi.config(IPAddress(link->ip), IPAddress(link->gateway), IPAddress(link->mask), IPAddress(link->dns));
+		WiFi.begin(ssid, password, link->channel, link->bssid, true);
+	}
+}
+
+inline uint8_t halWiFiStatus(void) {
+	switch (wifi_station_get_connect_status()) {
+	case STATION_GOT_IP:
+		return(HAL_WIFI_CONNECTED);
+	case STATION_CONNECTING:
+		return(HAL_WIFI_CONNECTING);
+	case STATION_NO_AP_FOUND:
+		return(HAL_WIFI_NO_AP);
+	case STATION_WRONG_PASSWORD:
+		return(HAL_WIFI_AUTH_FAILED);
+	case STATION_CONNECT_FAIL:
+		return(HAL_WIFI_FAILED);
+	}
+	return(HAL_WIFI_IDLE);
+}
+
+inline void halWiFiGetLink(halWiFiLink_t &link) {
+	memcpy(link.bssid, WiFi.BSSID(), sizeof(link.bssid));
+	link.channel = WiFi.channel();
+	link.rssi    = WiFi.RSSI();
+	link.ip      = WiFi.localIP();
+	link.gateway = WiFi.gatewayIP();
+	link.mask    = WiFi.subnetMask();
+	link.dns     = WiFi.dnsIP();
+}
+
+inline void halWiFiDisconnect(void) {
+	WiFi.disconnect();
+}
+
+// RTC memory ---------------------------------------------------------------------------------------------------------
+// offset and size in bytes, multiple of 4
+inline bool halRTCRead(uint32_t offset, void *data, size_t size) {
+	return(ESP.rtcUserMemoryRead(offset / 4, (uint32_t *)data, size));
+}
+
+inline bool halRTCWrite(uint32_t offset, const void *data, size_t size) {
+	return(ESP.rtcUserMemoryWrite(offset / 4, (uint32_t *)data, size));
+}
+
+#endif
@@ -0,0 +1,911 @@
+// Linux (host) backend of the hardware abstraction layer. Not compiled for the NodeMCU.
+#ifndef ARDUINO
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include "HAL.h"
+
+CHalConsole Serial;
+
+// simulated hardware state. Every thread has its own board (see HAL_THREAD_LOCAL)
+// carrier train of a pin (halCarrierTrain)
+struct simTrain_t {
+	uint32_t durations_us[HAL_CARRIER_TRAIN_MAX];
+	uint8_t  count;
+	uint8_t  next;
+	uint64_t deadline_us; // next edge
+	bool     isActive;
+};
+
+static thread_local uint64_t simTime_us;
+static thread_local bool     simAdvancing;
+static thread_local uint8_t  simPinLevel[HAL_PIN_COUNT];
+static thread_local int      simPWM[HAL_PIN_COUNT];
+static thread_local int      simADC[HAL_PIN_COUNT];
+static thread_local uint32_t simPWMFreq = 1000;
+static thread_local bool     simCarrier[HAL_PIN_COUNT];
+static thread_local uint32_t simCarrierFreq;
+static thread_local simTrain_t simTrains[HAL_PIN_COUNT];
+static thread_local void   (*simISR[HAL_PIN_COUNT])(void);
+static thread_local int      simISRMode[HAL_PIN_COUNT];
+static thread_local halSimPWMHook_t simPWMHook;
+static thread_local halSimCarrierHook_t simCarrierHook;
+static thread_local halSimStats_t   simStats;
+static thread_local uint32_t        simRandomState = 0x2545F491;
+static thread_local uint32_t        simTimerJitter_us;
+static thread_local uint32_t        simJitterState = 0x6C078965; // own sequence: halRandom is not touched
+
+static thread_local std::map<std::string, std::string> simFiles;
+static thread_local bool            simFSIsLegacy;
+static thread_local halSimFSStats_t simFSStats;
+static thread_local uint32_t        simFlashLog; // bytes programmed in the current block
+
+static thread_local std::string     simWiFiSSID, simWiFiPassword;
+static thread_local halWiFiLink_t   simWiFiLink;
+static thread_local bool            simWiFiIsUp;
+static thread_local uint8_t         simWiFiResult;  // status of the station at simWiFiDone_us...
+static thread_local uint64_t        simWiFiDone_us; // ...connecting until then
+static thread_local bool            simWiFiIsBegun;
+static thread_local uint32_t        simRTC[HAL_RTC_SIZE / 4];
+
+static void simFlashCommit(size_t bytes)
+{
+	simFSStats.commits++;
+	simFSStats.bytesWritten    += bytes;
+	simFSStats.bytesProgrammed += bytes + HAL_SIM_FLASH_METADATA;
+	simFlashLog                += bytes + HAL_SIM_FLASH_METADATA;
+	while (simFlashLog >= HAL_SIM_FLASH_BLOCK) {
+		simFSStats.blocksErased++;
+		simFlashLog -= HAL_SIM_FLASH_BLOCK;
+	}
+}
+
+// list of the timers, built on first use (timers can be global objects of other files)
+static std::vector<CHalTimer*> &simTimers(void)
+{
+	static thread_local std::vector<CHalTimer*> timers;
+	return(timers);
+}
+
+
+// host CPU time, nanoseconds
+static uint64_t hostTime_ns(void)
+{
+	return(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// String -------------------------------------------------------------------------------------------------------------
+bool String::startsWith(const char *prefix) const
+{
+	return(0 == compare(0, strlen(prefix), prefix));
+}
+
+void String::replace(const char *find, const char *replacement)
+{
+	size_t findLen = strlen(find);
+	size_t replacementLen = strlen(replacement);
+	if (0 == findLen)
+		return;
+	size_t pos = this->find(find);
+	while (pos != std::string::npos) {
+		std::string::replace(pos, findLen, replacement);
+		pos = this->find(find, pos + replacementLen);
+	}
+}
+
+// console ------------------------------------------------------------------------------------------------------------
+CHalConsole::CHalConsole()
+{
+	m_enabled = true;
+}
+
+void CHalConsole::begin(uint32_t baud)
+{
+}
+
+void CHalConsole::enable(bool enable)
+{
+	m_enabled = enable;
+}
+
+size_t CHalConsole::print(const char *str)
+{
+	if (!m_enabled)
+		return(0);
+	return(fputs(str, stdout) >= 0 ? strlen(str) : 0);
+}
+
+size_t CHalConsole::print(const String &str)
+{
+	return(print(str.c_str()));
+}
+
+size_t CHalConsole::print(char c)
+{
+	char str[2] = { c, 0 };
+	return(print(str));
+}
+
+size_t CHalConsole::print(int value, int base)
+{
+	char str[16];
+	if (HEX == base)
+		snprintf(str, sizeof(str), "%X", value);
+	else
+		snprintf(str, sizeof(str), "%d", value);
+	return(print(str));
+}
+
+size_t CHalConsole::println(void)
+{
+	return(print("\n"));
+}
+
+size_t CHalConsole::println(const char *str)
+{
+	return(print(str) + println());
+}
+
+size_t CHalConsole::println(const String &str)
+{
+	return(print(str) + println());
+}
+
+size_t CHalConsole::println(char c)
+{
+	return(print(c) + println());
+}
+
+size_t CHalConsole::println(int value, int base)
+{
+	return(print(value, base) + println());
+}
+
+size_t CHalConsole::printf(const char *format, ...)
+{
+	if (!m_enabled)
+		return(0);
+	va_list args;
+	va_start(args, format);
+	int written = vprintf(format, args);
+	va_end(args);
+	return(written > 0 ? written : 0);
+}
+
+// timers -------------------------------------------------------------------------------------------------------------
+// the software timers run in the system task, after loop() returns: random delay of the callback
+static uint32_t timerJitter(void)
+{
+	if (0 == simTimerJitter_us)
+		return(0);
+	simJitterState ^= simJitterState << 13;
+	simJitterState ^= simJitterState >> 17;
+	simJitterState ^= simJitterState << 5;
+	return(simJitterState % (simTimerJitter_us + 1));
+}
+
+CHalTimer::CHalTimer()
+{
+	m_period_us   = 0;
+	m_due_us      = 0;
+	m_deadline_us = 0;
+	m_repeat      = false;
+	m_active      = false;
+	m_isArmed     = false;
+	simTimers().push_back(this);
+}
+
+CHalTimer::~CHalTimer()
+{
+	std::vector<CHalTimer*> &timers = simTimers();
+	timers.erase(std::remove(timers.begin(), timers.end(), this), timers.end());
+}
+
+void CHalTimer::attach_ms(uint32_t milliseconds, callback_t callback)
+{
+	schedule((uint64_t)milliseconds * 1000, true, callback);
+}
+
+void CHalTimer::once_ms(uint32_t milliseconds, callback_t callback)
+{
+	schedule((uint64_t)milliseconds * 1000, false, callback);
+}
+
+void CHalTimer::detach(void)
+{
+	m_active  = false;
+	m_isArmed = false;
+}
+
+bool CHalTimer::active(void)
+{
+	return(m_active);
+}
+
+bool CHalTimer::isArmed(void)
+{
+	return(m_isArmed);
+}
+
+uint64_t CHalTimer::getDeadline(void)
+{
+	return(m_deadline_us);
+}
+
+void CHalTimer::fire(void)
+{
+	// as the ESP8266 Ticker, a one shot stays active until detach()
+	if (m_repeat) {
+		m_due_us     += m_period_us;
+		m_deadline_us = m_due_us + timerJitter();
+	}
+	else
+		m_isArmed = false;
+	// the callback may detach or re-attach this timer
+	std::function<void(void)> callback = m_callback;
+	callback();
+}
+
+void CHalTimer::schedule(uint64_t microseconds, bool repeat, std::function<void(void)> callback)
+{
+	m_callback    = callback;
+	m_period_us   = microseconds;
+	m_due_us      = simTime_us + m_period_us;
+	m_deadline_us = m_due_us + timerJitter();
+	m_repeat      = repeat;
+	m_active      = true;
+	m_isArmed     = true;
+}
+
+// servo --------------------------------------------------------------------------------------------------------------
+CHalServo::CHalServo()
+{
+	m_pin = -1;
+	m_us  = 1500;
+}
+
+uint8_t CHalServo::attach(int pin)
+{
+	m_pin = pin;
+	return(0);
+}
+
+void CHalServo::detach(void)
+{
+	m_pin = -1;
+}
+
+void CHalServo::write(int value)
+{
+	// same conversion of the Servo library: values below 544 are degrees
+	if (value < 544) {
+		if (value < 0) value = 0;
+		if (value > 180) value = 180;
+		value = 544 + (value * (2400 - 544)) / 180;
+	}
+	writeMicroseconds(value);
+}
+
+void CHalServo::writeMicroseconds(int value)
+{
+	m_us = value;
+}
+
+int CHalServo::read(void)
+{
+	return(((m_us - 544) * 180 + (2400 - 544) / 2) / (2400 - 544));
+}
+
+int CHalServo::readMicroseconds(void)
+{
+	return(m_us);
+}
+
+bool CHalServo::attached(void)
+{
+	return(m_pin >= 0);
+}
+
+// serial -------------------------------------------------------------------------------------------------------------
+CHalSerial::CHalSerial(int rxPin, int txPin)
+{
+	m_baud  = 0;
+	m_rxPos = 0;
+}
+
+void CHalSerial::begin(long baud)
+{
+	m_baud = baud;
+}
+
+size_t CHalSerial::write(uint8_t data)
+{
+	m_txBuffer.push_back(data);
+	return(1);
+}
+
+size_t CHalSerial::write(const uint8_t *buffer, size_t size)
+{
+	m_txBuffer.insert(m_txBuffer.end(), buffer, buffer + size);
+	return(size);
+}
+
+int CHalSerial::available(void)
+{
+	return(m_rxBuffer.size() - m_rxPos);
+}
+
+int CHalSerial::read(void)
+{
+	if (m_rxPos >= m_rxBuffer.size())
+		return(-1);
+	return(m_rxBuffer[m_rxPos++]);
+}
+
+void CHalSerial::flush(void)
+{
+}
+
+void CHalSerial::simInject(const uint8_t *buffer, size_t size)
+{
+	if (m_rxPos == m_rxBuffer.size()) {
+		m_rxBuffer.clear();
+		m_rxPos = 0;
+	}
+	m_rxBuffer.insert(m_rxBuffer.end(), buffer, buffer + size);
+}
+
+std::vector<uint8_t> &CHalSerial::simTransmitted(void)
+{
+	return(m_txBuffer);
+}
+
+// file ---------------------------------------------------------------------------------------------------------------
+CHalFile::CHalFile()
+{
+	m_pos     = 0;
+	m_written = 0;
+	m_write   = false;
+	m_open  = false;
+}
+
+CHalFile::CHalFile(const char *path, bool write, bool append)
+{
+	m_path    = path;
+	m_pos     = 0;
+	m_written = 0;
+	m_write   = write;
+	m_open  = true;
+	if (!write || append)
+		m_data = simFiles[m_path];
+}
+
+CHalFile::operator bool() const
+{
+	return(m_open);
+}
+
+int CHalFile::available(void)
+{
+	if (!m_open || m_write)
+		return(0);
+	return(m_data.size() - m_pos);
+}
+
+int CHalFile::read(void)
+{
+	if (available() <= 0)
+		return(-1);
+	return((uint8_t)m_data[m_pos++]);
+}
+
+size_t CHalFile::read(uint8_t *buffer, size_t size)
+{
+	size_t count = std::min(size, (size_t)available());
+	memcpy(buffer, m_data.data() + m_pos, count);
+	m_pos += count;
+	return(count);
+}
+
+String CHalFile::readStringUntil(char terminator)
+{
+	String str;
+	int c = read();
+	while ((c >= 0) && (c != terminator)) {
+		str += (char)c;
+		c = read();
+	}
+	return(str);
+}
+
+size_t CHalFile::write(uint8_t data)
+{
+	return(write(&data, 1));
+}
+
+size_t CHalFile::write(const uint8_t *buffer, size_t size)
+{
+	if (!m_open || !m_write)
+		return(0);
+	m_data.append((const char *)buffer, size);
+	m_written += size;
+	return(size);
+}
+
+size_t CHalFile::printf(const char *format, ...)
+{
+	char buffer[256];
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+	if (len < 0)
+		return(0);
+	return(write((const uint8_t *)buffer, std::min((size_t)len, sizeof(buffer) - 1)));
+}
+
+size_t CHalFile::size(void)
+{
+	return(m_data.size());
+}
+
+void CHalFile::close(void)
+{
+	if (m_open && m_write) {
+		simFiles[m_path] = m_data;
+		simFlashCommit(m_written);
+	}
+	m_open = false;
+}
+
+// GPIO ---------------------------------------------------------------------------------------------------------------
+void halPinMode(uint8_t pin, uint8_t mode)
+{
+	if (pin >= HAL_PIN_COUNT)
+		return;
+	if (INPUT_PULLUP == mode)
+		simPinLevel[pin] = HIGH;
+}
+
+void halDigitalWrite(uint8_t pin, uint8_t value)
+{
+	if (pin >= HAL_PIN_COUNT)
+		return;
+	simPinLevel[pin] = value ? HIGH : LOW;
+}
+
+int halDigitalRead(uint8_t pin)
+{
+	if (pin >= HAL_PIN_COUNT)
+		return(LOW);
+	return(simPinLevel[pin]);
+}
+
+void halAttachInterrupt(uint8_t pin, void (*isr)(void), int mode)
+{
+	if (pin >= HAL_PIN_COUNT)
+		return;
+	simISR[pin] = isr;
+	simISRMode[pin] = mode;
+}
+
+void halDetachInterrupt(uint8_t pin)
+{
+	if (pin >= HAL_PIN_COUNT)
+		return;
+	simISR[pin] = NULL;
+}
+
+// PWM ----------------------------------------------------------------------------------------------------------------
+void halAnalogWrite(uint8_t pin, int value)
+{
+	if (pin >= HAL_PIN_COUNT)
+		return;
+	simPWM[pin] = value;
+	if (simPWMHook != NULL)
+		simPWMHook(pin, value);
+}
+
+void halAnalogWriteFreq(uint32_t frequency)
+{
+	simPWMFreq = frequency;
+}
+
+// IR carrier ---------------------------------------------------------------------------------------------------------
+uint32_t halCarrierBegin(uint32_t frequency)
+{
+	simCarrierFreq = frequency;
+	return(frequency);
+}
+
+void halCarrierWrite(uint8_t pin, bool isOn)
+{
+	if (pin >= HAL_PIN_COUNT)
+		return;
+	simCarrier[pin] = isOn;
+	if (simCarrierHook != NULL)
+		simCarrierHook(pin, isOn);
+}
+
+// next edge of a train: carrier on at the even durations, off at the odd ones and at the end
+static void trainStep(uint8_t pin)
+{
+	simTrain_t &train = simTrains[pin];
+	if (train.next >= train.count) {
+		halCarrierWrite(pin, false);
+		train.isActive = false;
+		return;
+	}
+	halCarrierWrite(pin, 0 == (train.next & 1));
+	train.deadline_us += train.durations_us[train.next++];
+}
+
+bool halCarrierTrain(uint8_t pin, const uint32_t *durations_us, uint8_t count)
+{
+	if ((pin >= HAL_PIN_COUNT) || (0 == count) || (count > HAL_CARRIER_TRAIN_MAX) || simTrains[pin].isActive)
+		return(false);
+	simTrain_t &train = simTrains[pin];
+	memcpy(train.durations_us, durations_us, count * sizeof(uint32_t));
+	train.count       = count;
+	train.next        = 0;
+	train.deadline_us = simTime_us;
+	train.isActive    = true;
+	trainStep(pin); // first mark now
+	return(true);
+}
+
+bool halCarrierTrainActive(uint8_t pin)
+{
+	if (pin >= HAL_PIN_COUNT)
+		return(false);
+	return(simTrains[pin].isActive);
+}
+
+// ADC ----------------------------------------------------------------------------------------------------------------
+int halAnalogRead(uint8_t pin)
+{
+	if (pin >= HAL_PIN_COUNT)
+		return(0);
+	return(simADC[pin]);
+}
+
+// time ---------------------------------------------------------------------------------------------------------------
+uint32_t halMillis(void)
+{
+	return((uint32_t)(simTime_us / 1000));
+}
+
+uint32_t halMicros(void)
+{
+	return((uint32_t)simTime_us);
+}
+
+void halDelay(uint32_t ms)
+{
+	halSimAdvance(ms * 1000);
+}
+
+void halDelayMicroseconds(uint32_t us)
+{
+	halSimAdvance(us);
+}
+
+uint32_t halCycleCount(void)
+{
+	return((uint32_t)hostTime_ns());
+}
+
+// xorshift32
+uint32_t halRandom(uint32_t max)
+{
+	simRandomState ^= simRandomState << 13;
+	simRandomState ^= simRandomState >> 17;
+	simRandomState ^= simRandomState << 5;
+	return(simRandomState % max);
+}
+
+// file system --------------------------------------------------------------------------------------------------------
+bool halFSBegin(void)
+{
+	if (simFSIsLegacy)
+		return(false);
+	simFSStats.mounts++;
+	return(true);
+}
+
+bool halFSFormat(void)
+{
+	simFiles.clear();
+	simFSIsLegacy = false;
+	simFSStats.formats++;
+	return(true);
+}
+
+bool halFSExists(const char *path)
+{
+	return(simFiles.count(path) != 0);
+}
+
+bool halFSRemove(const char *path)
+{
+	if (0 == simFiles.erase(path))
+		return(false);
+	simFlashCommit(0);
+	return(true);
+}
+
+CHalFile halFSOpen(const char *path, const char *mode)
+{
+	if ((mode[0] == 'r') && !halFSExists(path))
+		return(CHalFile());
+	return(CHalFile(path, mode[0] != 'r', mode[0] == 'a'));
+}
+
+bool halFSLegacyBegin(void)
+{
+	return(simFSIsLegacy);
+}
+
+CHalFile halFSLegacyOpen(const char *path)
+{
+	if (!simFSIsLegacy || !halFSExists(path))
+		return(CHalFile());
+	return(CHalFile(path, false));
+}
+
+void halFSLegacyEnd(void)
+{
+}
+
+// WiFi station -------------------------------------------------------------------------------------------------------
+void halWiFiBegin(const char *ssid, const char *password, const halWiFiLink_t *link)
+{
+	simWiFiIsBegun = true;
+	if (!simWiFiIsUp || (simWiFiSSID != ssid)) {
+		simWiFiResult  = HAL_WIFI_NO_AP;
+		simWiFiDone_us = simTime_us + HAL_SIM_WIFI_SCAN_MS * 1000;
+	}
+	else if ((NULL != link) && ((link->channel != simWiFiLink.channel) || (0 != memcmp(link->bssid, simWiFiLink.bssid, sizeof(link->bssid))))) {
+		simWiFiResult  = HAL_WIFI_NO_AP;
+		simWiFiDone_us = simTime_us + HAL_SIM_WIFI_SCAN_MS * 1000;
+	}
+	else if (simWiFiPassword != password) {
+		simWiFiResult  = HAL_WIFI_AUTH_FAILED;
+		simWiFiDone_us = simTime_us + ((NULL == link) ? HAL_SIM_WIFI_SCAN_MS : 0) * 1000 + HAL_SIM_WIFI_ASSOCIATE_MS * 1000;
+	}
+	else {
+		simWiFiResult  = HAL_WIFI_CONNECTED;
+		simWiFiDone_us = simTime_us + ((NULL == link) ? HAL_SIM_WIFI_SCAN_MS + HAL_SIM_WIFI_DHCP_MS : 0) * 1000 +
+			HAL_SIM_WIFI_ASSOCIATE_MS * 1000;
+	}
+}
+
+uint8_t halWiFiStatus(void)
+{
+	if (!simWiFiIsBegun)
+		return(HAL_WIFI_IDLE);
+	if (simTime_us < simWiFiDone_us)
+		return(HAL_WIFI_CONNECTING);
+	return(simWiFiResult);
+}
+
+void halWiFiGetLink(halWiFiLink_t &link)
+{
+	if (HAL_WIFI_CONNECTED == halWiFiStatus())
+		link = simWiFiLink;
+	else
+		memset(&link, 0, sizeof(link));
+}
+
+void halWiFiDisconnect(void)
+{
+	simWiFiIsBegun = false;
+}
+
+// RTC memory ---------------------------------------------------------------------------------------------------------
+bool halRTCRead(uint32_t offset, void *data, size_t size)
+{
+	if ((offset % 4 != 0) || (size % 4 != 0) || (offset + size > HAL_RTC_SIZE))
+		return(false);
+	memcpy(data, (uint8_t *)simRTC + offset, size);
+	return(true);
+}
+
+bool halRTCWrite(uint32_t offset, const void *data, size_t size)
+{
+	if ((offset % 4 != 0) || (size % 4 != 0) || (offset + size > HAL_RTC_SIZE))
+		return(false);
+	memcpy((uint8_t *)simRTC + offset, data, size);
+	return(true);
+}
+
+// simulation control -------------------------------------------------------------------------------------------------
+uint64_t halSimTime_us(void)
+{
+	return(simTime_us);
+}
+
+void halSimAdvance(uint32_t us)
+{
+	uint64_t target = simTime_us + us;
+
+	// called from a timer callback or an interrupt: only move the clock, the outer
+	// call will fire the timers expired in the meantime (they are not reentrant)
+	if (simAdvancing) {
+		simTime_us = target;
+		return;
+	}
+
+	simAdvancing = true;
+	for (;;) {
+		std::vector<CHalTimer*> &timers = simTimers();
+		CHalTimer *next = NULL;
+		for (size_t i = 0; i < timers.size(); i++) {
+			if (!timers[i]->isArmed() || (timers[i]->getDeadline() > target))
+				continue;
+			if ((NULL == next) || (timers[i]->getDeadline() < next->getDeadline()))
+				next = timers[i];
+		}
+		// the carrier trains are hardware: their edges first, on time
+		int train = -1;
+		for (uint8_t pin = 0; pin < HAL_PIN_COUNT; pin++) {
+			if (!simTrains[pin].isActive || (simTrains[pin].deadline_us > target))
+				continue;
+			if ((train < 0) || (simTrains[pin].deadline_us < simTrains[train].deadline_us))
+				train = pin;
+		}
+		if ((train >= 0) && ((NULL == next) || (simTrains[train].deadline_us <= next->getDeadline()))) {
+			if (simTrains[train].deadline_us > simTime_us)
+				simTime_us = simTrains[train].deadline_us;
+			trainStep(train);
+			continue;
+		}
+		if (NULL == next)
+			break;
+		if (next->getDeadline() > simTime_us)
+			simTime_us = next->getDeadline();
+		uint64_t start_ns = hostTime_ns();
+		next->fire();
+		uint64_t elapsed_ns = hostTime_ns() - start_ns;
+		simStats.timerCount++;
+		simStats.timerHost_ns += elapsed_ns;
+		if (elapsed_ns > simStats.timerMaxHost_ns)
+			simStats.timerMaxHost_ns = elapsed_ns;
+	}
+	if (target > simTime_us)
+		simTime_us = target;
+	simAdvancing = false;
+}
+
+void halSimSetPin(uint8_t pin, uint8_t value)
+{
+	if (pin >= HAL_PIN_COUNT)
+		return;
+	value = value ? HIGH : LOW;
+	uint8_t oldValue = simPinLevel[pin];
+	simPinLevel[pin] = value;
+	if ((oldValue == value) || (NULL == simISR[pin]))
+		return;
+
+	if ((CHANGE == simISRMode[pin]) ||
+		((FALLING == simISRMode[pin]) && (LOW == value)) ||
+		((RISING == simISRMode[pin]) && (HIGH == value))) {
+		uint64_t start_us = simTime_us;
+		uint64_t start_ns = hostTime_ns();
+		simISR[pin]();
+		uint64_t elapsed_ns = hostTime_ns() - start_ns;
+		uint64_t elapsed_us = simTime_us - start_us;
+		simStats.isrCount++;
+		simStats.isrHost_ns += elapsed_ns;
+		simStats.isrVirtual_us += elapsed_us;
+		if (elapsed_ns > simStats.isrMaxHost_ns)
+			simStats.isrMaxHost_ns = elapsed_ns;
+		if (elapsed_us > simStats.isrMaxVirtual_us)
+			simStats.isrMaxVirtual_us = elapsed_us;
+	}
+}
+
+int halSimGetPWM(uint8_t pin)
+{
+	if (pin >= HAL_PIN_COUNT)
+		return(0);
+	return(simPWM[pin]);
+}
+
+uint32_t halSimGetPWMFreq(void)
+{
+	return(simPWMFreq);
+}
+
+bool halSimGetCarrier(uint8_t pin)
+{
+	if (pin >= HAL_PIN_COUNT)
+		return(false);
+	return(simCarrier[pin]);
+}
+
+uint32_t halSimGetCarrierFreq(void)
+{
+	return(simCarrierFreq);
+}
+
+void halSimSetADC(uint8_t pin, int value)
+{
+	if (pin >= HAL_PIN_COUNT)
+		return;
+	simADC[pin] = value;
+}
+
+void halSimSetPWMHook(halSimPWMHook_t hook)
+{
+	simPWMHook = hook;
+}
+
+void halSimSetCarrierHook(halSimCarrierHook_t hook)
+{
+	simCarrierHook = hook;
+}
+
+halSimStats_t halSimGetStats(void)
+{
+	return(simStats);
+}
+
+void halSimSetRandomSeed(uint32_t seed)
+{
+	if (0 != seed)
+		simRandomState = seed;
+}
+
+void halSimSetTimerJitter(uint32_t max_us)
+{
+	simTimerJitter_us = max_us;
+}
+
+void halSimResetStats(void)
+{
+	memset(&simStats, 0, sizeof(simStats));
+}
+
+void halSimSetLegacyFS(bool isLegacy)
+{
+	simFSIsLegacy = isLegacy;
+}
+
+halSimFSStats_t halSimGetFSStats(void)
+{
+	return(simFSStats);
+}
+
+void halSimResetFSStats(void)
+{
+	memset(&simFSStats, 0, sizeof(simFSStats));
+}
+
+void halSimSetWiFi(const char *ssid, const char *password, const halWiFiLink_t &link)
+{
+	simWiFiSSID     = ssid;
+	simWiFiPassword = password;
+	simWiFiLink     = link;
+	simWiFiIsUp     = true;
+}
+
+// a lost link stays lost: the station connects again only with a new begin
+void halSimSetWiFiUp(bool isUp)
+{
+	simWiFiIsUp = isUp;
+	if (!isUp && simWiFiIsBegun)
+		simWiFiResult = HAL_WIFI_NO_AP;
+}
+
+void halSimPowerOff(void)
+{
+	for (uint16_t i = 0; i < HAL_RTC_SIZE / 4; i++)
+		simRTC[i] = halRandom(0xFFFFFFFF);
+	simWiFiIsBegun = false;
+}
+
+#endif
@@ -0,0 +1,337 @@
+#pragma once
+#ifndef HAL_LINUX_H
+#define HAL_LINUX_H
+
+// Linux (host) backend of the hardware abstraction layer.
+// There is no real hardware: the pin levels, the PWM duty cycles and the ADC values are
+// stored in memory and the time is a virtual clock that moves forward only when the
+// firmware calls halDelay/halDelayMicroseconds or the simulation calls halSimAdvance.
+// All the CHalTimer callbacks are fired, in deadline order, while the clock is moving.
+// Every host thread simulates its own board (pins, clock, timers, files), so several
+// boards can run in parallel: the firmware globals touched by the interrupts must be
+// declared HAL_THREAD_LOCAL.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <functional>
+
+// Arduino core definitions used by the firmware ----------------------------------------------------------------------
+#define LOW          0
+#define HIGH         1
+#define INPUT        0x00
+#define OUTPUT       0x01
+#define INPUT_PULLUP 0x02
+
+#define RISING       0x01
+#define FALLING      0x02
+#define CHANGE       0x03
+
+#define DEC          10
+#define HEX          16
+
+#define PWMRANGE     1023
+
+// NodeMCU pin mapping (GPIO numbers)
+#define D0           16
+#define D1           5
+#define D2           4
+#define D3           0
+#define D4           2
+#define D5           14
+#define D6           12
+#define D7           13
+#define D8           15
+#define A0           17
+
+#define HAL_PIN_COUNT 18
+
+#define ADC_MODE(mode)
+#define ICACHE_RAM_ATTR
+#define HAL_THREAD_LOCAL thread_local
+
+// minimal replacement of the Arduino String class
+class String : public std::string
+{
+public:
+	String() {}
+	String(const char *str) : std::string(str != NULL ? str : "") {}
+	String(const std::string &str) : std::string(str) {}
+
+	bool startsWith(const char *prefix) const;
+	void replace(const char *find, const char *replacement);
+};
+
+// debug console (the Arduino Serial object), printed on stdout
+class CHalConsole
+{
+public:
+	CHalConsole();
+	void   begin(uint32_t baud);
+	void   enable(bool enable);
+	size_t print(const char *str);
+	size_t print(const String &str);
+	size_t print(char c);
+	size_t print(int value, int base = DEC);
+	size_t println(void);
+	size_t println(const char *str);
+	size_t println(const String &str);
+	size_t println(char c);
+	size_t println(int value, int base = DEC);
+	size_t printf(const char *format, ...);
+
+private:
+	bool m_enabled;
+};
+
+extern CHalConsole Serial;
+
+// software timer with the same interface of the Ticker library
+class CHalTimer
+{
+public:
+	typedef void(*callback_t)(void);
+
+	CHalTimer();
+	~CHalTimer();
+
+	void attach_ms(uint32_t milliseconds, callback_t callback);
+	void once_ms(uint32_t milliseconds, callback_t callback);
+
+	template<typename TArg>
+	void attach_ms(uint32_t milliseconds, void(*callback)(TArg), TArg arg) {
+		schedule((uint64_t)milliseconds * 1000, true, [callback, arg]() { callback(arg); });
+	}
+
+	template<typename TArg>
+	void once_ms(uint32_t milliseconds, void(*callback)(TArg), TArg arg) {
+		schedule((uint64_t)milliseconds * 1000, false, [callback, arg]() { callback(arg); });
+	}
+
+	// microsecond one shot timer (see halTimerInit)
+	template<typename TArg>
+	void once_us(uint32_t microseconds, void(*callback)(TArg), TArg arg) {
+		schedule(microseconds, false, [callback, arg]() { callback(arg); });
+	}
+
+	void detach(void);
+	bool active(void); // a one shot that fired stays active until detach(), as the ESP8266 Ticker
+
+	// used by the virtual clock
+	bool     isArmed(void); // waiting to fire
+	uint64_t getDeadline(void);
+	void     fire(void);
+
+private:
+	std::function<void(void)> m_callback;
+	uint64_t m_period_us;
+	uint64_t m_due_us;      // nominal deadline...
+	uint64_t m_deadline_us; // ...plus the callback jitter
+	bool     m_repeat;
+	bool     m_active;
+	bool     m_isArmed;
+
+	void schedule(uint64_t microseconds, bool repeat, std::function<void(void)> callback);
+};
+
+// servo with the same interface of the Servo library
+class CHalServo
+{
+public:
+	CHalServo();
+	uint8_t attach(int pin);
+	void    detach(void);
+	void    write(int value);
+	void    writeMicroseconds(int value);
+	int     read(void);
+	int     readMicroseconds(void);
+	bool    attached(void);
+
+private:
+	int m_pin;
+	int m_us;
+};
+
+// serial port with the same interface of the SoftwareSerial library.
+// Transmitted bytes are stored in a buffer, received bytes are injected by the simulation.
+class CHalSerial
+{
+public:
+	CHalSerial(int rxPin, int txPin);
+	void   begin(long baud);
+	size_t write(uint8_t data);
+	size_t write(const uint8_t *buffer, size_t size);
+	int    available(void);
+	int    read(void);
+	void   flush(void);
+
+	// simulation side
+	void                  simInject(const uint8_t *buffer, size_t size);
+	std::vector<uint8_t> &simTransmitted(void);
+
+private:
+	long                 m_baud;
+	std::vector<uint8_t> m_rxBuffer;
+	size_t               m_rxPos;
+	std::vector<uint8_t> m_txBuffer;
+};
+
+// file stored in the in-memory file system
+class CHalFile
+{
+public:
+	CHalFile();
+	CHalFile(const char *path, bool write, bool append = false);
+
+	operator bool() const;
+	int    available(void);
+	int    read(void);
+	size_t read(uint8_t *buffer, size_t size);
+	String readStringUntil(char terminator);
+	size_t write(uint8_t data);
+	size_t write(const uint8_t *buffer, size_t size);
+	size_t printf(const char *format, ...);
+	size_t size(void);
+	void   close(void);
+
+private:
+	std::string m_path;
+	std::string m_data;
+	size_t      m_pos;
+	size_t      m_written;
+	bool        m_write;
+	bool        m_open;
+};
+
+// GPIO
+void     halPinMode(uint8_t pin, uint8_t mode);
+void     halDigitalWrite(uint8_t pin, uint8_t value);
+int      halDigitalRead(uint8_t pin);
+inline int halDigitalReadISR(uint8_t pin) {
+	return(halDigitalRead(pin));
+}
+void     halAttachInterrupt(uint8_t pin, void (*isr)(void), int mode);
+void     halDetachInterrupt(uint8_t pin);
+
+// PWM
+void     halAnalogWrite(uint8_t pin, int value);
+void     halAnalogWriteFreq(uint32_t frequency);
+
+// IR carrier. The trains run on the virtual clock, they are not delayed by halSimSetTimerJitter
+uint32_t halCarrierBegin(uint32_t frequency);
+void     halCarrierWrite(uint8_t pin, bool isOn);
+bool     halCarrierTrain(uint8_t pin, const uint32_t *durations_us, uint8_t count);
+bool     halCarrierTrainActive(uint8_t pin);
+
+// ADC
+int      halAnalogRead(uint8_t pin);
+
+// time
+uint32_t halMillis(void);
+uint32_t halMicros(void);
+void     halDelay(uint32_t ms);
+void     halDelayMicroseconds(uint32_t us);
+
+// enable the microsecond timers (CHalTimer::once_us). Nothing to do on the host
+inline void halTimerInit(void) {
+}
+
+// CPU cycle counter. On the host it counts the host clock nanoseconds
+#define HAL_CPU_MHZ  1000
+uint32_t halCycleCount(void);
+
+// random number in [0, max). Pseudo random, every board starts with the same seed (see halSimSetRandomSeed)
+uint32_t halRandom(uint32_t max);
+
+// memory barrier between interrupt (or another thread) and main loop
+inline void halMemoryBarrier(void) {
+	__sync_synchronize();
+}
+
+// file system (LittleFS). halFSBegin fails on a flash formatted by the older firmwares (SPIFFS)
+bool     halFSBegin(void);
+bool     halFSFormat(void);
+bool     halFSExists(const char *path);
+bool     halFSRemove(const char *path);
+CHalFile halFSOpen(const char *path, const char *mode);
+// file system of the older firmwares (SPIFFS), read only: migration to LittleFS
+bool     halFSLegacyBegin(void);
+CHalFile halFSLegacyOpen(const char *path);
+void     halFSLegacyEnd(void);
+
+// WiFi station, associated to the simulated access point (see halSimSetWiFi)
+void     halWiFiBegin(const char *ssid, const char *password, const halWiFiLink_t *link);
+uint8_t  halWiFiStatus(void);
+void     halWiFiGetLink(halWiFiLink_t &link);
+void     halWiFiDisconnect(void);
+
+// RTC memory (offset and size in bytes, multiple of 4). Kept across the resets, see halSimPowerOff
+bool     halRTCRead(uint32_t offset, void *data, size_t size);
+bool     halRTCWrite(uint32_t offset, const void *data, size_t size);
+
+// simulation control -------------------------------------------------------------------------------------------------
+typedef void(*halSimPWMHook_t)(uint8_t pin, int value);
+typedef void(*halSimCarrierHook_t)(uint8_t pin, bool isOn);
+
+// time spent in interrupt context (pin interrupts) and in the timer callbacks
+struct halSimStats_t {
+	uint32_t isrCount;
+	uint64_t isrHost_ns;       // host CPU time
+	uint64_t isrMaxHost_ns;
+	uint64_t isrVirtual_us;    // virtual time (busy waits inside the interrupt)
+	uint64_t isrMaxVirtual_us;
+	uint32_t timerCount;
+	uint64_t timerHost_ns;
+	uint64_t timerMaxHost_ns;
+};
+
+uint64_t halSimTime_us(void);                        // virtual clock, microseconds
+void     halSimAdvance(uint32_t us);                 // move the clock forward firing the timers
+void     halSimSetPin(uint8_t pin, uint8_t value);   // drive an input pin (edge interrupts are fired)
+int      halSimGetPWM(uint8_t pin);                  // last duty cycle written on a pin
+uint32_t halSimGetPWMFreq(void);                     // last PWM frequency set
+bool     halSimGetCarrier(uint8_t pin);              // IR carrier on a pin
+uint32_t halSimGetCarrierFreq(void);                 // IR carrier frequency (0 -> generator not started)
+void     halSimSetADC(uint8_t pin, int value);       // value returned by halAnalogRead
+void     halSimSetPWMHook(halSimPWMHook_t hook);     // called on every halAnalogWrite
+void     halSimSetCarrierHook(halSimCarrierHook_t hook); // called on every halCarrierWrite (e.g. IR loopback)
+void     halSimSetRandomSeed(uint32_t seed);         // sequence of halRandom (seed != 0)
+void     halSimSetTimerJitter(uint32_t max_us);      // the timer callbacks run late, up to max_us (busy loop())
+halSimStats_t halSimGetStats(void);
+void     halSimResetStats(void);
+
+// flash model of the file system (LittleFS): every commit (file closed after writing, file removed)
+// programs the data plus the metadata in the log of the flash blocks, a block is erased when it is full
+#define HAL_SIM_FLASH_BLOCK    4096 // bytes
+#define HAL_SIM_FLASH_METADATA 64   // bytes per commit (tags, CRC, padding)
+
+struct halSimFSStats_t {
+	uint32_t mounts;
+	uint32_t formats;
+	uint32_t commits;
+	uint64_t bytesWritten;     // by the firmware
+	uint64_t bytesProgrammed;  // on the flash
+	uint32_t blocksErased;
+};
+
+void     halSimSetLegacyFS(bool isLegacy);          // the files are on a SPIFFS flash (older firmware)
+halSimFSStats_t halSimGetFSStats(void);
+void     halSimResetFSStats(void);
+
+// access point seen by the station. The connection takes (ESP8266 timings):
+//   begin without link   -> scan of all the channels + association + DHCP
+//   begin with the link  -> association only (no scan, static address)
+// A link of another access point (BSSID or channel) is not found after a scan, a wrong password
+// fails the association. The address given by the DHCP is the one of the access point link
+#define HAL_SIM_WIFI_SCAN_MS      1800 // active scan of the 13 channels
+#define HAL_SIM_WIFI_ASSOCIATE_MS 250  // authentication, association, WPA2 handshake
+#define HAL_SIM_WIFI_DHCP_MS      600
+
+void     halSimSetWiFi(const char *ssid, const char *password, const halWiFiLink_t &link);
+void     halSimSetWiFiUp(bool isUp);                // access point powered and in range (off: the link is lost)
+void     halSimPowerOff(void);                      // the RTC memory is lost (random content)
+
+#endif
@@ -0,0 +1,142 @@
+#pragma once
+#ifndef CWORKSTEALINGPOOL_H
+#define CWORKSTEALINGPOOL_H
+
+// Thread pool with one task queue per worker. A worker takes its own tasks from the back
+// of its queue and, when it runs out of work, steals from the front of the other queues:
+// tasks of different length keep all the cores busy until the end.
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+class CWorkStealingPool
+{
+public:
+	typedef std::function<void(void)> task_t;
+
+	// threads = 0 -> one worker per core
+	CWorkStealingPool(unsigned threads = 0) {
+		if (0 == threads)
+			threads = std::thread::hardware_concurrency();
+		if (0 == threads)
+			threads = 1;
+		m_pending = 0;
+		m_steals  = 0;
+		m_stop    = false;
+		m_next    = 0;
+		for (unsigned i = 0; i < threads; i++)
+			m_queues.push_back(std::unique_ptr<queue_t>(new queue_t));
+		for (unsigned i = 0; i < threads; i++)
+			m_workers.push_back(std::thread(&CWorkStealingPool::worker, this, i));
+	}
+
+	~CWorkStealingPool() {
+		wait();
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_stop = true;
+		}
+		m_wakeUp.notify_all();
+		for (size_t i = 0; i < m_workers.size(); i++)
+			m_workers[i].join();
+	}
+
+	// tasks are spread round robin on the worker queues
+	void submit(task_t task) {
+		queue_t &queue = *m_queues[m_next];
+		m_next = (m_next + 1) % m_queues.size();
+		m_pending++;
+		{
+			std::lock_guard<std::mutex> lock(queue.lock);
+			queue.tasks.push_back(task);
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+		}
+		m_wakeUp.notify_one();
+	}
+
+	// wait for all the submitted tasks
+	void wait(void) {
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_done.wait(lock, [this]() { return(0 == m_pending); });
+	}
+
+	unsigned threads(void) {
+		return(m_workers.size());
+	}
+
+	// tasks executed by a worker different from the one they were queued to
+	uint64_t steals(void) {
+		return(m_steals);
+	}
+
+private:
+	struct queue_t {
+		std::mutex         lock;
+		std::deque<task_t> tasks;
+	};
+
+	std::vector<std::unique_ptr<queue_t> > m_queues;
+	std::vector<std::thread>               m_workers;
+	std::mutex                             m_lock;   // idle workers and wait()
+	std::condition_variable                m_wakeUp;
+	std::condition_variable                m_done;
+	std::atomic<uint32_t>                  m_pending;
+	std::atomic<uint64_t>                  m_steals;
+	bool                                   m_stop;
+	size_t                                 m_next;
+
+	bool popLocal(unsigned index, task_t &task) {
+		queue_t &queue = *m_queues[index];
+		std::lock_guard<std::mutex> lock(queue.lock);
+		if (queue.tasks.empty())
+			return(false);
+		task = queue.tasks.back();
+		queue.tasks.pop_back();
+		return(true);
+	}
+
+	bool steal(unsigned index, task_t &task) {
+		for (size_t i = 1; i < m_queues.size(); i++) {
+			queue_t &queue = *m_queues[(index + i) % m_queues.size()];
+			std::lock_guard<std::mutex> lock(queue.lock);
+			if (!queue.tasks.empty()) {
+				task = queue.tasks.front();
+				queue.tasks.pop_front();
+				m_steals++;
+				return(true);
+			}
+		}
+		return(false);
+	}
+
+	void worker(unsigned index) {
+		task_t task;
+		for (;;) {
+			if (popLocal(index, task) || steal(index, task)) {
+				task();
+				task = NULL;
+				if (0 == --m_pending) {
+					std::lock_guard<std::mutex> lock(m_lock);
+					m_done.notify_all();
+				}
+				continue;
+			}
+			// nothing to do: sleep until a new task is submitted
+			std::unique_lock<std::mutex> lock(m_lock);
+			if (m_stop)
+				return;
+			m_wakeUp.wait_for(lock, std::chrono::milliseconds(10));
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,429 @@
+// Monte-Carlo simulation of the IR channel between the tanks.
+// The real CIR transmitter and decoder (CIR.cpp) run on the Linux backend of the hardware
+// abstraction layer; a channel model between the IR diodes and the TSOP38238 adds edge
+// jitter, lost bursts (weak signal), noise bursts and the overlapping shots of other tanks.
+// With carrier sense the shooters get a receiver too: all the tanks see the same channel
+// (no hidden tanks behind obstacles).
+// Every worker thread simulates its own board, the trials are spread on all the cores by
+// a work stealing thread pool.
+//
+// Build (from this folder):
+//   g++ -std=c++11 -O2 -Wall -pthread -I../BlynkTank ../BlynkTank/*.cpp IRChannelSim.cpp -o IRChannelSim
+//
+// Usage:
+//   ./IRChannelSim [trials per configuration] [threads]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include <queue>
+#include "CIR.h"
+#include "CFEC.h"
+#include "CWorkStealingPool.h"
+
+#define DEFAULT_TRIALS   100000
+#define TRIALS_PER_TASK  500
+
+#define MAX_SHOOTERS     8
+#define RX_PIN           12 // shooters use the GPIOs 0..MAX_SHOOTERS - 1
+#define NOISE_SOURCE     MAX_SHOOTERS
+
+// shooter receivers (carrier sense)
+const uint8_t shooterRxPins[MAX_SHOOTERS] = { 8, 9, 10, 11, 13, 14, 15, 16 };
+
+// TSOP38238: the output follows the carrier with a delay of some carrier cycles. The
+// simulation step must not be longer than the shortest delay (events are never in the past)
+#define TSOP_DELAY_US    120
+#define SIM_STEP_US      100
+#define QUIET_TIME_US    (FRAME_BITS * BIT_TIME_US + 4000) // after the last edge, the decoders are idle
+#define STUCK_TIME_US    1000000 // after the last edge, a transmitter still sending is stuck
+
+#define LATENCY_BIN_US   100
+#define LATENCY_BINS     1000
+
+struct channelConfig_t {
+	const char *name;
+	uint8_t  protocol;    // IR_PROTOCOL_LEGACY or IR_PROTOCOL_PD
+	bool     fec;         // 16 bits FEC coded frames (hit payloads)
+	uint8_t  shooters;    // tanks firing in the same trial
+	uint32_t window_us;   // the shots start in this time window
+	uint32_t jitter_us;   // max random delay of every edge (tx timer + TSOP)
+	uint32_t missPPM;     // lost bursts (weak signal), parts per million
+	uint32_t noiseRate;   // noise bursts per second (sunlight, lamps)
+	uint32_t noiseMax_us; // max noise burst length
+	bool     csma;        // shooters listen before transmitting
+	uint32_t loop_us;     // max delay of the task level timer callbacks (busy loop(), halSimSetTimerJitter)
+};
+
+struct channelStats_t {
+	uint64_t framesSent;
+	uint64_t framesGood;
+	uint64_t falseHits;      // frames accepted with a payload nobody sent
+	uint64_t fecDiscarded;   // FEC uncorrectable frames
+	uint64_t decoderErrors;  // parity + framing + version errors of the receiver
+	uint64_t latencySum_us;  // shot start -> frame available
+	uint64_t latencyMax_us;
+	uint64_t latency[LATENCY_BINS];
+	uint64_t txDeferred;     // carrier sense: shots delayed by a busy channel
+	uint64_t txDropped;      // carrier sense: shots dropped at the deadline
+	uint64_t txStuck;        // transmitters still sending at the end of a trial (the tank cannot fire)
+};
+
+struct channelEvent_t {
+	uint64_t time_us;
+	uint8_t  source;
+	int8_t   delta;  // +1 burst start, -1 burst end
+	bool operator>(const channelEvent_t &other) const {
+		return(time_us > other.time_us);
+	}
+};
+
+// channel of the board simulated by this thread
+struct channel_t {
+	const channelConfig_t *config;
+	uint64_t random;
+	std::priority_queue<channelEvent_t, std::vector<channelEvent_t>, std::greater<channelEvent_t> > events;
+	uint64_t lastEvent_us[MAX_SHOOTERS + 1];
+	bool     isOn[MAX_SHOOTERS];      // carrier of the transmitter on
+	bool     isVisible[MAX_SHOOTERS]; // current burst seen by the receiver
+	int      active;                  // bursts seen by the receiver now
+};
+
+thread_local channel_t *simChannel;
+
+// xorshift64*
+uint32_t channelRandom(channel_t &channel)
+{
+	channel.random ^= channel.random >> 12;
+	channel.random ^= channel.random << 25;
+	channel.random ^= channel.random >> 27;
+	return((channel.random * 2685821657736338717ULL) >> 32);
+}
+
+void addEvent(channel_t &channel, uint8_t source, uint64_t time_us, int8_t delta)
+{
+	// the edges of a source can't swap
+	if (time_us <= channel.lastEvent_us[source])
+		time_us = channel.lastEvent_us[source] + 1;
+	channel.lastEvent_us[source] = time_us;
+	channelEvent_t event = { time_us, source, delta };
+	channel.events.push(event);
+}
+
+// the IR diodes: every carrier edge reaches the receiver output after the TSOP delay plus jitter
+void channelCarrierHook(uint8_t pin, bool isOn)
+{
+	channel_t &channel = *simChannel;
+	if (pin >= MAX_SHOOTERS)
+		return;
+	if (isOn == channel.isOn[pin])
+		return;
+	channel.isOn[pin] = isOn;
+
+	uint64_t time_us = halSimTime_us() + TSOP_DELAY_US;
+	if (channel.config->jitter_us > 0)
+		time_us += channelRandom(channel) % (channel.config->jitter_us + 1);
+	if (isOn) {
+		// weak signal: the whole burst is lost
+		channel.isVisible[pin] = (channelRandom(channel) % 1000000) >= channel.config->missPPM;
+		if (channel.isVisible[pin])
+			addEvent(channel, pin, time_us, +1);
+	}
+	else if (channel.isVisible[pin])
+		addEvent(channel, pin, time_us, -1);
+}
+
+void applyEvents(channel_t &channel, uint64_t now)
+{
+	while (!channel.events.empty() && (channel.events.top().time_us <= now)) {
+		channel.active += channel.events.top().delta;
+		channel.events.pop();
+	}
+	// TSOP output is active low
+	uint8_t level = (channel.active > 0) ? LOW : HIGH;
+	halSimSetPin(RX_PIN, level);
+	if (channel.config->csma) {
+		for (uint8_t i = 0; i < channel.config->shooters; i++)
+			halSimSetPin(shooterRxPins[i], level);
+	}
+}
+
+// one shot from every shooter, all of them aimed to the receiver
+void runTrial(channel_t &channel, CIR *shooters[], CIR &receiver, channelStats_t &stats)
+{
+	const channelConfig_t &config = *channel.config;
+	uint64_t start_us[MAX_SHOOTERS];
+	uint8_t  payload[MAX_SHOOTERS];
+	bool     isSent[MAX_SHOOTERS];
+	bool     isReceived[MAX_SHOOTERS];
+	uint64_t now = halSimTime_us();
+
+	for (uint8_t i = 0; i < config.shooters; i++) {
+		start_us[i]   = now + SIM_STEP_US + channelRandom(channel) % (config.window_us + 1);
+		isSent[i]     = false;
+		isReceived[i] = false;
+		// a different payload for every shooter
+		bool isUnique;
+		do {
+			payload[i] = channelRandom(channel) & 0xFF;
+			isUnique = true;
+			for (uint8_t j = 0; j < i; j++)
+				isUnique = isUnique && (payload[j] != payload[i]);
+		} while (!isUnique);
+	}
+
+	// noise bursts (Poisson arrivals) during the whole trial
+	uint64_t end_us = now + config.window_us + QUIET_TIME_US * 2;
+	if (config.noiseRate > 0) {
+		uint64_t time_us = now;
+		for (;;) {
+			double uniform = (channelRandom(channel) + 1.0) / 4294967297.0;
+			time_us += (uint64_t)(-log(uniform) * 1000000.0 / config.noiseRate);
+			if (time_us >= end_us)
+				break;
+			uint32_t length_us = 20 + channelRandom(channel) % config.noiseMax_us;
+			addEvent(channel, NOISE_SOURCE, time_us, +1);
+			addEvent(channel, NOISE_SOURCE, time_us + length_us, -1);
+		}
+	}
+
+	uint64_t lastActivity_us = now;
+	for (;;) {
+		// next step: a shot, a channel event or at most SIM_STEP_US
+		uint64_t next = now + SIM_STEP_US;
+		for (uint8_t i = 0; i < config.shooters; i++) {
+			if (!isSent[i] && (start_us[i] < next))
+				next = start_us[i];
+		}
+		if (!channel.events.empty() && (channel.events.top().time_us < next))
+			next = channel.events.top().time_us;
+		halSimAdvance(next - now);
+		now = next;
+
+		for (uint8_t i = 0; i < config.shooters; i++) {
+			if (!isSent[i] && (start_us[i] <= now)) {
+				if (config.fec)
+					shooters[i]->sendWord(CFEC::encode(payload[i]));
+				else
+					shooters[i]->sendByte(payload[i]);
+				isSent[i] = true;
+			}
+		}
+		if (!channel.events.empty())
+			lastActivity_us = now;
+		applyEvents(channel, now);
+
+		IRFrame_t frame;
+		// the tanks read their receivers every loop (the shots of the others are not hits here)
+		if (config.csma) {
+			for (uint8_t i = 0; i < config.shooters; i++) {
+				while (shooters[i]->receiveFrame(frame))
+					;
+			}
+		}
+		while (receiver.receiveFrame(frame)) {
+			uint8_t data = frame.data;
+			if (IR_PROTOCOL_PD_WORD == frame.protocol) {
+				if (FEC_UNCORRECTABLE == CFEC::decode(frame.data, data)) {
+					stats.fecDiscarded++;
+					continue;
+				}
+			}
+			bool isHit = false;
+			for (uint8_t i = 0; i < config.shooters; i++) {
+				if (isSent[i] && !isReceived[i] && (payload[i] == data)) {
+					uint64_t latency_us = now - start_us[i];
+					isReceived[i] = true;
+					isHit = true;
+					stats.framesGood++;
+					stats.latencySum_us += latency_us;
+					if (latency_us > stats.latencyMax_us)
+						stats.latencyMax_us = latency_us;
+					uint32_t bin = latency_us / LATENCY_BIN_US;
+					stats.latency[(bin < LATENCY_BINS) ? bin : LATENCY_BINS - 1]++;
+					break;
+				}
+			}
+			if (!isHit)
+				stats.falseHits++;
+		}
+
+		bool isBusy = false;
+		for (uint8_t i = 0; i < config.shooters; i++)
+			isBusy = isBusy || !isSent[i] || shooters[i]->isSendingData();
+		if (!isBusy && channel.events.empty() && ((now - lastActivity_us) > QUIET_TIME_US))
+			break;
+		if (channel.events.empty() && ((now - lastActivity_us) > STUCK_TIME_US)) {
+			for (uint8_t i = 0; i < config.shooters; i++) {
+				if (shooters[i]->isSendingData())
+					stats.txStuck++;
+			}
+			break;
+		}
+	}
+	stats.framesSent += config.shooters;
+}
+
+// a batch of trials on the board of the calling thread
+void runTask(const channelConfig_t *config, uint32_t trials, uint64_t seed, channelStats_t &stats)
+{
+	channel_t channel;
+	channel.config = config;
+	channel.random = seed;
+	channel.active = 0;
+	for (uint8_t i = 0; i < MAX_SHOOTERS; i++) {
+		channel.isOn[i]      = false;
+		channel.isVisible[i] = false;
+	}
+	for (uint8_t i = 0; i <= MAX_SHOOTERS; i++)
+		channel.lastEvent_us[i] = 0;
+	simChannel = &channel;
+	halSimSetCarrierHook(channelCarrierHook);
+	halSimSetTimerJitter(config->loop_us);
+	halSimSetPin(RX_PIN, HIGH);
+	for (uint8_t i = 0; i < MAX_SHOOTERS; i++)
+		halSimSetPin(shooterRxPins[i], HIGH);
+
+	CIR  receiver(RX_PIN, IR_NO_PIN);
+	CIR *shooters[MAX_SHOOTERS];
+	for (uint8_t i = 0; i < config->shooters; i++) {
+		shooters[i] = new CIR(config->csma ? shooterRxPins[i] : IR_NO_PIN, i);
+		shooters[i]->setProtocol(config->protocol);
+		shooters[i]->setCarrierSense(config->csma);
+	}
+
+	for (uint32_t i = 0; i < trials; i++)
+		runTrial(channel, shooters, receiver, stats);
+
+	IRStats_t rxStats = receiver.getStats();
+	stats.decoderErrors += rxStats.parityErrors + rxStats.framingErrors + rxStats.versionErrors;
+	for (uint8_t i = 0; i < config->shooters; i++) {
+		IRStats_t txStats = shooters[i]->getStats();
+		stats.txDeferred += txStats.txDeferred;
+		stats.txDropped  += txStats.txDropped;
+		delete shooters[i];
+	}
+	halSimSetCarrierHook(NULL);
+	simChannel = NULL;
+}
+
+void mergeStats(channelStats_t &total, const channelStats_t &stats)
+{
+	total.framesSent    += stats.framesSent;
+	total.framesGood    += stats.framesGood;
+	total.falseHits     += stats.falseHits;
+	total.fecDiscarded  += stats.fecDiscarded;
+	total.decoderErrors += stats.decoderErrors;
+	total.latencySum_us += stats.latencySum_us;
+	if (stats.latencyMax_us > total.latencyMax_us)
+		total.latencyMax_us = stats.latencyMax_us;
+	for (uint32_t i = 0; i < LATENCY_BINS; i++)
+		total.latency[i] += stats.latency[i];
+	total.txDeferred += stats.txDeferred;
+	total.txDropped  += stats.txDropped;
+	total.txStuck    += stats.txStuck;
+}
+
+uint64_t latencyPercentile(const channelStats_t &stats, double percentile)
+{
+	uint64_t target = (uint64_t)(stats.framesGood * percentile), count = 0;
+	for (uint32_t i = 0; i < LATENCY_BINS; i++) {
+		count += stats.latency[i];
+		if ((count > target) && ((uint64_t)(i + 1) * LATENCY_BIN_US < stats.latencyMax_us))
+			return((uint64_t)(i + 1) * LATENCY_BIN_US);
+		if (count > target)
+			break;
+	}
+	return(stats.latencyMax_us);
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t trials  = DEFAULT_TRIALS;
+	unsigned threads = 0;
+	if (argc > 1)
+		trials = strtoul(argv[1], NULL, 10);
+	if (argc > 2)
+		threads = strtoul(argv[2], NULL, 10);
+
+	// channel scenarios, every one with the three frame formats
+	const channelConfig_t scenarios[] = {
+		//  name              protocol fec shooters window jitter  miss noise noiseMax csma loop
+		{ "clean",            0, false, 1,     0,  20,     0,   0,   0, false,    0 },
+		{ "jitter 80us",      0, false, 1,     0,  80,     0,   0,   0, false,    0 },
+		{ "weak signal",      0, false, 1,     0,  40, 20000,   0,   0, false,    0 },
+		{ "noise 200/s",      0, false, 1,     0,  40,     0, 200, 300, false,    0 },
+		{ "2 tanks 5ms",      0, false, 2,  5000,  40,     0,   0,   0, false,    0 },
+		{ "2 tanks CSMA",     0, false, 2,  5000,  40,     0,   0,   0, true,     0 },
+		{ "8 tanks 20ms",     0, false, 8, 20000,  40,     0,   0,   0, false,    0 },
+		{ "8 tanks CSMA",     0, false, 8, 20000,  40,     0,   0,   0, true,     0 },
+		{ "noise CSMA",       0, false, 1,     0,  40,     0, 200, 300, true,     0 },
+		{ "busy loop 1ms",    0, false, 1,     0,  40,     0,   0,   0, false, 1000 },
+		{ "busy 8 CSMA",      0, false, 8, 20000,  40,     0,   0,   0, true,  1000 },
+	};
+	const struct { const char *name; uint8_t protocol; bool fec; } formats[] = {
+		{ "legacy", IR_PROTOCOL_LEGACY, false },
+		{ "PD",     IR_PROTOCOL_PD,     false },
+		{ "PD FEC", IR_PROTOCOL_PD,     true  },
+	};
+	const size_t scenarioCount = sizeof(scenarios) / sizeof(scenarios[0]);
+	const size_t formatCount   = sizeof(formats) / sizeof(formats[0]);
+
+	std::vector<channelConfig_t> configs;
+	for (size_t s = 0; s < scenarioCount; s++) {
+		for (size_t f = 0; f < formatCount; f++) {
+			channelConfig_t config = scenarios[s];
+			config.protocol = formats[f].protocol;
+			config.fec      = formats[f].fec;
+			configs.push_back(config);
+		}
+	}
+
+	std::vector<channelStats_t> results(configs.size());
+	memset(&results[0], 0, results.size() * sizeof(channelStats_t));
+	std::mutex resultsLock;
+
+	auto start = std::chrono::steady_clock::now();
+	{
+		CWorkStealingPool pool(threads);
+		printf("%u trials per configuration, %u threads\n", trials, pool.threads());
+		for (size_t c = 0; c < configs.size(); c++) {
+			for (uint32_t first = 0; first < trials; first += TRIALS_PER_TASK) {
+				uint32_t count = (trials - first < TRIALS_PER_TASK) ? trials - first : TRIALS_PER_TASK;
+				uint64_t seed  = ((uint64_t)(c + 1) << 32) | (first + 1);
+				const channelConfig_t *config = &configs[c];
+				channelStats_t *total = &results[c];
+				pool.submit([config, count, seed, total, &resultsLock]() {
+					channelStats_t stats;
+					memset(&stats, 0, sizeof(stats));
+					runTask(config, count, seed, stats);
+					std::lock_guard<std::mutex> lock(resultsLock);
+					mergeStats(*total, stats);
+				});
+			}
+		}
+		pool.wait();
+		printf("%llu tasks stolen\n", (unsigned long long)pool.steals());
+	}
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	printf("\n%-14s %-7s %9s %9s %11s %9s %9s %8s %8s %8s %9s %9s\n", "scenario", "format", "frames", "FER %",
+		"false hits", "FEC drop", "dec.err", "lat avg", "lat p99", "lat max", "deferred", "tx drop");
+	uint64_t frames = 0, stuck = 0;
+	for (size_t c = 0; c < configs.size(); c++) {
+		const channelStats_t &stats = results[c];
+		frames += stats.framesSent;
+		stuck  += stats.txStuck;
+		printf("%-14s %-7s %9llu %9.3f %11llu %9llu %9llu %6.1fms %6.1fms %6.1fms %9llu %9llu\n",
+			configs[c].name, formats[c % formatCount].name, (unsigned long long)stats.framesSent,
+			100.0 * (stats.framesSent - stats.framesGood) / stats.framesSent, (unsigned long long)stats.falseHits,
+			(unsigned long long)stats.fecDiscarded, (unsigned long long)stats.decoderErrors,
+			(stats.framesGood > 0) ? stats.latencySum_us / 1000.0 / stats.framesGood : 0.0,
+			latencyPercentile(stats, 0.99) / 1000.0, stats.latencyMax_us / 1000.0,
+			(unsigned long long)stats.txDeferred, (unsigned long long)stats.txDropped);
+	}
+	printf("\n%llu frames in %.1f s (%.0f frames/s), %llu transmitters stuck -> %s\n", (unsigned long long)frames, elapsed,
+		frames / elapsed, (unsigned long long)stuck, (0 == stuck) ? "ok" : "FAILED");
+	return(0);
+}
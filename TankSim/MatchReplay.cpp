@@ -0,0 +1,285 @@
+// Replay of the match records (CMatchRecorder).
+// Every segment is replayed twice:
+//  - game check: the game events go through CGameEngine starting from the segment snapshot,
+//    the state transitions (delta flags) and the checksums must be the recorded ones
+//  - input trace: all the inputs go through a CTank on the Linux backend of the hardware
+//    abstraction layer with the recorded timing, measuring the host time of every call
+//    (performance regression trace)
+// Without a record file a match is played on a simulated tank, recorded and replayed.
+//
+// Build (from this folder):
+//   g++ -std=c++11 -O2 -Wall -I../BlynkTank ../BlynkTank/*.cpp MatchReplay.cpp -o MatchReplay
+//
+// Usage:
+//   ./MatchReplay [-v] [record file]
+// The record file is the output of the 'm' serial command (the other console lines are skipped)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "CTank.h"
+
+#define SELF_TEST_TIME_MS 600000 // 10 minutes match
+#define TRACE_WINDOW_MS   100    // input rate window
+
+typedef std::vector<uint8_t> segment_t;
+
+static const char *recordNames[MATCH_REC_TYPES] = { "snapshot", "game", "check", "joystick", "turret us",
+	"turret deg", "trigger", "hit code", "battery" };
+static const char *gameEventNames[] = { "reset", "fire", "hit", "repair", "ammo", "respawn" };
+
+bool verbose = false;
+
+uint64_t hostTime_ns(void)
+{
+	return(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// serial console dump: "MATCH SEGMENT" starts a segment, "MATCH <hex>" are the data lines
+bool loadDump(const char *fileName, std::vector<segment_t> &segments)
+{
+	FILE *file = fopen(fileName, "r");
+	if (NULL == file)
+		return(false);
+	char line[256];
+	while (fgets(line, sizeof(line), file)) {
+		const char *data = strstr(line, "MATCH ");
+		if (NULL == data)
+			continue;
+		data += 6;
+		if (0 == strncmp(data, "SEGMENT", 7)) {
+			segments.push_back(segment_t());
+			continue;
+		}
+		if (segments.empty() || (0 == strncmp(data, "BEGIN", 5)) || (0 == strncmp(data, "END", 3)))
+			continue;
+		unsigned value;
+		while (1 == sscanf(data, "%2x", &value)) {
+			segments.back().push_back((uint8_t)value);
+			data += 2;
+		}
+	}
+	fclose(file);
+	return(true);
+}
+
+// simulated match: random joystick, turret and fire button, hits from the other tanks, repair when destroyed
+void playSelfTest(std::vector<segment_t> &segments)
+{
+	Serial.enable(false);
+	CTank tank(true);
+	halSimSetRandomSeed(0x5EED);
+	bool isDestroyed = false;
+	for (uint32_t ms = 0; ms < SELF_TEST_TIME_MS; ms++) {
+		halSimAdvance(1000);
+		tank.runTimers();
+		if (0 == ms % 100) {
+			halSimSetADC(A0, 900 - ms / 20000 + halRandom(8));
+			tank.getBatteryVoltage();
+		}
+		if (isDestroyed) {
+			if (0 == halRandom(150) && (0 == tank.getMaxHitpoint() - tank.repairTank())) {
+				tank.canRespawnAmmo(true);
+				isDestroyed = false;
+			}
+			continue;
+		}
+		if (0 == halRandom(50))
+			tank.moveTank((int)halRandom(2047) - 1023, (int)halRandom(2047) - 1023);
+		if (0 == halRandom(200))
+			tank.moveTurret_us(1000 + halRandom(1001));
+		if (0 == halRandom(400))
+			tank.shoot();
+		if (0 == halRandom(1500)) {
+			tank.gotHitByDamage(DEFAULT_AMMO_DAMAGE);
+			if (0 == tank.getHitpoint()) {
+				tank.moveTank(0, 0);
+				tank.canRespawnAmmo(false);
+				isDestroyed = true;
+			}
+		}
+	}
+	CMatchRecorder &recorder = tank.getMatchRecorder();
+	recorder.flush();
+	MatchRecorderStats_t stats = recorder.getStats();
+	for (uint8_t i = 0; i < 2; i++) {
+		CHalFile file = halFSOpen(recorder.getSegmentFile(i), "r");
+		if (!file)
+			continue;
+		segments.push_back(segment_t(file.size()));
+		file.read(segments.back().data(), file.size());
+		file.close();
+	}
+	Serial.enable(true);
+	printf("self test          : %u s match, %u records, %u bytes (%.1f bytes/s), %u segments, flush max %u us (host)\n",
+		SELF_TEST_TIME_MS / 1000, stats.records, stats.bytes, stats.bytes * 1000.0 / SELF_TEST_TIME_MS, stats.segments,
+		stats.flushMax_us);
+}
+
+// game events through the engine: returns the mismatches
+uint32_t checkGame(const segment_t &segment, uint32_t &events, uint32_t &checks)
+{
+	CGameEngine   game;
+	MatchRecord_t record;
+	uint32_t      time_ms = 0, mismatches = 0;
+	size_t        pos = MATCH_HEADER_SIZE;
+	bool          hasSnapshot = false;
+	events = 0;
+	checks = 0;
+	while (CMatchRecorder::decode(segment.data(), segment.size(), pos, time_ms, record)) {
+		switch (record.type) {
+		case MATCH_REC_SNAPSHOT:
+			game.restore(record.rules, record.state);
+			hasSnapshot = true;
+			break;
+		case MATCH_REC_GAME: {
+			if (!hasSnapshot)
+				break;
+			game.advance(record.time_ms);
+			GameDelta_t delta = game.post(record.time_ms, (uint8_t)record.value1, (uint8_t)record.value2);
+			events++;
+			if (delta.changed != record.changed)
+				mismatches++;
+			if (verbose || (delta.changed != record.changed))
+				printf("  %9.3f s  %-8s %3d -> hit points %3u, ammos %2u, changed %02X%s\n", record.time_ms / 1000.0,
+					(record.value1 <= GAME_EVENT_RESPAWN) ? gameEventNames[record.value1] : "?", record.value2,
+					game.getState().hitPoints, game.getState().ammo, delta.changed,
+					(delta.changed != record.changed) ? " MISMATCH" : "");
+			break;
+		}
+		case MATCH_REC_CHECK:
+			checks++;
+			if (game.getChecksum() != record.checksum) {
+				mismatches++;
+				printf("  %9.3f s  checksum MISMATCH\n", record.time_ms / 1000.0);
+			}
+			break;
+		}
+	}
+	if (pos != segment.size())
+		printf("  corrupted record at byte %u\n", (unsigned)pos);
+	return(mismatches);
+}
+
+// all the inputs through a simulated tank with the recorded timing
+void traceInputs(const segment_t &segment)
+{
+	uint64_t hostTotal_ns[MATCH_REC_TYPES] = { 0 }, hostMax_ns[MATCH_REC_TYPES] = { 0 };
+	uint32_t count[MATCH_REC_TYPES] = { 0 };
+	uint32_t windowStart_ms = 0, windowInputs = 0, maxWindowInputs = 0;
+	uint32_t time_ms = 0, simTime_ms = 0;
+	MatchRecord_t record;
+	size_t pos = MATCH_HEADER_SIZE;
+
+	Serial.enable(false);
+	CTank tank(true);
+	tank.getMatchRecorder().enable(false);
+	while (CMatchRecorder::decode(segment.data(), segment.size(), pos, time_ms, record)) {
+		if (MATCH_REC_SNAPSHOT == record.type) {
+			simTime_ms = record.time_ms;
+			continue;
+		}
+		// main loop every millisecond up to the input time
+		while ((int32_t)(record.time_ms - simTime_ms) > 0) {
+			halSimAdvance(1000);
+			tank.runTimers();
+			simTime_ms++;
+		}
+		if (record.time_ms - windowStart_ms >= TRACE_WINDOW_MS) {
+			windowStart_ms = record.time_ms;
+			windowInputs = 0;
+		}
+		if (++windowInputs > maxWindowInputs)
+			maxWindowInputs = windowInputs;
+
+		uint64_t start = hostTime_ns();
+		switch (record.type) {
+		case MATCH_REC_GAME:
+			if (GAME_EVENT_HIT == record.value1)
+				tank.gotHitByDamage((uint8_t)record.value2);
+			else if (GAME_EVENT_REPAIR == record.value1)
+				tank.repairTank();
+			else if (GAME_EVENT_AMMO == record.value1)
+				tank.newAmmos((uint8_t)record.value2);
+			else if (GAME_EVENT_RESPAWN == record.value1)
+				tank.canRespawnAmmo(0 != record.value2);
+			else if (GAME_EVENT_RESET == record.value1)
+				tank.resetGame();
+			break;
+		case MATCH_REC_JOYSTICK:
+			tank.moveTank(record.value1, record.value2);
+			break;
+		case MATCH_REC_TURRET_US:
+			tank.moveTurret_us(record.value1, 0 != record.value2);
+			break;
+		case MATCH_REC_TURRET_DEG:
+			tank.moveTurretDegree(record.value1);
+			break;
+		case MATCH_REC_TRIGGER:
+			tank.shoot();
+			break;
+		case MATCH_REC_HIT_CODE:
+			tank.getHitCode();
+			break;
+		case MATCH_REC_BATTERY:
+			halSimSetADC(A0, (int)(record.value1 * 1024.0 / 4200.0 + 0.5));
+			tank.getBatteryVoltage();
+			break;
+		}
+		uint64_t elapsed = hostTime_ns() - start;
+		hostTotal_ns[record.type] += elapsed;
+		count[record.type]++;
+		if (elapsed > hostMax_ns[record.type])
+			hostMax_ns[record.type] = elapsed;
+	}
+	Serial.enable(true);
+
+	printf("  input trace      : max %u inputs in %u ms\n", maxWindowInputs, TRACE_WINDOW_MS);
+	for (uint8_t type = MATCH_REC_GAME; type < MATCH_REC_TYPES; type++) {
+		if ((0 == count[type]) || (MATCH_REC_CHECK == type))
+			continue;
+		printf("    %-14s : %6u, avg %6.0f ns, max %7llu ns (host)\n", recordNames[type], count[type],
+			(double)hostTotal_ns[type] / count[type], (unsigned long long)hostMax_ns[type]);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<segment_t> segments;
+	const char *fileName = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (0 == strcmp(argv[i], "-v"))
+			verbose = true;
+		else
+			fileName = argv[i];
+	}
+
+	if (NULL == fileName)
+		playSelfTest(segments);
+	else if (!loadDump(fileName, segments)) {
+		printf("Unable to open %s\n", fileName);
+		return(1);
+	}
+
+	uint32_t totalMismatches = 0;
+	for (size_t i = 0; i < segments.size(); i++) {
+		uint32_t sequence;
+		if (!CMatchRecorder::decodeHeader(segments[i].data(), segments[i].size(), sequence)) {
+			printf("segment %u: not a match record\n", (unsigned)i);
+			continue;
+		}
+		uint32_t events, checks;
+		uint64_t start = hostTime_ns();
+		uint32_t mismatches = checkGame(segments[i], events, checks);
+		uint64_t elapsed = hostTime_ns() - start;
+		totalMismatches += mismatches;
+		printf("segment %-10u : %u bytes, %u game events, %u checksums, %u mismatches, replay %.1f ns/event (host)\n",
+			sequence, (unsigned)segments[i].size(), events, checks, mismatches, events ? (double)elapsed / events : 0.0);
+		traceInputs(segments[i]);
+	}
+	printf("replay             : %s\n", (0 == totalMismatches) ? "identical" : "DIFFERENT");
+	return((0 == totalMismatches) ? 0 : 2);
+}
@@ -0,0 +1,1638 @@
+// Host simulation of the BlynkTank firmware.
+// It runs the real CTank/CIR code on the Linux backend of the hardware abstraction layer
+// (virtual clock, simulated pins) and measures the hot paths at full host speed.
+//
+// Build (from this folder):
+//   g++ -std=c++11 -O2 -Wall -I../BlynkTank ../BlynkTank/*.cpp TankSim.cpp -o TankSim
+//
+// Usage:
+//   ./TankSim [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include <new>
+#include <stddef.h>
+#include "CTank.h"
+#include "CTelemetry.h"
+
+// same pins used by CTank.cpp
+#define SIM_IR_TX_PIN D5
+#define SIM_IR_RX_PIN D6
+#define SIM_L_MOTOR_PWM_PIN D1
+#define SIM_R_MOTOR_PWM_PIN D2
+#define SIM_L_MOTOR_DIR_PIN D3
+
+#define MP3_SIM_TX_PIN D8
+#define MP3_SIM_RX_PIN D7
+
+// pins of the extra transceivers (GPIO numbers not used by CTank)
+#define SIM_BARREL1_TX_PIN 1
+#define SIM_BARREL1_RX_PIN 3
+#define SIM_BARREL2_TX_PIN 9
+#define SIM_BARREL2_RX_PIN 10
+
+#define DEFAULT_ITERATIONS 100000
+
+// motor power model: NodeMCU motor shield (L293D, PWM on the enable pin) and N20 6V gear motor
+// fed by the 5V boost converter. Rough datasheet values, good enough to compare PWM frequencies
+#define MOTOR_SUPPLY_V     5.0
+#define MOTOR_R_OHM        12.0    // winding resistance
+#define MOTOR_L_H          0.6e-3  // winding inductance
+#define MOTOR_K            0.0025  // back EMF (V s/rad) and torque (N m/A) constant
+#define MOTOR_J_KGM2       2e-8    // rotor + gearbox + tank, seen from the motor shaft
+#define MOTOR_LOAD_NM      2e-4    // friction and rolling load
+#define MOTOR_GEAR_RATIO   100.0
+#define L293D_VSAT_V       1.4     // source + sink drop...
+#define L293D_RSAT_OHM     1.0     // ...growing with the current
+#define L293D_DIODE_V      1.0     // clamp diodes: enable low -> the current flows back to the supply
+#define L293D_SWITCH_S     300e-9  // output transition time
+#define PWM_ISR_US         2.0     // ESP8266 software PWM: one timer1 interrupt per edge
+#define MOTOR_SIM_STEP_S   0.25e-6
+#define MOTOR_SIM_TIME_S   0.25    // the speed settles in less than 0.2 s
+#define MOTOR_MEASURE_S    0.05
+
+// turret servo model: SG90 class servo at 5V, proportional controller driving a DC motor that
+// moves the turret. Pulse width units: position in us, speed in us/s
+#define SERVO_SUPPLY_V     5.0
+#define SERVO_R_OHM        6.0     // motor winding: 0.83 A stall current
+#define SERVO_SPEED_US_S   7000.0  // no load speed (0.1 s/60 degrees)
+#define SERVO_GAIN_V_US    0.1     // full voltage from 50 us of error
+#define SERVO_DEADBAND_US  4.0
+#define SERVO_TM_S         0.03    // mechanical time constant with the turret
+#define SERVO_SIM_STEP_S   20e-6
+#define SERVO_SIM_TIME_S   1.0
+#define SERVO_SETTLED_US   5.0     // aim tolerance (half a degree)
+
+// carrier of the barrel 1 transmitter (airtime benchmark)
+uint64_t carrierOnSince_us;
+uint64_t carrierFirstOn_us;
+uint64_t carrierLastOff_us;
+uint64_t carrierOnTotal_us;
+
+void trackCarrier(bool isOn)
+{
+	uint64_t now = halSimTime_us();
+	if (isOn) {
+		carrierOnSince_us = now;
+		if (0 == carrierFirstOn_us)
+			carrierFirstOn_us = now;
+	}
+	else if (0 != carrierOnSince_us) {
+		carrierOnTotal_us += now - carrierOnSince_us;
+		carrierLastOff_us  = now;
+		carrierOnSince_us  = 0;
+	}
+}
+
+// the IR diode is pointed to a wall: the receiver sees its own carrier.
+// TSOP38238 output is active low (LOW -> carrier detected)
+void irLoopback(uint8_t pin, bool isOn)
+{
+	if (SIM_IR_TX_PIN == pin)
+		halSimSetPin(SIM_IR_RX_PIN, isOn ? LOW : HIGH);
+	else if (SIM_BARREL1_TX_PIN == pin) {
+		trackCarrier(isOn);
+		halSimSetPin(SIM_BARREL1_RX_PIN, isOn ? LOW : HIGH);
+	}
+	else if (SIM_BARREL2_TX_PIN == pin)
+		halSimSetPin(SIM_BARREL2_RX_PIN, isOn ? LOW : HIGH);
+}
+
+// heap allocations of the whole program (config benchmark)
+uint64_t heapAllocations;
+
+void *operator new(size_t size)
+{
+	heapAllocations++;
+	void *p = malloc(size);
+	if (NULL == p)
+		throw std::bad_alloc();
+	return(p);
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+uint64_t hostTime_ns(void)
+{
+	return(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// one iteration of the main loop, without the Blynk calls
+int simLoop(CTank &tank)
+{
+	int value = tank.runTimers();
+	value += tank.getAmmo();
+	value += tank.getBatteryVoltage();
+	value += tank.getHitCode();
+	return(value);
+}
+
+// virtual time goes on with the main loop running the timers every millisecond
+void simAdvance(CTank &tank, uint32_t us)
+{
+	while (us > 0) {
+		uint32_t step = (us > 1000) ? 1000 : us;
+		halSimAdvance(step);
+		tank.runTimers();
+		us -= step;
+	}
+}
+
+void benchLoop(CTank &tank, uint32_t iterations)
+{
+	volatile int sink = 0;
+	uint64_t start = hostTime_ns();
+	for (uint32_t i = 0; i < iterations; i++)
+		sink += simLoop(tank);
+	uint64_t elapsed = hostTime_ns() - start;
+	printf("loop()             : %8.1f ns/iteration\n", (double)elapsed / iterations);
+}
+
+void benchMoveTank(CTank &tank, uint32_t iterations)
+{
+	uint64_t start = hostTime_ns();
+	for (uint32_t i = 0; i < iterations; i++)
+		tank.moveTank((int)(i % 2047) - 1023, 1023 - (int)(i % 2047));
+	uint64_t elapsed = hostTime_ns() - start;
+	printf("moveTank()         : %8.1f ns/call\n", (double)elapsed / iterations);
+}
+
+// the animations must not block the main loop, and the user must be able to drive during the recoil
+void benchAnimations(CTank &tank)
+{
+	// recoil: back, forward, stop, then the joystick command again. The keyframes last the mixer
+	// ramps: the motor outputs must reach full reverse, full forward and stop, in this order
+	CMotorMixer &mixer = tank.getMotorMixer();
+	int16_t left, right;
+	tank.moveTank(0, 500);
+	simAdvance(tank, 400000);
+	uint64_t start = hostTime_ns();
+	tank.shootAnimation();
+	uint64_t elapsed = hostTime_ns() - start;
+	const int expected[] = { -1023, 1023, 0 };
+	uint8_t reached = 0;
+	for (uint32_t ms = 0; ms < 1500; ms++) {
+		simAdvance(tank, 1000);
+		int duty = halSimGetPWM(SIM_L_MOTOR_PWM_PIN);
+		if (HIGH == halDigitalRead(SIM_L_MOTOR_DIR_PIN)) // reverse
+			duty = -duty;
+		if ((reached < 3) && (expected[reached] == duty))
+			reached++;
+	}
+	mixer.mix(0, 500, left, right);
+	bool isRecoilOk = (3 == reached) && mixer.isSettled() && (left == mixer.getLeftTarget()) &&
+		(mixer.getLeftDuty() == halSimGetPWM(SIM_L_MOTOR_PWM_PIN)) && (LOW == halDigitalRead(SIM_L_MOTOR_DIR_PIN));
+
+	// joystick moved during the recoil: applied at once, never overwritten by the animation
+	tank.shootAnimation();
+	simAdvance(tank, 20000);
+	tank.moveTank(0, 800);
+	mixer.mix(0, 800, left, right);
+	bool isJoystickOk = (left == mixer.getLeftTarget());
+	simAdvance(tank, 400000);
+	isJoystickOk = isJoystickOk && mixer.isSettled() && (mixer.getLeftDuty() == halSimGetPWM(SIM_L_MOTOR_PWM_PIN));
+	tank.moveTank(0, 0);
+
+	// the main loop keeps running during a long turret animation (3 shakes, 1.8 s)
+	volatile int sink = 0;
+	uint32_t loops = 0;
+	tank.shakeTurretAnimation(3);
+	for (uint32_t i = 0; i < 1800; i++) {
+		sink += simLoop(tank);
+		loops++;
+		halSimAdvance(1000);
+	}
+	printf("animations         : shootAnimation() returns in %.0f ns, recoil %s, joystick during recoil %s, %u loop() runs during 3 turret shakes\n",
+		(double)elapsed, isRecoilOk ? "full scale" : "WRONG", isJoystickOk ? "applied at once" : "LOST", loops);
+}
+
+// shoot to the wall and wait for the hit code
+void benchIRLoopback(CTank &tank, uint32_t shots)
+{
+	uint32_t received = 0;
+	uint64_t latency_us = 0, maxLatency_us = 0;
+
+	halSimResetStats();
+	IRStats_t irStartStats = tank.getIRStats();
+	uint64_t start = hostTime_ns();
+	for (uint32_t i = 0; i < shots; i++) {
+		// wait the reload time
+		while (!tank.shoot()) {
+			tank.newAmmos(1);
+			simAdvance(tank, 1000);
+		}
+		uint64_t shotTime_us = halSimTime_us();
+		int hitCode = -1;
+		for (int t = 0; (t < 500) && (hitCode < 0); t++) {
+			halSimAdvance(100);
+			hitCode = tank.getHitCode();
+		}
+		if (hitCode >= 0) {
+			uint64_t frameLatency_us = halSimTime_us() - shotTime_us;
+			received++;
+			latency_us += frameLatency_us;
+			if (frameLatency_us > maxLatency_us)
+				maxLatency_us = frameLatency_us;
+		}
+	}
+	uint64_t elapsed = hostTime_ns() - start;
+	halSimStats_t stats = halSimGetStats();
+	IRStats_t irStats = tank.getIRStats();
+	uint32_t frames = irStats.framesReceived - irStartStats.framesReceived;
+
+	printf("IR loopback        : %u/%u frames received, %8.1f ns/frame (host)\n", received, shots, (double)elapsed / shots);
+	if (received > 0)
+		printf("  frame latency    : avg %llu us, max %llu us (virtual)\n",
+			(unsigned long long)(latency_us / received), (unsigned long long)maxLatency_us);
+	if (stats.isrCount > 0)
+		printf("  pin interrupts   : %u, avg %llu us, max %llu us (virtual), avg %llu ns (host)\n", stats.isrCount,
+			(unsigned long long)(stats.isrVirtual_us / stats.isrCount), (unsigned long long)stats.isrMaxVirtual_us,
+			(unsigned long long)(stats.isrHost_ns / stats.isrCount));
+	if (frames > 0)
+		printf("  IR receiver      : %u interrupts, %llu ns/frame, max %u ns/interrupt, %u parity, %u framing, %u overflow errors\n",
+			irStats.isrCount - irStartStats.isrCount,
+			(unsigned long long)((irStats.frameISRCycles - irStartStats.frameISRCycles) * 1000 / HAL_CPU_MHZ / frames),
+			(unsigned)(irStats.isrMaxCycles * 1000 / HAL_CPU_MHZ), irStats.parityErrors, irStats.framingErrors, irStats.edgeOverflows);
+	if (stats.timerCount > 0)
+		printf("  timer callbacks  : %u, avg %llu ns, max %llu ns (host)\n", stats.timerCount,
+			(unsigned long long)(stats.timerHost_ns / stats.timerCount), (unsigned long long)stats.timerMaxHost_ns);
+}
+
+// another tank shoots us: drive the receiver pin with a frame (same framing of CIR::sendByte)
+void simReceiveFrame(uint8_t data)
+{
+	uint8_t parity = 0;
+	for (uint8_t i = 0; i < 8; i++)
+		parity += (data >> i) & 0x01;
+	uint16_t frame = 1 + (data << 1) + ((parity % 2) << 9) + 0x0400;
+	for (uint8_t i = 0; i < 12; i++) {
+		halSimSetPin(SIM_IR_RX_PIN, (frame & 0x01) ? LOW : HIGH);
+		halSimAdvance(BIT_TIME_US);
+		frame = frame >> 1;
+	}
+}
+
+// several hits received while the main loop is busy (e.g. Blynk.run), then drained in one loop
+void benchHitBurst(CTank &tank, uint8_t hits)
+{
+	IRStats_t startStats = tank.getIRStats();
+	for (uint8_t i = 0; i < hits; i++)
+		simReceiveFrame(i);
+	halSimAdvance(BIT_TIME_US);
+
+	uint8_t drained = 0;
+	while (tank.getHitCode() != -1)
+		drained++;
+	IRStats_t stats = tank.getIRStats();
+	printf("hit burst          : %u sent, %u drained in one loop, %u frame overflows, %u edge overflows\n", hits, drained,
+		stats.frameOverflows - startStats.frameOverflows, stats.edgeOverflows - startStats.edgeOverflows);
+}
+
+// two more transceivers working at the same time: every one must receive only its own frames
+void benchMultipleTransceivers(uint32_t shots)
+{
+	CIR barrel1(SIM_BARREL1_RX_PIN, SIM_BARREL1_TX_PIN);
+	CIR barrel2(SIM_BARREL2_RX_PIN, SIM_BARREL2_TX_PIN);
+	CIR *barrels[] = { &barrel1, &barrel2 };
+	uint32_t good = 0;
+
+	for (uint32_t i = 0; i < shots; i++) {
+		uint8_t data = i & 0xFF;
+		if (i % 2) {
+			CIR::sendByteAll(barrels, 2, data);
+		}
+		else {
+			barrel1.sendByte(data);
+			barrel2.sendByte(~data);
+		}
+		halSimAdvance(15 * BIT_TIME_US);
+		int16_t data1 = barrel1.receiveByte();
+		int16_t data2 = barrel2.receiveByte();
+		if ((data1 == data) && (data2 == (uint8_t)((i % 2) ? data : ~data)))
+			good++;
+	}
+	printf("2 transceivers     : %u/%u shots received by both\n", good, shots);
+}
+
+// airtime of a shot and back to back throughput of the IR protocols, all the 256 codes.
+// fec -> 16 bits FEC coded frames (hit payloads)
+void benchIRProtocol(uint8_t protocol, bool fec, const char *name)
+{
+	CIR barrel(SIM_BARREL1_RX_PIN, SIM_BARREL1_TX_PIN);
+	uint64_t frameTotal_us = 0, frameMin_us = UINT64_MAX, frameMax_us = 0, carrierTotal_us = 0;
+	uint32_t good = 0;
+
+	barrel.setProtocol(protocol);
+	uint64_t start_us = halSimTime_us();
+	for (uint16_t data = 0; data < 256; data++) {
+		carrierFirstOn_us = 0;
+		carrierOnTotal_us = 0;
+		if (fec)
+			barrel.sendWord(CFEC::encode(data));
+		else
+			barrel.sendByte(data);
+		// next frame as soon as the transmitter is free
+		while (barrel.isSendingData())
+			halSimAdvance(10);
+		uint64_t frame_us = carrierLastOff_us - carrierFirstOn_us;
+		frameTotal_us   += frame_us;
+		carrierTotal_us += carrierOnTotal_us;
+		if (frame_us < frameMin_us)
+			frameMin_us = frame_us;
+		if (frame_us > frameMax_us)
+			frameMax_us = frame_us;
+		IRFrame_t frame;
+		if (barrel.receiveFrame(frame)) {
+			uint8_t payload = frame.data;
+			if (fec)
+				CFEC::decode(frame.data, payload);
+			if (payload == data)
+				good++;
+		}
+	}
+	uint64_t elapsed_us = halSimTime_us() - start_us;
+	IRStats_t stats = barrel.getStats();
+
+	printf("%-19s: frame avg %5llu us (min %5llu, max %5llu), carrier on %5llu us/frame, %5.1f frames/s, %u/256 received, %u errors\n",
+		name, (unsigned long long)(frameTotal_us / 256), (unsigned long long)frameMin_us, (unsigned long long)frameMax_us,
+		(unsigned long long)(carrierTotal_us / 256), 256 * 1000000.0 / elapsed_us, good,
+		stats.parityErrors + stats.framingErrors + stats.versionErrors);
+}
+
+struct motorPower_t {
+	double rpm;          // output shaft
+	double supply_mW;    // from the boost converter
+	double mechanical_mW;
+	double driver_mW;    // L293D conduction and clamp diodes
+	double switching_mW; // L293D transitions
+	double copper_mW;    // winding (ripple included)
+};
+
+// one motor driven at a duty cycle until the speed settles, then the power flows are averaged.
+// Enable low -> fast decay: the current flows back to the supply through the clamp diodes
+motorPower_t simMotorPower(uint32_t frequency, double duty)
+{
+	const double period = 1.0 / frequency;
+	const uint32_t steps = (uint32_t)(MOTOR_SIM_TIME_S / MOTOR_SIM_STEP_S);
+	// measure a whole number of periods at the end of the simulation
+	const double measureStart = MOTOR_SIM_TIME_S - floor(MOTOR_MEASURE_S / period) * period;
+	double current = 0, speed = 0, supply = 0, mechanical = 0, driver = 0, switching = 0, copper = 0, rotation = 0;
+	double measured = 0;
+	bool wasOn = false;
+
+	for (uint32_t i = 0; i < steps; i++) {
+		double t = i * MOTOR_SIM_STEP_S;
+		bool isOn = fmod(t, period) < duty * period;
+		double emf = MOTOR_K * speed;
+		double voltage, supplyCurrent, driverLoss;
+		if (isOn) {
+			double drop = L293D_VSAT_V + L293D_RSAT_OHM * current;
+			voltage = MOTOR_SUPPLY_V - drop;
+			supplyCurrent = current;
+			driverLoss = drop * current;
+		}
+		else if (current > 0) {
+			voltage = -(MOTOR_SUPPLY_V + 2 * L293D_DIODE_V);
+			supplyCurrent = -current;
+			driverLoss = 2 * L293D_DIODE_V * current;
+		}
+		else {
+			voltage = emf; // outputs off, no current
+			supplyCurrent = 0;
+			driverLoss = 0;
+		}
+		double switchLoss = 0;
+		if (isOn != wasOn)
+			switchLoss = 0.5 * MOTOR_SUPPLY_V * current * L293D_SWITCH_S / MOTOR_SIM_STEP_S;
+		wasOn = isOn;
+
+		current += (voltage - emf - MOTOR_R_OHM * current) / MOTOR_L_H * MOTOR_SIM_STEP_S;
+		if (current < 0)
+			current = 0;
+		double torque = MOTOR_K * current;
+		if ((speed > 0) || (torque > MOTOR_LOAD_NM)) {
+			speed += (torque - MOTOR_LOAD_NM) / MOTOR_J_KGM2 * MOTOR_SIM_STEP_S;
+			if (speed < 0)
+				speed = 0;
+		}
+
+		if (t >= measureStart) {
+			supply     += MOTOR_SUPPLY_V * supplyCurrent;
+			mechanical += MOTOR_LOAD_NM * speed;
+			driver     += driverLoss;
+			switching  += switchLoss;
+			copper     += MOTOR_R_OHM * current * current;
+			rotation   += speed;
+			measured++;
+		}
+	}
+	motorPower_t power;
+	power.rpm           = rotation / measured * 60.0 / (2 * M_PI) / MOTOR_GEAR_RATIO;
+	power.supply_mW     = supply / measured * 1000.0;
+	power.mechanical_mW = mechanical / measured * 1000.0;
+	power.driver_mW     = driver / measured * 1000.0;
+	power.switching_mW  = switching / measured * 1000.0;
+	power.copper_mW     = copper / measured * 1000.0;
+	return(power);
+}
+
+// motor PWM at the old frequency (the IR carrier one, analogWriteFreq is global) and at the
+// frequency set by CTank, now that the carrier has its own generator
+void benchMotorPower(void)
+{
+	uint32_t motorFrequency = halSimGetPWMFreq();
+	printf("motor PWM          : %u Hz (IR carrier %u Hz on its own generator)\n", motorFrequency, halSimGetCarrierFreq());
+	const uint32_t frequencies[] = { CARRIER_FREQUENCY, motorFrequency };
+	const char    *names[]       = { "old", "now" };
+	const double   duties[]      = { 0.4, 0.7, 0.9 };
+	for (uint8_t f = 0; f < 2; f++) {
+		for (uint8_t d = 0; d < sizeof(duties) / sizeof(duties[0]); d++) {
+			motorPower_t power = simMotorPower(frequencies[f], duties[d]);
+			// two motors, different duty cycles: start of the period + two ends
+			double cpuLoad = 3.0 * frequencies[f] * PWM_ISR_US / 10000.0;
+			printf("  %s %5u Hz %2.0f%% : %5.1f rpm, supply %6.1f mW, mechanical %5.1f mW (%4.1f%%), driver %5.1f mW, switching %4.1f mW, copper %5.1f mW, PWM interrupts %4.1f%% CPU\n",
+				names[f], frequencies[f], duties[d] * 100, power.rpm, power.supply_mW, power.mechanical_mW,
+				(power.supply_mW > 0) ? 100.0 * power.mechanical_mW / power.supply_mW : 0.0,
+				power.driver_mW, power.switching_mW, power.copper_mW, cpuLoad);
+		}
+	}
+}
+
+struct servoMove_t {
+	double peak_mA;
+	double charge_mAs;  // drawn from the battery
+	double overshoot_us;
+	double settling_ms; // from the command to the target (inside SERVO_SETTLED_US)
+};
+
+// the servo reads the pulse width every 20 ms (servo frame = planner step)
+servoMove_t simServoMove(uint8_t profileType, uint16_t from_us, uint16_t to_us)
+{
+	TurretProfile_t profile;
+	CTurretPlanner planner;
+	CTurretPlanner::defaultProfile(profile);
+	profile.type = profileType;
+	planner.configure(profile);
+	planner.reset(from_us);
+	planner.setTarget(to_us);
+	const double ke = SERVO_SUPPLY_V / SERVO_SPEED_US_S;
+	const uint32_t frameSteps = (uint32_t)(TURRET_STEP_MS * 1e-3 / SERVO_SIM_STEP_S);
+	double position = from_us, speed = 0, command = from_us;
+	servoMove_t result = { 0, 0, 0, 0 };
+	for (uint32_t i = 0; i < (uint32_t)(SERVO_SIM_TIME_S / SERVO_SIM_STEP_S); i++) {
+		if (0 == i % frameSteps) {
+			planner.step();
+			command = planner.getPosition_us();
+		}
+		double error = command - position;
+		double voltage = (fabs(error) <= SERVO_DEADBAND_US) ? 0 : fmax(-SERVO_SUPPLY_V, fmin(SERVO_SUPPLY_V, SERVO_GAIN_V_US * error));
+		double current = (voltage - ke * speed) / SERVO_R_OHM;
+		speed += current * SERVO_R_OHM / (ke * SERVO_TM_S) * SERVO_SIM_STEP_S;
+		position += speed * SERVO_SIM_STEP_S;
+		result.peak_mA = fmax(result.peak_mA, fabs(current) * 1000);
+		result.charge_mAs += fabs(current) * 1000 * SERVO_SIM_STEP_S;
+		double away = (to_us > from_us) ? position - to_us : to_us - position;
+		result.overshoot_us = fmax(result.overshoot_us, away);
+		if (fabs(position - to_us) > SERVO_SETTLED_US)
+			result.settling_ms = (i + 1) * SERVO_SIM_STEP_S * 1000;
+	}
+	return(result);
+}
+
+// slider jumps: peak current, overshoot and settling time of the servo with every profile.
+// The tank must report the turret position while it moves
+void benchTurret(CTank &tank)
+{
+	const char *names[] = { "jump", "trapezoid", "S-curve" };
+	const uint16_t moves[][2] = { { 1000, 2000 }, { 1400, 1600 } };
+	for (uint8_t m = 0; m < 2; m++) {
+		for (uint8_t type = TURRET_PROFILE_NONE; type <= TURRET_PROFILE_SCURVE; type++) {
+			servoMove_t move = simServoMove(type, moves[m][0], moves[m][1]);
+			printf("%s %4u us %-9s: peak %4.0f mA, charge %5.1f mAs, overshoot %5.1f us, settled in %4.0f ms\n",
+				(0 == type) ? "turret move        :" : "                    ", moves[m][1] - moves[m][0], names[type],
+				move.peak_mA, move.charge_mAs, move.overshoot_us, move.settling_ms);
+		}
+	}
+
+	// the turret position goes from the center to the slider end, and stops there
+	tank.moveTurret_us(tank.getServoCenter(), true);
+	simAdvance(tank, 1000000);
+	tank.moveTurret_us(tank.getServoMin_us());
+	uint16_t target = tank.getTurretPlanner().getTarget_us();
+	uint32_t updates = 0, elapsed_ms = 0;
+	uint16_t last = tank.getTurretPosition_us();
+	while ((tank.getTurretPosition_us() != target) && (elapsed_ms < 2000)) {
+		simAdvance(tank, 1000);
+		elapsed_ms++;
+		if (tank.getTurretPosition_us() != last)
+			updates++;
+		last = tank.getTurretPosition_us();
+	}
+	printf("  tank             : center to slider end (%u us) in %u ms, %u servo updates, position %s\n",
+		abs(target - tank.getServoCenter()), elapsed_ms, updates,
+		((target == tank.getTurretPosition_us()) && tank.getTurretPlanner().isSettled()) ? "reached" : "WRONG");
+}
+
+// deterministic pseudo random numbers (xorshift32)
+uint32_t simRandom(void)
+{
+	static uint32_t state = 0x12345678;
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return(state);
+}
+
+// FEC codec of the hit payloads: decode speed, exhaustive error patterns and residual error rate
+void benchFEC(uint32_t iterations)
+{
+	volatile uint8_t sink = 0;
+	uint8_t data;
+	uint64_t start = hostTime_ns();
+	for (uint32_t i = 0; i < iterations; i++)
+		sink += CFEC::decode(i & 0xFFFF, data) + data;
+	uint64_t elapsed = hostTime_ns() - start;
+	printf("CFEC::decode()     : %8.1f ns/call\n", (double)elapsed / iterations);
+
+	// every single bit error and every wrong pulse distance symbol must be corrected
+	uint32_t bitCorrected = 0, symbolCorrected = 0;
+	for (uint16_t payload = 0; payload < 256; payload++) {
+		uint16_t codeword = CFEC::encode(payload);
+		for (uint8_t bit = 0; bit < 16; bit++) {
+			if ((FEC_CORRECTED == CFEC::decode(codeword ^ (1 << bit), data)) && (data == payload))
+				bitCorrected++;
+		}
+		for (uint8_t symbol = 0; symbol < 8; symbol++) {
+			for (uint16_t error = 1; error < 4; error++) {
+				if ((FEC_CORRECTED == CFEC::decode(codeword ^ (error << (symbol * 2)), data)) && (data == payload))
+					symbolCorrected++;
+			}
+		}
+	}
+	printf("  single errors    : %u/%u bits, %u/%u symbols corrected\n", bitCorrected, 256 * 16, symbolCorrected, 256 * 8 * 3);
+
+	// random bit errors: FEC coded 16 bits vs 8 bits + even parity (legacy frame)
+	const uint32_t frames = 100000;
+	const uint32_t bitErrorRates[] = { 1000, 10000, 50000 }; // parts per million
+	for (uint8_t r = 0; r < 3; r++) {
+		uint32_t fecGood = 0, fecDiscarded = 0, fecWrong = 0;
+		uint32_t parityGood = 0, parityDiscarded = 0, parityWrong = 0;
+		for (uint32_t i = 0; i < frames; i++) {
+			uint8_t  payload  = simRandom() & 0xFF;
+			uint16_t codeword = CFEC::encode(payload);
+			for (uint8_t bit = 0; bit < 16; bit++) {
+				if ((simRandom() % 1000000) < bitErrorRates[r])
+					codeword ^= 1 << bit;
+			}
+			if (FEC_UNCORRECTABLE == CFEC::decode(codeword, data))
+				fecDiscarded++;
+			else if (data == payload)
+				fecGood++;
+			else
+				fecWrong++;
+
+			uint8_t parity = 0;
+			for (uint8_t bit = 0; bit < 8; bit++)
+				parity += (payload >> bit) & 0x01;
+			uint16_t frame = payload | ((parity & 0x01) << 8);
+			for (uint8_t bit = 0; bit < 9; bit++) {
+				if ((simRandom() % 1000000) < bitErrorRates[r])
+					frame ^= 1 << bit;
+			}
+			parity = 0;
+			for (uint8_t bit = 0; bit < 9; bit++)
+				parity += (frame >> bit) & 0x01;
+			if (parity & 0x01)
+				parityDiscarded++;
+			else if ((frame & 0xFF) == payload)
+				parityGood++;
+			else
+				parityWrong++;
+		}
+		printf("  BER %5.3f%%      : FEC %6u good, %5u discarded, %4u wrong | parity %6u good, %5u discarded, %4u wrong\n",
+			bitErrorRates[r] / 10000.0, fecGood, fecDiscarded, fecWrong, parityGood, parityDiscarded, parityWrong);
+	}
+}
+
+// timer wheel: start/stop cost with many timers and dispatch lateness of periodic and one shot timers
+struct wheelBenchTimer_t {
+	CWheelTimer timer;
+	uint32_t    fired;
+};
+
+void wheelBenchCallback(wheelBenchTimer_t *timer)
+{
+	timer->fired++;
+}
+
+void benchTimerWheel(uint32_t iterations)
+{
+	const uint32_t timerCount = 1000;
+	CTimerWheel wheel;
+	wheelBenchTimer_t *timers = new wheelBenchTimer_t[timerCount];
+
+	// start and stop with random delays (all the levels)
+	uint64_t start = hostTime_ns();
+	for (uint32_t i = 0; i < iterations; i++) {
+		wheelBenchTimer_t &t = timers[i % timerCount];
+		wheel.once_ms(t.timer, halRandom(100000), wheelBenchCallback, &t);
+	}
+	uint64_t startElapsed = hostTime_ns() - start;
+	start = hostTime_ns();
+	for (uint32_t i = 0; i < timerCount; i++)
+		wheel.detach(timers[i].timer);
+	uint64_t stopElapsed = hostTime_ns() - start;
+
+	// mixed load: a third periodic (10..1000 ms), the others one shot (up to 60 s), run every ms for 70 s
+	uint32_t expected = 0;
+	for (uint32_t i = 0; i < timerCount; i++) {
+		timers[i].fired = 0;
+		if (0 == i % 3)
+			wheel.attach_ms(timers[i].timer, 10 + halRandom(991), wheelBenchCallback, &timers[i]);
+		else {
+			wheel.once_ms(timers[i].timer, halRandom(60000), wheelBenchCallback, &timers[i]);
+			expected++;
+		}
+	}
+	wheel.resetStats();
+	start = hostTime_ns();
+	for (uint32_t ms = 0; ms < 70000; ms++) {
+		halSimAdvance(1000);
+		wheel.run();
+	}
+	uint64_t runElapsed = hostTime_ns() - start;
+	uint32_t fired = 0;
+	for (uint32_t i = 0; i < timerCount; i++) {
+		if (0 != i % 3)
+			fired += timers[i].fired;
+	}
+	TimerWheelStats_t stats = wheel.getStats();
+	printf("timer wheel        : start %5.1f ns, stop %5.1f ns, run %5.1f ns/ms (host, %u timers)\n", (double)startElapsed / iterations,
+		(double)stopElapsed / timerCount, (double)runElapsed / 70000, timerCount);
+	printf("  deadlines        : %u dispatched, %u cascaded, one shot %u/%u, late max %u ms, pending %u\n", stats.dispatched,
+		stats.cascaded, fired, expected, stats.lateMax_ms, wheel.getPending());
+
+	// main loop stalled for 2 s (e.g. Blynk reconnection): the periodic timers skip the missed periods
+	wheel.resetStats();
+	halSimAdvance(2000000);
+	uint32_t count = wheel.run();
+	stats = wheel.getStats();
+	printf("  2 s stall        : %u callbacks, late max %u ms\n", count, stats.lateMax_ms);
+
+	for (uint32_t i = 0; i < timerCount; i++)
+		wheel.detach(timers[i].timer);
+	delete[] timers;
+}
+
+// game engine: random matches between two tanks (fire attempts every 50..500 ms, 40% of the shots
+// hit), stepped by events only. The same seed must give the same matches
+uint32_t matchRandom(uint32_t &seed)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return(seed);
+}
+
+uint32_t simMatches(uint32_t matches, uint32_t seed, uint32_t &events, uint32_t &wrongHits, uint64_t &duration_ms)
+{
+	uint32_t checksum = 0;
+	uint8_t  hitsToDestroy = (DEFAULT_MAX_HITPOINT + DEFAULT_AMMO_DAMAGE - 1) / DEFAULT_AMMO_DAMAGE;
+	events = 0;
+	wrongHits = 0;
+	duration_ms = 0;
+	for (uint32_t m = 0; m < matches; m++) {
+		CGameEngine tanks[2];
+		uint32_t nextFire_ms[2] = { 50 + matchRandom(seed) % 451, 50 + matchRandom(seed) % 451 };
+		uint8_t  hits[2] = { 0, 0 };
+		uint32_t now_ms = 0;
+		while ((tanks[0].getState().hitPoints > 0) && (tanks[1].getState().hitPoints > 0)) {
+			uint8_t shooter = (nextFire_ms[0] <= nextFire_ms[1]) ? 0 : 1;
+			now_ms = nextFire_ms[shooter];
+			nextFire_ms[shooter] = now_ms + 50 + matchRandom(seed) % 451;
+			GameDelta_t delta = tanks[shooter].post(now_ms, GAME_EVENT_FIRE);
+			events++;
+			if ((delta.changed & GAME_CHANGED_FIRED) && (matchRandom(seed) % 100 < 40)) {
+				tanks[1 - shooter].post(now_ms, GAME_EVENT_HIT, tanks[shooter].getRules().ammoDamage);
+				hits[1 - shooter]++;
+				events++;
+			}
+		}
+		uint8_t loser = (0 == tanks[0].getState().hitPoints) ? 0 : 1;
+		if (hits[loser] != hitsToDestroy)
+			wrongHits++;
+		tanks[1 - loser].advance(now_ms);
+		checksum = checksum * 31 + tanks[0].getChecksum() + tanks[1].getChecksum();
+		duration_ms += now_ms;
+	}
+	return(checksum);
+}
+
+void benchGameEngine(uint32_t matches)
+{
+	uint32_t events, wrongHits;
+	uint64_t duration_ms;
+	uint64_t start = hostTime_ns();
+	uint32_t checksum = simMatches(matches, 0x1234567, events, wrongHits, duration_ms);
+	uint64_t elapsed = hostTime_ns() - start;
+	uint32_t replayEvents, replayWrongHits;
+	uint64_t replayDuration_ms;
+	bool isDeterministic = (checksum == simMatches(matches, 0x1234567, replayEvents, replayWrongHits, replayDuration_ms));
+	printf("game engine        : %u matches, %.0f matches/s, %.1f ns/event (host), avg match %.1f s, %u wrong kill counts, replay %s\n",
+		matches, matches * 1e9 / elapsed, (double)elapsed / events, duration_ms / 1000.0 / matches, wrongHits,
+		isDeterministic ? "identical" : "DIFFERENT");
+}
+
+// Blynk telemetry: one minute of play with the sketch update pattern (voltage sampled every 100 ms
+// with ADC noise, ammos at every shot and spawn, hit points at every hit), compared with one
+// message per update (old sketch: voltage value and color every 100 ms)
+uint32_t telemetryMessages;
+
+void countTelemetryValue(uint8_t pin, int32_t value)
+{
+	telemetryMessages++;
+}
+
+void countTelemetryProperty(uint8_t pin, const char *property, const char *value)
+{
+	telemetryMessages++;
+}
+
+void benchTelemetry(void)
+{
+	CTelemetry telemetry(countTelemetryValue, countTelemetryProperty);
+	int8_t voltage = telemetry.addValue(0, 1000, 20);
+	int8_t voltageColor = telemetry.addProperty(0, "color");
+	int8_t hitPoints = telemetry.addValue(7);
+	int8_t ammos = telemetry.addValue(8, 200);
+	uint32_t updates = 0, oldMessages = 0;
+	uint8_t ammo = 20, damage = 0;
+
+	telemetryMessages = 0;
+	telemetry.resetStats();
+	for (uint32_t ms = 1; ms <= 60000; ms++) {
+		halSimAdvance(1000);
+		if (0 == ms % 100) {
+			telemetry.set(voltage, 3900 - ms / 1000 + (int)halRandom(17) - 8);
+			telemetry.set(voltageColor, "#23C48E");
+			updates += 2;
+			oldMessages += 2;
+		}
+		// bursts of shots, one ammo every 7 s
+		if ((0 == ms % 300) && (ms % 10000 < 3000) && (ammo > 0)) {
+			telemetry.set(ammos, --ammo);
+			updates++;
+			oldMessages += 2; // fire button and loop() both wrote it
+		}
+		if ((0 == ms % 7000) && (ammo < 20)) {
+			telemetry.set(ammos, ++ammo);
+			updates++;
+			oldMessages++;
+		}
+		if (0 == ms % 4000) {
+			telemetry.set(hitPoints, damage += 40);
+			if (damage >= 200)
+				damage = 0;
+			updates++;
+			oldMessages++;
+		}
+		if (0 == ms % TELEMETRY_FLUSH_PERIOD)
+			telemetry.flush();
+	}
+	TelemetryStats_t stats = telemetry.getStats();
+	printf("telemetry          : %.1f messages/s (was %.1f), %u updates, %.1f/s suppressed (%u unchanged, %u coalesced)\n",
+		telemetryMessages / 60.0, oldMessages / 60.0, updates, (stats.unchanged + stats.coalesced) / 60.0, stats.unchanged,
+		stats.coalesced);
+}
+
+// mixing math regression: outputs of the default pipeline (deadband 300, expo 128, min duty 300,
+// slew 70, jerk 20) recorded when it was written
+static const int16_t goldenMix[][4] = {
+	// joystick x, y -> left, right targets
+	{     0,     0,     0,     0 },
+	{   300,     0,     0,     0 },
+	{   301,     0,     0,     0 },
+	{     0,   400,    71,    71 },
+	{     0,  -400,   -71,   -71 },
+	{     0,   700,   369,   369 },
+	{     0,  1023,  1023,  1023 },
+	{  1023,     0, -1023,  1023 },
+	{ -1023,     0,  1023, -1023 },
+	{   500,   500,     0,   304 },
+	{  -800,   300,   523,  -523 },
+	{  1023,  1023,     0,  1023 },
+	{   200,  -900,  -716,  -716 },
+	{  -512,  -512,     0,  -324 },
+};
+// full forward to full reverse, duty of the first steps (stopped for one step before the reversal)
+static const int16_t goldenReversal[] = { 1008, 980, 938, 888, 839, 789, 740, 690, 641, 591, 542, 492, 443, 393, 344, 0, -349 };
+
+void benchMotorMixer(uint32_t iterations)
+{
+	CMotorMixer mixer;
+	int16_t left, right;
+	uint32_t wrong = 0;
+	for (uint8_t i = 0; i < sizeof(goldenMix) / sizeof(goldenMix[0]); i++) {
+		mixer.mix(goldenMix[i][0], goldenMix[i][1], left, right);
+		if ((left != goldenMix[i][2]) || (right != goldenMix[i][3])) {
+			printf("  mix(%d, %d) = %d, %d instead of %d, %d\n", goldenMix[i][0], goldenMix[i][1], left, right, goldenMix[i][2], goldenMix[i][3]);
+			wrong++;
+		}
+	}
+
+	// reversal: duty steps and time to full reverse
+	mixer.setTarget(0, 1023);
+	while (!mixer.isSettled())
+		mixer.step();
+	mixer.setTarget(0, -1023);
+	int16_t previous = mixer.getLeftDuty();
+	uint32_t steps = 0, maxStep = 0;
+	while (!mixer.isSettled()) {
+		mixer.step();
+		if ((steps < sizeof(goldenReversal) / sizeof(goldenReversal[0])) && (goldenReversal[steps] != mixer.getLeftDuty()))
+			wrong++;
+		uint32_t change = abs(mixer.getLeftDuty() - previous);
+		if (change > maxStep)
+			maxStep = change;
+		previous = mixer.getLeftDuty();
+		steps++;
+	}
+
+	volatile int sink = 0;
+	uint64_t start = hostTime_ns();
+	for (uint32_t i = 0; i < iterations; i++) {
+		mixer.mix((int)(i % 2047) - 1023, 1023 - (int)(i % 2047), left, right);
+		sink += left + right;
+	}
+	uint64_t mixTime = hostTime_ns() - start;
+	start = hostTime_ns();
+	for (uint32_t i = 0; i < iterations; i++) {
+		if (0 == i % 64)
+			mixer.setTarget((int)(i % 2047) - 1023, 1023 - (int)(i % 2047));
+		sink += mixer.step();
+	}
+	uint64_t stepTime = hostTime_ns() - start;
+	printf("motor mixer        : mix %.1f ns, step %.1f ns (host), golden outputs %s\n", (double)mixTime / iterations,
+		(double)stepTime / iterations, (0 == wrong) ? "ok" : "WRONG");
+	printf("  reversal         : full forward to full reverse in %u ms, max duty step %u (was %u in one step)\n",
+		steps * MIXER_STEP_MS, maxStep, 2 * MIXER_MAX_DUTY);
+}
+
+// network config text file of the older firmwares, parsed as they did it (reference)
+void legacyReadNetworkConfig(const char *path, String fields[7])
+{
+	static const char *tags[] = { "WiFiSSID = ", "WiFiPassword = ", "HotspotSSID = ", "HotspotPassword = ",
+		"BlynkServer = ", "BlynkPort = ", "BlynkToken = " };
+	CHalFile configFile = halFSOpen(path, "r");
+	while (configFile.available()) {
+		String data = configFile.readStringUntil('\n');
+		if (data.startsWith("Version = ")) {
+			data.replace("Version = ", "");
+			if (data != "1.0.0")
+				return;
+		}
+		for (uint8_t i = 0; i < 7; i++) {
+			if (data.startsWith(tags[i])) {
+				data.replace(tags[i], "");
+				fields[i] = data;
+				break;
+			}
+		}
+	}
+	configFile.close();
+}
+
+// same fields of the CTank network record
+static const ConfigField_t simNetworkFields[] = {
+	{ 1, CONFIG_FIELD_STRING, offsetof(NetworkConfig_t, wifiSSID),    sizeof(NetworkConfig_t::wifiSSID),    "WiFiSSID = " },
+	{ 2, CONFIG_FIELD_STRING, offsetof(NetworkConfig_t, wifiPSW),     sizeof(NetworkConfig_t::wifiPSW),     "WiFiPassword = " },
+	{ 3, CONFIG_FIELD_STRING, offsetof(NetworkConfig_t, hotspotSSID), sizeof(NetworkConfig_t::hotspotSSID), "HotspotSSID = " },
+	{ 4, CONFIG_FIELD_STRING, offsetof(NetworkConfig_t, hotspotPSW),  sizeof(NetworkConfig_t::hotspotPSW),  "HotspotPassword = " },
+	{ 5, CONFIG_FIELD_STRING, offsetof(NetworkConfig_t, blynkServer), sizeof(NetworkConfig_t::blynkServer), "BlynkServer = " },
+	{ 6, CONFIG_FIELD_STRING, offsetof(NetworkConfig_t, blynkPort),   sizeof(NetworkConfig_t::blynkPort),   "BlynkPort = " },
+	{ 7, CONFIG_FIELD_STRING, offsetof(NetworkConfig_t, blynkToken),  sizeof(NetworkConfig_t::blynkToken),  "BlynkToken = " },
+};
+
+// old text parser against the binary record: time and heap allocations per load, text import,
+// schema migration (a field added, a field of a newer firmware) and a corrupted record
+void benchConfig(uint32_t iterations)
+{
+	const char *values[] = { "HomeNetwork-2.4GHz", "a long WPA2 passphrase, 40 characters!!", "AUGC_Tank_0F",
+		"tank-password", "192.168.1.100", "8080", "0123456789abcdef0123456789abcdef" };
+	const uint8_t fieldCount = sizeof(simNetworkFields) / sizeof(simNetworkFields[0]);
+	CHalFile file = halFSOpen("/sim.cfg", "w");
+	file.printf("Version = 1.0.0\n");
+	for (uint8_t i = 0; i < fieldCount; i++)
+		file.printf("%s%s\n", simNetworkFields[i].textTag, values[i]);
+	file.close();
+
+	// text file of the older firmwares
+	String legacy[7];
+	uint64_t allocations = heapAllocations;
+	uint64_t start = hostTime_ns();
+	for (uint32_t i = 0; i < iterations; i++)
+		legacyReadNetworkConfig("/sim.cfg", legacy);
+	double legacy_ns = (double)(hostTime_ns() - start) / iterations;
+	// the host file system copies the file in a std::string: one allocation per open is the simulation
+	double legacyAllocations = (double)(heapAllocations - allocations) / iterations - 1;
+
+	// import, then binary loads
+	CConfigStore store("/sim.bin", "/sim.jnl", "/sim.cfg", simNetworkFields, fieldCount, 2);
+	NetworkConfig_t config;
+	memset(&config, 0, sizeof(config));
+	uint8_t imported = store.load(&config);
+	bool isOk = (CONFIG_IMPORTED == imported) && !halFSExists("/sim.cfg");
+	for (uint8_t i = 0; i < fieldCount; i++)
+		isOk = isOk && (legacy[i] == (const char *)&config + simNetworkFields[i].offset);
+	allocations = heapAllocations;
+	start = hostTime_ns();
+	uint8_t result = CONFIG_LOADED;
+	for (uint32_t i = 0; (i < iterations) && (CONFIG_LOADED == result); i++)
+		result = store.load(&config);
+	double binary_ns = (double)(hostTime_ns() - start) / iterations;
+	double binaryAllocations = (double)(heapAllocations - allocations) / iterations - 1;
+	isOk = isOk && (CONFIG_LOADED == result);
+
+	// migration: a record of schema 1 without the token (field 7) and with a field 9 of a newer firmware
+	uint8_t record[CONFIG_RECORD_MAX];
+	CConfigStore oldStore("/sim.bin", NULL, NULL, simNetworkFields, fieldCount - 1, 1);
+	uint16_t length = oldStore.encode(&config, record, sizeof(record) - 5);
+	const uint8_t extra[] = { 9, 3, 'x', 'y', 'z' };
+	memcpy(record + length, extra, sizeof(extra));
+	length += sizeof(extra);
+	uint32_t crc = CConfigStore::crc32(record + CONFIG_HEADER_SIZE, length - CONFIG_HEADER_SIZE);
+	record[6] = (length - CONFIG_HEADER_SIZE) & 0xFF;
+	record[7] = (length - CONFIG_HEADER_SIZE) >> 8;
+	for (uint8_t i = 0; i < 4; i++)
+		record[8 + i] = (crc >> (8 * i)) & 0xFF;
+	NetworkConfig_t migrated = config;
+	CConfigStore::copyString(migrated.blynkToken, "default token", sizeof(migrated.blynkToken));
+	uint8_t migration = store.decode(&migrated, record, length);
+	isOk = isOk && (CONFIG_MIGRATED == migration) && (0 == strcmp(migrated.blynkToken, "default token")) &&
+		(0 == strcmp(migrated.wifiPSW, config.wifiPSW));
+
+	// corrupted record: nothing changes
+	record[CONFIG_HEADER_SIZE + 3] ^= 0x20;
+	NetworkConfig_t corrupted = config;
+	uint8_t corruption = store.decode(&corrupted, record, length);
+	isOk = isOk && (CONFIG_CORRUPTED == corruption) && (0 == memcmp(&corrupted, &config, sizeof(config)));
+	halFSRemove("/sim.bin");
+
+	printf("config load        : text %.0f ns, %.1f allocations; binary %.0f ns, %.1f allocations (host), %u bytes record\n",
+		legacy_ns, legacyAllocations, binary_ns, binaryAllocations, store.encode(&config, record, sizeof(record)));
+	printf("  import/migration : %s, %s, %s -> %s\n", CConfigStore::resultName(imported), CConfigStore::resultName(migration),
+		CConfigStore::resultName(corruption), isOk ? "ok" : "FAILED");
+}
+
+// save slider gestures while trimming the turret: 6 bursts of 5 gestures (1 s apart, the servo
+// center changes every time), 10 s between the bursts. Old firmware: the text file written at
+// every gesture. Flash model of the HAL (LittleFS log, 4 KB blocks)
+void benchStorage(CTank &tank)
+{
+	halSimResetFSStats();
+	for (uint8_t burst = 0; burst < 6; burst++) {
+		for (uint8_t gesture = 0; gesture < 5; gesture++) {
+			CHalFile file = halFSOpen("/sim_old.cfg", "w");
+			file.printf("Version = 1.0.0\nServoMin_us = %u\nServoMax_us = %u\nServoCenter = %u\n", tank.getServoMin_us(),
+				tank.getServoMax_us(), 1500 + burst * 5 + gesture);
+			file.close();
+		}
+	}
+	halFSRemove("/sim_old.cfg");
+	halSimFSStats_t old = halSimGetFSStats();
+
+	halSimResetFSStats();
+	uint16_t center = tank.getServoCenter();
+	for (uint8_t burst = 0; burst < 6; burst++) {
+		for (uint8_t gesture = 0; gesture < 5; gesture++) {
+			tank.setServoCenter(1500 + burst * 5 + gesture);
+			tank.writeTankConfigFile();
+			simAdvance(tank, 1000000);
+		}
+		simAdvance(tank, 10000000);
+	}
+	halSimFSStats_t stats = halSimGetFSStats();
+	tank.setServoCenter(center);
+
+	// journal: replayed on load, a torn entry (reset while writing) loses only that save
+	const ConfigField_t fields[] = { { 1, CONFIG_FIELD_UINT16, offsetof(TankConfig_t, servoCenter), 2, NULL } };
+	CConfigStore store("/sim.bin", "/sim.jnl", NULL, fields, 1, 1);
+	TankConfig_t config = { 1000, 2000, 1500 }, loaded = config;
+	for (uint16_t i = 0; i < 10; i++) {
+		config.servoCenter = 1500 + i;
+		store.save(&config);
+	}
+	bool isOk = (CONFIG_LOADED == store.load(&loaded)) && (1509 == loaded.servoCenter) && (9 == store.getStats().replayed);
+	CHalFile file = halFSOpen("/sim.jnl", "r");
+	uint8_t journal[CONFIG_JOURNAL_MAX];
+	size_t  length = file.read(journal, sizeof(journal));
+	file.close();
+	file = halFSOpen("/sim.jnl", "w");
+	file.write(journal, length - 2);
+	file.close();
+	CConfigStore reboot("/sim.bin", "/sim.jnl", NULL, fields, 1, 1);
+	isOk = isOk && (CONFIG_LOADED == reboot.load(&loaded)) && (1508 == loaded.servoCenter) && (1 == reboot.getStats().tornEntries);
+	config.servoCenter = 1600;
+	reboot.save(&config);
+	reboot.save(&config);
+	isOk = isOk && (1 == reboot.getStats().compactions) && (1 == reboot.getStats().unchanged);
+	isOk = isOk && (CONFIG_LOADED == store.load(&loaded)) && (1600 == loaded.servoCenter);
+	halFSRemove("/sim.bin");
+	halFSRemove("/sim.jnl");
+
+	printf("config saves       : 30 gestures -> %u writes, %llu bytes programmed, %u blocks erased (was %u, %llu, %u)\n",
+		stats.commits, (unsigned long long)stats.bytesProgrammed, stats.blocksErased, old.commits,
+		(unsigned long long)old.bytesProgrammed, old.blocksErased);
+	printf("  journal          : replay, torn entry, compaction -> %s\n", isOk ? "ok" : "FAILED");
+}
+
+// a season: 40 play sessions of 30 minutes, every boot reloads the journal. Random shots and hits
+// (shooter IDs) every minute; a third of the sessions end with a power cut (the counters of the
+// last minute are lost), one with a record torn while writing. The totals must be the counters
+// written, and the firing path only increments a counter
+void benchStats(void)
+{
+	CStatsJournal probe;
+	uint64_t start = hostTime_ns();
+	for (uint32_t i = 0; i < 1000000; i++)
+		probe.countShot();
+	double shot_ns = (double)(hostTime_ns() - start) / 1000000;
+
+	halFSRemove(STATS_JOURNAL_FILE);
+	halFSRemove(STATS_HISTORY_FILE);
+	halSimSetRandomSeed(0x57A7);
+	halSimResetFSStats();
+	StatsRecord_t expected;
+	memset(&expected, 0, sizeof(expected));
+	uint32_t flushes = 0;
+	uint64_t flush_ns = 0;
+	for (uint8_t session = 0; session < 40; session++) {
+		CStatsJournal journal;
+		journal.begin();
+		for (uint8_t minute = 0; minute < 30; minute++) {
+			StatsRecord_t played;
+			memset(&played, 0, sizeof(played));
+			played.shots = halRandom(20);
+			for (uint32_t i = 0; i < played.shots; i++)
+				journal.countShot();
+			played.hitsTaken = halRandom(4);
+			for (uint32_t i = 0; i < played.hitsTaken; i++) {
+				// the one byte IDs of the older firmwares (legacy frames) count as unknown shooters
+				uint8_t id = halRandom(STATS_TANK_IDS * 2);
+				journal.countHit(id);
+				if (id < STATS_TANK_IDS)
+					played.hitBy[id]++;
+			}
+			if (played.hitsTaken > 2) {
+				journal.countDeath();
+				played.deaths = 1;
+			}
+			halSimAdvance(60000000);
+			if ((0 == session % 3) && (29 == minute))
+				break; // power cut
+			start = hostTime_ns();
+			journal.flush();
+			flush_ns += hostTime_ns() - start;
+			flushes++;
+			expected.uptime_s  += 60;
+			expected.shots     += played.shots;
+			expected.hitsTaken += played.hitsTaken;
+			expected.deaths    += played.deaths;
+			for (uint8_t i = 0; i < STATS_TANK_IDS; i++)
+				expected.hitBy[i] += played.hitBy[i];
+		}
+		// power cut while writing a record
+		if (20 == session) {
+			CHalFile file = halFSOpen(STATS_JOURNAL_FILE, "a");
+			file.write((const uint8_t *)"torn record", 11);
+			file.close();
+		}
+	}
+	halSimFSStats_t fs = halSimGetFSStats();
+	CStatsJournal season;
+	season.begin();
+	StatsRecord_t totals = season.getTotals();
+	bool isOk = (totals.shots == expected.shots) && (totals.hitsTaken == expected.hitsTaken) && (totals.deaths == expected.deaths) &&
+		(totals.uptime_s == expected.uptime_s) && (0 == memcmp(totals.hitBy, expected.hitBy, sizeof(totals.hitBy)));
+	CHalFile history = halFSOpen(STATS_HISTORY_FILE, "r");
+	size_t historySize = history.size();
+	history.close();
+
+	printf("stats journal      : countShot %.1f ns, flush %.0f ns (host), %u file system writes, %llu bytes programmed\n",
+		shot_ns, (double)flush_ns / flushes, fs.commits, (unsigned long long)fs.bytesProgrammed);
+	printf("  season           : 40 sessions, %u shots, %u hits, history %u bytes, totals after reboot -> %s\n",
+		totals.shots, totals.hitsTaken, (uint32_t)historySize, isOk ? "ok" : "FAILED");
+}
+
+// Blynk server, as seen by the callbacks of BlynkTank.ino. The TCP connection is started by the
+// server connect and never blocks (CAsyncClient): to a server down it waits for the TCP timeout of
+// the connection manager. The login is sent once it is established and answered in the server run:
+// a server rejecting it (wrong auth token) closes the connection. A server restart closes it at once
+#define SIM_BLYNK_TCP_MS            50   // TCP connection...
+#define SIM_BLYNK_LOGIN_MS          100  // ...then login to the Blynk server
+#define SIM_SERVER_IDLE             0
+#define SIM_SERVER_TCP              1
+#define SIM_SERVER_LOGIN            2
+#define SIM_SERVER_ONLINE           3
+#define SIM_SERVER_CLOSED           4
+#define SIM_SERVER_NO_ANSWER        5 // connection started while the server was down
+bool     simServerIsUp = true;
+bool     simServerRejectsLogin = false;
+uint8_t  simServerState = SIM_SERVER_IDLE;
+uint64_t simServerSince_us;
+
+void simServerConnect(void)
+{
+	simServerState    = simServerIsUp ? SIM_SERVER_TCP : SIM_SERVER_NO_ANSWER;
+	simServerSince_us = halSimTime_us();
+}
+
+uint8_t simServerLink(void)
+{
+	switch (simServerState) {
+	case SIM_SERVER_TCP:
+		if (halSimTime_us() - simServerSince_us >= SIM_BLYNK_TCP_MS * 1000)
+			return(CONN_LINK_UP);
+		return(CONN_LINK_PENDING);
+	case SIM_SERVER_NO_ANSWER:
+		return(CONN_LINK_PENDING);
+	case SIM_SERVER_LOGIN:
+	case SIM_SERVER_ONLINE:
+		return(CONN_LINK_UP);
+	}
+	return(CONN_LINK_DOWN);
+}
+
+void simServerLogin(void)
+{
+	simServerState    = SIM_SERVER_LOGIN;
+	simServerSince_us = halSimTime_us();
+}
+
+bool simServerConnected(void)
+{
+	return(SIM_SERVER_ONLINE == simServerState);
+}
+
+void simServerDisconnect(void)
+{
+	simServerState = SIM_SERVER_IDLE;
+}
+
+void simServerRun(void)
+{
+	if ((SIM_SERVER_LOGIN != simServerState) && (SIM_SERVER_ONLINE != simServerState))
+		return;
+	if (!simServerIsUp)
+		simServerState = SIM_SERVER_CLOSED;
+	else if ((SIM_SERVER_LOGIN == simServerState) && (halSimTime_us() - simServerSince_us >= SIM_BLYNK_LOGIN_MS * 1000))
+		simServerState = simServerRejectsLogin ? SIM_SERVER_CLOSED : SIM_SERVER_ONLINE;
+}
+
+// sketch setup() up to the Blynk login, then the loop until online: the tank can drive. The access
+// point is in range, the network config has the defaults of CTank.cpp
+#define SIM_HOTSPOT_REQUEST_TIMEOUT 3000 // as in BlynkTank.ino
+#define SIM_HOTSPOT_REQUEST_MIN     500
+
+struct simBoot_t {
+	uint32_t drive_ms;      // 0: not connected
+	uint32_t wifi_ms;
+	uint32_t proximity_ms;
+	uint8_t  cacheSource;
+	uint32_t cacheWrites;
+	bool     isHotspotRequested;
+};
+
+simBoot_t simBoot(bool isPowerOn)
+{
+	simBoot_t boot;
+	if (isPowerOn)
+		halSimPowerOff();
+	uint64_t start = halSimTime_us();
+	Serial.enable(false);
+	{
+		CTank tank;
+		tank.getConnectivity().setServer(simServerConnect, simServerLink, simServerLogin, simServerConnected, simServerDisconnect, simServerRun);
+		tank.wifiBegin();
+		uint64_t proximityStart = halSimTime_us();
+		boot.isHotspotRequested = tank.checkProximity(SIM_HOTSPOT_REQUEST_TIMEOUT, SIM_HOTSPOT_REQUEST_MIN);
+		boot.proximity_ms = (halSimTime_us() - proximityStart) / 1000;
+		while ((CONN_ONLINE != tank.runNetwork()) && (halSimTime_us() - start < 20000000))
+			halDelay(1);
+		boot.drive_ms     = tank.getConnectivity().isOnline() ? (halSimTime_us() - start) / 1000 : 0;
+		CFastBoot &fastBoot = tank.getFastBoot();
+		boot.wifi_ms = 0;
+		for (uint8_t i = 0; i < fastBoot.getStageCount(); i++) {
+			BootStage_t stage = fastBoot.getStage(i);
+			if (0 == strcmp("wifi", stage.name))
+				boot.wifi_ms = (stage.end_us - stage.start_us) / 1000;
+		}
+		boot.cacheSource = fastBoot.getCacheSource();
+		boot.cacheWrites = fastBoot.getCacheWrites();
+	}
+	Serial.enable(true);
+	halWiFiDisconnect();
+	simServerDisconnect();
+	return(boot);
+}
+
+// older setup(): wait for the serial monitor, full proximity check, then the WiFi polled every second
+uint32_t simLegacyBoot(void)
+{
+	halSimPowerOff();
+	uint64_t start = halSimTime_us();
+	Serial.enable(false);
+	{
+		CTank tank;
+		halDelay(2000);
+		tank.checkProximity(SIM_HOTSPOT_REQUEST_TIMEOUT);
+		halWiFiBegin("mySSID", "myPassword", NULL);
+		for (uint8_t i = 0; (HAL_WIFI_CONNECTED != halWiFiStatus()) && (i <= 10); i++)
+			halDelay(1000);
+		halDelay(SIM_BLYNK_TCP_MS + SIM_BLYNK_LOGIN_MS);
+	}
+	Serial.enable(true);
+	halWiFiDisconnect();
+	return((halSimTime_us() - start) / 1000);
+}
+
+// time to drive: first boot, reset (link in the RTC memory), battery swap (link in flash), access point
+// replaced (stale link: fallback to the scan), then a hotspot request (hand in front of the turret)
+void benchBoot(void)
+{
+	halWiFiLink_t link = { { 0x60, 0x31, 0x97, 0x12, 0x34, 0x56 }, 6, -60, 0x2A01A8C0, 0x0101A8C0, 0x00FFFFFF, 0x0101A8C0 };
+	halSimSetWiFi("mySSID", "myPassword", link);
+	halFSRemove("/network.bin");
+	halFSRemove("/network.jnl");
+	halFSRemove("/network.cfg");
+	halFSRemove(BOOT_WIFI_CACHE_FILE);
+
+	uint32_t legacy = simLegacyBoot();
+	simBoot_t cold  = simBoot(true);
+	simBoot_t reset = simBoot(false);
+	simBoot_t swap  = simBoot(true);
+	halWiFiLink_t replaced = link;
+	replaced.bssid[5] ^= 0xFF;
+	replaced.channel   = 11;
+	halSimSetWiFi("mySSID", "myPassword", replaced);
+	simBoot_t stale = simBoot(true);
+	simBoot_t next  = simBoot(true);
+	halSimSetCarrierHook(irLoopback);
+	simBoot_t request = simBoot(false);
+	halSimSetCarrierHook(NULL);
+
+	bool isOk = (BOOT_CACHE_NONE == cold.cacheSource) && (BOOT_CACHE_RTC == reset.cacheSource) &&
+		(BOOT_CACHE_FLASH == swap.cacheSource) && (BOOT_CACHE_FLASH == stale.cacheSource) && (BOOT_CACHE_FLASH == next.cacheSource) &&
+		(reset.drive_ms < 1000) && (swap.drive_ms < 1000) && (next.drive_ms < 1000) && (0 != stale.drive_ms) &&
+		(0 == reset.cacheWrites + swap.cacheWrites + next.cacheWrites) && request.isHotspotRequested && !cold.isHotspotRequested;
+	printf("boot               : time to drive %u ms (older setup), first boot %u ms, reset %u ms, battery swap %u ms\n",
+		legacy, cold.drive_ms, reset.drive_ms, swap.drive_ms);
+	printf("  WiFi             : scan %u ms, cached link %u ms; access point replaced %u ms (drive %u ms), then %u ms -> %s\n",
+		cold.wifi_ms, swap.wifi_ms, stale.wifi_ms, stale.drive_ms, next.drive_ms, isOk ? "ok" : "FAILED");
+	printf("  hotspot request  : detected in %u ms (proximity check %u ms while the WiFi associates)\n",
+		request.proximity_ms, swap.proximity_ms);
+}
+
+// main loop with the connection manager for the given time: the loop period is 1 ms, a step of the
+// manager longer than that is time the loop was blocked
+struct simNetRun_t {
+	uint64_t blocked_us;
+	uint64_t clearedAt_us;   // the cause of the outage went away...
+	uint32_t recovery_ms[3]; // ...then online after, longest by scenario
+	uint8_t  scenario;
+};
+
+void simRunNetwork(CConnectivity &conn, uint32_t ms, simNetRun_t &run)
+{
+	uint64_t end = halSimTime_us() + (uint64_t)ms * 1000;
+	while (halSimTime_us() < end) {
+		uint64_t start = halSimTime_us();
+		bool wasOnline = conn.isOnline();
+		conn.run();
+		uint64_t elapsed = halSimTime_us() - start;
+		if (elapsed > 1000)
+			run.blocked_us += elapsed - 1000;
+		if (!wasOnline && conn.isOnline() && (0 != run.clearedAt_us)) {
+			uint32_t recovery = (uint32_t)((halSimTime_us() - run.clearedAt_us) / 1000);
+			if (recovery > run.recovery_ms[run.scenario])
+				run.recovery_ms[run.scenario] = recovery;
+			run.clearedAt_us = 0;
+		}
+		halDelay(1);
+	}
+}
+
+// 5 times: access point power cycle (20 s), Blynk server restart (15 s), WiFi dropout (2 s), with 30 s
+// online between them. Then a wrong WiFi password: the hotspot is needed
+void benchConnectivity(void)
+{
+	halWiFiLink_t link = { { 0x60, 0x31, 0x97, 0x12, 0x34, 0x56 }, 6, -58, 0x2A01A8C0, 0x0101A8C0, 0x00FFFFFF, 0x0101A8C0 };
+	const uint32_t outage_ms[3] = { 20000, 15000, 2000 };
+	halSimSetWiFi("mySSID", "myPassword", link);
+	halSimSetRandomSeed(0xC0DE);
+	simServerIsUp = true;
+	simNetRun_t run;
+	memset(&run, 0, sizeof(run));
+	Serial.enable(false);
+	CFastBoot fastBoot;
+	CConnectivity conn;
+	conn.setServer(simServerConnect, simServerLink, simServerLogin, simServerConnected, simServerDisconnect, simServerRun);
+	conn.begin("mySSID", "myPassword", &fastBoot);
+	simRunNetwork(conn, 30000, run);
+	for (uint8_t cycle = 0; cycle < 5; cycle++) {
+		for (run.scenario = 0; run.scenario < 3; run.scenario++) {
+			if (1 == run.scenario)
+				simServerIsUp = false;
+			else
+				halSimSetWiFiUp(false);
+			simRunNetwork(conn, outage_ms[run.scenario], run);
+			// the access point may come back farther
+			link.rssi = -58 - 4 * cycle;
+			halSimSetWiFi("mySSID", "myPassword", link);
+			simServerIsUp    = true;
+			run.clearedAt_us = halSimTime_us();
+			simRunNetwork(conn, 30000, run);
+		}
+	}
+	ConnectivityStats_t stats = conn.getStats();
+	uint32_t total = stats.online_ms + stats.offline_ms;
+
+	CConnectivity wrong;
+	wrong.setServer(simServerConnect, simServerLink, simServerLogin, simServerConnected, simServerDisconnect, simServerRun);
+	uint64_t start = halSimTime_us();
+	wrong.begin("mySSID", "wrongPassword", &fastBoot);
+	while (!wrong.isHotspotNeeded() && (halSimTime_us() - start < 60000000)) {
+		wrong.run();
+		halDelay(1);
+	}
+	uint32_t hotspot_ms = (uint32_t)((halSimTime_us() - start) / 1000);
+	ConnectivityStats_t wrongStats = wrong.getStats();
+
+	// TCP up, login rejected (wrong auth token): the server closes the connection, no timeout
+	CConnectivity rejected;
+	rejected.setServer(simServerConnect, simServerLink, simServerLogin, simServerConnected, simServerDisconnect, simServerRun);
+	simServerRejectsLogin = true;
+	start = halSimTime_us();
+	rejected.begin("mySSID", "myPassword", &fastBoot);
+	while (!rejected.isHotspotNeeded() && (halSimTime_us() - start < 60000000)) {
+		rejected.run();
+		halDelay(1);
+	}
+	uint32_t rejected_ms = (uint32_t)((halSimTime_us() - start) / 1000);
+	ConnectivityStats_t rejectedStats = rejected.getStats();
+	simServerRejectsLogin = false;
+	Serial.enable(true);
+	halWiFiDisconnect();
+	simServerDisconnect();
+
+	bool isOk = (5 * 2 == stats.reconnects[CONN_FAIL_LINK_LOST]) && (5 == stats.reconnects[CONN_FAIL_SERVER_LOST]) &&
+		(5 * 2 == stats.reconnects[CONN_FAIL_NO_AP]) && (5 == stats.reconnects[CONN_FAIL_SERVER]) &&
+		(stats.runMax_us < 1000) && (0 == run.blocked_us) && (run.recovery_ms[0] < 12000) && (run.recovery_ms[1] < 12000) &&
+		(run.recovery_ms[2] < 5000) && !conn.isHotspotNeeded() && wrong.isHotspotNeeded() &&
+		(CONN_HOTSPOT_FAILURES == wrongStats.failures[CONN_FAIL_AUTH]) && rejected.isHotspotNeeded() &&
+		(CONN_HOTSPOT_FAILURES == rejectedStats.failures[CONN_FAIL_LOGIN]) && (0 == rejectedStats.failures[CONN_FAIL_SERVER]);
+	printf("connectivity       : 5 x (AP power cycle 20 s, server restart 15 s, WiFi dropout 2 s), %u attempts, online %u per mille\n",
+		stats.attempts, (uint32_t)((uint64_t)stats.online_ms * 1000 / total));
+	for (uint8_t i = 0; i < CONN_FAIL_TYPES; i++) {
+		if (0 == stats.failures[i])
+			continue;
+		if (0 == stats.reconnects[i]) {
+			printf("  %-16s : %2u failures, no reconnect\n", CConnectivity::failureName(i), stats.failures[i]);
+			continue;
+		}
+		printf("  %-16s : %2u failures, %2u reconnects in %5u ms (max %5u ms)\n", CConnectivity::failureName(i), stats.failures[i],
+			stats.reconnects[i], stats.reconnectSum_ms[i] / stats.reconnects[i], stats.reconnectMax_ms[i]);
+	}
+	printf("  once cleared     : online again in %u ms (AP back), %u ms (server back), %u ms (dropout) at most\n",
+		run.recovery_ms[0], run.recovery_ms[1], run.recovery_ms[2]);
+	printf("  main loop        : longest step %u us, blocked %u ms in total\n",
+		stats.runMax_us, (uint32_t)(run.blocked_us / 1000));
+	printf("  RSSI             : %d dBm, min %d, average %d\n", stats.rssiLast, stats.rssiMin, (int)(stats.rssiSum / (int32_t)stats.rssiSamples));
+	printf("  wrong password   : hotspot needed after %u ms (%u attempts)\n", hotspot_ms, wrongStats.attempts);
+	printf("  login rejected   : hotspot needed after %u ms (%u login failures) -> %s\n", rejected_ms,
+		rejectedStats.failures[CONN_FAIL_LOGIN], isOk ? "ok" : "FAILED");
+}
+
+// battery open circuit voltage (mV) from the state of charge (per mille): the monitor discharge
+// curve is under load, here the average driving load (135 mV)
+double simBatteryOCV(double charge)
+{
+	const double curve[][2] = { { 0, 3500 }, { 60, 3600 }, { 200, 3700 }, { 330, 3750 }, { 450, 3800 }, { 630, 3900 },
+		{ 780, 4000 }, { 900, 4100 }, { 1000, 4200 } };
+	for (uint8_t i = 1; i < sizeof(curve) / sizeof(curve[0]); i++) {
+		if (charge <= curve[i][0])
+			return(135 + curve[i - 1][1] + (charge - curve[i - 1][0]) * (curve[i][1] - curve[i - 1][1]) / (curve[i][0] - curve[i - 1][0]));
+	}
+	return(135 + curve[8][1]);
+}
+
+// 500 mAh cell, 0.15 ohm: the tank drives 3 s every 5 s (1.5 A motors, 225 mV sag) plus 150 mA of
+// electronics, until the battery is low. Old firmware: one ADC read every 100 ms against the threshold
+void benchBattery(void)
+{
+	const double capacity_mAs = 500 * 3600.0, resistance = 0.15e-3; // V/mA
+	CBatteryMonitor monitor;
+	monitor.begin(4200);
+	double used_mAs = 0;
+	uint32_t oldToggles = 0, newToggles = 0, emptyAt_ms = 0, halfAt_ms = 0, estimate = 0;
+	bool oldCouldMove = true, newCouldMove = true;
+	halSimSetRandomSeed(0xBA77);
+	for (uint32_t ms = 0; (ms < 3600000) && (0 == emptyAt_ms); ms += BATTERY_SAMPLE_PERIOD) {
+		double charge = 1000.0 * (1.0 - used_mAs / capacity_mAs);
+		// the new firmware drives: its sag is the one seen by both (the old tank stutters anyway)
+		double current = 150 + ((newCouldMove && (ms % 5000 < 3000)) ? 1500 : 0);
+		used_mAs += current * BATTERY_SAMPLE_PERIOD / 1000.0;
+		double voltage = simBatteryOCV(charge) - current * resistance * 1000;
+		int adc = (int)(voltage * 1024 / 4200) + (int)halRandom(7) - 3;
+		if (0 == ms % 100) {
+			bool couldMove = (adc * 4200 / 1024) >= 3500;
+			if (couldMove != oldCouldMove)
+				oldToggles++;
+			oldCouldMove = couldMove;
+		}
+		monitor.addSample((uint16_t)adc, ms);
+		if (monitor.isLow() == newCouldMove) {
+			newToggles++;
+			newCouldMove = !monitor.isLow();
+			if (monitor.isLow())
+				emptyAt_ms = ms;
+		}
+		if ((0 == halfAt_ms) && (charge <= 500)) {
+			halfAt_ms = ms;
+			estimate = monitor.getRuntime();
+		}
+	}
+	BatteryStats_t stats = monitor.getStats();
+	printf("battery            : stop/go toggles %u (was %u), %u ADC reads/s, sag min %u mV, filtered %u mV when low\n",
+		newToggles, oldToggles, 1000 / BATTERY_SAMPLE_PERIOD, stats.minVoltage, monitor.getVoltage());
+	printf("  runtime estimate : at 50%% charge %u min, actual %.1f min (battery low after %.1f min)\n", estimate,
+		(emptyAt_ms - halfAt_ms) / 60000.0, emptyAt_ms / 60000.0);
+}
+
+// DFPlayer frame with its checksum
+void buildMP3Frame(uint8_t *frame, uint8_t command, uint16_t parameter)
+{
+	uint8_t data[DFPLAYER_FRAME_SIZE] = { 0x7E, 0xFF, 0x06, command, 0, (uint8_t)(parameter >> 8), (uint8_t)parameter, 0, 0, 0xEF };
+	uint16_t sum = 0;
+	for (uint8_t i = 1; i < 7; i++)
+		sum += data[i];
+	sum = -sum;
+	data[7] = sum >> 8;
+	data[8] = sum & 0xFF;
+	memcpy(frame, data, sizeof(data));
+}
+
+// 10 s of play: fire button bursts, hits, the volume slider dragged. Before, every command wrote
+// its 10 bytes at once (1 ms per byte of software serial at 9600 baud) inside the handlers
+void benchMP3(void)
+{
+	const double byte_ms = 10 * 1000.0 / 9600;
+	CHalSerial serial(MP3_SIM_RX_PIN, MP3_SIM_TX_PIN);
+	CDFPlayer player;
+	serial.begin(9600);
+	player.begin(&serial);
+	player.send(DFPLAYER_CMD_PLAY, 1);
+	uint32_t requests = 1, longestRun = 0;
+	for (uint32_t ms = 1; ms <= 10000; ms++) {
+		halSimAdvance(1000);
+		if ((0 == ms % 150) && (ms % 2000 < 1000)) {
+			player.send(DFPLAYER_CMD_PLAY, 2); // shot
+			requests++;
+		}
+		if (0 == ms % 1300) {
+			player.send(DFPLAYER_CMD_PLAY, 5); // hit
+			requests++;
+		}
+		if ((ms > 5000) && (ms < 6000) && (0 == ms % 20)) {
+			player.send(DFPLAYER_CMD_VOLUME, (uint16_t)((ms - 5000) / 34));
+			requests++;
+		}
+		if (0 == ms % DFPLAYER_BYTE_PERIOD) {
+			size_t before = serial.simTransmitted().size();
+			player.run();
+			uint32_t written = serial.simTransmitted().size() - before;
+			if (written > longestRun)
+				longestRun = written;
+		}
+	}
+	while (!player.isIdle()) {
+		halSimAdvance(1000);
+		player.run();
+	}
+	DFPlayerStats_t stats = player.getStats();
+	uint8_t golden[DFPLAYER_FRAME_SIZE];
+	buildMP3Frame(golden, DFPLAYER_CMD_PLAY, 1);
+	std::vector<uint8_t> &sent = serial.simTransmitted();
+	bool isWireOk = (sent.size() == stats.sent * DFPLAYER_FRAME_SIZE) && (0 == memcmp(sent.data(), golden, DFPLAYER_FRAME_SIZE));
+	printf("MP3 commands       : %u requests, %u sent (%u coalesced, %u dropped), queue max %u, latency avg %.1f ms, max %.1f ms, frames %s\n",
+		requests, stats.sent, stats.coalesced, stats.dropped, stats.queueMax, stats.sent ? stats.latencySum_us / 1000.0 / stats.sent : 0.0,
+		stats.latencyMax_us / 1000.0, isWireOk ? "ok" : "WRONG");
+	printf("  serial blocking  : max %.1f ms per loop() (was %.1f ms per command), %.0f ms in the handlers before\n",
+		longestRun * byte_ms, DFPLAYER_FRAME_SIZE * byte_ms, requests * DFPLAYER_FRAME_SIZE * byte_ms);
+
+	// feedback: noise, track finished, corrupted error frame, ack, error (track not found)
+	uint8_t rx[4 * DFPLAYER_FRAME_SIZE + 2] = { 0x00, 0x12 };
+	buildMP3Frame(rx + 2, DFPLAYER_FB_TRACK_FINISHED, 2);
+	buildMP3Frame(rx + 12, DFPLAYER_FB_ERROR, 6);
+	rx[18] ^= 0x01;
+	buildMP3Frame(rx + 22, DFPLAYER_FB_ACK, 0);
+	buildMP3Frame(rx + 32, DFPLAYER_FB_ERROR, 6);
+	player.resetStats();
+	serial.simInject(rx, sizeof(rx));
+	player.run();
+	DFPlayerFeedback_t frame;
+	const uint8_t expected[] = { DFPLAYER_FB_TRACK_FINISHED, DFPLAYER_FB_ACK, DFPLAYER_FB_ERROR };
+	bool isParserOk = true;
+	for (uint8_t i = 0; i < sizeof(expected); i++)
+		isParserOk = isParserOk && player.readFeedback(frame) && (expected[i] == frame.command);
+	stats = player.getStats();
+	isParserOk = isParserOk && !player.readFeedback(frame) && (6 == frame.parameter) && (1 == stats.finished) &&
+		(1 == stats.checksumErrors) && (2 == stats.framingErrors) && (6 == stats.lastError);
+	printf("  feedback parser  : %u frames, %u checksum, %u framing errors, %s\n", stats.frames, stats.checksumErrors,
+		stats.framingErrors, isParserOk ? "decoded ok" : "WRONG");
+}
+
+// Blynk delivers the joystick updates queued during a WiFi stall in bursts: 10 positions
+// every 100 ms, plus the turret slider at 20 updates/s. Before, every update drove the motors
+void benchControlLoop(CTank &tank)
+{
+	uint32_t updates = 0;
+	// the benches above moved the virtual clock without the main loop: late timers not counted
+	tank.runTimers();
+	tank.getTimerWheel().resetStats();
+	tank.resetControlStats();
+	for (uint32_t ms = 1; ms <= 10000; ms++) {
+		simAdvance(tank, 1000);
+		if (0 == ms % 100) {
+			for (int i = 0; i < 10; i++) {
+				tank.setJoystick((int)halRandom(2047) - 1023, (int)halRandom(2047) - 1023);
+				updates++;
+			}
+		}
+		if (0 == ms % 50) {
+			tank.setTurret_us(1000 + halRandom(1001));
+			updates++;
+		}
+	}
+	simAdvance(tank, CONTROL_PERIOD_MS * 1000);
+	tank.moveTank(0, 0);
+	ControlStats_t stats = tank.getControlStats();
+	printf("control loop       : %.1f actuations/s (was %.1f), %u stale, latency avg %.1f ms, max %.1f ms (%u ms period)\n",
+		stats.applied / 10.0, updates / 10.0, stats.stale, stats.applied ? stats.latencySum_us / 1000.0 / stats.applied : 0.0,
+		stats.latencyMax_us / 1000.0, CONTROL_PERIOD_MS);
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t iterations = DEFAULT_ITERATIONS;
+	if (argc > 1)
+		iterations = strtoul(argv[1], NULL, 10);
+
+	halSimSetADC(A0, 900);
+	halSimSetCarrierHook(irLoopback);
+
+	// firmware debug messages are not useful here
+	Serial.enable(false);
+	CTank tank(true);
+	Serial.enable(true);
+
+	benchLoop(tank, iterations);
+	benchMoveTank(tank, iterations);
+	benchMotorMixer(iterations);
+	benchTurret(tank);
+	benchAnimations(tank);
+	benchTimerWheel(iterations);
+	benchGameEngine(iterations / 10 + 1);
+	benchTelemetry();
+	benchControlLoop(tank);
+	benchMP3();
+	benchBattery();
+	benchConfig(iterations / 10 + 1);
+	benchStorage(tank);
+	tank.printTimerStats();
+	benchIRLoopback(tank, iterations / 100 + 1);
+	tank.printIRStats();
+	benchMultipleTransceivers(iterations / 100 + 1);
+	benchIRProtocol(IR_PROTOCOL_LEGACY, false, "legacy protocol");
+	benchIRProtocol(IR_PROTOCOL_PD, false, "pulse distance");
+	benchIRProtocol(IR_PROTOCOL_PD, true, "pulse distance FEC");
+	benchFEC(iterations * 10);
+	benchMotorPower();
+
+	// the tank doesn't see its own shots anymore
+	halSimSetCarrierHook(NULL);
+	benchHitBurst(tank, 4);
+	benchHitBurst(tank, 10);
+	benchHitBurst(tank, 20);
+	// the tank timers no longer run: virtual hours go by
+	benchStats();
+	benchBoot();
+	benchConnectivity();
+
+	return(0);
+}